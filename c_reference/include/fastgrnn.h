@@ -8,6 +8,7 @@
 #define ERR_TEMPLRW_NOT_INIT -2
 #define ERR_TEMPLRU_NOT_INIT -3
 #define ERR_NORMFEATURES_NOT_INIT -4
+#define ERR_WCOMP_NOT_INIT -5
 
 /**
  * @brief Model paramters for low-rank FastGRNN
@@ -74,6 +75,51 @@ int fastgrnn_lr(float* const hiddenState, unsigned hiddenDims,
   const float* const input, unsigned inputDims, unsigned steps,
   const void* params, void* buffers, int backward, int normalize);
 
+/**
+* @brief Buffers required for computation of bidirectional low-rank FastGRNN
+* @var   wComp        pointer to buffer space, must be initalized to atleast hiddenDims*steps size
+* @var   preCompFwd   pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preCompBwd   pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   tempLRW      pointer to buffer space, must be initalized to atleast wRank size
+* @var   tempLRUFwd   pointer to buffer space, must be initalized to atleast uRank size
+* @var   tempLRUBwd   pointer to buffer space, must be initalized to atleast uRank size
+* @var   normFeatures pointer to buffer space, must be initalized to atleast inputDims size
+*/
+typedef struct FastGRNN_LR_Bi_Buffers {
+  float* wComp;
+  float* preCompFwd;
+  float* preCompBwd;
+  float* tempLRW;
+  float* tempLRUFwd;
+  float* tempLRUBwd;
+  float* normFeatures;
+} FastGRNN_LR_Bi_Buffers;
+
+/**
+ * @brief Forward and backward passes of a FastGRNN cell with low rank W, U over the same input.
+ *        Equivalent to fastgrnn_lr with backward = 0 on hiddenStateFwd and backward = 1 on
+ *        hiddenStateBwd, but W*x is computed once per step for both directions and the two
+ *        recurrences share each pass over U1, U2.
+ * @param[in,out]   hiddenStateFwd  pointer to initial and output hidden state of the forward pass
+ * @param[in,out]   hiddenStateBwd  pointer to initial and output hidden state of the backward pass
+ * @param[in]       hiddenDims   dimension of hidden state of the FastGRNN cell
+ * @param[in]       input        pointer to concatenated input vectors for all steps, size inputDims*steps
+ * @param[in]       inputDims    dimension of input vector for each step
+ * @param[in]       steps        number of steps of FastGRNN cell
+ * @param[in]       params       pointer to model parameter
+ * @param[in]       buffers      pointer to buffer spaces (FastGRNN_LR_Bi_Buffers)
+ * @param[in]       normalize    apply mean-var normalization, 0 for no, 1 for yes
+ * @return     The function returns <code>0</code> on success
+ *             <code>ERR_WCOMP_NOT_INIT</code> if wComp not allocated
+ *             <code>ERR_PRECOMP_NOT_INIT</code> if preCompFwd or preCompBwd not allocated
+ *             <code>ERR_TEMPLRW_NOT_INIT</code> if tempLRW not allocated
+ *             <code>ERR_TEMPLRU_NOT_INIT</code> if tempLRUFwd or tempLRUBwd not allocated
+ *             <code>ERR_NORMFEAT_NOT_INIT</code> if normFeatures not allocated
+*/
+int fastgrnn_lr_bi(float* const hiddenStateFwd, float* const hiddenStateBwd,
+  unsigned hiddenDims, const float* const input, unsigned inputDims, unsigned steps,
+  const void* params, void* buffers, int normalize);
+
 /**
  * @brief Model paramters for low-rank FastGRNN
  * @var       mean         pointer to mean of input vector for normalization, size inputDims
@@ -125,4 +171,41 @@ int fastgrnn(float* const hiddenState, unsigned hiddenDims,
   const float* const input, unsigned inputDims, unsigned steps,
   const void* params, void* buffers, int backward, int normalize);
 
+/**
+* @brief Buffers required for computation of bidirectional FastGRNN
+* @var   wComp        pointer to buffer space, must be initalized to atleast hiddenDims*steps size
+* @var   preCompFwd   pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preCompBwd   pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   normFeatures pointer to buffer space, must be initalized to atleast inputDims size
+*/
+typedef struct FastGRNN_Bi_Buffers {
+  float* wComp;
+  float* preCompFwd;
+  float* preCompBwd;
+  float* normFeatures;
+} FastGRNN_Bi_Buffers;
+
+/**
+ * @brief Forward and backward passes of a FastGRNN cell over the same input.
+ *        Equivalent to fastgrnn with backward = 0 on hiddenStateFwd and backward = 1 on
+ *        hiddenStateBwd, but W*x is computed once per step for both directions and the two
+ *        recurrences share each pass over U.
+ * @param[in,out]   hiddenStateFwd  pointer to initial and output hidden state of the forward pass
+ * @param[in,out]   hiddenStateBwd  pointer to initial and output hidden state of the backward pass
+ * @param[in]       hiddenDims   dimension of hidden state of the FastGRNN cell
+ * @param[in]       input        pointer to concatenated input vectors for all steps, size inputDims*steps
+ * @param[in]       inputDims    dimension of input vector for each step
+ * @param[in]       steps        number of steps of FastGRNN cell
+ * @param[in]       params       pointer to model parameter
+ * @param[in]       buffers      pointer to buffer spaces (FastGRNN_Bi_Buffers)
+ * @param[in]       normalize    apply mean-var normalization, 0 for no, 1 for yes
+ * @return     The function returns <code>0</code> on success
+ *             <code>ERR_WCOMP_NOT_INIT</code> if wComp not allocated
+ *             <code>ERR_PRECOMP_NOT_INIT</code> if preCompFwd or preCompBwd not allocated
+ *             <code>ERR_NORMFEAT_NOT_INIT</code> if normFeatures not allocated
+*/
+int fastgrnn_bi(float* const hiddenStateFwd, float* const hiddenStateBwd,
+  unsigned hiddenDims, const float* const input, unsigned inputDims, unsigned steps,
+  const void* params, void* buffers, int normalize);
+
 #endif
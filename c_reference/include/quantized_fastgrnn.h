@@ -8,6 +8,7 @@
 #define ERR_TEMPLRW_NOT_INIT -2
 #define ERR_TEMPLRU_NOT_INIT -3
 #define ERR_NORMFEATURES_NOT_INIT -4
+#define ERR_WCOMP_NOT_INIT -5
 
 #include "quantized_utils.h"
 
@@ -149,6 +150,52 @@ int q_fastgrnn_lr(INT_T* const hiddenState, ITER_T hiddenDims,
                   const void* params, void* buffers, const void* scales,
                   int backward, int normalize);
 
+/**
+* @brief Buffers required for computation of bidirectional low-rank FastGRNN
+* @var   wComp        pointer to buffer space, must be initalized to atleast hiddenDims*steps size
+* @var   preComp1     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preComp2     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preComp3     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   tempLRW      pointer to buffer space, must be initalized to atleast wRank size
+* @var   tempLRU      pointer to buffer space, must be initalized to atleast uRank size
+* @var   normFeatures pointer to buffer space, must be initalized to atleast inputDims size
+*/
+typedef struct Q_FastGRNN_LR_Bi_Buffers {
+  INT_T* wComp;
+  INT_T* preComp1;
+  INT_T* preComp2;
+  INT_T* preComp3;
+  INT_T* tempLRW;
+  INT_T* tempLRU;
+  INT_T* normFeatures;
+} Q_FastGRNN_LR_Bi_Buffers;
+
+/**
+ * @brief Forward and backward passes of a low-rank FastGRNN cell over the same input.
+ *        Equivalent to q_fastgrnn_lr with backward = 0 on hiddenStateFwd and backward = 1
+ *        on hiddenStateBwd, but W*x is computed once per step for both directions.
+ * @param[in,out]   hiddenStateFwd  pointer to initial and output hidden state of the forward pass
+ * @param[in,out]   hiddenStateBwd  pointer to initial and output hidden state of the backward pass
+ * @param[in]       hiddenDims   dimension of hidden state of the FastGRNN cell
+ * @param[in]       input        pointer to concatenated input vectors for all steps, size inputDims*steps
+ * @param[in]       inputDims    dimension of input vector for each step
+ * @param[in]       steps        number of steps of FastGRNN cell
+ * @param[in]       params       pointer to model parameter
+ * @param[in]       buffers      pointer to buffer spaces (Q_FastGRNN_LR_Bi_Buffers)
+ * @param[in]       scales       pointer to model scales
+ * @param[in]       normalize    apply mean-var normalization, 0 for no, 1 for yes
+ * @return     The function returns <code>0</code> on success
+ *             <code>ERR_WCOMP_NOT_INIT</code> if wComp not allocated
+ *             <code>ERR_PRECOMP_NOT_INIT</code> if preComp1, preComp2 or preComp3 not allocated
+ *             <code>ERR_TEMPLRW_NOT_INIT</code> if tempLRW not allocated
+ *             <code>ERR_TEMPLRU_NOT_INIT</code> if tempLRU not allocated
+ *             <code>ERR_NORMFEAT_NOT_INIT</code> if normFeatures not allocated
+ */
+int q_fastgrnn_lr_bi(INT_T* const hiddenStateFwd, INT_T* const hiddenStateBwd,
+                     ITER_T hiddenDims, const INT_T* const input,
+                     ITER_T inputDims, ITER_T steps, const void* params,
+                     void* buffers, const void* scales, int normalize);
+
 /**
  * @brief Model paramters for low-rank FastGRNN
  * @var       mean         pointer to mean of input vector for normalization, size inputDims
@@ -266,4 +313,45 @@ int q_fastgrnn(INT_T* const hiddenState, ITER_T hiddenDims,
                const void* params, void* buffers, const void* scales,
                int backward, int normalize);
 
+/**
+* @brief Buffers required for computation of bidirectional FastGRNN
+* @var   wComp        pointer to buffer space, must be initalized to atleast hiddenDims*steps size
+* @var   preComp1     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preComp2     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   preComp3     pointer to buffer space, must be initalized to atleast hiddenDims size
+* @var   normFeatures pointer to buffer space, must be initalized to atleast inputDims size
+*/
+typedef struct Q_FastGRNN_Bi_Buffers {
+  INT_T* wComp;
+  INT_T* preComp1;
+  INT_T* preComp2;
+  INT_T* preComp3;
+  INT_T* normFeatures;
+} Q_FastGRNN_Bi_Buffers;
+
+/**
+ * @brief Forward and backward passes of a FastGRNN cell over the same input.
+ *        Equivalent to q_fastgrnn with backward = 0 on hiddenStateFwd and backward = 1
+ *        on hiddenStateBwd, but W*x is computed once per step for both directions.
+ * @param[in,out]   hiddenStateFwd  pointer to initial and output hidden state of the forward pass
+ * @param[in,out]   hiddenStateBwd  pointer to initial and output hidden state of the backward pass
+ * @param[in]       hiddenDims   dimension of hidden state of the FastGRNN cell
+ * @param[in]       input        pointer to concatenated input vectors for all steps, size inputDims*steps
+ * @param[in]       inputDims    dimension of input vector for each step
+ * @param[in]       steps        number of steps of FastGRNN cell
+ * @param[in]       params       pointer to model parameter
+ * @param[in]       buffers      pointer to buffer spaces (Q_FastGRNN_Bi_Buffers)
+ * @param[in]       scales       pointer to model scales
+ * @param[in]       normalize    apply mean-var normalization, 0 for no, 1 for yes
+ * @return     The function returns <code>0</code> on success
+ *             <code>ERR_WCOMP_NOT_INIT</code> if wComp not allocated
+ *             <code>ERR_PRECOMP_NOT_INIT</code> if preComp1, preComp2 or preComp3 not allocated
+ *             <code>ERR_NORMFEAT_NOT_INIT</code> if normFeatures not allocated
+ * @example          Please refer the file: c_reference/tests/rnnpool/test_quantized_rnnpool.c
+ */
+int q_fastgrnn_bi(INT_T* const hiddenStateFwd, INT_T* const hiddenStateBwd,
+                  ITER_T hiddenDims, const INT_T* const input,
+                  ITER_T inputDims, ITER_T steps, const void* params,
+                  void* buffers, const void* scales, int normalize);
+
 #endif
@@ -7,6 +7,8 @@
 #include "quantized_datatypes.h"
 
 typedef int (*q_rnn_t)(INT_T* const, ITER_T, const INT_T* const, ITER_T, ITER_T, const void*, void*, const void*, int, int);
+// Both directions over the same input in one call, e.g. q_fastgrnn_bi
+typedef int (*q_rnn_bi_t)(INT_T* const, INT_T* const, ITER_T, const INT_T* const, ITER_T, ITER_T, const void*, void*, const void*, int);
 
 /**
  * @param[in]        patch          pointer to activation of patch (row, col, channel)
@@ -18,7 +20,7 @@ typedef int (*q_rnn_t)(INT_T* const, ITER_T, const INT_T* const, ITER_T, ITER_T,
  * @param[in]        rnn1_params    pointer to parameters of RNN1
  * @param[in]        rnn1_buffers   pointer to buffers needed for RNN1
  * @param[in]        rnn1_scales    pointer to the scales needed for RNN1
- * @param[in]        rnn2           function pointer to RNN2
+ * @param[in]        rnn2           function pointer to bidirectional RNN2
  * @param[in]        hiddenDims2    dimension of the hidden state of RNN2
  * @param[in]        rnn2_params    pointer to parameters of RNN2
  * @param[in]        rnn2_buffers   pointer to buffers needed for RNN2
@@ -31,7 +33,7 @@ typedef int (*q_rnn_t)(INT_T* const, ITER_T, const INT_T* const, ITER_T, ITER_T,
 int q_rnnpool_block(const INT_T* const patch, ITER_T inputDims, ITER_T patchDim,
                     ITER_T stride, q_rnn_t rnn1, ITER_T hiddenDims1,
                     const void* rnn1_params, void* rnn1_buffers,
-                    const void* rnn1_scales, q_rnn_t rnn2,
+                    const void* rnn1_scales, q_rnn_bi_t rnn2,
                     ITER_T hiddenDims2, const void* rnn2_params,
                     void* rnn2_buffers, const void* rnn2_scales,
                     INT_T* const output, INT_T* const buffer);
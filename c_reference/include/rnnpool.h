@@ -5,6 +5,8 @@
 #define __RNNPOOL_H__
 
 typedef int (*rnn_t)(float* const, unsigned, const float* const, unsigned, unsigned, const void*, void*, int, int);
+// Both directions over the same input in one call, e.g. fastgrnn_bi
+typedef int (*rnn_bi_t)(float* const, float* const, unsigned, const float* const, unsigned, unsigned, const void*, void*, int);
 
 /**
  * @param[in]        patch          pointer to activation of patch (row, col, channel)
@@ -15,7 +17,7 @@ typedef int (*rnn_t)(float* const, unsigned, const float* const, unsigned, unsig
  * @param[in]        hiddenDims1    dimension of the hidden state of RNN1
  * @param[in]        rnn1_params    pointer to parameters of RNN1
  * @param[in]        rnn1_buffers   pointer to buffers needed for RNN1
- * @param[in]        rnn2           function pointer to RNN2
+ * @param[in]        rnn2           function pointer to bidirectional RNN2
  * @param[in]        hiddenDims2    dimension of the hidden state of RNN2
  * @param[in]        rnn2_params    pointer to parameters of RNN2
  * @param[in]        rnn2_buffers   pointer to buffers needed for RNN2
@@ -25,7 +27,7 @@ typedef int (*rnn_t)(float* const, unsigned, const float* const, unsigned, unsig
 int rnnpool_block(const float* const patch, unsigned inputDims,
   unsigned patchDim, unsigned stride,
   rnn_t rnn1, unsigned hiddenDims1, const void* rnn1_params, void* rnn1_buffers,
-  rnn_t rnn2, unsigned hiddenDims2, const void* rnn2_params, void* rnn2_buffers,
+  rnn_bi_t rnn2, unsigned hiddenDims2, const void* rnn2_params, void* rnn2_buffers,
   float* const output, float* const buffer);
 
 
@@ -31,6 +31,15 @@ void matVec(const float* const mat, const float* const vec,
   float alpha, float beta,
   float* const ret);
 
+/* matVec on two vectors with one pass over mat:
+   ret1 = alpha * ret1 + beta * mat * vec1, ret2 = alpha * ret2 + beta * mat * vec2
+   The two dot products are independent, which lets them overlap in the pipeline */
+void matVec2(const float* const mat,
+  const float* const vec1, const float* const vec2,
+  unsigned nrows, unsigned ncols,
+  float alpha, float beta,
+  float* const ret1, float* const ret2);
+
 // scaled vector addition: ret = scalar1 * vec1 + scalar2 * vector2
 void v_add(float scalar1, const float* const vec1,
   float scalar2, const float* const vec2,
@@ -51,6 +51,64 @@ int fastgrnn_lr(float* const hiddenState, unsigned hiddenDims,
   return 0;
 }
 
+int fastgrnn_lr_bi(float* const hiddenStateFwd, float* const hiddenStateBwd,
+  unsigned hiddenDims, const float* const input, unsigned inputDims, unsigned steps,
+  const void* params, void* buffers, int normalize) {
+
+  const FastGRNN_LR_Params* tparams = (const FastGRNN_LR_Params*)params;
+  FastGRNN_LR_Bi_Buffers* tbuffers = (FastGRNN_LR_Bi_Buffers*)buffers;
+
+  if (tbuffers->wComp == 0) return ERR_WCOMP_NOT_INIT;
+  if (tbuffers->preCompFwd == 0) return ERR_PRECOMP_NOT_INIT;
+  if (tbuffers->preCompBwd == 0) return ERR_PRECOMP_NOT_INIT;
+  if (tbuffers->tempLRW == 0) return ERR_TEMPLRW_NOT_INIT;
+  if (tbuffers->tempLRUFwd == 0) return ERR_TEMPLRU_NOT_INIT;
+  if (tbuffers->tempLRUBwd == 0) return ERR_TEMPLRU_NOT_INIT;
+  if (tbuffers->normFeatures == 0) return ERR_NORMFEATURES_NOT_INIT;
+
+  // Project the input of every step once; both directions read it
+  for (unsigned t = 0; t < steps; t++) {
+    if (normalize) {
+      v_add(1.0f, input + t * inputDims, -1.0f, tparams->mean + t * inputDims,
+        inputDims, tbuffers->normFeatures);
+      v_div(tparams->stdDev + t * inputDims, tbuffers->normFeatures, inputDims,
+        tbuffers->normFeatures);
+    }
+    else {
+      for (unsigned d = 0; d < inputDims; ++d)
+        tbuffers->normFeatures[d] = input[t * inputDims + d];
+    }
+    matVec(tparams->W1, tbuffers->normFeatures, tparams->wRank, inputDims,
+      0.0f, 1.0f, tbuffers->tempLRW);
+    matVec(tparams->W2, tbuffers->tempLRW, hiddenDims, tparams->wRank,
+      0.0f, 1.0f, tbuffers->wComp + t * hiddenDims);
+  }
+
+  // The two recurrences are independent; step them together
+  for (unsigned t = 0; t < steps; t++) {
+    const float* const wCompFwd = tbuffers->wComp + t * hiddenDims;
+    const float* const wCompBwd = tbuffers->wComp + (steps - 1 - t) * hiddenDims;
+    for (unsigned i = 0; i < hiddenDims; i++) {
+      tbuffers->preCompFwd[i] = wCompFwd[i];
+      tbuffers->preCompBwd[i] = wCompBwd[i];
+    }
+    matVec2(tparams->U1, hiddenStateFwd, hiddenStateBwd, tparams->uRank, hiddenDims,
+      0.0f, 1.0f, tbuffers->tempLRUFwd, tbuffers->tempLRUBwd);
+    matVec2(tparams->U2, tbuffers->tempLRUFwd, tbuffers->tempLRUBwd, hiddenDims, tparams->uRank,
+      1.0f, 1.0f, tbuffers->preCompFwd, tbuffers->preCompBwd);
+
+    for (unsigned i = 0; i < hiddenDims; i++) {
+      float gateFwd = sigmoid(tbuffers->preCompFwd[i] + tparams->Bg[i]);
+      float gateBwd = sigmoid(tbuffers->preCompBwd[i] + tparams->Bg[i]);
+      float updateFwd = tanh(tbuffers->preCompFwd[i] + tparams->Bh[i]);
+      float updateBwd = tanh(tbuffers->preCompBwd[i] + tparams->Bh[i]);
+      hiddenStateFwd[i] = gateFwd * hiddenStateFwd[i] + (tparams->sigmoid_zeta * (1.0 - gateFwd) + tparams->sigmoid_nu) * updateFwd;
+      hiddenStateBwd[i] = gateBwd * hiddenStateBwd[i] + (tparams->sigmoid_zeta * (1.0 - gateBwd) + tparams->sigmoid_nu) * updateBwd;
+    }
+  }
+  return 0;
+}
+
 int fastgrnn(float* const hiddenState, unsigned hiddenDims,
   const float* const input, unsigned inputDims, unsigned steps,
   const void* params, void* buffers, int backward, int normalize) {
@@ -91,3 +149,54 @@ int fastgrnn(float* const hiddenState, unsigned hiddenDims,
   }
   return 0;
 }
+
+int fastgrnn_bi(float* const hiddenStateFwd, float* const hiddenStateBwd,
+  unsigned hiddenDims, const float* const input, unsigned inputDims, unsigned steps,
+  const void* params, void* buffers, int normalize) {
+
+  const FastGRNN_Params* tparams = (const FastGRNN_Params*)params;
+  FastGRNN_Bi_Buffers* tbuffers = (FastGRNN_Bi_Buffers*)buffers;
+
+  if (tbuffers->wComp == 0) return ERR_WCOMP_NOT_INIT;
+  if (tbuffers->preCompFwd == 0) return ERR_PRECOMP_NOT_INIT;
+  if (tbuffers->preCompBwd == 0) return ERR_PRECOMP_NOT_INIT;
+  if (tbuffers->normFeatures == 0) return ERR_NORMFEATURES_NOT_INIT;
+
+  // Project the input of every step once; both directions read it
+  for (unsigned t = 0; t < steps; t++) {
+    if (normalize) {
+      v_add(1.0f, input + t * inputDims, -1.0f, tparams->mean + t * inputDims,
+        inputDims, tbuffers->normFeatures);
+      v_div(tparams->stdDev + t * inputDims, tbuffers->normFeatures, inputDims,
+        tbuffers->normFeatures);
+      matVec(tparams->W, tbuffers->normFeatures, hiddenDims, inputDims,
+        0.0f, 1.0f, tbuffers->wComp + t * hiddenDims);
+    }
+    else {
+      matVec(tparams->W, input + t * inputDims, hiddenDims, inputDims,
+        0.0f, 1.0f, tbuffers->wComp + t * hiddenDims);
+    }
+  }
+
+  // The two recurrences are independent; step them together
+  for (unsigned t = 0; t < steps; t++) {
+    const float* const wCompFwd = tbuffers->wComp + t * hiddenDims;
+    const float* const wCompBwd = tbuffers->wComp + (steps - 1 - t) * hiddenDims;
+    for (unsigned i = 0; i < hiddenDims; i++) {
+      tbuffers->preCompFwd[i] = wCompFwd[i];
+      tbuffers->preCompBwd[i] = wCompBwd[i];
+    }
+    matVec2(tparams->U, hiddenStateFwd, hiddenStateBwd, hiddenDims, hiddenDims,
+      1.0f, 1.0f, tbuffers->preCompFwd, tbuffers->preCompBwd);
+
+    for (unsigned i = 0; i < hiddenDims; i++) {
+      float gateFwd = sigmoid(tbuffers->preCompFwd[i] + tparams->Bg[i]);
+      float gateBwd = sigmoid(tbuffers->preCompBwd[i] + tparams->Bg[i]);
+      float updateFwd = tanh(tbuffers->preCompFwd[i] + tparams->Bh[i]);
+      float updateBwd = tanh(tbuffers->preCompBwd[i] + tparams->Bh[i]);
+      hiddenStateFwd[i] = gateFwd * hiddenStateFwd[i] + (tparams->sigmoid_zeta * (1.0 - gateFwd) + tparams->sigmoid_nu) * updateFwd;
+      hiddenStateBwd[i] = gateBwd * hiddenStateBwd[i] + (tparams->sigmoid_zeta * (1.0 - gateBwd) + tparams->sigmoid_nu) * updateBwd;
+    }
+  }
+  return 0;
+}
@@ -7,7 +7,7 @@
 int q_rnnpool_block(const INT_T* const patch, ITER_T inputDims, ITER_T patchDim,
                     ITER_T stride, q_rnn_t rnn1, ITER_T hiddenDims1,
                     const void* rnn1_params, void* rnn1_buffers,
-                    const void* rnn1_scales, q_rnn_t rnn2,
+                    const void* rnn1_scales, q_rnn_bi_t rnn2,
                     ITER_T hiddenDims2, const void* rnn2_params,
                     void* rnn2_buffers, const void* rnn2_scales,
                     INT_T* const output, INT_T* const buffer) {
@@ -22,10 +22,8 @@ int q_rnnpool_block(const INT_T* const patch, ITER_T inputDims, ITER_T patchDim,
   }
 
   // Bi-directional vertical pass over the row summaries
-  rnn2(output, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params,
-       rnn2_buffers, rnn2_scales, 0, 0);
-  rnn2(output + hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim,
-       rnn2_params, rnn2_buffers, rnn2_scales, 1, 0);
+  rnn2(output, output + hiddenDims2, hiddenDims2, buffer, hiddenDims1,
+       patchDim, rnn2_params, rnn2_buffers, rnn2_scales, 0);
 
   // Vertical pass over each column with RNN1
   memset(buffer, 0, sizeof(INT_T) * hiddenDims1 * patchDim);
@@ -38,10 +36,8 @@ int q_rnnpool_block(const INT_T* const patch, ITER_T inputDims, ITER_T patchDim,
   }
 
   // Bi-directional horizontal pass over the columns summaries
-  rnn2(output + 2 * hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim,
-       rnn2_params, rnn2_buffers, rnn2_scales, 0, 0);
-  rnn2(output + 3 * hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim,
-       rnn2_params, rnn2_buffers, rnn2_scales, 1, 0);
+  rnn2(output + 2 * hiddenDims2, output + 3 * hiddenDims2, hiddenDims2, buffer,
+       hiddenDims1, patchDim, rnn2_params, rnn2_buffers, rnn2_scales, 0);
 
   return 0;
 }
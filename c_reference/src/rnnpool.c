@@ -7,7 +7,7 @@
 int rnnpool_block(const float* const patch, unsigned inputDims,
   unsigned patchDim, unsigned stride,
   rnn_t rnn1, unsigned hiddenDims1, const void* rnn1_params, void* rnn1_buffers,
-  rnn_t rnn2, unsigned hiddenDims2, const void* rnn2_params, void* rnn2_buffers,
+  rnn_bi_t rnn2, unsigned hiddenDims2, const void* rnn2_params, void* rnn2_buffers,
   float* const output, float* const buffer) {
 
   // Clear the output
@@ -21,8 +21,7 @@ int rnnpool_block(const float* const patch, unsigned inputDims,
       rnn1_params, rnn1_buffers, 0, 0);
 
   // Bi-directional vertical pass over the row summaries
-  rnn2(output, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 0, 0);
-  rnn2(output + hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 1, 0);
+  rnn2(output, output + hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 0);
 
   // Vertical pass over each column with RNN1
   memset(buffer, 0, sizeof(float) * hiddenDims1 * patchDim);
@@ -33,8 +32,7 @@ int rnnpool_block(const float* const patch, unsigned inputDims,
         rnn1_params, rnn1_buffers, 0, 0);
 
   // Bi-directional horizontal pass over the columns summaries
-  rnn2(output + 2 * hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 0, 0);
-  rnn2(output + 3 * hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 1, 0);
+  rnn2(output + 2 * hiddenDims2, output + 3 * hiddenDims2, hiddenDims2, buffer, hiddenDims1, patchDim, rnn2_params, rnn2_buffers, 0);
 
   return 0;
 }
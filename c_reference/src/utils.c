@@ -71,6 +71,24 @@ void matVec(const float* const mat, const float* const vec,
   }
 }
 
+void matVec2(const float* const mat,
+  const float* const vec1, const float* const vec2,
+  unsigned nrows, unsigned ncols,
+  float alpha, float beta,
+  float* const ret1, float* const ret2) {
+
+  for (unsigned row = 0; row < nrows; row++) {
+    float sum1 = 0.0f, sum2 = 0.0f;
+    float* mat_offset = (float*)mat + row * ncols;
+    for (unsigned col = 0; col < ncols; col++) {
+      sum1 += *mat_offset * vec1[col];
+      sum2 += *mat_offset++ * vec2[col];
+    }
+    ret1[row] = alpha * ret1[row] + beta * sum1;
+    ret2[row] = alpha * ret2[row] + beta * sum2;
+  }
+}
+
 void v_add(float scalar1, const float* const vec1,
   float scalar2, const float* const vec2,
   unsigned len, float* const ret) {
@@ -173,15 +173,18 @@ int main(int argc, char **argv) {
     .normFeatures = normFeatures1
   };
 
+  INT_T wComp2[HIDDEN_DIM2 * PATCH_DIM];
   INT_T preComp21[HIDDEN_DIM2];
   INT_T preComp22[HIDDEN_DIM2];
   INT_T preComp23[HIDDEN_DIM2];
   INT_T normFeatures2[HIDDEN_DIM1];
+  memset(wComp2, 0, sizeof(INT_T) * HIDDEN_DIM2 * PATCH_DIM);
   memset(preComp21, 0, sizeof(INT_T) * HIDDEN_DIM2);
   memset(preComp22, 0, sizeof(INT_T) * HIDDEN_DIM2);
   memset(preComp23, 0, sizeof(INT_T) * HIDDEN_DIM2);
   memset(normFeatures2, 0, sizeof(INT_T) * HIDDEN_DIM1);
-  Q_FastGRNN_Buffers rnn2_buffers = {
+  Q_FastGRNN_Bi_Buffers rnn2_buffers = {
+    .wComp = wComp2,
     .preComp1 = preComp21,
     .preComp2 = preComp22,
     .preComp3 = preComp23,
@@ -310,7 +313,7 @@ int main(int argc, char **argv) {
     q_rnnpool_block(reshapedXLine, INPUT_CHANNELS, PATCH_DIM, PATCH_DIM,
                     q_fastgrnn, HIDDEN_DIM1, (const void*)(&rnn1_params),
                     (void*)(&rnn1_buffers), (const void*)(&rnn1_scales),
-                    q_fastgrnn, HIDDEN_DIM2, (const void*)(&rnn2_params),
+                    q_fastgrnn_bi, HIDDEN_DIM2, (const void*)(&rnn2_params),
                     (void*)(&rnn2_buffers), (const void*)(&rnn2_scales),
                     output_test, buffer);
     clock_t end = clock();
@@ -46,12 +46,18 @@ int main() {
     .normFeatures = normFeatures1
   };
 
-  float preComp2[HIDDEN_DIMS2];
+  float wComp2[HIDDEN_DIMS2 * PATCH_DIM];
+  float preCompFwd2[HIDDEN_DIMS2];
+  float preCompBwd2[HIDDEN_DIMS2];
   float normFeatures2[HIDDEN_DIMS1];
-  memset(preComp2, 0, sizeof(float) * HIDDEN_DIMS2);
+  memset(wComp2, 0, sizeof(float) * HIDDEN_DIMS2 * PATCH_DIM);
+  memset(preCompFwd2, 0, sizeof(float) * HIDDEN_DIMS2);
+  memset(preCompBwd2, 0, sizeof(float) * HIDDEN_DIMS2);
   memset(normFeatures2, 0, sizeof(float) * HIDDEN_DIMS1);
-  FastGRNN_Buffers rnn2_buffers = {
-    .preComp = preComp2,
+  FastGRNN_Bi_Buffers rnn2_buffers = {
+    .wComp = wComp2,
+    .preCompFwd = preCompFwd2,
+    .preCompBwd = preCompBwd2,
     .normFeatures = normFeatures2
   };
 
@@ -61,7 +67,7 @@ int main() {
   memset(buffer, 0, sizeof(float) * HIDDEN_DIMS1 * PATCH_DIM);
   rnnpool_block(input, INPUT_DIMS, PATCH_DIM, PATCH_DIM,
     fastgrnn, HIDDEN_DIMS1, (const void*)(&rnn1_params), (void*)(&rnn1_buffers),
-    fastgrnn, HIDDEN_DIMS2, (const void*)(&rnn2_params), (void*)(&rnn2_buffers),
+    fastgrnn_bi, HIDDEN_DIMS2, (const void*)(&rnn2_params), (void*)(&rnn2_buffers),
     output_test, buffer);
 
   printf("Error: %f\n", l2squared(output, output_test, 4 * HIDDEN_DIMS2));
@@ -2,7 +2,7 @@
 # Licensed under the MIT license.
 
 DEBUGGING_FLAGS = #-DLIGHT_LOGGER #-DLOGGER #-DTIMER -DCONCISE #-DSTDERR_ONSCREEN #-DLIGHT_LOGGER -DVERBOSE #-DDUMP #-DVERIFY
-CONFIG_FLAGS = -DSINGLE #-DXML -DZERO_BASED_IO 
+CONFIG_FLAGS = -DSINGLE #-DXML -DZERO_BASED_IO -DXTRAIN_CSR -DCOMPRESSED_XTRAIN -DPERF_COUNTERS -DMEMORY_ACCOUNTING 
 
 MKL_EIGEN_FLAGS = -DEIGEN_USE_BLAS -DMKL_ILP64
 
@@ -20,4 +20,7 @@ CILK_FLAGS = -fcilkplus -DCILK
 
 CC=g++-5
 
-CFLAGS= -p -g -fPIC -O3 -std=c++11 -DLINUX $(DEBUGGING_FLAGS) $(CONFIG_FLAGS) $(MKL_EIGEN_FLAGS) $(CILK_FLAGS)
+# Opt-in SIMD for the int8 scoring kernels in quantized.cpp: -mavx2, or -mavx512f -mavx512bw -mavx512vnni (g++ 8 or later)
+SIMD_FLAGS = #-mavx2
+
+CFLAGS= -p -g -fPIC -O3 -std=c++11 -DLINUX $(DEBUGGING_FLAGS) $(CONFIG_FLAGS) $(SIMD_FLAGS) $(MKL_EIGEN_FLAGS) $(CILK_FLAGS)
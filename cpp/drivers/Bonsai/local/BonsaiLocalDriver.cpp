@@ -38,7 +38,7 @@ int main(int argc, char **argv)
   BonsaiPredictor predictor(modelBytes, model); // use the constructor predictor(modelBytes, model, false) for loading a sparse model.
   predictor.importMeanStd(meanStdBytes, meanStd);
   
-  predictor.batchEvaluate(trainer.data.Xvalidation, trainer.data.Yvalidation, dataDir, currResultsPath);
+  predictor.batchEvaluate(trainer.data, validationSplit, dataDir, currResultsPath);
   
   delete[] model, meanStd;
   
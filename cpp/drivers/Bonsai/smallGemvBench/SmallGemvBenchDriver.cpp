@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <chrono>
+
+#include "blas_routines.h"
+#include "small_gemv.h"
+
+using namespace EdgeML;
+
+//
+// Times the products of one class's node rows of a Bonsai parameter with a projected point,
+// as in fillWX, fillTanhVX and gradZCoeff.
+// Usage: SmallGemvBench [<rows> <cols> [<numCalls>]]
+// <rows> is the number of tree nodes (default 15, depth 3) and <cols> the projection dimension
+// (default 10). The parameter holds the rows of 10 classes, and the calls cycle through them.
+// Reports the time per call of mm on a copy of the rows (the path before smallGemvRows), and
+// of smallGemvRows on dense and sparse (half the entries non-zero) parameters, in both directions.
+// Run single-threaded, e.g. with MKL_NUM_THREADS=1 and CILK_NWORKERS=1.
+//
+
+static volatile FP_TYPE sink;
+
+template<class Function>
+static void report(const std::string& name, const long long numCalls, Function call)
+{
+  FP_TYPE checksum = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  for (long long i = 0; i < numCalls; ++i)
+    checksum += call(i);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+  sink = checksum;
+  std::cout << std::left << std::setw(40) << name
+    << std::fixed << std::setprecision(1) << elapsed.count() * 1e9 / (double)numCalls << " ns per call" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  const Eigen::Index rows = argc > 2 ? atoi(argv[1]) : 15;
+  const Eigen::Index cols = argc > 2 ? atoi(argv[2]) : 10;
+  const long long numCalls = argc > 3 ? atoll(argv[3]) : 1000000;
+  assert(rows > 0 && cols > 0 && numCalls > 0);
+  const Eigen::Index numClasses = 10;
+
+  std::mt19937_64 generator(42);
+  std::uniform_real_distribution<FP_TYPE> value((FP_TYPE)-1.0, (FP_TYPE)1.0);
+  MatrixXuf A(numClasses * rows, cols);
+  for (Eigen::Index i = 0; i < A.size(); ++i)
+    A.data()[i] = value(generator);
+  MatrixXuf halfZero = A;
+  for (Eigen::Index i = 0; i < halfZero.size(); ++i)
+    if (i % 2 == 1) halfZero.data()[i] = (FP_TYPE)0.0;
+  const SparseMatrixuf ASparse = halfZero.sparseView();
+
+  MatrixXuf x = MatrixXuf::Random(cols, 1);
+  MatrixXuf xTrans = MatrixXuf::Random(rows, 1);
+  MatrixXuf y(rows, 1), yTrans(cols, 1);
+
+  std::cout << rows << " x " << cols << " rows of a " << A.rows() << " x " << A.cols()
+    << " parameter, " << numCalls << " calls" << std::endl;
+
+  // mm logs and times every call; fewer calls give the same time per call
+  report("mm on a copy of the rows", std::max(numCalls / 100, 1LL), [&](const long long i) {
+    const MatrixXuf block = A.middleRows((i % numClasses) * rows, rows);
+    mm(y, block, CblasNoTrans, x, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0);
+    return y(0, 0);
+  });
+  report("smallGemvRows", numCalls, [&](const long long i) {
+    smallGemvRows(y.data(), A, (i % numClasses) * rows, rows, CblasNoTrans, x.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    return y(0, 0);
+  });
+  report("smallGemvRows, transposed", numCalls, [&](const long long i) {
+    smallGemvRows(yTrans.data(), A, (i % numClasses) * rows, rows, CblasTrans, xTrans.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    return yTrans(0, 0);
+  });
+  report("sparse smallGemvRows", numCalls, [&](const long long i) {
+    smallGemvRows(y.data(), ASparse, (i % numClasses) * rows, rows, CblasNoTrans, x.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    return y(0, 0);
+  });
+  report("sparse smallGemvRows, transposed", numCalls, [&](const long long i) {
+    smallGemvRows(yTrans.data(), ASparse, (i % numClasses) * rows, rows, CblasTrans, xTrans.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    return yTrans(0, 0);
+  });
+
+  return 0;
+}
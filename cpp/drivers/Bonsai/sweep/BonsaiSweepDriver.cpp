@@ -0,0 +1,182 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <mutex>
+#include <sstream>
+
+#include "Bonsai.h"
+#include "BonsaiFunctions.h"
+#include "par_utils.h"
+
+using namespace EdgeML;
+
+using namespace EdgeML::Bonsai;
+
+//
+// Hyperparameter sweep over one dataset.
+// Usage: BonsaiSweep <configsFile> <numConcurrent> <threadsPerJob> [Bonsai options] DataFolder
+// [Bonsai options] DataFolder are the usual BonsaiTrain arguments. Every line of
+// configsFile holds further Bonsai options (e.g. "-P 20 -D 3 -lW 0.001") that override
+// the base options for one configuration.
+// Data is loaded and normalized once and shared read-only by all configurations.
+// Each configuration is evaluated on the validation data; the resultDump entries
+// and a per-sweep summary end up in DataFolder/BonsaiResults.
+//
+
+struct SweepResult
+{
+  std::string config;
+  std::string resultsPath;
+  FP_TYPE accuracy;
+};
+
+static std::vector<std::string> tokenize(const std::string& line)
+{
+  std::vector<std::string> tokens;
+  std::istringstream stream(line);
+  std::string token;
+  while (stream >> token)
+    tokens.push_back(token);
+  return tokens;
+}
+
+int main(int argc, char **argv)
+{
+#ifdef LINUX
+  trapfpe();
+  struct sigaction sa;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = fpehandler;
+  sigaction (SIGFPE, &sa, NULL);
+#endif
+  assert (sizeof(MKL_INT) == sizeof(Eigen::Index));
+
+  if (argc < 4) {
+    LOG_INFO("Usage: BonsaiSweep <configsFile> <numConcurrent> <threadsPerJob> [Bonsai options] DataFolder");
+    exitWithHelp();
+  }
+
+  const std::string configsFile = argv[1];
+  const int numConcurrent = atoi(argv[2]);
+  const int threadsPerJob = atoi(argv[3]);
+  assert(numConcurrent >= 1 && threadsPerJob >= 1);
+
+  // Base arguments as BonsaiTrain would see them
+  std::vector<std::string> baseArgs;
+  baseArgs.push_back(argv[0]);
+  for (int i = 4; i < argc; ++i)
+    baseArgs.push_back(argv[i]);
+  assert(baseArgs.back()[0] != '-' && "the data folder must be the last argument");
+
+  std::vector<std::string> configs;
+  std::ifstream configReader(configsFile);
+  assert(configReader.is_open());
+  std::string line;
+  while (std::getline(configReader, line))
+    if (tokenize(line).size() > 0)
+      configs.push_back(line);
+  configReader.close();
+  LOG_INFO("Number of configurations: " + std::to_string(configs.size()));
+
+  // parseInput expects [options] DataFolder; config options are spliced in before the data folder
+  auto hyperParamsOf = [&baseArgs](const std::string& config, std::string& dataDir) {
+    std::vector<std::string> args(baseArgs.begin(), baseArgs.end() - 1);
+    std::vector<std::string> configArgs = tokenize(config);
+    for (size_t i = 0; i < configArgs.size(); i += 2) {
+      // The shared data fixes these
+      assert(configArgs[i] != "-F" && configArgs[i] != "-C" && configArgs[i] != "-f"
+        && configArgs[i] != "-nT" && configArgs[i] != "-nE");
+    }
+    args.insert(args.end(), configArgs.begin(), configArgs.end());
+    args.push_back(baseArgs.back());
+
+    std::vector<const char*> argPtrs;
+    for (size_t i = 0; i < args.size(); ++i)
+      argPtrs.push_back(args[i].c_str());
+
+    BonsaiModel::BonsaiHyperParams hyperParams;
+    parseInput((int)argPtrs.size(), argPtrs.data(), hyperParams, dataDir);
+    hyperParams.finalizeHyperParams();
+    return hyperParams;
+  };
+
+  // Load and normalize the data once
+  std::string dataDir;
+  BonsaiModel::BonsaiHyperParams baseParams = hyperParamsOf("", dataDir);
+  assert(baseParams.nvalidation > 0 && "sweep configurations are compared on the validation data");
+
+  const featureCount_t dataDimension = baseParams.dataDimension + 1; // bias feature
+  Data data(FileIngest,
+    DataFormatParams{
+      baseParams.ntrain,
+      baseParams.nvalidation,
+      baseParams.ntest,
+      baseParams.numClasses,
+      dataDimension });
+  data.loadDataFromFile(baseParams.dataformatType, dataDir + "/train.txt", dataDir + "/test.txt", "");
+  data.finalizeData();
+
+  MatrixXuf mean = MatrixXuf::Zero(dataDimension, 1);
+  MatrixXuf stdDev = MatrixXuf::Zero(dataDimension, 1);
+  data.meanVarNormalize(trainSplit, mean, stdDev);
+
+  std::string sweepPath;
+  createOutputDirs(dataDir, sweepPath);
+  LOG_INFO("Sweep results in " + sweepPath);
+
+  std::vector<SweepResult> results(configs.size());
+  // Each trainer draws from generators seeded by its own hyperParams.seed, so a job
+  // trains the same model as a serial run of its config, whatever the interleaving
+  std::mutex initMutex; // hyperParamsOf creates the output directories
+
+  std::vector<std::function<void()> > jobs;
+  for (size_t c = 0; c < configs.size(); ++c) {
+    jobs.push_back([&, c]() {
+      std::string currResultsPath = sweepPath + "/config_" + std::to_string(c);
+
+      BonsaiTrainer* trainer;
+      {
+        std::lock_guard<std::mutex> lock(initMutex);
+        std::string configDataDir;
+        BonsaiModel::BonsaiHyperParams hyperParams = hyperParamsOf(configs[c], configDataDir);
+        trainer = new BonsaiTrainer(hyperParams, data, mean, stdDev, currResultsPath);
+      }
+      trainer->train();
+
+      auto modelBytes = trainer->getModelSize();
+      auto model = new char[modelBytes];
+      auto meanStdBytes = trainer->getMeanStdSize();
+      auto meanStd = new char[meanStdBytes];
+
+      trainer->exportModel(modelBytes, model, currResultsPath);
+      trainer->exportMeanStd(meanStdBytes, meanStd, currResultsPath);
+      trainer->dumpModelMeanStd(currResultsPath);
+
+      BonsaiPredictor predictor(modelBytes, model);
+      predictor.importMeanStd(meanStdBytes, meanStd);
+      results[c].accuracy = predictor.batchEvaluate(data, validationSplit, dataDir, currResultsPath);
+      results[c].config = configs[c];
+      results[c].resultsPath = currResultsPath;
+
+      delete trainer;
+      delete[] model;
+      delete[] meanStd;
+    });
+  }
+
+  runJobs(jobs, numConcurrent, threadsPerJob);
+
+  size_t best = 0;
+  std::ofstream summaryWriter(sweepPath + "/sweepSummary");
+  for (size_t c = 0; c < results.size(); ++c) {
+    summaryWriter << results[c].accuracy << "\t" << results[c].resultsPath << "\t" << results[c].config << "\n";
+    if (results[c].accuracy > results[best].accuracy) best = c;
+  }
+  summaryWriter.close();
+
+  if (results.size() > 0)
+    LOG_INFO("Best validation accuracy " + std::to_string(results[best].accuracy) + " with: " + results[best].config);
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 // Licensed under the MIT license.
 
 #include "Bonsai.h"
+#include "BonsaiFunctions.h"
 
 using namespace EdgeML;
 
@@ -21,21 +22,71 @@ int main(int argc, char **argv)
   
   std::string dataDir;
   std::string currResultsPath;
+
+  // -i <uniformShare> is handled here rather than by parseInput: the trainer must be
+  // told to importance-sample before it trains
+  FP_TYPE importanceUniformShare = (FP_TYPE)0.0;
+  std::vector<const char*> args(argv, argv + argc);
+  for (size_t i = 1; i + 1 < args.size() && args[i][0] == '-'; i += 2) {
+    if (std::string(args[i]) == "-i") {
+      importanceUniformShare = (FP_TYPE)atof(args[i + 1]);
+      if (importanceUniformShare <= (FP_TYPE)0.0 || importanceUniformShare > (FP_TYPE)1.0)
+        exitWithHelp();
+      args.erase(args.begin() + i, args.begin() + i + 2);
+      break;
+    }
+  }
+
+  BonsaiTrainer* trainer;
+  Data* data = NULL;
+  MatrixXuf mean, stdDev;
+  if (importanceUniformShare == (FP_TYPE)0.0) {
+    trainer = new BonsaiTrainer(DataIngestType::FileIngest, (int)args.size(), args.data(),
+                                dataDir, currResultsPath);
+  }
+  else {
+    // Same data as the FileIngest constructor loads, normalized outside the trainer
+    BonsaiModel::BonsaiHyperParams hyperParams;
+    parseInput((int)args.size(), args.data(), hyperParams, dataDir);
+    hyperParams.finalizeHyperParams();
+
+    const featureCount_t dataDimension = hyperParams.dataDimension + 1; // bias feature
+    data = new Data(FileIngest,
+      DataFormatParams{
+        hyperParams.ntrain,
+        hyperParams.nvalidation,
+        hyperParams.ntest,
+        hyperParams.numClasses,
+        dataDimension });
+    data->loadDataFromFile(hyperParams.dataformatType, dataDir + "/train.txt", dataDir + "/test.txt", "");
+    data->finalizeData();
+
+    mean = MatrixXuf::Zero(dataDimension, 1);
+    stdDev = MatrixXuf::Zero(dataDimension, 1);
+    data->meanVarNormalize(trainSplit, mean, stdDev);
+
+    createOutputDirs(dataDir, currResultsPath);
+#ifdef TIMER
+    OPEN_TIMER_LOGFILE(currResultsPath);
+#endif
+    trainer = new BonsaiTrainer(hyperParams, *data, mean, stdDev, currResultsPath);
+    trainer->enableImportanceSampling(importanceUniformShare);
+    trainer->train();
+  }
   
-  BonsaiTrainer trainer(DataIngestType::FileIngest, argc, (const char**) argv, 
-                        dataDir, currResultsPath);
-  
-  auto modelBytes = trainer.getModelSize(); // This can be changed to getSparseModelSize() if you need to export sparse model
+  auto modelBytes = trainer->getModelSize(); // This can be changed to getSparseModelSize() if you need to export sparse model
   auto model = new char[modelBytes];
-  auto meanStdBytes = trainer.getMeanStdSize();
+  auto meanStdBytes = trainer->getMeanStdSize();
   auto meanStd = new char[meanStdBytes];
   
-  trainer.exportModel(modelBytes, model); // use exportSparseModel(...) if you need sparse model
-  trainer.exportMeanStd(meanStdBytes, meanStd);
-  trainer.getLoadableModelMeanStd(model, modelBytes, meanStd, meanStdBytes, currResultsPath);
-  trainer.dumpModelMeanStd(currResultsPath);
+  trainer->exportModel(modelBytes, model); // use exportSparseModel(...) if you need sparse model
+  trainer->exportMeanStd(meanStdBytes, meanStd);
+  trainer->getLoadableModelMeanStd(model, modelBytes, meanStd, meanStdBytes, currResultsPath);
+  trainer->dumpModelMeanStd(currResultsPath);
   
   delete[] model, meanStd;
+  delete trainer;
+  delete data;
   
   return 0;
 }
@@ -0,0 +1,210 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Cascade.h"
+
+#include <chrono>
+
+using namespace EdgeML;
+using namespace EdgeML::Ensemble;
+
+static void exitWithHelp()
+{
+  LOG_INFO("./Cascade [Options] \n");
+  LOG_INFO("Scores with a Bonsai model and escalates low-margin points to a ProtoNN model.");
+  LOG_INFO("Options:");
+  LOG_INFO("-B    : [Required] Directory of the Bonsai model (loadableModel and loadableMeanStd).");
+  LOG_INFO("-P    : [Required] ProtoNN model file.");
+  LOG_INFO("-n    : [Optional] Min-max normalization file of the ProtoNN model.");
+  LOG_INFO("-F    : [Required] Input format. 0 for libsvm format, 1 for tab/space separated input.");
+  LOG_INFO("-V    : [Optional] Validation file to calibrate the threshold on.");
+  LOG_INFO("-v    : [Optional] Number of validation points.");
+  LOG_INFO("-a    : [Optional] Target validation accuracy of the calibrated threshold (default: accuracy of the ProtoNN model).");
+  LOG_INFO("-t    : [Optional] Margin threshold to use instead of calibrating one.");
+  LOG_INFO("-T    : [Optional] Test file to report accuracy, escalation rate and time on.");
+  LOG_INFO("-e    : [Optional] Number of test points.");
+  exit(1);
+}
+
+// Reads a model whose size in bytes is stored in its first sizeof(size_t) bytes
+static std::vector<char> readModelFile(
+  const std::string& fileName,
+  const bool isSizeIncluded)
+{
+  std::ifstream infile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!infile.is_open()) {
+    LOG_ERROR("Cannot open the model file " + fileName);
+    exit(1);
+  }
+  const std::streamoff fileSize = infile.tellg();
+  infile.seekg(0);
+
+  size_t numBytes = 0;
+  infile.read((char*)&numBytes, sizeof(numBytes));
+  const size_t headerBytes = isSizeIncluded ? 0 : sizeof(numBytes);
+  if (!infile || numBytes > (size_t)fileSize - headerBytes) {
+    LOG_ERROR("The model file " + fileName + " is truncated or not a model");
+    exit(1);
+  }
+  if (isSizeIncluded)
+    infile.seekg(0);
+
+  std::vector<char> buffer(numBytes);
+  infile.read(buffer.data(), numBytes);
+  infile.close();
+  return buffer;
+}
+
+static FP_TYPE top1Accuracy(
+  const MatrixXuf& scores,
+  const SparseMatrixuf& Y)
+{
+  dataCount_t correct = 0;
+  for (Eigen::Index j = 0; j < scores.cols(); ++j) {
+    Eigen::Index predicted;
+    scores.col(j).maxCoeff(&predicted);
+    if (Y.coeff(predicted, j) != (FP_TYPE)0.0)
+      ++correct;
+  }
+  return (FP_TYPE)correct / (FP_TYPE)scores.cols();
+}
+
+template<class Scorer>
+static FP_TYPE timeBatch(Scorer score)
+{
+  const auto start = std::chrono::steady_clock::now();
+  score();
+  return std::chrono::duration<FP_TYPE, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<class DataMatType>
+static void calibrateCascade(
+  CascadePredictor& cascade,
+  EnsemblePredictor& secondStage,
+  const DataMatType& Xvalidation,
+  const SparseMatrixuf& Yvalidation,
+  FP_TYPE targetAccuracy)
+{
+  if (targetAccuracy < 0) {
+    MatrixXuf scores;
+    secondStage.scoreBatch(scores, Xvalidation);
+    targetAccuracy = top1Accuracy(scores, Yvalidation);
+  }
+  cascade.calibrate(Xvalidation, Yvalidation, targetAccuracy);
+}
+
+template<class DataMatType>
+static void reportTest(
+  CascadePredictor& cascade,
+  EnsemblePredictor& firstStage,
+  EnsemblePredictor& secondStage,
+  const DataMatType& Xtest,
+  const SparseMatrixuf& Ytest)
+{
+  MatrixXuf firstScores, secondScores, cascadeScores;
+  const FP_TYPE firstTime = timeBatch([&]() { firstStage.scoreBatch(firstScores, Xtest); });
+  const FP_TYPE secondTime = timeBatch([&]() { secondStage.scoreBatch(secondScores, Xtest); });
+  const FP_TYPE cascadeTime = timeBatch([&]() { cascade.scoreBatch(cascadeScores, Xtest); });
+  const FP_TYPE n = (FP_TYPE)Xtest.cols();
+
+  LOG_INFO("Bonsai test accuracy: " + std::to_string(top1Accuracy(firstScores, Ytest))
+    + " (" + std::to_string(firstTime / n) + " ms per point)");
+  LOG_INFO("ProtoNN test accuracy: " + std::to_string(top1Accuracy(secondScores, Ytest))
+    + " (" + std::to_string(secondTime / n) + " ms per point)");
+  LOG_INFO("Cascade test accuracy: " + std::to_string(top1Accuracy(cascadeScores, Ytest))
+    + " (" + std::to_string(cascadeTime / n) + " ms per point), escalation rate "
+    + std::to_string(cascade.escalationRate()));
+}
+
+int main(int argc, char **argv)
+{
+#ifdef LINUX
+  trapfpe();
+  struct sigaction sa;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = fpehandler;
+  sigaction (SIGFPE, &sa, NULL);
+#endif
+  assert(sizeof(MKL_INT) == sizeof(Eigen::Index));
+
+  std::string bonsaiDir, protoNNFile, normParamFile, validationFile, testFile;
+  DataFormat format = undefinedData;
+  dataCount_t numValidation = 0, numTest = 0;
+  FP_TYPE targetAccuracy = -1.0, threshold = -1.0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i % 2 == 1) {
+      if (argv[i][0] != '-') exitWithHelp();
+      continue;
+    }
+    switch (argv[i - 1][1]) {
+      case 'B': bonsaiDir = argv[i]; break;
+      case 'P': protoNNFile = argv[i]; break;
+      case 'n': normParamFile = argv[i]; break;
+      case 'F':
+        if (argv[i][0] == '0') format = libsvmFormat;
+        else if (argv[i][0] == '1') format = tsvFormat;
+        else exitWithHelp();
+        break;
+      case 'V': validationFile = argv[i]; break;
+      case 'v': numValidation = strtol(argv[i], NULL, 0); break;
+      case 'a': targetAccuracy = (FP_TYPE)atof(argv[i]); break;
+      case 't': threshold = (FP_TYPE)atof(argv[i]); break;
+      case 'T': testFile = argv[i]; break;
+      case 'e': numTest = strtol(argv[i], NULL, 0); break;
+      default:
+        LOG_INFO("Unknown option: " + std::string(argv[i - 1]));
+        exitWithHelp();
+    }
+  }
+  if (bonsaiDir.empty() || protoNNFile.empty() || format == undefinedData) exitWithHelp();
+  if (threshold < 0 && (validationFile.empty() || numValidation == 0)) exitWithHelp();
+
+  const std::vector<char> bonsaiModel = readModelFile(bonsaiDir + "/loadableModel", true);
+  const std::vector<char> bonsaiMeanStd = readModelFile(bonsaiDir + "/loadableMeanStd", true);
+  const std::vector<char> protoNNModel = readModelFile(protoNNFile, false);
+
+  const ProtoNN::ProtoNNModel::ProtoNNHyperParams protoNNHyperParams
+    = ProtoNN::ProtoNNModel(protoNNModel.size(), protoNNModel.data()).hyperParams;
+  const featureCount_t numFeatures = protoNNHyperParams.D;
+
+  EnsemblePredictor firstStage(numFeatures), secondStage(numFeatures);
+  firstStage.addBonsaiModel(bonsaiModel.size(), bonsaiModel.data(), bonsaiMeanStd.size(), bonsaiMeanStd.data());
+  if (protoNNHyperParams.normalizationType == minMax) {
+    if (normParamFile.empty()) {
+      LOG_ERROR("The ProtoNN model uses min-max normalization; give its normalization file with -n");
+      exit(1);
+    }
+    MatrixXuf min, max;
+    loadMinMax(min, max, numFeatures, normParamFile);
+    secondStage.addProtoNNModel(protoNNModel.size(), protoNNModel.data(), min, max);
+  }
+  else
+    secondStage.addProtoNNModel(protoNNModel.size(), protoNNModel.data());
+  firstStage.finalize();
+  secondStage.finalize();
+
+  Data data(FileIngest,
+    DataFormatParams{ 0, numValidation, numTest, protoNNHyperParams.l, numFeatures });
+  data.loadDataFromFile(format, "", validationFile, testFile);
+  data.finalizeData();
+
+  CascadePredictor cascade(firstStage, secondStage);
+  if (threshold >= 0)
+    cascade.setThreshold(threshold);
+  else if (data.isDense(validationSplit))
+    calibrateCascade(cascade, secondStage, data.validationData, data.Yvalidation, targetAccuracy);
+  else
+    calibrateCascade(cascade, secondStage, data.Xvalidation, data.Yvalidation, targetAccuracy);
+  LOG_INFO("Cascade threshold: " + std::to_string(cascade.getThreshold()));
+
+  if (numTest > 0 && !testFile.empty()) {
+    if (data.isDense(testSplit))
+      reportTest(cascade, firstStage, secondStage, data.testData, data.Ytest);
+    else
+      reportTest(cascade, firstStage, secondStage, data.Xtest, data.Ytest);
+  }
+
+  return 0;
+}
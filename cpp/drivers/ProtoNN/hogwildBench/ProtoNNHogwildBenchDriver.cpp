@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <chrono>
+
+#include "ProtoNN.h"
+#include "logger.h"
+
+using namespace EdgeML;
+using namespace EdgeML::ProtoNN;
+
+//
+// Compares the serial solver with the Hogwild solver (-H) on one configuration.
+// Usage: ProtoNNHogwildBench <numThreads> [ProtoNN options]
+// [ProtoNN options] are the usual ProtoNNTrain arguments without -H. Data is loaded and
+// normalized once, and both runs start from the same initialization. Each run writes its
+// usual output to its own directory under <outDir>; the per-iteration accuracies and
+// optimization times in their logs give time-to-accuracy curves. The total time and final
+// validation accuracy of both runs are appended to <outDir>/ProtoNNHogwildBenchResults.
+//
+
+struct BenchResult
+{
+  std::string name;
+  FP_TYPE seconds;
+  FP_TYPE accuracy;
+};
+
+int main(int argc, char **argv)
+{
+#ifdef LINUX
+  trapfpe();
+  struct sigaction sa;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = fpehandler;
+  sigaction (SIGFPE, &sa, NULL);
+#endif
+
+  assert(sizeof(MKL_INT) == 8 && "need large enough indices to store matrices");
+  assert(sizeof(MKL_INT) == sizeof(Eigen::Index) && "MKL BLAS routines are called directly on data of an Eigen matrix. Hence, the index sizes should match.");
+
+  if (argc < 2) {
+    LOG_INFO("Usage: ProtoNNHogwildBench <numThreads> [ProtoNN options]");
+    return 1;
+  }
+
+  const int numThreads = atoi(argv[1]);
+  assert(numThreads >= 2);
+
+  // Arguments as ProtoNNTrain would see them
+  std::vector<const char*> args;
+  args.push_back(argv[0]);
+  std::string outDir;
+  for (int i = 2; i < argc; ++i) {
+    args.push_back(argv[i]);
+    assert(std::string(argv[i]) != "-H");
+    if (std::string(argv[i - 1]) == "-O") outDir = argv[i];
+  }
+  assert(!outDir.empty());
+
+  // Load and normalize the data once
+  ProtoNNTrainer loader((int)args.size(), args.data());
+  Data& data = loader.getData();
+  const ProtoNNModel::ProtoNNHyperParams hyperParams
+    = ProtoNNModel((int)args.size(), args.data()).hyperParams;
+
+  ProtoNNModel::ProtoNNParams initParams;
+  FP_TYPE initGamma;
+  {
+    ProtoNNTrainer trainer(hyperParams, data, outDir + "/ProtoNNHogwildBench_init");
+    trainer.exportInitialization(initParams, initGamma);
+  }
+
+  std::vector<BenchResult> results;
+  for (int threads : { 1, numThreads }) {
+    const std::string name = threads == 1 ? "serial" : "hogwild_" + std::to_string(threads);
+    ProtoNNTrainer trainer(hyperParams, data, outDir + "/ProtoNNHogwildBench_" + name);
+    trainer.importInitialization(initParams, initGamma);
+    trainer.enableHogwild(threads);
+
+    const auto start = std::chrono::steady_clock::now();
+    const FP_TYPE accuracy = trainer.train();
+    const FP_TYPE seconds = std::chrono::duration<FP_TYPE>(std::chrono::steady_clock::now() - start).count();
+    results.push_back(BenchResult{ name, seconds, accuracy });
+
+    LOG_INFO(name + ": " + std::to_string(seconds) + " s, validation accuracy " + std::to_string(accuracy));
+  }
+
+  std::ofstream summaryWriter(outDir + "/ProtoNNHogwildBenchResults", std::ofstream::out | std::ofstream::app);
+  for (size_t r = 0; r < results.size(); ++r)
+    summaryWriter << results[r].name << "\t" << results[r].seconds << "\t" << results[r].accuracy << "\n";
+  summaryWriter.close();
+
+  LOG_INFO("Hogwild speedup over the serial solver: " + std::to_string(results[0].seconds / results[1].seconds));
+
+  return 0;
+}
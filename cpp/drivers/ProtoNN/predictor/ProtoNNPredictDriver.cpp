@@ -40,4 +40,26 @@ int main(int argc, char **argv) {
     default:
       assert(false);
   }
+
+  if (predictor.int8Requested()) {
+    predictor.quantizeModel();
+    EdgeML::ResultStruct int8Res = predictor.test();
+    switch(int8Res.problemType) {
+      case binary:
+      case multiclass:
+        LOG_INFO("int8 Accuracy: " + std::to_string(int8Res.accuracy)
+          + " (delta: " + std::to_string(int8Res.accuracy - res.accuracy) + ")");
+        break;
+      case multilabel:
+        LOG_INFO("int8 Prec@1: " + std::to_string(int8Res.precision1)
+          + " (delta: " + std::to_string(int8Res.precision1 - res.precision1) + ")");
+        LOG_INFO("int8 Prec@3: " + std::to_string(int8Res.precision3)
+          + " (delta: " + std::to_string(int8Res.precision3 - res.precision3) + ")");
+        LOG_INFO("int8 Prec@5: " + std::to_string(int8Res.precision5)
+          + " (delta: " + std::to_string(int8Res.precision5 - res.precision5) + ")");
+        break;
+      default:
+        assert(false);
+    }
+  }
 }
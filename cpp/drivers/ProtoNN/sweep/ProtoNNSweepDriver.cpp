@@ -0,0 +1,177 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "ProtoNN.h"
+#include "logger.h"
+#include "par_utils.h"
+
+using namespace EdgeML;
+using namespace EdgeML::ProtoNN;
+
+//
+// Hyperparameter sweep over one dataset.
+// Usage: ProtoNNSweep <configsFile> <numConcurrent> <threadsPerJob> [ProtoNN options]
+// [ProtoNN options] are the usual ProtoNNTrain arguments. Every line of configsFile holds
+// further ProtoNN options (e.g. "-W 0.5 -Z 0.8 -B 0.8") that override the base options
+// for one configuration.
+// Data is loaded and normalized once and shared read-only by all configurations.
+// Configurations that agree on everything initializeModel uses (d, m/k, gamma numerator,
+// seed) start from one shared initialization, so k-means runs once per such group.
+// Validation accuracies of all configurations are collected in <outDir>/ProtoNNSweepResults.
+//
+
+struct SweepResult
+{
+  std::string config;
+  std::string outDir;
+  FP_TYPE accuracy;
+};
+
+struct SharedInitialization
+{
+  ProtoNNModel::ProtoNNParams params;
+  FP_TYPE gamma;
+};
+
+static std::vector<std::string> tokenize(const std::string& line)
+{
+  std::vector<std::string> tokens;
+  std::istringstream stream(line);
+  std::string token;
+  while (stream >> token)
+    tokens.push_back(token);
+  return tokens;
+}
+
+static std::string initializationKey(const ProtoNNModel::ProtoNNHyperParams& hyperParams)
+{
+  return std::to_string(hyperParams.initializationType)
+    + "_" + std::to_string(hyperParams.d)
+    + "_" + std::to_string(hyperParams.m)
+    + "_" + std::to_string(hyperParams.k)
+    + "_" + std::to_string(hyperParams.gammaNumerator)
+    + "_" + std::to_string(hyperParams.seed);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef LINUX
+  trapfpe();
+  struct sigaction sa;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = fpehandler;
+  sigaction (SIGFPE, &sa, NULL);
+#endif
+
+  assert(sizeof(MKL_INT) == 8 && "need large enough indices to store matrices");
+  assert(sizeof(MKL_INT) == sizeof(Eigen::Index) && "MKL BLAS routines are called directly on data of an Eigen matrix. Hence, the index sizes should match.");
+
+  if (argc < 4) {
+    LOG_INFO("Usage: ProtoNNSweep <configsFile> <numConcurrent> <threadsPerJob> [ProtoNN options]");
+    return 1;
+  }
+
+  const std::string configsFile = argv[1];
+  const int numConcurrent = atoi(argv[2]);
+  const int threadsPerJob = atoi(argv[3]);
+  assert(numConcurrent >= 1 && threadsPerJob >= 1);
+
+  // Base arguments as ProtoNNTrain would see them
+  std::vector<std::string> baseArgs;
+  baseArgs.push_back(argv[0]);
+  std::string outDir;
+  for (int i = 4; i < argc; ++i) {
+    baseArgs.push_back(argv[i]);
+    if (std::string(argv[i - 1]) == "-O") outDir = argv[i];
+  }
+  assert(!outDir.empty());
+
+  std::vector<std::string> configs;
+  std::ifstream configReader(configsFile);
+  assert(configReader.is_open());
+  std::string line;
+  while (std::getline(configReader, line))
+    if (tokenize(line).size() > 0)
+      configs.push_back(line);
+  configReader.close();
+  LOG_INFO("Number of configurations: " + std::to_string(configs.size()));
+
+  // Load and normalize the data once
+  std::vector<const char*> baseArgPtrs;
+  for (size_t i = 0; i < baseArgs.size(); ++i)
+    baseArgPtrs.push_back(baseArgs[i].c_str());
+  ProtoNNTrainer loader((int)baseArgPtrs.size(), baseArgPtrs.data());
+  Data& data = loader.getData();
+
+  std::vector<ProtoNNModel::ProtoNNHyperParams> hyperParams;
+  for (size_t c = 0; c < configs.size(); ++c) {
+    std::vector<std::string> args(baseArgs);
+    std::vector<std::string> configArgs = tokenize(configs[c]);
+    for (size_t i = 0; i < configArgs.size(); i += 2) {
+      // The shared data and output location fix these
+      assert(configArgs[i] != "-I" && configArgs[i] != "-V" && configArgs[i] != "-O"
+        && configArgs[i] != "-F" && configArgs[i] != "-M" && configArgs[i] != "-P"
+        && configArgs[i] != "-r" && configArgs[i] != "-v" && configArgs[i] != "-D"
+        && configArgs[i] != "-l" && configArgs[i] != "-C" && configArgs[i] != "-N"
+        && configArgs[i] != "-X");
+    }
+    args.insert(args.end(), configArgs.begin(), configArgs.end());
+
+    std::vector<const char*> argPtrs;
+    for (size_t i = 0; i < args.size(); ++i)
+      argPtrs.push_back(args[i].c_str());
+    hyperParams.push_back(ProtoNNModel((int)argPtrs.size(), argPtrs.data()).hyperParams);
+  }
+
+  auto configOutDir = [&](const size_t c) {
+    return outDir + "/ProtoNNSweep_" + std::to_string(c) + "_" + hyperParams[c].subdirName();
+  };
+
+  // Initializations are computed one at a time with all the MKL threads. Like the
+  // jobs below, they draw from generators seeded by their own hyperParams.seed, so a
+  // job trains the same model as a serial run of its config, whatever the interleaving
+  std::map<std::string, SharedInitialization> initializations;
+  for (size_t c = 0; c < configs.size(); ++c) {
+    std::string key = initializationKey(hyperParams[c]);
+    if (initializations.find(key) != initializations.end())
+      continue;
+    ProtoNNTrainer trainer(hyperParams[c], data, configOutDir(c));
+    trainer.exportInitialization(initializations[key].params, initializations[key].gamma);
+  }
+  LOG_INFO("Number of distinct initializations: " + std::to_string(initializations.size()));
+
+  std::vector<SweepResult> results(configs.size());
+  std::vector<std::function<void()> > jobs;
+  for (size_t c = 0; c < configs.size(); ++c) {
+    jobs.push_back([&, c]() {
+      const SharedInitialization& init = initializations.at(initializationKey(hyperParams[c]));
+
+      ProtoNNTrainer trainer(hyperParams[c], data, configOutDir(c));
+      trainer.importInitialization(init.params, init.gamma);
+
+      results[c].accuracy = trainer.train();
+      results[c].config = configs[c];
+      results[c].outDir = configOutDir(c);
+    });
+  }
+
+  runJobs(jobs, numConcurrent, threadsPerJob);
+
+  size_t best = 0;
+  std::ofstream summaryWriter(outDir + "/ProtoNNSweepResults", std::ofstream::out | std::ofstream::app);
+  for (size_t c = 0; c < results.size(); ++c) {
+    summaryWriter << results[c].accuracy << "\t" << results[c].outDir << "\t" << results[c].config << "\n";
+    if (results[c].accuracy > results[best].accuracy) best = c;
+  }
+  summaryWriter.close();
+
+  if (results.size() > 0)
+    LOG_INFO("Best validation accuracy " + std::to_string(results[best].accuracy) + " with: " + results[best].config);
+
+  return 0;
+}
@@ -5,6 +5,8 @@
 #define __BONSAI_H__
 
 #include "Data.h"
+#include "quantized.h"
+#include "score_cache.h"
 
 
 namespace EdgeML
@@ -264,6 +266,16 @@ namespace EdgeML
 
     };
 
+    ///
+    /// Read the mean and stdDev written by BonsaiTrainer::exportMeanStd into @mean and @stdDev,
+    /// which already have the dimension of the model
+    ///
+    void importMeanStd(
+      const size_t numBytes,
+      const char *const fromBuffer,
+      MatrixXuf& mean,
+      MatrixXuf& stdDev);
+
     ///
     /// Class to hold the requirements for Training Bonsai Model
     ///
@@ -297,13 +309,16 @@ namespace EdgeML
         tanhVXWeightMatType tanhVXWeight;
         WXWeightMatType WXWeight;
         partialZGradientMatType partialZGradient;
+        Eigen::Index batchBegin = -1; ///< Column of data.Xtrain where the current minibatch starts, -1 if it is not a slice of Xtrain
+        MatrixXuf pointWeight; ///< Unbiasing weights of the points of an importance-sampled minibatch, empty otherwise
+        MatrixXuf pointLoss; ///< Hinge loss of the points of an importance-sampled minibatch at the last gradient
 
         ///
         /// Function to fill the Indicator Values at each node
         ///
         void fillNodeProbability(
           const BonsaiModel& model,
-          const MatrixXuf& Theta,
+          const ThetaMatType& Theta,
           const MatrixXuf& Xdata);
 
         ///
@@ -325,14 +340,22 @@ namespace EdgeML
           const MatrixXufINT& classID);
       };
 
-      /// DO NOT REORDER model and data. They should be in this order for constructors to work
+      /// DO NOT REORDER model, ownedData and data. They should be in this order for constructors to work
       BonsaiModel model; ///< Model Object    
-      Data data; ///< Data Object to store the train and test data
+      Data ownedData; ///< Data loaded by this trainer, empty when training on shared data
+      Data& data; ///< Data Object to store the train and test data
       //////////////////// 
 
       struct TreeCache treeCache; ///< Tree Cache Object
       MatrixXuf YMultCoeff; ///< Object to hold different label convention of Binary classification
 
+      std::string checkpointPath; ///< Snapshot file for jointSgdBonsai, empty disables checkpointing
+      int checkpointInterval; ///< Number of batches between snapshots
+      int checkpointStopBatch = 0; ///< Batch after whose snapshot jointSgdBonsai returns, 0 to run to the end
+
+      bool isImportanceSampled = false; ///< Draw jointSgdBonsai minibatches in proportion to per-point loss estimates
+      FP_TYPE importanceUniformShare = (FP_TYPE)0.2; ///< Share of the draws that are uniform when importance sampling
+
       ///
       /// Use this constructor for training 
       /// 1. On data ingested from file
@@ -371,6 +394,35 @@ namespace EdgeML
         const DataIngestType& dataIngestType,
         const BonsaiModel::BonsaiHyperParams& hyperParams);
 
+      ///
+      /// Call this constructor for training
+      /// 1. On data that has already been loaded, finalized and mean-var normalized,
+      ///    and is shared read-only with other trainers (e.g. a hyperparameter sweep)
+      /// 2. Starting with a new model from scratch
+      /// hyperParams must not include the bias dimension, as for the InterfaceIngest constructor
+      ///
+      BonsaiTrainer(
+        const BonsaiModel::BonsaiHyperParams& hyperParams,
+        Data& sharedData,
+        const MatrixXuf& sharedMean,
+        const MatrixXuf& sharedStdDev,
+        const std::string& currResultsPath);
+
+      ///
+      /// Call this constructor to warm start from an exported model
+      /// 1. On new (plus e.g. reservoir-sampled old) data, loaded and finalized but not normalized
+      /// 2. Normalizes warmStartData in place with the exported mean/stdDev, which the model keeps
+      /// Follow with fineTune(...) rather than train()
+      ///
+      BonsaiTrainer(
+        const size_t& numBytes,
+        const char *const fromModel,
+        const size_t& meanStdBytes,
+        const char *const fromMeanStd,
+        Data& warmStartData,
+        const std::string& currResultsPath,
+        const bool isDense = true);
+
       ~BonsaiTrainer();
 
       ///
@@ -407,10 +459,10 @@ namespace EdgeML
       /// Overloaded Function to Compute the regularized Loss function with custom params
       ///
       FP_TYPE computeObjective(
-        const MatrixXuf& Z,
-        const MatrixXuf& W,
-        const MatrixXuf& V,
-        const MatrixXuf& Theta,
+        const ZMatType& Z,
+        const WMatType& W,
+        const VMatType& V,
+        const ThetaMatType& Theta,
         const MatrixXuf& ZX,
         const LabelMatType& Y);
 
@@ -424,6 +476,29 @@ namespace EdgeML
       ///
       void train();
 
+      ///
+      /// Short training schedule for a warm-started model: iters passes of sparse retraining
+      /// on the model's current support, without re-initializing or re-thresholding
+      ///
+      void fineTune(const int iters);
+
+      ///
+      /// Snapshot parameters and solver state every interval batches to path, from a background thread.
+      /// If path already holds a snapshot of this run, training resumes from it, with the same result
+      /// as an uninterrupted run. The snapshot is removed once training completes.
+      /// A positive stopAfter, a multiple of interval, ends training once the snapshot after that
+      /// many batches is written and keeps it, e.g. to split a run across jobs with a time limit.
+      ///
+      void enableCheckpointing(const std::string& path, const int interval, const int stopAfter = 0);
+
+      ///
+      /// Draw minibatches with probability proportional to a hinge loss estimate per training point,
+      /// refreshed from the margins each minibatch computes anyway, with uniformShare of the draws
+      /// uniform so that every point is revisited. Gradients and the Armijo objective are weighted by
+      /// 1/(n p) per point, so they stay unbiased; points with zero loss are mostly skipped.
+      ///
+      void enableImportanceSampling(const FP_TYPE uniformShare = (FP_TYPE)0.2);
+
       ///
       /// Compute Score of a given point on a given Class, by having it pass through entire tree
       ///
@@ -438,12 +513,13 @@ namespace EdgeML
 
       ///
       /// Function to get Score and Index of True Class and Best Non Class. Used in computing margin loss
+      /// Scores all classes together through the stacked W and V; expects fillNodeProbability(ZX) first
       ///
       void getTrueBestClass(
         MatrixXuf& true_best_Score,
         MatrixXufINT& true_best_classIndex,
-        const MatrixXuf& Wmat,
-        const MatrixXuf& Vmat,
+        const WMatType& Wmat,
+        const VMatType& Vmat,
         const LabelMatType& Y,
         const MatrixXuf& ZX);
 
@@ -496,6 +572,10 @@ namespace EdgeML
 
       size_t getMeanStdSize();
 
+      void importMeanStd(
+        const size_t numBytes,
+        const char *const fromBuffer);
+
       ///
       /// Gives reloadablity for a pretrained model stored after training in the results directory
       ///
@@ -555,6 +635,14 @@ namespace EdgeML
       MatrixXuf mean; ///< Object to hold the mean of the train data from imported model
       MatrixXuf stdDev; ///< Object to hold stdDev of the train data from imported model
 
+      ///
+      /// Z*x of a normalized point x is ZNormalized*x + ZXOffset for the raw point x, so that
+      /// scoreSparseDataPoint only reads the columns of its non-zeros. ZNormalized is Z*diag(1/stdDev);
+      /// ZXOffset is Z times the normalized point of x = 0, i.e. -Z*(mean/stdDev) plus the bias column.
+      ///
+      ZMatType ZNormalized;
+      MatrixXuf ZXOffset;
+
       BonsaiModel model; ///< Object to hold the imported model
       Data testData;
       dataCount_t numTest;
@@ -562,9 +650,56 @@ namespace EdgeML
 
       std::string dataDir;
       std::string modelDir;
+      bool isInt8Requested; ///< Also evaluate an int8 copy of the model (-q 1)
+      bool isBinaryOutput; ///< Write predictions in the binary format of PredictionWriter (-o 1)
+
+      bool isQuantized; ///< Score with the int8 parameters below instead of model.params
+      QuantizedMatrix ZQ, WQ, VQ, ThetaQ;
+
+      ScoreCache* scoreCache; ///< Optional cache of scores, possibly shared with other predictors
+      bool isScoreCacheOwned; ///< Set when the cache was created from the -c option
+      uint64_t modelTag; ///< Fingerprint of the model, mean/stdDev and quantization, used in cache keys
+
       void setFromArgs(const int argc, const char** argv);
       void exitWithHelp();
 
+      ///
+      /// Scores of all classes from the int8 parameters for a dense, normalized point
+      ///
+      void quantizedPredictionScore(
+        const FP_TYPE *const x,
+        FP_TYPE *scores);
+
+      ///
+      /// Recompute modelTag; called whenever the scores of a point could change
+      ///
+      void updateModelTag();
+
+      void allocateFeedBuffers();
+
+      ///
+      /// Recompute ZNormalized and ZXOffset; called whenever Z, mean or stdDev change
+      ///
+      void updateNormalizedProjection();
+
+      ///
+      /// Scores of all classes from the projection @ZX of a point
+      ///
+      void projectionScore(
+        const MatrixXuf& ZX,
+        FP_TYPE *scores);
+
+      ///
+      /// batchEvaluate on test data whose columns can be read as DataMatType: MatrixXuf,
+      /// or a column-major sparse matrix
+      ///
+      template<class DataMatType>
+      FP_TYPE batchEvaluateOn(
+        const DataMatType& Xtest,
+        const SparseMatrixuf& Ytest,
+        const std::string& dataDir,
+        const std::string& currResultsPath);
+
     public:
       
       ///
@@ -594,7 +729,21 @@ namespace EdgeML
       void importMeanStd(std::string meanStdFile);
 
       ///
-      /// Function to Score an incoming Dense Data Point.Not thread safe
+      /// Replace the model by the one serialized in @fromModel. Call importMeanStd again
+      /// before scoring. Cached scores of the old model are never returned again.
+      ///
+      void swapModel(const size_t numBytes,
+        const char *const fromModel,
+        const bool isDense = true);
+
+      ///
+      /// Look up and store scores of scoreDenseDataPoint and scoreSparseDataPoint in @cache.
+      /// The cache is not owned and can be shared by predictors on several threads; NULL disables caching.
+      ///
+      void setScoreCache(ScoreCache* cache);
+
+      ///
+      /// Function to Score an incoming Dense Data Point. Safe to call concurrently
       ///
       void scoreDenseDataPoint(FP_TYPE* scores,
         const FP_TYPE *const values);
@@ -626,7 +775,7 @@ namespace EdgeML
         FP_TYPE *scores);
 
       ///
-      /// Function to Score an incoming sparse Data Point.Not thread safe
+      /// Function to Score an incoming sparse Data Point. Safe to call concurrently, as batchEvaluate does
       ///
       void scoreSparseDataPoint(
         FP_TYPE* scores,
@@ -634,6 +783,12 @@ namespace EdgeML
         const featureCount_t *const indices,
         const featureCount_t& numIndices);
 
+      ///
+      /// Quantizes Z, W, V and Theta to int8 with per-row scales; all later scoring
+      /// uses int8 dot products. Build with AVX2 or AVX-512 VNNI enabled for SIMD kernels.
+      ///
+      void quantizeModel();
+
       ///
       /// Function to return total nonzeros in the model loaded
       ///
@@ -647,13 +802,30 @@ namespace EdgeML
         const FP_TYPE& correct);
 
       ///
-      /// Function to predict an entire test dataset
+      /// Function to predict an entire test dataset. Returns the accuracy.
+      /// Points are scored in parallel, sparse ones from their non-zeros. Predictors may
+      /// evaluate concurrently; their appends to resultDump are serialized.
       ///
-      void batchEvaluate(
+      FP_TYPE batchEvaluate(
         const SparseMatrixuf& Xtest,
         const SparseMatrixuf& Ytest,
         const std::string& dataDir,
         const std::string& currResultsPath);
+
+      FP_TYPE batchEvaluate(
+        const MatrixXuf& Xtest,
+        const SparseMatrixuf& Ytest,
+        const std::string& dataDir,
+        const std::string& currResultsPath);
+
+      ///
+      /// batchEvaluate on @split of @data, whichever its storage
+      ///
+      FP_TYPE batchEvaluate(
+        const Data& data,
+        const DataSplit split,
+        const std::string& dataDir,
+        const std::string& currResultsPath);
       
       ///
       /// Function to predict an entire test dataset
@@ -5,6 +5,23 @@
 // Bonsai Functions
 
 using namespace EdgeML;
+using namespace EdgeML::Bonsai;
+
+// Unbiasing weight of point j of the minibatch, 1 unless the minibatch was importance-sampled
+static inline FP_TYPE pointWeight(const EdgeML::Bonsai::BonsaiTrainer& trainer, const int j)
+{
+  return trainer.treeCache.pointWeight.size() == 0 ? (FP_TYPE)1.0 : trainer.treeCache.pointWeight(0, j);
+}
+
+// Hinge loss of the points of an importance-sampled minibatch, to refresh their loss estimates
+static void recordPointLoss(EdgeML::Bonsai::BonsaiTrainer& trainer, const MatrixXuf& margin)
+{
+  if (trainer.treeCache.pointWeight.size() == 0)
+    return;
+  trainer.treeCache.pointLoss.resize(1, margin.cols());
+  for (Eigen::Index j = 0; j < margin.cols(); ++j)
+    trainer.treeCache.pointLoss(0, j) = std::max((FP_TYPE)0.0, (FP_TYPE)1.0 - trainer.YMultCoeff(0, j) * margin(0, j));
+}
 
 int Bonsai::countnnz(const MatrixXuf& A)
 {
@@ -38,7 +55,7 @@ void Bonsai::gradWCoeff(MatrixXuf& CoeffMat, const MatrixXuf& ZX, EdgeML::Bonsai
 	  for (int i = classNodesStart; i < classNodesStart + trainer.model.hyperParams.totalNodes; i++)
 	  {
 		// dot product
-		CoeffMat(i, j) = trainer.YMultCoeff(0, j)
+		CoeffMat(i, j) = trainer.YMultCoeff(0, j) * pointWeight(trainer, j)
 		  *tanh(trainer.model.hyperParams.Sigma * trainer.treeCache.tanhVXWeight(i, j))
 		  *trainer.treeCache.nodeProbability(i%trainer.model.hyperParams.totalNodes, j);
 	  }
@@ -56,7 +73,7 @@ void Bonsai::gradVCoeff(MatrixXuf& CoeffMat, const MatrixXuf& ZX, EdgeML::Bonsai
 	  int classNodesStart = (labelCount_t)classLst(0, j)*trainer.model.hyperParams.totalNodes;
 	  for (int i = classNodesStart; i < classNodesStart + trainer.model.hyperParams.totalNodes; i++)
 	  {
-		CoeffMat(i, j) = trainer.YMultCoeff(0, j) * trainer.treeCache.WXWeight(i, j)
+		CoeffMat(i, j) = trainer.YMultCoeff(0, j) * pointWeight(trainer, j) * trainer.treeCache.WXWeight(i, j)
 		  * ((FP_TYPE)1.0 - pow(tanh(trainer.model.hyperParams.Sigma * trainer.treeCache.tanhVXWeight(i, j)), (FP_TYPE)2.0))
 		  *trainer.treeCache.nodeProbability(i%trainer.model.hyperParams.totalNodes, j);
 	  }
@@ -64,7 +81,7 @@ void Bonsai::gradVCoeff(MatrixXuf& CoeffMat, const MatrixXuf& ZX, EdgeML::Bonsai
   }
 }
 
-void Bonsai::gradThetaCoeff(MatrixXuf &ThetaCoeffMat, const MatrixXuf& ZX, const EdgeML::Bonsai::BonsaiTrainer& trainer,
+void Bonsai::gradThetaCoeff(MatrixXuf &ThetaCoeffMat, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer,
   const MatrixXufINT &classLst, const MatrixXuf& margin)
 {
   for (int n = 0; n < ZX.cols(); n++)
@@ -75,7 +92,7 @@ void Bonsai::gradThetaCoeff(MatrixXuf &ThetaCoeffMat, const MatrixXuf& ZX, const
 	  int classNodesStart = (labelCount_t)classLst(0, n)*trainer.model.hyperParams.totalNodes;
 	  for (int i = classNodesStart; i < classNodesStart + trainer.model.hyperParams.totalNodes; i++)
 	  {
-		FP_TYPE tempGrad = trainer.YMultCoeff(0, n)
+		FP_TYPE tempGrad = trainer.YMultCoeff(0, n) * pointWeight(trainer, n)
 		  *trainer.treeCache.nodeProbability(i%trainer.model.hyperParams.totalNodes, n)
 		  *tanh(trainer.model.hyperParams.Sigma * trainer.treeCache.tanhVXWeight(i, n))
 		  *trainer.treeCache.WXWeight(i, n);
@@ -92,10 +109,11 @@ void Bonsai::gradThetaCoeff(MatrixXuf &ThetaCoeffMat, const MatrixXuf& ZX, const
   }
 }
 
+template<class DataMatType>
 void Bonsai::gradYhatW(
   MatrixXuf& gradOut,
   const LabelMatType& Y,
-  const SparseMatrixuf& X,
+  const DataMatType& X,
   const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer,
   const MatrixXufINT &classLst,
@@ -111,10 +129,11 @@ void Bonsai::gradYhatW(
   mm(gradOut, CoeffMat, CblasNoTrans, ZX, CblasTrans, (FP_TYPE)1.0, (FP_TYPE)0.0);
 }
 
+template<class DataMatType>
 void Bonsai::gradYhatV(
   MatrixXuf& gradOut,
   const LabelMatType& Y,
-  const SparseMatrixuf& X,
+  const DataMatType& X,
   const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer,
   const MatrixXufINT &classLst,
@@ -130,8 +149,9 @@ void Bonsai::gradYhatV(
 };
 
 
+template<class DataMatType>
 void Bonsai::gradYhatTheta(MatrixXuf& gradOut,
-  const LabelMatType& Y, const SparseMatrixuf& X,
+  const LabelMatType& Y, const DataMatType& X,
   const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer, const MatrixXufINT &classLst, const MatrixXuf &margin)
 {
   assert(gradOut.rows() == trainer.model.hyperParams.internalNodes);
@@ -145,16 +165,15 @@ void Bonsai::gradYhatTheta(MatrixXuf& gradOut,
 };
 
 
-void Bonsai::gradYhatZ(
-  MatrixXuf& gradOut,
-  const LabelMatType& Y, const SparseMatrixuf& X,
+void Bonsai::gradZCoeff(
+  MatrixXuf& ZCoeffMat,
   const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer,
   const MatrixXufINT &classLst,
   const MatrixXuf &margin)
 {
-  assert(gradOut.rows() == trainer.model.hyperParams.projectionDimension);
-  assert(gradOut.cols() == trainer.model.hyperParams.dataDimension);
+  assert(ZCoeffMat.rows() == trainer.model.hyperParams.projectionDimension);
+  assert(ZCoeffMat.cols() == ZX.cols());
 
   MatrixXuf CoeffMatW = MatrixXuf::Zero(trainer.model.hyperParams.internalClasses * trainer.model.hyperParams.totalNodes, ZX.cols());
   MatrixXuf CoeffMatV = MatrixXuf::Zero(trainer.model.hyperParams.internalClasses * trainer.model.hyperParams.totalNodes, ZX.cols());
@@ -164,41 +183,67 @@ void Bonsai::gradYhatZ(
   gradVCoeff(CoeffMatV, ZX, trainer, classLst, margin);
   gradThetaCoeff(CoeffMatTheta, ZX, trainer, classLst, margin);
 
+  // W' and V' of one class times a column of coefficients, with the small-matrix kernels
+  const labelCount_t totalNodes = trainer.model.hyperParams.totalNodes;
+  MatrixXuf partialZGradientColN(trainer.model.hyperParams.projectionDimension, 1);
+  MatrixXuf coeffW(totalNodes, 1), coeffV(totalNodes, 1);
   for (int n = 0; n < ZX.cols(); n++)
   {
-	MatrixXuf partialZGradientColN = MatrixXuf::Zero(trainer.model.hyperParams.projectionDimension, 1);
+	const labelCount_t rowBegin = (labelCount_t)classLst(0, n)*totalNodes;
+	coeffW = CoeffMatW.block(rowBegin, n, totalNodes, 1);
+	coeffV = CoeffMatV.block(rowBegin, n, totalNodes, 1);
 
-	mm(partialZGradientColN, trainer.model.getW((labelCount_t)classLst(0, n)),
-	  CblasTrans, CoeffMatW.block((labelCount_t)classLst(0, n)*trainer.model.hyperParams.totalNodes, n, trainer.model.hyperParams.totalNodes, 1),
-	  CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)1.0);
+	smallGemvRows(partialZGradientColN.data(), trainer.model.params.W, rowBegin, totalNodes,
+	  CblasTrans, coeffW.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+	smallGemvRows(partialZGradientColN.data(), trainer.model.params.V, rowBegin, totalNodes,
+	  CblasTrans, coeffV.data(), (FP_TYPE)1.0, (FP_TYPE)1.0);
 
-	mm(partialZGradientColN, trainer.model.getV((labelCount_t)classLst(0, n)),
-	  CblasTrans, CoeffMatV.block((labelCount_t)classLst(0, n)*trainer.model.hyperParams.totalNodes, n, trainer.model.hyperParams.totalNodes, 1),
-	  CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)1.0);
-
-	trainer.treeCache.partialZGradient.col(n) = partialZGradientColN;
+	ZCoeffMat.col(n) = partialZGradientColN;
   }
 
   if(trainer.model.hyperParams.internalNodes > 0)
-    mm(trainer.treeCache.partialZGradient, trainer.model.params.Theta, CblasTrans,
+    mm(ZCoeffMat, trainer.model.params.Theta, CblasTrans,
   	CoeffMatTheta, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)1.0);
+}
+
+template<class DataMatType>
+void Bonsai::gradYhatZ(
+  MatrixXuf& gradOut,
+  const LabelMatType& Y, const DataMatType& X,
+  const MatrixXuf& ZX,
+  EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const MatrixXufINT &classLst,
+  const MatrixXuf &margin)
+{
+  assert(gradOut.rows() == trainer.model.hyperParams.projectionDimension);
+  assert(gradOut.cols() == trainer.model.hyperParams.dataDimension);
 
-  mm(gradOut, trainer.treeCache.partialZGradient, CblasNoTrans, X, CblasTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
+  trainer.treeCache.partialZGradient = MatrixXuf::Zero(trainer.model.hyperParams.projectionDimension, ZX.cols());
+  gradZCoeff(trainer.treeCache.partialZGradient, ZX, trainer, classLst, margin);
+
+  const SparseMatrixufCSR* XCSR = trainer.data.getXtrainCSR();
+  if (XCSR != NULL && trainer.treeCache.batchBegin >= 0)
+    mmTransCSR(gradOut, trainer.treeCache.partialZGradient, *XCSR, (FP_TYPE)1.0, (FP_TYPE)0.0L,
+      trainer.treeCache.batchBegin, trainer.treeCache.batchBegin + X.cols());
+  else
+    mm(gradOut, trainer.treeCache.partialZGradient, CblasNoTrans, X, CblasTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
 };
 
 
+template<class DataMatType>
 void Bonsai::gradLossParam(
   MatrixXuf& gradOut,
-  const grad_y_param_fun gradYParam,
+  const grad_y_param_fun<DataMatType> gradYParam,
   const MatrixXuf& param,
   const FP_TYPE& regularizer,
-  const LabelMatType& Y, const SparseMatrixuf& X, const MatrixXuf& ZX,
+  const LabelMatType& Y, const DataMatType& X, const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer,
   const  MatrixXuf& margin, const MatrixXufINT& trueBestClassIndex)
 {
   assert(gradOut.rows() == param.rows());
   assert(gradOut.cols() == param.cols());
 
+  recordPointLoss(trainer, margin);
   gradYParam(gradOut, Y, X, ZX, trainer, trueBestClassIndex.row(0), margin);
 
   if (trainer.model.hyperParams.numClasses > 2)
@@ -217,18 +262,20 @@ void Bonsai::gradLossParam(
   }
 };
 
+template<class DataMatType>
 void Bonsai::gradLossParam(
   MatrixXuf& gradOut,
-  const grad_y_param_fun gradYParam,
+  const grad_y_param_fun<DataMatType> gradYParam,
   const SparseMatrixuf& param,
   const FP_TYPE& regularizer,
-  const LabelMatType& Y, const SparseMatrixuf& X, const MatrixXuf& ZX,
+  const LabelMatType& Y, const DataMatType& X, const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer,
   const  MatrixXuf& margin, const MatrixXufINT& trueBestClassIndex)
 {
   assert(gradOut.rows() == param.rows());
   assert(gradOut.cols() == param.cols());
 
+  recordPointLoss(trainer, margin);
   gradYParam(gradOut, Y, X, ZX, trainer, trueBestClassIndex.row(0), margin);
 
   if (trainer.model.hyperParams.numClasses > 2)
@@ -247,10 +294,11 @@ void Bonsai::gradLossParam(
   }
 };
 
+template<class DataMatType>
 void Bonsai::gradLW(
   MatrixXuf& gradOut,
   const WMatType& W, const FP_TYPE& lW, const LabelMatType& Y,
-  const SparseMatrixuf& X, const MatrixXuf& ZX,
+  const DataMatType& X, const MatrixXuf& ZX,
   EdgeML::Bonsai::BonsaiTrainer& trainer)
 {
   //std::cout << "Starting Gradient: " << std::endl;
@@ -274,13 +322,14 @@ void Bonsai::gradLW(
 	trainer.fillTanhVX(ZX, trueBestClassIndex.row(1));
   }
 
-  gradLossParam(gradOut, &gradYhatW, W, lW, Y, X, ZX, trainer, margin, trueBestClassIndex);
+  gradLossParam(gradOut, &gradYhatW<DataMatType>, W, lW, Y, X, ZX, trainer, margin, trueBestClassIndex);
 }
 
+template<class DataMatType>
 void Bonsai::gradLV(
   MatrixXuf& gradOut,
   const VMatType& V, const FP_TYPE& lV, const LabelMatType& Y,
-  const SparseMatrixuf& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
 {
 
   trainer.initializeTrainVariables(Y);
@@ -302,13 +351,14 @@ void Bonsai::gradLV(
 	trainer.fillWX(ZX, trueBestClassIndex.row(1));
 	trainer.fillTanhVX(ZX, trueBestClassIndex.row(1));
   }
-  gradLossParam(gradOut, &gradYhatV, V, lV, Y, X, ZX, trainer, margin, trueBestClassIndex);
+  gradLossParam(gradOut, &gradYhatV<DataMatType>, V, lV, Y, X, ZX, trainer, margin, trueBestClassIndex);
 };
 
+template<class DataMatType>
 void Bonsai::gradLTheta(
   MatrixXuf& gradOut,
   const ThetaMatType& Theta, const FP_TYPE& lTheta, const LabelMatType& Y,
-  const SparseMatrixuf& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
 {
   trainer.initializeTrainVariables(Y);
   trainer.fillNodeProbability(ZX);
@@ -330,13 +380,14 @@ void Bonsai::gradLTheta(
 	trainer.fillTanhVX(ZX, trueBestClassIndex.row(1));
   }
 
-  gradLossParam(gradOut, &gradYhatTheta, Theta, lTheta, Y, X, ZX, trainer, margin, trueBestClassIndex);
+  gradLossParam(gradOut, &gradYhatTheta<DataMatType>, Theta, lTheta, Y, X, ZX, trainer, margin, trueBestClassIndex);
 };
 
+template<class DataMatType>
 void Bonsai::gradLZ(
   MatrixXuf& gradOut,
   const ZMatType& Z, const FP_TYPE& lZ, const LabelMatType& Y,
-  const SparseMatrixuf& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
 {
   trainer.initializeTrainVariables(Y);
   trainer.fillNodeProbability(ZX);
@@ -358,18 +409,235 @@ void Bonsai::gradLZ(
 	trainer.fillTanhVX(ZX, trueBestClassIndex.row(1));
   }
 
-  gradLossParam(gradOut, &gradYhatZ, Z, lZ, Y, X, ZX, trainer, margin, trueBestClassIndex);
+  gradLossParam(gradOut, &gradYhatZ<DataMatType>, Z, lZ, Y, X, ZX, trainer, margin, trueBestClassIndex);
 };
 
+//
+// Caches shared by the gradients wrt all parameters: node probabilities,
+// true and best classes with their WX and tanh(VX), and the margin
+//
+static void prepareGradient(
+  MatrixXuf& margin,
+  MatrixXufINT& trueBestClassIndex,
+  const LabelMatType& Y,
+  const MatrixXuf& ZX,
+  EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  trainer.initializeTrainVariables(Y);
+  trainer.fillNodeProbability(ZX);
+
+  MatrixXuf trueBestScore = MatrixXuf::Ones(2, ZX.cols())*(-1000.0L);
+  trueBestClassIndex = MatrixXufINT::Zero(2, ZX.cols());
+
+  trainer.getTrueBestClass(trueBestScore, trueBestClassIndex, trainer.model.params.W, trainer.model.params.V, Y, ZX);
+
+  trainer.fillWX(ZX, trueBestClassIndex.row(0));
+  trainer.fillTanhVX(ZX, trueBestClassIndex.row(0));
+
+  // 2nd term not needed for binary classification
+  margin = trueBestScore.row(0) - trueBestScore.row(1);
+
+  if (trainer.model.hyperParams.internalClasses > 2)
+  {
+	trainer.fillWX(ZX, trueBestClassIndex.row(1));
+	trainer.fillTanhVX(ZX, trueBestClassIndex.row(1));
+  }
+}
+
+//
+// Same as gradLossParam, restricted to the support of param.
+// GradYhatParam is linear in its coefficients, so the true and best class
+// coefficients are combined before the (sampled) product with the right factor,
+// which sampleRightFactor(gradOut, CoeffMat) computes.
+//
+template<class SampledProductType>
+static void gradLossParamOnSupport(
+  SparseMatrixuf& gradOut,
+  const Bonsai::grad_coeff_fun gradCoeff,
+  const Eigen::Index coeffRows,
+  const SampledProductType& sampleRightFactor,
+  const SparseMatrixuf& param,
+  const FP_TYPE& regularizer,
+  const MatrixXuf& ZX,
+  EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const MatrixXuf& margin,
+  const MatrixXufINT& trueBestClassIndex)
+{
+  assert(param.isCompressed());
+
+  recordPointLoss(trainer, margin);
+  MatrixXuf CoeffMat = MatrixXuf::Zero(coeffRows, ZX.cols());
+  gradCoeff(CoeffMat, ZX, trainer, trueBestClassIndex.row(0), margin);
+
+  if (trainer.model.hyperParams.numClasses > 2)
+  {
+	MatrixXuf CoeffMatBestClass = MatrixXuf::Zero(coeffRows, ZX.cols());
+	gradCoeff(CoeffMatBestClass, ZX, trainer, trueBestClassIndex.row(1), margin);
+	CoeffMat -= CoeffMatBestClass;
+  }
+
+  gradOut = param;
+  sampleRightFactor(gradOut, CoeffMat);
+
+  FP_TYPE* gradValues = gradOut.valuePtr();
+  const FP_TYPE* paramValues = param.valuePtr();
+  for (Eigen::Index k = 0; k < param.nonZeros(); ++k)
+	gradValues[k] = gradValues[k] * ((FP_TYPE)-1.0 / (FP_TYPE)ZX.cols()) + regularizer * paramValues[k];
+}
+
+//
+// Sampled product with the right factor ZX of the gradients wrt W, V and Theta
+//
+static std::function<void(SparseMatrixuf&, const MatrixXuf&)> sampledWithZX(const MatrixXuf& ZX)
+{
+  return [&ZX](SparseMatrixuf& out, const MatrixXuf& A) { Bonsai::sampledProduct(out, A, ZX); };
+}
+
+//
+// Sampled product with X^T, the right factor of the gradient wrt Z. Dense X is taken as is.
+// A slice of sparse Xtrain reads its CSR copy, whose row c holds the points that have
+// feature c; other sparse minibatches are transposed into that form.
+//
+static std::function<void(SparseMatrixuf&, const MatrixXuf&)> sampledWithXt(
+  const MatrixXuf& X, const EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  return [&X](SparseMatrixuf& out, const MatrixXuf& A) { Bonsai::sampledProduct(out, A, X); };
+}
+
+static std::function<void(SparseMatrixuf&, const MatrixXuf&)> sampledWithXt(
+  const SparseMatrixuf& X, const EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  const SparseMatrixufCSR* XCSR = trainer.data.getXtrainCSR();
+  const Eigen::Index begin = trainer.treeCache.batchBegin;
+  if (XCSR != NULL && begin >= 0)
+    return [XCSR, begin, &X](SparseMatrixuf& out, const MatrixXuf& A)
+      { Bonsai::sampledProduct(out, A, *XCSR, begin, begin + X.cols()); };
+  return [&X](SparseMatrixuf& out, const MatrixXuf& A)
+    { Bonsai::sampledProduct(out, A, SparseMatrixuf(X.transpose())); };
+}
+
+template<class DataMatType>
+void Bonsai::gradLWOnSupport(
+  SparseMatrixuf& gradOut,
+  const SparseMatrixuf& W, const FP_TYPE& lW, const LabelMatType& Y,
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  MatrixXuf margin;
+  MatrixXufINT trueBestClassIndex;
+  prepareGradient(margin, trueBestClassIndex, Y, ZX, trainer);
+
+  gradLossParamOnSupport(gradOut, &gradWCoeff, W.rows(), sampledWithZX(ZX), W, lW, ZX, trainer, margin, trueBestClassIndex);
+}
+
+template<class DataMatType>
+void Bonsai::gradLVOnSupport(
+  SparseMatrixuf& gradOut,
+  const SparseMatrixuf& V, const FP_TYPE& lV, const LabelMatType& Y,
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  MatrixXuf margin;
+  MatrixXufINT trueBestClassIndex;
+  prepareGradient(margin, trueBestClassIndex, Y, ZX, trainer);
+
+  gradLossParamOnSupport(gradOut, &gradVCoeff, V.rows(), sampledWithZX(ZX), V, lV, ZX, trainer, margin, trueBestClassIndex);
+}
+
+template<class DataMatType>
+void Bonsai::gradLThetaOnSupport(
+  SparseMatrixuf& gradOut,
+  const SparseMatrixuf& Theta, const FP_TYPE& lTheta, const LabelMatType& Y,
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  MatrixXuf margin;
+  MatrixXufINT trueBestClassIndex;
+  prepareGradient(margin, trueBestClassIndex, Y, ZX, trainer);
+
+  gradLossParamOnSupport(gradOut, &gradThetaCoeff, Theta.rows(), sampledWithZX(ZX), Theta, lTheta, ZX, trainer, margin, trueBestClassIndex);
+}
+
+template<class DataMatType>
+void Bonsai::gradLZOnSupport(
+  SparseMatrixuf& gradOut,
+  const SparseMatrixuf& Z, const FP_TYPE& lZ, const LabelMatType& Y,
+  const DataMatType& X, const MatrixXuf& ZX, EdgeML::Bonsai::BonsaiTrainer& trainer)
+{
+  MatrixXuf margin;
+  MatrixXufINT trueBestClassIndex;
+  prepareGradient(margin, trueBestClassIndex, Y, ZX, trainer);
+
+  gradLossParamOnSupport(gradOut, &gradZCoeff, Z.rows(), sampledWithXt(X, trainer), Z, lZ, ZX, trainer, margin, trueBestClassIndex);
+}
+
+void Bonsai::sampledProduct(SparseMatrixuf& out, const MatrixXuf& A, const MatrixXuf& B)
+{
+  assert(out.rows() == A.rows() && out.cols() == B.rows() && A.cols() == B.cols());
+  pfor(Eigen::Index j = 0; j < out.outerSize(); ++j)
+	for (SparseMatrixuf::InnerIterator it(out, j); it; ++it) {
+	  FP_TYPE value = (FP_TYPE)0.0;
+	  for (Eigen::Index k = 0; k < A.cols(); ++k)
+		value += A(it.row(), k) * B(it.col(), k);
+	  it.valueRef() = value;
+	}
+}
+
+void Bonsai::sampledProduct(SparseMatrixuf& out, const MatrixXuf& A, const SparseMatrixuf& Bt)
+{
+  assert(out.rows() == A.rows() && out.cols() == Bt.cols() && A.cols() == Bt.rows());
+#ifdef ROWMAJOR
+  // Inner iteration over the columns of Bt needs column-major storage
+  const SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t> BtCols = Bt;
+#else
+  const SparseMatrixuf& BtCols = Bt;
+#endif
+  pfor(Eigen::Index j = 0; j < out.outerSize(); ++j)
+	for (SparseMatrixuf::InnerIterator it(out, j); it; ++it) {
+	  FP_TYPE value = (FP_TYPE)0.0;
+	  for (SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t>::InnerIterator bt(BtCols, it.col()); bt; ++bt)
+		value += A(it.row(), bt.row()) * bt.value();
+	  it.valueRef() = value;
+	}
+}
+
+void Bonsai::sampledProduct(SparseMatrixuf& out, const MatrixXuf& A, const SparseMatrixufCSR& B,
+  const Eigen::Index begin, const Eigen::Index end)
+{
+  assert(out.rows() == A.rows() && out.cols() == B.rows() && A.cols() == end - begin);
+  assert(0 <= begin && begin <= end && end <= B.cols());
+  const sparseIndex_t* rowStart = B.outerIndexPtr();
+  const sparseIndex_t* colIdx = B.innerIndexPtr();
+  const FP_TYPE* vals = B.valuePtr();
+  pfor(Eigen::Index j = 0; j < out.outerSize(); ++j)
+	for (SparseMatrixuf::InnerIterator it(out, j); it; ++it) {
+	  // Column indices are sorted within each row of B
+	  const sparseIndex_t* first = std::lower_bound(colIdx + rowStart[it.col()], colIdx + rowStart[it.col() + 1], (sparseIndex_t)begin);
+	  FP_TYPE value = (FP_TYPE)0.0;
+	  for (const sparseIndex_t* k = first; k < colIdx + rowStart[it.col() + 1] && *k < end; ++k)
+		value += A(it.row(), *k - begin) * vals[k - colIdx];
+	  it.valueRef() = value;
+	}
+}
+
+// Loss of a dense Armijo candidate for a parameter of the given type
+static FP_TYPE lossAt(const std::function<FP_TYPE(const MatrixXuf&)>& Loss, const MatrixXuf& candidate)
+{
+  return Loss(candidate);
+}
+
+static FP_TYPE lossAt(const std::function<FP_TYPE(const SparseMatrixuf&)>& Loss, const MatrixXuf& candidate)
+{
+  return Loss(SparseMatrixuf(candidate.sparseView()));
+}
+
 template<class ParamType>
-MatrixXuf Bonsai::Armijo(std::function<FP_TYPE(const MatrixXuf&)> Loss,
-  ParamType &param, MatrixXuf &grad, FP_TYPE targetSparsity, int iter)
+MatrixXuf Bonsai::Armijo(std::function<FP_TYPE(const ParamType&)> Loss,
+  ParamType &param, MatrixXuf &grad, FP_TYPE targetSparsity, int iter,
+  std::mt19937_64& generator)
 {
   FP_TYPE baseOffset = (FP_TYPE)0.01 * grad.squaredNorm();
   FP_TYPE s = (FP_TYPE)1.0;
   FP_TYPE beta = (FP_TYPE)0.5;
 
-  FP_TYPE initLoss = Loss(MatrixXuf(param));
+  FP_TYPE initLoss = Loss(param);
 
   MatrixXuf paramPlusSGrad(param.rows(), param.cols());
   FP_TYPE curLoss;
@@ -377,16 +645,241 @@ MatrixXuf Bonsai::Armijo(std::function<FP_TYPE(const MatrixXuf&)> Loss,
   int runCount = 0;
   do {
 	paramPlusSGrad = MatrixXuf(param) - s*grad;
-	hardThrsd(paramPlusSGrad, targetSparsity);
-	curLoss = Loss(paramPlusSGrad);
+	hardThrsd(paramPlusSGrad, targetSparsity, generator);
+	curLoss = lossAt(Loss, paramPlusSGrad);
 	s *= beta;
   } while (curLoss > initLoss - (s / beta)*baseOffset && runCount++ < 21);
 
   return paramPlusSGrad;
 }
 
+void Bonsai::ArmijoOnSupport(std::function<FP_TYPE(const SparseMatrixuf&)> Loss,
+  SparseMatrixuf &param, const SparseMatrixuf &grad)
+{
+  assert(param.isCompressed() && grad.isCompressed());
+  assert(param.nonZeros() == grad.nonZeros());
+
+  FP_TYPE baseOffset = (FP_TYPE)0.01 * grad.squaredNorm();
+  FP_TYPE s = (FP_TYPE)1.0;
+  FP_TYPE beta = (FP_TYPE)0.5;
+
+  FP_TYPE initLoss = Loss(param);
+
+  // Same support as param, only the values array changes
+  SparseMatrixuf paramPlusSGrad = param;
+  const FP_TYPE* paramValues = param.valuePtr();
+  const FP_TYPE* gradValues = grad.valuePtr();
+  FP_TYPE* candidateValues = paramPlusSGrad.valuePtr();
+  FP_TYPE curLoss;
+
+  int runCount = 0;
+  do {
+	for (Eigen::Index k = 0; k < param.nonZeros(); ++k)
+	  candidateValues[k] = paramValues[k] - s*gradValues[k];
+	curLoss = Loss(paramPlusSGrad);
+	s *= beta;
+  } while (curLoss > initLoss - (s / beta)*baseOffset && runCount++ < 21);
+
+  param.swap(paramPlusSGrad);
+}
+
+
+// ZX = Z * X / projectionDimension
+static void projectData(MatrixXuf& ZX, const MatrixXuf& Z, const SparseMatrixuf& X, const FP_TYPE projectionDimension)
+{
+  mm(ZX, Z, CblasNoTrans, X, CblasNoTrans, (FP_TYPE)1.0 / projectionDimension, (FP_TYPE)0.0L);
+}
+
+static void projectData(MatrixXuf& ZX, const SparseMatrixuf& Z, const SparseMatrixuf& X, const FP_TYPE projectionDimension)
+{
+  ZX = MatrixXuf(SparseMatrixuf(Z * X)) * ((FP_TYPE)1.0 / projectionDimension);
+}
+
+static void projectData(MatrixXuf& ZX, const MatrixXuf& Z, const MatrixXuf& X, const FP_TYPE projectionDimension)
+{
+  mm(ZX, Z, CblasNoTrans, X, CblasNoTrans, (FP_TYPE)1.0 / projectionDimension, (FP_TYPE)0.0L);
+}
+
+static void projectData(MatrixXuf& ZX, const SparseMatrixuf& Z, const MatrixXuf& X, const FP_TYPE projectionDimension)
+{
+  mm(ZX, Z, CblasNoTrans, X, CblasNoTrans, (FP_TYPE)1.0 / projectionDimension, (FP_TYPE)0.0L);
+}
+
+//
+// Projects the columns XSlice = Xtrain(:, begin:begin + XSlice.cols()),
+// reading the compressed copy of Xtrain instead of XSlice when Data holds one
+//
+template<class DataMatType>
+static void projectXtrain(MatrixXuf& ZX, const MatrixXuf& Z, const Data& data,
+  const DataMatType& XSlice, const Eigen::Index begin, const FP_TYPE projectionDimension)
+{
+  const CompressedSparseMatrix* XCompressed = data.getXtrainCompressed();
+  if (XCompressed != NULL)
+    XCompressed->leftMultiply(ZX, Z, (FP_TYPE)1.0 / projectionDimension, (FP_TYPE)0.0L, begin, begin + XSlice.cols());
+  else
+    projectData(ZX, Z, XSlice, projectionDimension);
+}
+
+template<class DataMatType>
+static void projectXtrain(MatrixXuf& ZX, const SparseMatrixuf& Z, const Data& data,
+  const DataMatType& XSlice, const Eigen::Index begin, const FP_TYPE projectionDimension)
+{
+  projectData(ZX, Z, XSlice, projectionDimension);
+}
+
+Bonsai::LossEstimates::LossEstimates(const size_t numPoints_, const double initialLoss)
+  : numPoints(numPoints_), numLeaves(1)
+{
+  while (numLeaves < numPoints) numLeaves *= 2;
+  tree.assign(2 * numLeaves, 0.0);
+  std::fill(tree.begin() + numLeaves, tree.begin() + numLeaves + numPoints, initialLoss);
+  for (size_t k = numLeaves - 1; k >= 1; --k)
+    tree[k] = tree[2 * k] + tree[2 * k + 1];
+}
+
+void Bonsai::LossEstimates::update(size_t k)
+{
+  for (k /= 2; k >= 1; k /= 2)
+    tree[k] = tree[2 * k] + tree[2 * k + 1];
+}
+
+void Bonsai::LossEstimates::set(const size_t j, const double loss)
+{
+  tree[numLeaves + j] = loss;
+  update(numLeaves + j);
+}
+
+size_t Bonsai::LossEstimates::find(double target) const
+{
+  size_t k = 1;
+  while (k < numLeaves) {
+    // Never descend into a subtree of zero estimates, which rounding could otherwise reach
+    if (tree[2 * k + 1] <= 0.0 || (target < tree[2 * k] && tree[2 * k] > 0.0))
+      k = 2 * k;
+    else {
+      target -= tree[2 * k];
+      k = 2 * k + 1;
+    }
+  }
+  return k - numLeaves;
+}
+
+void Bonsai::LossEstimates::appendTo(std::vector<char>& snapshot) const
+{
+  appendToSnapshot(snapshot, (const char*)(tree.data() + numLeaves), numPoints * sizeof(double));
+}
+
+void Bonsai::LossEstimates::readFrom(const std::vector<char>& snapshot, size_t& offset)
+{
+  readFromSnapshot(snapshot, offset, (char*)(tree.data() + numLeaves), numPoints * sizeof(double));
+  for (size_t k = numLeaves - 1; k >= 1; --k)
+    tree[k] = tree[2 * k] + tree[2 * k + 1];
+}
+
+template<class DataMatType>
+void Bonsai::sampleMinibatch(
+  std::vector<Eigen::Index>& indices,
+  DataMatType& X,
+  LabelMatType& Y,
+  EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const LossEstimates& estimates,
+  std::mt19937_64& generator)
+{
+  const Eigen::Index n = trainer.data.Xtrain.cols();
+  const double total = estimates.total();
+  // All estimates are 0 once every point is classified with margin, then draw uniformly
+  const double uniformShare = total > 0.0 ? (double)trainer.importanceUniformShare : 1.0;
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::uniform_int_distribution<Eigen::Index> uniformPoint(0, n - 1);
+
+  trainer.treeCache.pointWeight.resize(1, (Eigen::Index)indices.size());
+  std::vector<Trip> selection;
+  selection.reserve(indices.size());
+  for (size_t b = 0; b < indices.size(); ++b) {
+    const Eigen::Index j = unit(generator) < uniformShare
+      ? uniformPoint(generator)
+      : (Eigen::Index)estimates.find(unit(generator) * total);
+    const double probability = uniformShare / (double)n
+      + (total > 0.0 ? (1.0 - uniformShare) * estimates[j] / total : 0.0);
+
+    indices[b] = j;
+    trainer.treeCache.pointWeight(0, b) = (FP_TYPE)(1.0 / ((double)n * probability));
+    selection.push_back(Trip((sparseIndex_t)j, (sparseIndex_t)b, (FP_TYPE)1.0));
+  }
+
+  // Gathers the columns, for any storage of Xtrain
+  SparseMatrixuf select(n, (Eigen::Index)indices.size());
+  select.setFromTriplets(selection.begin(), selection.end());
+  X = trainer.data.features<DataMatType>(trainSplit) * select;
+  Y = trainer.data.Ytrain * select;
+}
+
+template void Bonsai::sampleMinibatch<MatrixXuf>(std::vector<Eigen::Index>&, MatrixXuf&, LabelMatType&,
+  EdgeML::Bonsai::BonsaiTrainer&, const LossEstimates&, std::mt19937_64&);
+template void Bonsai::sampleMinibatch<SparseMatrixuf>(std::vector<Eigen::Index>&, SparseMatrixuf&, LabelMatType&,
+  EdgeML::Bonsai::BonsaiTrainer&, const LossEstimates&, std::mt19937_64&);
 
-void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
+//
+// Solver state of jointSgdBonsai between two batches; the phase flags
+// and sparsity targets are functions of the batch index
+//
+struct JointSgdState
+{
+  int nextBatch;
+  Eigen::Index end;
+  int iterationsWithinPhase;
+  int numBatches;
+  int batchSize;
+  bool isFineTune;
+  bool isImportanceSampled;
+};
+
+static void snapshotJointSgd(
+  std::vector<char>& snapshot,
+  const JointSgdState& state,
+  const EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const Bonsai::LossEstimates* estimates)
+{
+  snapshot.clear();
+  appendToSnapshot(snapshot, state);
+  appendToSnapshot(snapshot, trainer.model.hyperParams.sigma_i);
+  appendMatrixToSnapshot(snapshot, trainer.model.params.Z);
+  appendMatrixToSnapshot(snapshot, trainer.model.params.W);
+  appendMatrixToSnapshot(snapshot, trainer.model.params.V);
+  appendMatrixToSnapshot(snapshot, trainer.model.params.Theta);
+  if (estimates != NULL)
+    estimates->appendTo(snapshot);
+}
+
+static void restoreJointSgd(
+  const std::vector<char>& snapshot,
+  JointSgdState& state,
+  EdgeML::Bonsai::BonsaiTrainer& trainer,
+  Bonsai::LossEstimates* estimates)
+{
+  size_t offset = 0;
+  readFromSnapshot(snapshot, offset, state);
+  readFromSnapshot(snapshot, offset, trainer.model.hyperParams.sigma_i);
+  readMatrixFromSnapshot(snapshot, offset, trainer.model.params.Z,
+    trainer.model.params.Z.rows(), trainer.model.params.Z.cols());
+  readMatrixFromSnapshot(snapshot, offset, trainer.model.params.W,
+    trainer.model.params.W.rows(), trainer.model.params.W.cols());
+  readMatrixFromSnapshot(snapshot, offset, trainer.model.params.V,
+    trainer.model.params.V.rows(), trainer.model.params.V.cols());
+  readMatrixFromSnapshot(snapshot, offset, trainer.model.params.Theta,
+    trainer.model.params.Theta.rows(), trainer.model.params.Theta.cols());
+  if (estimates != NULL && state.isImportanceSampled)
+    estimates->readFrom(snapshot, offset);
+  if (offset != snapshot.size())
+    checkpointError("Checkpoint holds more than the state of jointSgdBonsai");
+}
+
+//
+// jointSgdBonsai on training data stored as DataMatType
+//
+template<class DataMatType>
+static void jointSgdBonsaiOn(EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const bool isFineTune)
 {
   Logger logger("jointSgdBonsai");
   Timer timer("jointSgdBonsai");
@@ -397,6 +890,7 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
   training_phase trainFlag = DENSE_TRAIN;
   int trimLevel = (trainer.model.hyperParams.numClasses <= 2) ? 5 : 15;
 
+  const DataMatType& Xtrain = trainer.data.features<DataMatType>(trainSplit);
   dataCount_t n = trainer.data.Xtrain.cols();
   int         epochs = trainer.model.hyperParams.epochs;
   //int print_interval = 100;
@@ -426,11 +920,41 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
   MatrixXuf gradV(trainer.model.params.V.rows(), trainer.model.params.V.cols());
   MatrixXuf gradW(trainer.model.params.W.rows(), trainer.model.params.W.cols());
   MatrixXuf gradTheta(trainer.model.params.Theta.rows(), trainer.model.params.Theta.cols());
+  SparseMatrixuf gradZOnSupport, gradWOnSupport, gradVOnSupport, gradThetaOnSupport;
+
+  // Every point starts at the hinge loss of a zero margin
+  LossEstimates* estimates = trainer.isImportanceSampled ? new LossEstimates(n, 1.0) : NULL;
+  std::vector<Eigen::Index> batchIndices(trainer.isImportanceSampled ? batchSize : 0);
+
+  int startBatch = 0;
+  bool isStopped = false;
+  std::vector<char> snapshot;
+  CheckpointWriter* checkpointWriter = NULL;
+  if (!trainer.checkpointPath.empty()) {
+	if (loadCheckpoint(trainer.checkpointPath, snapshot)) {
+	  JointSgdState state;
+	  restoreJointSgd(snapshot, state, trainer, estimates);
+	  if (state.numBatches != numBatches || state.batchSize != batchSize || state.isFineTune != isFineTune
+		|| state.isImportanceSampled != trainer.isImportanceSampled)
+		checkpointError("Checkpoint belongs to a different run of jointSgdBonsai");
+	  startBatch = state.nextBatch;
+	  end = state.end;
+	  iterations_within_phase = state.iterationsWithinPhase;
+	  LOG_INFO("Resuming from checkpoint " + trainer.checkpointPath + " at batch " + std::to_string(startBatch));
+	}
+	checkpointWriter = new CheckpointWriter(trainer.checkpointPath);
+  }
+
+  // Hard thresholding draws from a generator of this run rather than the shared rand(),
+  // so that concurrent trainers do not interfere. It is reseeded for every batch, so that
+  // the draws do not depend on whether the run is checkpointed or resumed.
+  std::mt19937_64 generator;
 
   // TODO: update the hyperParams.iter to *= sqrt(ntrain).
   // TODO: Ask for more sensible default iteration parameters
-  for (int i = 0; i < numBatches; ++i)
+  for (int i = startBatch; i < numBatches; ++i)
   {
+	generator.seed((unsigned long long)(trainer.model.hyperParams.seed + i));
 	if (end == trainer.data.Xtrain.cols())  end = 0;
 	begin = (i == 0) ? 0 : end;
 	end = std::min(begin + batchSize, trainer.data.Xtrain.cols());
@@ -439,17 +963,45 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
 	  LOG_INFO("=========================== \n On iter "
 		+ std::to_string(i / batchesPerIter) + "\n"
 		+ "=========================== ");
-	LOG_INFO("points: (" + std::to_string(begin) + "," + std::to_string(end) + ")");
 
 	// Move to outside the loop
 	MatrixXuf ZX_i = MatrixXuf::Zero(trainer.model.params.Z.rows(), end - begin);
-	SparseMatrixuf X_sliced = trainer.data.Xtrain.middleCols(begin, end - begin);
-	LabelMatType Y_sliced = trainer.data.Ytrain.middleCols(begin, end - begin);
+	DataMatType X_sliced;
+	LabelMatType Y_sliced;
+
+	// An importance-sampled minibatch has as many points as the slice it stands in for,
+	// so that iterations still end where the slices reach the end of Xtrain.
+	if (estimates != NULL)
+	{
+	  LOG_INFO("points: " + std::to_string(end - begin) + " importance-sampled");
+	  batchIndices.resize(end - begin);
+	  sampleMinibatch(batchIndices, X_sliced, Y_sliced, trainer, *estimates, generator);
+	}
+	else
+	{
+	  LOG_INFO("points: (" + std::to_string(begin) + "," + std::to_string(end) + ")");
+	  X_sliced = Xtrain.middleCols(begin, end - begin);
+	  Y_sliced = trainer.data.Ytrain.middleCols(begin, end - begin);
+	}
+
+	// The compressed copy and the CSR copy of Xtrain are only read for slices
+	auto projectBatch = [&trainer, &X_sliced, &ZX_i, &begin, &estimates](const ZMatType &Z)
+	{
+	  if (estimates != NULL)
+		projectData(ZX_i, Z, X_sliced, trainer.model.hyperParams.projectionDimension);
+	  else
+		projectXtrain(ZX_i, Z, trainer.data, X_sliced, begin, trainer.model.hyperParams.projectionDimension);
+	};
 
 	//  1st 1/3rd iterations are for dense training, 
 	//  2nd 1/3rd are for the Core IHT algorithm
 	//  3rd 1/3rd is sparse retraining with fixed support 
-	if (i >= 1 * (numBatches) / 3
+	//  Fine tuning a warm-started model only does the last phase
+	if (isFineTune)
+	{
+	  trainFlag = SPARSE_RETRAIN;
+	}
+	else if (i >= 1 * (numBatches) / 3
 	  && i < 2 * (numBatches) / 3)
 	{
 	  // For Core IHT, we threshod every trimLevel'th iteration,
@@ -466,44 +1018,91 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
 
 	timer.nextTime("starting gradZ");
 
-	mm(ZX_i, MatrixXuf(trainer.model.params.Z), CblasNoTrans,
-	  X_sliced, CblasNoTrans, (FP_TYPE)1.0 / trainer.model.hyperParams.projectionDimension, (FP_TYPE)0.0L);
+	projectBatch(trainer.model.params.Z);
+	trainer.treeCache.batchBegin = estimates != NULL ? -1 : begin;
 
-	if (i == 0 || i == 2 * numBatches / 3 || i == 1 * numBatches / 3)
+	// A warm-started model keeps the sigma_i it was exported with
+	if (isFineTune);
+	else if (i == 0 || i == 2 * numBatches / 3 || i == 1 * numBatches / 3)
 	{
 	  trainer.model.initializeSigmaI();
 	  iterations_within_phase = 0;
 	}
 	else if (iterations_within_phase % 100 == 0)
 	{
-	  int exp_fac = iterations_within_phase / (numBatches / 30);
+	  int exp_fac = iterations_within_phase / std::max(1, numBatches / 30);
 	  trainer.model.updateSigmaI(ZX_i, exp_fac);
 	}
 
+	// In the fixed-support phases sparse parameters are trained on their support only:
+	// gradients are computed at the nonzeros and updates go to the values arrays
+	const bool isFixedSupport = (trainFlag == SPARSE_RETRAIN || trainFlag == CORE_IHT_FC);
+
+#ifdef SPARSE_Z_BONSAI
+	if (isFixedSupport)
+	  gradLZOnSupport(gradZOnSupport, trainer.model.params.Z,
+		trainer.model.hyperParams.regList.lZ, Y_sliced,
+		X_sliced, ZX_i, trainer);
+	else
+#endif
 	gradLZ(gradZ, trainer.model.params.Z,
 	  trainer.model.hyperParams.regList.lZ, Y_sliced,
 	  X_sliced, ZX_i, trainer);
 
+#ifdef SPARSE_W_BONSAI
+	if (isFixedSupport)
+	  gradLWOnSupport(gradWOnSupport, trainer.model.params.W,
+		trainer.model.hyperParams.regList.lW, Y_sliced,
+		X_sliced, ZX_i, trainer);
+	else
+#endif
 	gradLW(gradW, trainer.model.params.W,
 	  trainer.model.hyperParams.regList.lW, Y_sliced,
 	  X_sliced, ZX_i, trainer);
 
+#ifdef SPARSE_V_BONSAI
+	if (isFixedSupport)
+	  gradLVOnSupport(gradVOnSupport, trainer.model.params.V,
+		trainer.model.hyperParams.regList.lV, Y_sliced,
+		X_sliced, ZX_i, trainer);
+	else
+#endif
 	gradLV(gradV, trainer.model.params.V,
 	  trainer.model.hyperParams.regList.lV, Y_sliced,
 	  X_sliced, ZX_i, trainer);
 
+#ifdef SPARSE_THETA_BONSAI
+	if (isFixedSupport)
+	  gradLThetaOnSupport(gradThetaOnSupport, trainer.model.params.Theta,
+		trainer.model.hyperParams.regList.lTheta, Y_sliced,
+		X_sliced, ZX_i, trainer);
+	else
+#endif
 	gradLTheta(gradTheta, trainer.model.params.Theta,
 	  trainer.model.hyperParams.regList.lTheta, Y_sliced,
 	  X_sliced, ZX_i, trainer);
 
-	if (trainFlag == SPARSE_RETRAIN || trainFlag == CORE_IHT_FC)
+	// The gradients recorded the loss of every point at the current parameters
+	if (estimates != NULL)
+	  for (size_t b = 0; b < batchIndices.size(); ++b)
+		estimates->set(batchIndices[b], (double)trainer.treeCache.pointLoss(0, b));
+
+	if (isFixedSupport)
 	{
 	  // SPARSE_RETRAIN and CORE_IHT_FC
 	  // freeze the support and do gradient updates
+#ifndef SPARSE_Z_BONSAI
 	  copySupport(gradZ, trainer.model.params.Z);
+#endif
+#ifndef SPARSE_W_BONSAI
 	  copySupport(gradW, trainer.model.params.W);
+#endif
+#ifndef SPARSE_V_BONSAI
 	  copySupport(gradV, trainer.model.params.V);
+#endif
+#ifndef SPARSE_THETA_BONSAI
 	  copySupport(gradTheta, trainer.model.params.Theta);
+#endif
 	}
 	if (trainFlag == SPARSE_RETRAIN || trainFlag == CORE_IHT_FC || trainFlag == DENSE_TRAIN)
 	{
@@ -521,77 +1120,74 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
 	  sparsity_Theta = trainer.model.hyperParams.lambdaTheta;
 	}
 
-	MatrixXuf Wupdated = Armijo<WMatType>(
-	  [&trainer, &X_sliced, &Y_sliced, &ZX_i](const MatrixXuf &W)->FP_TYPE
+	auto lossW = [&trainer, &Y_sliced, &ZX_i](const WMatType &W)->FP_TYPE
 	{
-	  FP_TYPE obj_val = trainer.computeObjective(MatrixXuf(trainer.model.params.Z), W,
-		MatrixXuf(trainer.model.params.V), MatrixXuf(trainer.model.params.Theta),
+	  return trainer.computeObjective(trainer.model.params.Z, W,
+		trainer.model.params.V, trainer.model.params.Theta,
 		ZX_i, Y_sliced);
-	  return obj_val;
-	}
-	, trainer.model.params.W, gradW, sparsity_W, i);
-
+	};
 #ifdef SPARSE_W_BONSAI
-	trainer.model.params.W = Wupdated.sparseView();
+	if (isFixedSupport)
+	  ArmijoOnSupport(lossW, trainer.model.params.W, gradWOnSupport);
+	else
+	  trainer.model.params.W = Armijo<WMatType>(lossW, trainer.model.params.W, gradW, sparsity_W, i, generator).sparseView();
 #else
-	trainer.model.params.W = Wupdated;
+	trainer.model.params.W = Armijo<WMatType>(lossW, trainer.model.params.W, gradW, sparsity_W, i, generator);
 #endif
 
 
-	MatrixXuf Vupdated = Armijo<VMatType>(
-	  [&trainer, &X_sliced, &Y_sliced, &ZX_i](const MatrixXuf &V)->FP_TYPE
+	auto lossV = [&trainer, &Y_sliced, &ZX_i](const VMatType &V)->FP_TYPE
 	{
-	  FP_TYPE obj_val = trainer.computeObjective(MatrixXuf(trainer.model.params.Z), MatrixXuf(trainer.model.params.W),
-		V, MatrixXuf(trainer.model.params.Theta),
+	  return trainer.computeObjective(trainer.model.params.Z, trainer.model.params.W,
+		V, trainer.model.params.Theta,
 		ZX_i, Y_sliced);
-	  return obj_val;
-	}
-	, trainer.model.params.V, gradV, sparsity_V, i);
-
+	};
 #ifdef SPARSE_V_BONSAI
-	trainer.model.params.V = Vupdated.sparseView();
+	if (isFixedSupport)
+	  ArmijoOnSupport(lossV, trainer.model.params.V, gradVOnSupport);
+	else
+	  trainer.model.params.V = Armijo<VMatType>(lossV, trainer.model.params.V, gradV, sparsity_V, i, generator).sparseView();
 #else
-	trainer.model.params.V = Vupdated;
+	trainer.model.params.V = Armijo<VMatType>(lossV, trainer.model.params.V, gradV, sparsity_V, i, generator);
 #endif
 
 
-	MatrixXuf Thetaupdated = Armijo<ThetaMatType>(
-	  [&trainer, &X_sliced, &Y_sliced, &ZX_i](const MatrixXuf &Theta)->FP_TYPE
+	auto lossTheta = [&trainer, &Y_sliced, &ZX_i](const ThetaMatType &Theta)->FP_TYPE
 	{
-	  FP_TYPE obj_val = trainer.computeObjective(MatrixXuf(trainer.model.params.Z), MatrixXuf(trainer.model.params.W),
-		MatrixXuf(trainer.model.params.V), Theta,
+	  return trainer.computeObjective(trainer.model.params.Z, trainer.model.params.W,
+		trainer.model.params.V, Theta,
 		ZX_i, Y_sliced);
-	  return obj_val;
-	}
-	, trainer.model.params.Theta, gradTheta, sparsity_Theta, i);
-
+	};
 #ifdef SPARSE_THETA_BONSAI
-	trainer.model.params.Theta = Thetaupdated.sparseView();
+	if (isFixedSupport)
+	  ArmijoOnSupport(lossTheta, trainer.model.params.Theta, gradThetaOnSupport);
+	else
+	  trainer.model.params.Theta = Armijo<ThetaMatType>(lossTheta, trainer.model.params.Theta, gradTheta, sparsity_Theta, i, generator).sparseView();
 #else
-	trainer.model.params.Theta = Thetaupdated;
+	trainer.model.params.Theta = Armijo<ThetaMatType>(lossTheta, trainer.model.params.Theta, gradTheta, sparsity_Theta, i, generator);
 #endif
 
-	MatrixXuf Zupdated = Armijo<ZMatType>(
-	  [&trainer, &X_sliced, &Y_sliced, &ZX_i](const MatrixXuf &Z)->FP_TYPE
+	auto lossZ = [&trainer, &Y_sliced, &ZX_i, &projectBatch](const ZMatType &Z)->FP_TYPE
 	{
-	  mm(ZX_i, Z, CblasNoTrans, X_sliced, CblasNoTrans, (FP_TYPE)1.0L / trainer.model.hyperParams.projectionDimension, (FP_TYPE)0.0L);
-	  FP_TYPE obj_val = trainer.computeObjective(Z, MatrixXuf(trainer.model.params.W),
-		MatrixXuf(trainer.model.params.V), MatrixXuf(trainer.model.params.Theta),
+	  projectBatch(Z);
+	  return trainer.computeObjective(Z, trainer.model.params.W,
+		trainer.model.params.V, trainer.model.params.Theta,
 		ZX_i, Y_sliced);
-	  return obj_val;
-	}
-	, trainer.model.params.Z, gradZ, sparsity_Z, i);
-
+	};
 #ifdef SPARSE_Z_BONSAI
-	trainer.model.params.Z = Zupdated.sparseView();
+	if (isFixedSupport)
+	  ArmijoOnSupport(lossZ, trainer.model.params.Z, gradZOnSupport);
+	else
+	  trainer.model.params.Z = Armijo<ZMatType>(lossZ, trainer.model.params.Z, gradZ, sparsity_Z, i, generator).sparseView();
 #else
-	trainer.model.params.Z = Zupdated;
+	trainer.model.params.Z = Armijo<ZMatType>(lossZ, trainer.model.params.Z, gradZ, sparsity_Z, i, generator);
 #endif
+	trainer.treeCache.pointWeight.resize(0, 0);
 
 
 	if (end >= trainer.data.Xtrain.cols())
 	{
-	  mm(ZX, MatrixXuf(trainer.model.params.Z), CblasNoTrans, trainer.data.Xtrain, CblasNoTrans, (FP_TYPE)1.0 / trainer.model.hyperParams.projectionDimension, (FP_TYPE)0.0L);
+	  projectXtrain(ZX, trainer.model.params.Z, trainer.data, Xtrain, 0, trainer.model.hyperParams.projectionDimension);
 	  FP_TYPE objval = trainer.computeObjective(ZX, trainer.data.Ytrain);
 
 	  LOG_INFO("Finished Iter:" + std::to_string(i / batchesPerIter) + "  "
@@ -601,13 +1197,49 @@ void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer)
 		+"nnz(Z): " + std::to_string(countnnz(trainer.model.params.Z)) + "/" + std::to_string(trainer.model.params.Z.rows()*trainer.model.params.Z.cols()));
 	}
 	iterations_within_phase++;
+
+	if (checkpointWriter != NULL && (i + 1) % trainer.checkpointInterval == 0 && i + 1 < numBatches)
+	{
+	  snapshotJointSgd(snapshot,
+		JointSgdState{ i + 1, end, iterations_within_phase, numBatches, batchSize, isFineTune,
+		  trainer.isImportanceSampled },
+		trainer, estimates);
+	  checkpointWriter->submit(snapshot);
+	  if (i + 1 == trainer.checkpointStopBatch) {
+		isStopped = true;
+		LOG_INFO("Stopping after batch " + std::to_string(i + 1) + "; rerun to resume from " + trainer.checkpointPath);
+		break;
+	  }
+	}
+  }
+  trainer.treeCache.batchBegin = -1;
+  delete estimates;
+
+  if (checkpointWriter != NULL) {
+	delete checkpointWriter; // waits for the pending snapshot
+	if (!isStopped)
+	  std::remove(trainer.checkpointPath.c_str());
   }
 }
 
+void Bonsai::jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer,
+  const bool isFineTune)
+{
+  if (trainer.data.isDense(trainSplit))
+    jointSgdBonsaiOn<MatrixXuf>(trainer, isFineTune);
+  else
+    jointSgdBonsaiOn<SparseMatrixuf>(trainer, isFineTune);
+}
+
 void Bonsai::copySupport(SparseMatrixuf& dst, const SparseMatrixuf& src)
 {
-  assert(false);
-  // Fill this in.
+  assert(dst.rows() == src.rows());
+  assert(dst.cols() == src.cols());
+  SparseMatrixuf restricted = src;
+  for (Eigen::Index j = 0; j < restricted.outerSize(); ++j)
+	for (SparseMatrixuf::InnerIterator it(restricted, j); it; ++it)
+	  it.valueRef() = dst.coeff(it.row(), it.col());
+  dst.swap(restricted);
 }
 
 void Bonsai::copySupport(MatrixXuf& dst, const MatrixXuf& src)
@@ -620,7 +1252,7 @@ void Bonsai::copySupport(MatrixXuf& dst, const MatrixXuf& src)
 		dst(i, j) = (FP_TYPE)0.0;
 }
 
-void Bonsai::hardThrsd(MatrixXuf& mat, FP_TYPE sparsity)
+void Bonsai::hardThrsd(MatrixXuf& mat, FP_TYPE sparsity, std::mt19937_64& generator)
 {
   Timer timer("hardThrsd");
   assert(sparsity >= (FP_TYPE)0.0 && sparsity <= (FP_TYPE)1.0);
@@ -644,7 +1276,7 @@ void Bonsai::hardThrsd(MatrixXuf& mat, FP_TYPE sparsity)
   else {
 	unsigned long long prime = 990377764891511ull;
 	assert(prime > mat_size);
-	unsigned long long seed = (rand() % 100000);
+	unsigned long long seed = std::uniform_int_distribution<unsigned long long>(0, 99999)(generator);
 	FP_TYPE* matData = mat.data();
 	size_t pick;
 	for (dataCount_t i = 0; i < sample_size; ++i) {
@@ -884,6 +1516,7 @@ void Bonsai::exitWithHelp()
 
   LOG_INFO("-I   : [Optional] [Default: 42 Try: [100, 30, 60]] Number of passes through the dataset.");
   LOG_INFO("-B   : [Optional] Batch Factor [Default: 1 Try: [2.5, 10, 100]] Float Factor to multiply with sqrt(ntrain) to make the batchSize = min(max(100, B*sqrt(nT)), nT).");
+  LOG_INFO("-i   : [Optional] BonsaiTrain only. Draw minibatches in proportion to per-point loss estimates, with this share of the draws uniform (Default: off Try: [0.2, 0.5]).");
   LOG_INFO("DataFolder : [Required] Path to folder containing data with filenames being 'train.txt' and 'test.txt' in the folder.");
   LOG_INFO("\ntrain.txt is train data file with label followed by features, test.txt is test data file with label followed by features");
   LOG_INFO("Try to shuffle the 'train.txt' file before feeding it in.");
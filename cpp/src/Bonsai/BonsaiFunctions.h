@@ -6,7 +6,9 @@
 
 #include "utils.h"
 #include "blas_routines.h"
+#include "small_gemv.h"
 #include "par_utils.h"
+#include "checkpoint.h"
 #include "Bonsai.h"
 
 
@@ -17,8 +19,53 @@ namespace EdgeML
   {
     ///
     /// Solver taking Trainer Object and Gives a converged Model
+    /// isFineTune runs sparse retraining on the current support for all iterations
     ///
-    void jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer);
+    void jointSgdBonsai(EdgeML::Bonsai::BonsaiTrainer& trainer,
+      const bool isFineTune = false);
+
+    ///
+    /// Loss estimates of the training points for importance-sampled minibatches, kept in
+    /// a sum tree, so that refreshing an estimate and drawing a point are O(log n)
+    ///
+    class LossEstimates
+    {
+      std::vector<double> tree; ///< node k holds the sum of nodes 2k and 2k + 1, the estimates are the leaves
+      size_t numPoints;
+      size_t numLeaves;
+
+      void update(size_t k);
+
+    public:
+      LossEstimates(const size_t numPoints_, const double initialLoss);
+
+      double total() const { return tree[1]; }
+      double operator[](const size_t j) const { return tree[numLeaves + j]; }
+
+      void set(const size_t j, const double loss);
+
+      ///
+      /// The point where the running sum of the estimates passes @target, for 0 <= target < total()
+      ///
+      size_t find(double target) const;
+
+      void appendTo(std::vector<char>& snapshot) const;
+      void readFrom(const std::vector<char>& snapshot, size_t& offset);
+    };
+
+    ///
+    /// Draws the points of a minibatch, a share of them uniformly and the rest in proportion
+    /// to their loss estimates, and sets their unbiasing weights 1/(n p) in the tree cache.
+    /// The share is trainer.importanceUniformShare, or 1 when all estimates are 0.
+    /// DataMatType is the storage of the training data (see Data::features)
+    ///
+    template<class DataMatType>
+    void sampleMinibatch(std::vector<Eigen::Index>& indices,
+      DataMatType& X,
+      LabelMatType& Y,
+      EdgeML::Bonsai::BonsaiTrainer& trainer,
+      const LossEstimates& estimates,
+      std::mt19937_64& generator);
 
     ///
     /// Function to Compute 2-way Hadamard product
@@ -57,16 +104,38 @@ namespace EdgeML
     ///
     void gradThetaCoeff(MatrixXuf& ThetaCoeffMat,
       const MatrixXuf& ZX,
-      const EdgeML::Bonsai::BonsaiTrainer& trainer,
+      EdgeML::Bonsai::BonsaiTrainer& trainer,
       const MatrixXufINT& classLst,
       const MatrixXuf& margin);
 
     ///
-    /// Function to Compute Gradient of prediction Function wrt W
+    /// Function to Compute Coefficient Obtained during GradYhatZ (projectionDimension x points),
+    /// i.e., GradYhatZ = ZCoeffMat * X^T
     ///
+    void gradZCoeff(MatrixXuf& ZCoeffMat,
+      const MatrixXuf& ZX,
+      EdgeML::Bonsai::BonsaiTrainer& trainer,
+      const MatrixXufINT& classLst,
+      const MatrixXuf& margin);
+
+    ///
+    /// Typedef for passing the coefficient functions above
+    ///
+    typedef void(*grad_coeff_fun)(MatrixXuf& CoeffMat,
+      const MatrixXuf&,
+      EdgeML::Bonsai::BonsaiTrainer&,
+      const MatrixXufINT&,
+      const MatrixXuf&);
+
+    ///
+    /// Function to Compute Gradient of prediction Function wrt W.
+    /// This and the functions below taking the data X are templates on its storage:
+    /// DataMatType is MatrixXuf for dense training data, SparseMatrixuf otherwise
+    ///
+    template<class DataMatType>
     void gradYhatW(MatrixXuf& gradOut,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const MatrixXufINT& classLst,
@@ -75,9 +144,10 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of prediction Function wrt V
     ///
+    template<class DataMatType>
     void gradYhatV(MatrixXuf& gradOut,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const MatrixXufINT& classLst,
@@ -86,9 +156,10 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of prediction Function wrt Theta
     ///
+    template<class DataMatType>
     void gradYhatTheta(MatrixXuf& gradOut,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const MatrixXufINT& classLst,
@@ -97,20 +168,22 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of prediction Function wrt Z
     ///
+    template<class DataMatType>
     void gradYhatZ(MatrixXuf& gradOut,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const MatrixXufINT& classLst,
       const MatrixXuf& margin);
 
     ///
-    /// Typedef for elegant passing of functions with same signature
+    /// Alias for elegant passing of functions with same signature
     ///
-    typedef void(*grad_y_param_fun)(MatrixXuf& gradOut,
+    template<class DataMatType>
+    using grad_y_param_fun = void(*)(MatrixXuf& gradOut,
       const LabelMatType&,
-      const SparseMatrixuf&,
+      const DataMatType&,
       const MatrixXuf&,
       EdgeML::Bonsai::BonsaiTrainer&,
       const MatrixXufINT&,
@@ -119,13 +192,14 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt a given Dense Param(one of Z, W, V, Theta) and its gradYhatParam
     ///
+    template<class DataMatType>
     void gradLossParam(
       MatrixXuf& gradOut,
-      const grad_y_param_fun grad_y_param,
+      const grad_y_param_fun<DataMatType> grad_y_param,
       const MatrixXuf& Param,
       const FP_TYPE& regularizer,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const  MatrixXuf& margin,
@@ -134,13 +208,14 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt a given Sparse Param(one of Z, W, V, Theta) and its gradYhatParam
     ///
+    template<class DataMatType>
     void gradLossParam(
       MatrixXuf& gradOut,
-      const grad_y_param_fun gradYParam,
+      const grad_y_param_fun<DataMatType> gradYParam,
       const SparseMatrixuf& param,
       const FP_TYPE& regularizer,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer,
       const  MatrixXuf& margin,
@@ -149,61 +224,139 @@ namespace EdgeML
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt W
     ///
+    template<class DataMatType>
     void gradLW(MatrixXuf& gradOut,
       const WMatType& W,
       const FP_TYPE& lW,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer);
 
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt V
     ///
+    template<class DataMatType>
     void gradLV(MatrixXuf& gradOut,
       const VMatType& V,
       const FP_TYPE& lV,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer);
 
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt Theta
     ///
+    template<class DataMatType>
     void gradLTheta(MatrixXuf& gradOut,
       const ThetaMatType& Theta,
       const FP_TYPE& lTheta,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer);
 
     ///
     /// Function to Compute Gradient of Entire Optimisation Function wrt Z
     ///
+    template<class DataMatType>
     void gradLZ(MatrixXuf& gradOut,
       const ZMatType& Z,
       const FP_TYPE& lZ,
       const LabelMatType& Y,
-      const SparseMatrixuf& X,
+      const DataMatType& X,
+      const MatrixXuf& ZX,
+      EdgeML::Bonsai::BonsaiTrainer& trainer);
+
+
+    ///
+    /// Gradients of the Entire Optimisation Function wrt sparse W, V, Theta and Z for the
+    /// fixed-support phases. gradOut gets the sparsity pattern of the parameter and only
+    /// those entries of the gradient are computed.
+    ///
+    template<class DataMatType>
+    void gradLWOnSupport(SparseMatrixuf& gradOut,
+      const SparseMatrixuf& W,
+      const FP_TYPE& lW,
+      const LabelMatType& Y,
+      const DataMatType& X,
+      const MatrixXuf& ZX,
+      EdgeML::Bonsai::BonsaiTrainer& trainer);
+
+    template<class DataMatType>
+    void gradLVOnSupport(SparseMatrixuf& gradOut,
+      const SparseMatrixuf& V,
+      const FP_TYPE& lV,
+      const LabelMatType& Y,
+      const DataMatType& X,
+      const MatrixXuf& ZX,
+      EdgeML::Bonsai::BonsaiTrainer& trainer);
+
+    template<class DataMatType>
+    void gradLThetaOnSupport(SparseMatrixuf& gradOut,
+      const SparseMatrixuf& Theta,
+      const FP_TYPE& lTheta,
+      const LabelMatType& Y,
+      const DataMatType& X,
+      const MatrixXuf& ZX,
+      EdgeML::Bonsai::BonsaiTrainer& trainer);
+
+    template<class DataMatType>
+    void gradLZOnSupport(SparseMatrixuf& gradOut,
+      const SparseMatrixuf& Z,
+      const FP_TYPE& lZ,
+      const LabelMatType& Y,
+      const DataMatType& X,
       const MatrixXuf& ZX,
       EdgeML::Bonsai::BonsaiTrainer& trainer);
 
+    ///
+    /// Entries of A * B^T on the sparsity pattern of out (sampled product)
+    ///
+    void sampledProduct(SparseMatrixuf& out,
+      const MatrixXuf& A,
+      const MatrixXuf& B);
+
+    ///
+    /// Entries of A * Bt on the sparsity pattern of out; Bt is the transposed right factor
+    ///
+    void sampledProduct(SparseMatrixuf& out,
+      const MatrixXuf& A,
+      const SparseMatrixuf& Bt);
+
+    ///
+    /// Entries of A * B.middleCols(begin, end - begin)^T on the sparsity pattern of out,
+    /// for B in CSR storage with sorted column indices (e.g. Data::XtrainCSR)
+    ///
+    void sampledProduct(SparseMatrixuf& out,
+      const MatrixXuf& A,
+      const SparseMatrixufCSR& B,
+      const Eigen::Index begin,
+      const Eigen::Index end);
 
     ///
     /// Function to obtain Step Size using Armijo Rule
     ///
     template<class ParamType>
-    MatrixXuf Armijo(std::function<FP_TYPE(const MatrixXuf&)> Loss,
+    MatrixXuf Armijo(std::function<FP_TYPE(const ParamType&)> Loss,
       ParamType &param,
       MatrixXuf &grad,
       FP_TYPE target_sparsity,
-      int iter);
+      int iter,
+      std::mt19937_64& generator);
+
+    ///
+    /// Armijo Rule on the support of a sparse param: grad must have the sparsity pattern
+    /// of param, which is updated in place through its values array
+    ///
+    void ArmijoOnSupport(std::function<FP_TYPE(const SparseMatrixuf&)> Loss,
+      SparseMatrixuf &param,
+      const SparseMatrixuf &grad);
 
 
     ///
-    /// Function to Copy Support for Sparse Matrices, to be filled
+    /// Function to Copy Support for Sparse Matrices; dst gets the sparsity pattern of src
     ///
     void copySupport(SparseMatrixuf& dst,
       const SparseMatrixuf& src);
@@ -217,9 +370,11 @@ namespace EdgeML
     // Input - 
     // @mat: Matrix to be thresholded
     // @sparsity: ratio of non-zero entries to be retained
+    // @generator: picks the entries the threshold is estimated from, for large matrices
     // Returns sparsified version of @mat, retaining only the top sparsity-many values
     void hardThrsd(MatrixXuf& mat,
-      FP_TYPE sparsity);
+      FP_TYPE sparsity,
+      std::mt19937_64& generator);
 
 
     // ParamType is either MatrixXuf or SparseMatrixuf
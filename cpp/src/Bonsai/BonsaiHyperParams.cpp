@@ -119,7 +119,6 @@ void BonsaiModel::BonsaiHyperParams::finalizeHyperParams()
   assert(dataformatType != undefinedData);
   assert(normalizationType != undefinedNormalization);
 
-  srand(seed);
   mkdir();
   internalClasses = (numClasses <= 2) ? 1 : numClasses;
   isModelInitialized = true;
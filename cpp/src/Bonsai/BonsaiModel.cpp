@@ -87,12 +87,15 @@ void BonsaiModel::updateSigmaI(
   FP_TYPE sum_tr = 0.0;
   int numTrials = std::min(100, (int)ZX.cols());
 
-  srand((unsigned int)hyperParams.seed);
+  // Same points on every call, and no shared state with concurrent trainers
+  std::mt19937_64 generator((unsigned long long)hyperParams.seed);
+  std::uniform_int_distribution<int> pickTheta(0, std::max(1, (int)params.Theta.rows()) - 1);
+  std::uniform_int_distribution<int> pickPoint(0, (int)ZX.cols() - 1);
 
   for (int f = 0; f < numTrials; f++)
   {
-    int theta_i = rand() % std::max(1, (int)params.Theta.rows());
-    int x_i = rand() % ZX.cols();
+    int theta_i = pickTheta(generator);
+    int x_i = pickPoint(generator);
     MatrixXuf ThetaZX(1, 1);
     if(params.Theta.rows() > 0)
       mm(ThetaZX, MatrixXuf(params.Theta).row(theta_i), CblasNoTrans, ZX.col(x_i), CblasNoTrans, 1.0, 0.0L);
@@ -2,8 +2,13 @@
 // Licensed under the MIT license.
 
 #include "blas_routines.h" 
+#include "prediction_writer.h"
+#include "small_gemv.h"
 #include "Bonsai.h"
 
+#include <mutex>
+#include <sstream>
+
 using namespace EdgeML;
 using namespace	EdgeML::Bonsai;
 
@@ -16,6 +21,9 @@ void BonsaiPredictor::exitWithHelp()
   LOG_INFO("-N    : [Required] Number of data points in the test data.");
   LOG_INFO("-D    : [Required] Directory of data with test.txt present in it.");
   LOG_INFO("-M    : [Required] Directory of the Model (loadableModel and loadableMeanStd).");
+  LOG_INFO("-q    : [Optional] 1 to also evaluate an int8 quantized copy of the model and report the accuracy delta (default: 0).");
+  LOG_INFO("-c    : [Optional] Size in MB of a cache of scores, which serves repeated test points without scoring them again (default: 0, no cache).");
+  LOG_INFO("-o    : [Optional] Prediction output format. 0 for text predClassAndScore (default), 1 for binary predClassAndScore.bin.");
   exit(1);
 }
 
@@ -50,6 +58,18 @@ void BonsaiPredictor::setFromArgs(
           dataDir = argv[i];
           required++;
           break;
+        case 'q':
+          isInt8Requested = atoi(argv[i]) != 0;
+          break;
+        case 'c':
+          if (atof(argv[i]) > 0) {
+            setScoreCache(new ScoreCache((size_t)(atof(argv[i]) * 1024 * 1024)));
+            isScoreCacheOwned = true;
+          }
+          break;
+        case 'o':
+          isBinaryOutput = atoi(argv[i]) != 0;
+          break;
         default:
           LOG_INFO("Unknown option: " + std::to_string(argv[i - 1][1]));
           exitWithHelp();
@@ -63,17 +83,19 @@ void BonsaiPredictor::setFromArgs(
 BonsaiPredictor::BonsaiPredictor(
   const int argc,
   const char** argv)
+  : isInt8Requested(false),
+  isBinaryOutput(false),
+  isQuantized(false),
+  scoreCache(NULL),
+  isScoreCacheOwned(false),
+  modelTag(0)
 {
   setFromArgs(argc, argv);
   std::string modelFile = modelDir + "/loadableModel"; 
  
   model = BonsaiModel(modelFile, 1);
 
-  feedDataValBuffer = new FP_TYPE[model.hyperParams.dataDimension];
-  feedDataFeatureBuffer = new labelCount_t[model.hyperParams.dataDimension];
-  
-  mean = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
-  stdDev = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
+  allocateFeedBuffers();
 
   std::string meanStdFile = modelDir + "/loadableMeanStd"; 
   
@@ -86,6 +108,7 @@ BonsaiPredictor::BonsaiPredictor(
     LOG_INFO("WARNING: The Train and Test input formats don't match.");
 
   testData.loadDataFromFile(dataformatType, "", "", dataDir + "/test.txt");
+  testData.finalizeData();
   evaluate();
 }
 
@@ -93,13 +116,77 @@ BonsaiPredictor::BonsaiPredictor(
   const size_t numBytes,
   const char *const fromModel,
   const bool isDense)
-  : model(numBytes, fromModel, isDense)
+  : model(numBytes, fromModel, isDense),
+  isInt8Requested(false),
+  isBinaryOutput(false),
+  isQuantized(false),
+  scoreCache(NULL),
+  isScoreCacheOwned(false),
+  modelTag(0)
+{
+  allocateFeedBuffers();
+  updateNormalizedProjection();
+  updateModelTag();
+}
+
+void BonsaiPredictor::allocateFeedBuffers()
 {
   feedDataValBuffer = new FP_TYPE[model.hyperParams.dataDimension];
   feedDataFeatureBuffer = new labelCount_t[model.hyperParams.dataDimension];
 
+  // Points are scored unnormalized until importMeanStd is called
   mean = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
-  stdDev = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
+  stdDev = MatrixXuf::Ones(model.hyperParams.dataDimension, 1);
+}
+
+void BonsaiPredictor::swapModel(
+  const size_t numBytes,
+  const char *const fromModel,
+  const bool isDense)
+{
+  delete[] feedDataValBuffer;
+  delete[] feedDataFeatureBuffer;
+
+  model = BonsaiModel(numBytes, fromModel, isDense);
+  allocateFeedBuffers();
+  isQuantized = false;
+  updateNormalizedProjection();
+  updateModelTag();
+}
+
+void BonsaiPredictor::updateNormalizedProjection()
+{
+  const featureCount_t biasFeature = model.hyperParams.dataDimension - 1;
+  Matrix<FP_TYPE, Dynamic, 1> invStdDev = stdDev.col(0).cwiseInverse();
+  invStdDev(biasFeature) = (FP_TYPE)0.0;
+  ZNormalized = model.params.Z * invStdDev.asDiagonal();
+
+  MatrixXuf offsetPoint = -mean.col(0).cwiseProduct(invStdDev);
+  offsetPoint(biasFeature, 0) = (FP_TYPE)1.0;
+  ZXOffset = MatrixXuf(model.hyperParams.projectionDimension, 1);
+  mm(ZXOffset, model.params.Z, CblasNoTrans, offsetPoint, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0);
+}
+
+void BonsaiPredictor::updateModelTag()
+{
+  uint64_t tag = hashMatrix(model.params.Z, 0);
+  tag = hashMatrix(model.params.W, tag);
+  tag = hashMatrix(model.params.V, tag);
+  tag = hashMatrix(model.params.Theta, tag);
+  tag = hashMatrix(mean, tag);
+  tag = hashMatrix(stdDev, tag);
+  tag = hashBytes(&model.hyperParams.Sigma, sizeof(model.hyperParams.Sigma), tag);
+  modelTag = hashBytes(&isQuantized, sizeof(isQuantized), tag);
+}
+
+void BonsaiPredictor::setScoreCache(ScoreCache* cache)
+{
+  if (isScoreCacheOwned) {
+    scoreCache->logStats();
+    delete scoreCache;
+    isScoreCacheOwned = false;
+  }
+  scoreCache = cache;
 }
 
 void BonsaiPredictor::importMeanStd(
@@ -125,17 +212,9 @@ void BonsaiPredictor::importMeanStd(
   const size_t numBytes,
   const char *const fromBuffer)
 {
-  size_t offset = 0;
-
-  size_t meanStdSize;
-  memcpy((void *)&meanStdSize, fromBuffer + offset, sizeof(meanStdSize));
-  offset += sizeof(meanStdSize);
-  memcpy(mean.data(), fromBuffer + offset, sizeof(FP_TYPE) * mean.rows() * mean.cols());
-  offset += sizeof(FP_TYPE) * mean.rows() * mean.cols();
-  memcpy(stdDev.data(), fromBuffer + offset, sizeof(FP_TYPE) * stdDev.rows() * stdDev.cols());
-  offset += sizeof(FP_TYPE) * stdDev.rows() * stdDev.cols();
-
-  assert(numBytes == offset);
+  Bonsai::importMeanStd(numBytes, fromBuffer, mean, stdDev);
+  updateNormalizedProjection();
+  updateModelTag();
 }
 
 
@@ -143,6 +222,7 @@ BonsaiPredictor::~BonsaiPredictor()
 {
   delete[] feedDataValBuffer;
   delete[] feedDataFeatureBuffer;
+  setScoreCache(NULL);
 }
 
 FP_TYPE BonsaiPredictor::predictionScoreOfClassID(
@@ -151,13 +231,13 @@ FP_TYPE BonsaiPredictor::predictionScoreOfClassID(
   const labelCount_t& ClassID)
 {
   FP_TYPE score = (FP_TYPE)0.0;
-  // Hadamard
-  MatrixXuf WZX = MatrixXuf::Zero(1, 1);
-  MatrixXuf VZX = MatrixXuf::Zero(1, 1);
+  // Hadamard; the rows of the nodes are read in place with the small-matrix kernels
+  FP_TYPE WZX, VZX;
   for (int i = 0; i < path.size(); i++) {
-    mm(WZX, model.getW(ClassID, path[i]), CblasNoTrans, ZX, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
-    mm(VZX, model.getV(ClassID, path[i]), CblasNoTrans, ZX, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
-    score += WZX(0, 0) * tanh(model.hyperParams.Sigma * VZX(0, 0));
+    const Eigen::Index row = (Eigen::Index)model.hyperParams.totalNodes * ClassID + path[i];
+    smallGemvRows(&WZX, model.params.W, row, 1, CblasNoTrans, ZX.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    smallGemvRows(&VZX, model.params.V, row, 1, CblasNoTrans, ZX.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    score += WZX * tanh(model.hyperParams.Sigma * VZX);
   }
   return score;
 }
@@ -167,10 +247,10 @@ std::vector<int> BonsaiPredictor::treePath(const MatrixXuf& ZX)
   std::vector<int> visitedNodesList;
   visitedNodesList.push_back(0);
   int curr_node = 0;
-  MatrixXuf ThetaZX = MatrixXuf::Zero(1, 1);
+  FP_TYPE ThetaZX;
   while (curr_node < model.hyperParams.internalNodes) {
-    mm(ThetaZX, model.getTheta(curr_node), CblasNoTrans, ZX, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
-    curr_node = ThetaZX(0, 0) > (FP_TYPE)0.0 ? 2 * curr_node + 1 : 2 * curr_node + 2;
+    smallGemvRows(&ThetaZX, model.params.Theta, curr_node, 1, CblasNoTrans, ZX.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
+    curr_node = ThetaZX > (FP_TYPE)0.0 ? 2 * curr_node + 1 : 2 * curr_node + 2;
     visitedNodesList.push_back(curr_node);
   }
   return visitedNodesList;
@@ -181,11 +261,22 @@ void BonsaiPredictor::predictionScore(
   FP_TYPE *scores)
 {
   assert(X.cols() == 1);
+  if (isQuantized) {
+    quantizedPredictionScore(X.data(), scores);
+    return;
+  }
   MatrixXuf ZX = MatrixXuf(model.hyperParams.projectionDimension, 1);
 
   mm(ZX, model.params.Z, CblasNoTrans, X, CblasNoTrans,
     (FP_TYPE)1.0 / model.hyperParams.projectionDimension, (FP_TYPE)0.0);
 
+  projectionScore(ZX, scores);
+}
+
+void BonsaiPredictor::projectionScore(
+  const MatrixXuf& ZX,
+  FP_TYPE *scores)
+{
   std::vector<int> path = treePath(ZX);
   FP_TYPE ymult = model.hyperParams.internalClasses <= 2 ? (FP_TYPE)-1.0 : (FP_TYPE)1.0;
   for (labelCount_t c = 0; c < model.hyperParams.internalClasses; c++)
@@ -197,15 +288,64 @@ void BonsaiPredictor::predictionSparseScore(
   FP_TYPE *scores)
 {
   assert(X.cols() == 1);
+  if (isQuantized) {
+    const MatrixXuf denseX = X;
+    quantizedPredictionScore(denseX.data(), scores);
+    return;
+  }
   MatrixXuf ZX = MatrixXuf(model.hyperParams.projectionDimension, 1);
 
   mm(ZX, model.params.Z, CblasNoTrans, MatrixXuf(X), CblasNoTrans,
     (FP_TYPE)1.0 / model.hyperParams.projectionDimension, (FP_TYPE)0.0);
 
-  std::vector<int> path = treePath(ZX);
+  projectionScore(ZX, scores);
+}
+
+void BonsaiPredictor::quantizeModel()
+{
+  ZQ.quantize(MatrixXuf(model.params.Z));
+  WQ.quantize(MatrixXuf(model.params.W));
+  VQ.quantize(MatrixXuf(model.params.V));
+  ThetaQ.quantize(MatrixXuf(model.params.Theta));
+
+  isQuantized = true;
+  updateModelTag();
+
+  LOG_INFO("Quantized the model to int8 (" + std::string(int8KernelName()) + " kernel): "
+    + std::to_string(ZQ.sizeInBytes() + WQ.sizeInBytes() + VQ.sizeInBytes() + ThetaQ.sizeInBytes()) + " bytes");
+}
+
+void BonsaiPredictor::quantizedPredictionScore(
+  const FP_TYPE *const x,
+  FP_TYPE *scores)
+{
+  const Eigen::Index projectionDimension = model.hyperParams.projectionDimension;
+  MatrixXuf ZX(projectionDimension, 1);
+  std::vector<int8_t> Xq(int8PaddedLength(model.hyperParams.dataDimension), 0);
+  std::vector<int8_t> ZXq(int8PaddedLength(projectionDimension), 0);
+
+  const FP_TYPE xScale = quantizeVector(x, model.hyperParams.dataDimension, Xq.data());
+  ZQ.gemv(ZX.data(), Xq.data(), xScale, (FP_TYPE)1.0 / projectionDimension);
+  const FP_TYPE ZXScale = quantizeVector(ZX.data(), projectionDimension, ZXq.data());
+
+  std::vector<int> path;
+  path.push_back(0);
+  int curr_node = 0;
+  while (curr_node < model.hyperParams.internalNodes) {
+    curr_node = ThetaQ.rowDot(curr_node, ZXq.data(), ZXScale) > (FP_TYPE)0.0 ? 2 * curr_node + 1 : 2 * curr_node + 2;
+    path.push_back(curr_node);
+  }
+
   FP_TYPE ymult = model.hyperParams.internalClasses <= 2 ? (FP_TYPE)-1.0 : (FP_TYPE)1.0;
-  for (labelCount_t c = 0; c < model.hyperParams.internalClasses; c++)
-    scores[c] = ymult*predictionScoreOfClassID(ZX, path, c);
+  for (labelCount_t c = 0; c < model.hyperParams.internalClasses; c++) {
+    FP_TYPE score = (FP_TYPE)0.0;
+    for (size_t i = 0; i < path.size(); i++) {
+      const Eigen::Index row = model.hyperParams.totalNodes * c + path[i];
+      score += WQ.rowDot(row, ZXq.data(), ZXScale)
+        * tanh(model.hyperParams.Sigma * VQ.rowDot(row, ZXq.data(), ZXScale));
+    }
+    scores[c] = ymult * score;
+  }
 }
 
 void BonsaiPredictor::scoreSparseDataPoint(
@@ -214,34 +354,61 @@ void BonsaiPredictor::scoreSparseDataPoint(
   const featureCount_t *const indices,
   const featureCount_t& numIndices)
 {
+  if (scoreCache != NULL
+    && scoreCache->lookup(modelTag, values, indices, numIndices, scores, model.hyperParams.numClasses))
+    return;
+
   memset(scores, 0, sizeof(FP_TYPE)*model.hyperParams.numClasses);
 
-  MatrixXuf dataPoint = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
+  if (isQuantized) {
+    // The int8 kernels take the whole normalized point
+    MatrixXuf dataPoint = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
 
-  for (featureCount_t f = 0; f < numIndices; ++f)
-    dataPoint(indices[f], 0) = values[f];
+    for (featureCount_t f = 0; f < numIndices; ++f)
+      dataPoint(indices[f], 0) = values[f];
 
-  dataPoint -= mean;
+    dataPoint -= mean;
 
-  //vDiv(model.hyperParams.dataDimension, dataPoint.data(), stdDev.data(), dataPoint.data());
-  for (featureCount_t f = 0; f < model.hyperParams.dataDimension; f++) {
-    dataPoint(f, 0) /= stdDev(f, 0);
-  }
+    //vDiv(model.hyperParams.dataDimension, dataPoint.data(), stdDev.data(), dataPoint.data());
+    for (featureCount_t f = 0; f < model.hyperParams.dataDimension; f++) {
+      dataPoint(f, 0) /= stdDev(f, 0);
+    }
 
-  dataPoint(model.hyperParams.dataDimension - 1, 0) = (FP_TYPE)1.0;
+    dataPoint(model.hyperParams.dataDimension - 1, 0) = (FP_TYPE)1.0;
 
-  predictionScore(dataPoint, scores);
+    predictionScore(dataPoint, scores);
+  }
+  else {
+    // Z*(normalized point) from the columns of the non-zeros; the bias feature is in ZXOffset
+    const featureCount_t biasFeature = model.hyperParams.dataDimension - 1;
+    MatrixXuf ZX = ZXOffset;
+    for (featureCount_t f = 0; f < numIndices; ++f)
+      if (indices[f] != biasFeature)
+        ZX.col(0) += values[f] * ZNormalized.col(indices[f]);
+    ZX *= (FP_TYPE)1.0 / model.hyperParams.projectionDimension;
+
+    projectionScore(ZX, scores);
+  }
+
+  if (scoreCache != NULL)
+    scoreCache->insert(modelTag, values, indices, numIndices, scores, model.hyperParams.numClasses);
 }
 
 void BonsaiPredictor::scoreDenseDataPoint(
   FP_TYPE* scores,
   const FP_TYPE *const values)
 {
+  // The last feature is the bias term and is not read from @values
+  const size_t numValues = model.hyperParams.dataDimension - 1;
+  if (scoreCache != NULL
+    && scoreCache->lookup(modelTag, values, NULL, numValues, scores, model.hyperParams.numClasses))
+    return;
+
   memset(scores, 0, sizeof(FP_TYPE)*model.hyperParams.numClasses);
 
   MatrixXuf dataPoint(model.hyperParams.dataDimension, 1);
 
-  memcpy(dataPoint.data(), values, sizeof(FP_TYPE)*(model.hyperParams.dataDimension - 1));
+  memcpy(dataPoint.data(), values, sizeof(FP_TYPE)*numValues);
 
   dataPoint = dataPoint - mean;
 
@@ -254,59 +421,168 @@ void BonsaiPredictor::scoreDenseDataPoint(
   dataPoint(model.hyperParams.dataDimension - 1, 0) = (FP_TYPE)1.0;
 
   predictionScore(dataPoint, scores);
+
+  if (scoreCache != NULL)
+    scoreCache->insert(modelTag, values, NULL, numValues, scores, model.hyperParams.numClasses);
 }
 
 void BonsaiPredictor::evaluate()
 {
-  batchEvaluate(testData.Xtest, testData.Ytest, dataDir, modelDir);
+  const FP_TYPE accuracy = batchEvaluate(testData, testSplit, dataDir, modelDir);
+
+  if (isInt8Requested) {
+    quantizeModel();
+    const FP_TYPE int8Accuracy = batchEvaluate(testData, testSplit, dataDir, modelDir);
+    LOG_INFO("int8 Test Accuracy = " + std::to_string(int8Accuracy)
+      + " (delta vs " + std::to_string(accuracy) + ": " + std::to_string(int8Accuracy - accuracy) + ")."
+      + " The prediction files in " + modelDir + " now hold the int8 results.");
+  }
+}
+
+// Points of sparse test data are read column by column through their non-zeros
+typedef SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t> SparseColMajor;
+
+static void scoreTestPoint(
+  BonsaiPredictor& predictor,
+  FP_TYPE* scores,
+  const SparseColMajor& Xtest,
+  const dataCount_t i,
+  std::vector<FP_TYPE>& values,
+  std::vector<featureCount_t>& indices)
+{
+  featureCount_t numIndices = 0;
+  for (SparseColMajor::InnerIterator it(Xtest, i); it; ++it) {
+    indices[numIndices] = (featureCount_t)it.row();
+    values[numIndices] = it.value();
+    ++numIndices;
+  }
+
+  predictor.scoreSparseDataPoint(scores, values.data(), indices.data(), numIndices);
 }
 
-void BonsaiPredictor::batchEvaluate(
+static void scoreTestPoint(
+  BonsaiPredictor& predictor,
+  FP_TYPE* scores,
+  const MatrixXuf& Xtest,
+  const dataCount_t i,
+  std::vector<FP_TYPE>& values,
+  std::vector<featureCount_t>& indices)
+{
+  Map<Matrix<FP_TYPE, Dynamic, 1> >(values.data(), Xtest.rows()) = Xtest.col(i);
+  predictor.scoreDenseDataPoint(scores, values.data());
+}
+
+FP_TYPE BonsaiPredictor::batchEvaluate(
   const SparseMatrixuf& Xtest,
   const SparseMatrixuf& Ytest,
   const std::string& dataDir,
   const std::string& currResultsPath)
 {
-  std::string predLabelPath = currResultsPath + "/predClassAndScore";
-  std::ofstream predwriter(predLabelPath);
-
-  dataCount_t nTest = Xtest.cols();
-  featureCount_t dataDim = Xtest.rows();
-  labelCount_t nLabels = Ytest.rows();
-
-  FP_TYPE *scoreArray = new FP_TYPE[nLabels];
-
-  FP_TYPE *trainvals = new FP_TYPE[dataDim];
-  memset(trainvals, 0, sizeof(FP_TYPE)*(dataDim));
-
-  labelCount_t *label = new labelCount_t[1];
+#ifdef ROWMAJOR
+  return batchEvaluateOn(SparseColMajor(Xtest), Ytest, dataDir, currResultsPath);
+#else
+  return batchEvaluateOn(Xtest, Ytest, dataDir, currResultsPath);
+#endif
+}
 
-  int correct = 0;
-  for (dataCount_t i = 0; i < nTest; ++i) {
-    featureCount_t count = 0;
-    while (count < dataDim) {
-      trainvals[count] = Xtest.coeff(count, i);
-      count++;
-    }
+FP_TYPE BonsaiPredictor::batchEvaluate(
+  const MatrixXuf& Xtest,
+  const SparseMatrixuf& Ytest,
+  const std::string& dataDir,
+  const std::string& currResultsPath)
+{
+  return batchEvaluateOn(Xtest, Ytest, dataDir, currResultsPath);
+}
 
-    scoreDenseDataPoint(scoreArray, trainvals);
+FP_TYPE BonsaiPredictor::batchEvaluate(
+  const Data& data,
+  const DataSplit split,
+  const std::string& dataDir,
+  const std::string& currResultsPath)
+{
+  const SparseMatrixuf& Y = split == trainSplit ? data.Ytrain
+    : (split == validationSplit ? data.Yvalidation : data.Ytest);
+  if (data.isDense(split))
+    return batchEvaluate(data.features<MatrixXuf>(split), Y, dataDir, currResultsPath);
+  return batchEvaluate(data.features<SparseMatrixuf>(split), Y, dataDir, currResultsPath);
+}
 
-    labelCount_t predLabel = 0;
-    FP_TYPE maxScore = scoreArray[0];
-    for (labelCount_t j = 0; j < nLabels; j++) {
-      if (maxScore <= scoreArray[j]) {
-        maxScore = scoreArray[j];
-        predLabel = j;
+template<class DataMatType>
+FP_TYPE BonsaiPredictor::batchEvaluateOn(
+  const DataMatType& Xtest,
+  const SparseMatrixuf& Ytest,
+  const std::string& dataDir,
+  const std::string& currResultsPath)
+{
+  Timer timer("BonsaiPredictor::batchEvaluate");
+
+  const dataCount_t nTest = Xtest.cols();
+  const featureCount_t dataDim = Xtest.rows();
+  const labelCount_t nLabels = Ytest.rows();
+
+  PredictionWriter predwriter(
+    currResultsPath + (isBinaryOutput ? "/predClassAndScore.bin" : "/predClassAndScore"),
+    isBinaryOutput
+    ? (PredictionFormatter*)new BinaryPredictionFormatter()
+    : (PredictionFormatter*)new TextPredictionFormatter(false, "\t", ""),
+    1);
+
+#ifdef ROWMAJOR
+  const SparseColMajor YtestCols(Ytest);
+  timer.nextTime("creating a colmajor copy of the test labels");
+#else
+  const SparseColMajor& YtestCols = Ytest;
+#endif
+
+  // Points are scored a wave at a time, in parallel blocks with their own buffers.
+  // The predictions of a wave are handed to the writer thread while the next one is scored.
+  const dataCount_t blockSize = 64;
+  const dataCount_t waveSize = 64 * blockSize;
+  std::vector<labelCount_t> predLabels(waveSize), labels(waveSize);
+  std::vector<FP_TYPE> maxScores(waveSize);
+
+  dataCount_t correct = 0;
+  for (dataCount_t waveBegin = 0; waveBegin < nTest; waveBegin += waveSize) {
+    const dataCount_t waveEnd = std::min(nTest, waveBegin + waveSize);
+    const dataCount_t numBlocks = (waveEnd - waveBegin + blockSize - 1) / blockSize;
+    pfor(dataCount_t block = 0; block < numBlocks; ++block) {
+      std::vector<FP_TYPE> values(dataDim);
+      std::vector<featureCount_t> indices(dataDim);
+      std::vector<FP_TYPE> scoreArray(nLabels);
+
+      const dataCount_t begin = waveBegin + block * blockSize;
+      const dataCount_t end = std::min(waveEnd, begin + blockSize);
+      for (dataCount_t i = begin; i < end; ++i) {
+        scoreTestPoint(*this, scoreArray.data(), Xtest, i, values, indices);
+
+        labelCount_t predLabel = 0;
+        FP_TYPE maxScore = scoreArray[0];
+        for (labelCount_t j = 0; j < nLabels; j++) {
+          if (maxScore <= scoreArray[j]) {
+            maxScore = scoreArray[j];
+            predLabel = j;
+          }
+        }
+
+        labelCount_t label = nLabels;
+        for (SparseColMajor::InnerIterator it(YtestCols, i); it; ++it)
+          if (it.value() == 1) label = (labelCount_t)it.row();
+
+        predLabels[i - waveBegin] = predLabel;
+        labels[i - waveBegin] = label;
+        maxScores[i - waveBegin] = maxScore;
       }
-      if (Ytest.coeff(j, i) == 1) label[0] = j;
     }
 
-    if (label[0] == predLabel) correct++;
-    (model.hyperParams.isOneIndex) ? predLabel++ : predLabel;
-    predwriter << predLabel << "\t" << maxScore << "\n";
+    for (dataCount_t i = 0; i < waveEnd - waveBegin; ++i) {
+      if (labels[i] == predLabels[i]) correct++;
+      labelCount_t predLabel = predLabels[i];
+      (model.hyperParams.isOneIndex) ? predLabel++ : predLabel;
+      predwriter.writeRow(&labels[i], labels[i] < nLabels ? 1 : 0, &predLabel, &maxScores[i]);
+    }
   }
-
   predwriter.close();
+  timer.nextTime("scoring the test points and writing the predictions");
 
   FP_TYPE accuracy = (FP_TYPE)(correct) / ((FP_TYPE)nTest);
 
@@ -314,13 +590,18 @@ void BonsaiPredictor::batchEvaluate(
 
   dumpRunInfo(currResultsPath, accuracy);
 
-  std::ofstream allDumper(dataDir + "/BonsaiResults" + "/resultDump", std::ofstream::out | std::ofstream::app);
-  allDumper << totalNonZeros() << " " << accuracy << " " << currResultsPath << "\n";
-  allDumper.close();
+  // Predictors evaluating concurrently (e.g. a sweep) share resultDump; only the append is serialized
+  static std::mutex resultDumpMutex;
+  std::ostringstream resultLine;
+  resultLine << totalNonZeros() << " " << accuracy << " " << currResultsPath << "\n";
+  {
+    std::lock_guard<std::mutex> lock(resultDumpMutex);
+    std::ofstream allDumper(dataDir + "/BonsaiResults" + "/resultDump", std::ofstream::out | std::ofstream::app);
+    allDumper << resultLine.str();
+    allDumper.close();
+  }
 
-  delete[] scoreArray;
-  delete[] trainvals;
-  delete[] label;
+  return accuracy;
 }
 
 size_t BonsaiPredictor::totalNonZeros()
@@ -26,13 +26,14 @@ BonsaiTrainer::BonsaiTrainer(
   const bool isDense)
   :
   model(numBytes, fromModel, isDense),   // Initialize model
-  data(dataIngestType,
+  ownedData(dataIngestType,
     DataFormatParams{
   model.hyperParams.ntrain,
   model.hyperParams.nvalidation,
   model.hyperParams.ntest,
   model.hyperParams.numClasses,
-  model.hyperParams.dataDimension })
+  model.hyperParams.dataDimension }),
+  data(ownedData)
 {
   assert(dataIngestType == FileIngest);
 
@@ -60,13 +61,14 @@ BonsaiTrainer::BonsaiTrainer(
   std::string& currResultsPath)
   :
   model(argc, argv, dataDir),               // Initialize model
-  data(dataIngestType,
+  ownedData(dataIngestType,
     DataFormatParams{
   model.hyperParams.ntrain,
   model.hyperParams.nvalidation,
   model.hyperParams.ntest,
   model.hyperParams.numClasses,
-  model.hyperParams.dataDimension })
+  model.hyperParams.dataDimension }),
+  data(ownedData)
 {
   assert(dataIngestType == FileIngest);
 
@@ -95,13 +97,14 @@ BonsaiTrainer::BonsaiTrainer(
   const DataIngestType& dataIngestType,
   const BonsaiModel::BonsaiHyperParams& fromHyperParams)
   : model(fromHyperParams),
-  data(dataIngestType,
+  ownedData(dataIngestType,
     DataFormatParams{
   model.hyperParams.ntrain,
   model.hyperParams.nvalidation,
   model.hyperParams.ntest,
   model.hyperParams.numClasses,
-  model.hyperParams.dataDimension })
+  model.hyperParams.dataDimension }),
+  data(ownedData)
 {
   assert(dataIngestType == InterfaceIngest);
   assert(model.hyperParams.normalizationType == none);
@@ -115,6 +118,92 @@ BonsaiTrainer::BonsaiTrainer(
   initializeModel();
 }
 
+BonsaiTrainer::BonsaiTrainer(
+  const BonsaiModel::BonsaiHyperParams& fromHyperParams,
+  Data& sharedData,
+  const MatrixXuf& sharedMean,
+  const MatrixXuf& sharedStdDev,
+  const std::string& currResultsPath)
+  : model(fromHyperParams),
+  ownedData(),
+  data(sharedData)
+{
+  assert(data.isDataLoaded == true);
+  assert(model.hyperParams.normalizationType == none);
+  assert(data.Xtrain.rows() == model.hyperParams.dataDimension);
+  assert(sharedMean.rows() == model.hyperParams.dataDimension);
+  assert(sharedStdDev.rows() == model.hyperParams.dataDimension);
+
+  std::string paramsPath = currResultsPath + "/Params";
+#if defined(_WIN32)
+  _mkdir(currResultsPath.c_str());
+  _mkdir(paramsPath.c_str());
+#else 
+  mkdir(currResultsPath.c_str(), 0777);
+  mkdir(paramsPath.c_str(), 0777);
+#endif
+
+  // not required for this constructor
+  feedDataValBuffer = new FP_TYPE[5];
+  feedDataFeatureBuffer = new featureCount_t[5];
+
+  mean = sharedMean;
+  stdDev = sharedStdDev;
+
+  if (model.hyperParams.ntrain == 0)
+    model.hyperParams.ntrain = data.Xtrain.cols();
+  assert(model.hyperParams.ntrain == data.Xtrain.cols());
+
+  initializeTrainVariables(data.Ytrain);
+  initializeModel();
+}
+
+BonsaiTrainer::BonsaiTrainer(
+  const size_t& numBytes,
+  const char *const fromModel,
+  const size_t& meanStdBytes,
+  const char *const fromMeanStd,
+  Data& warmStartData,
+  const std::string& currResultsPath,
+  const bool isDense)
+  : model(numBytes, fromModel, isDense),
+  ownedData(),
+  data(warmStartData)
+{
+  assert(data.isDataLoaded == true);
+  assert(data.Xtrain.rows() == model.hyperParams.dataDimension);
+  assert(data.Ytrain.rows() == model.hyperParams.numClasses);
+
+  std::string paramsPath = currResultsPath + "/Params";
+#if defined(_WIN32)
+  _mkdir(currResultsPath.c_str());
+  _mkdir(paramsPath.c_str());
+#else 
+  mkdir(currResultsPath.c_str(), 0777);
+  mkdir(paramsPath.c_str(), 0777);
+#endif
+
+  // not required for this constructor
+  feedDataValBuffer = new FP_TYPE[5];
+  feedDataFeatureBuffer = new featureCount_t[5];
+
+  mean = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
+  stdDev = MatrixXuf::Zero(model.hyperParams.dataDimension, 1);
+  importMeanStd(meanStdBytes, fromMeanStd);
+
+  // The model was trained on data normalized with the exported statistics; do not recompute them.
+  // Validation points are normalized the same way, so that they are scored like the predictor would.
+  data.applyMeanVarNormalize(trainSplit, mean, stdDev);
+  if (data.Xvalidation.cols() > 0)
+    data.applyMeanVarNormalize(validationSplit, mean, stdDev);
+
+  model.hyperParams.ntrain = data.Xtrain.cols();
+  model.hyperParams.nvalidation = data.Xvalidation.cols();
+  assert(model.hyperParams.ntrain > 0);
+
+  initializeTrainVariables(data.Ytrain);
+}
+
 BonsaiTrainer::~BonsaiTrainer()
 {
   mean.resize(0, 0);
@@ -171,19 +260,19 @@ void BonsaiTrainer::finalizeData()
 
   initializeTrainVariables(data.Ytrain);
 
-  meanVarNormalize(data.Xtrain, mean, stdDev);
+  data.meanVarNormalize(trainSplit, mean, stdDev);
 }
 
 FP_TYPE BonsaiTrainer::computeObjective(const MatrixXuf& ZX, const LabelMatType& Y)
 {
-  return computeObjective(MatrixXuf(model.params.Z), MatrixXuf(model.params.W), MatrixXuf(model.params.V), MatrixXuf(model.params.Theta), ZX, Y);
+  return computeObjective(model.params.Z, model.params.W, model.params.V, model.params.Theta, ZX, Y);
 }
 
 FP_TYPE BonsaiTrainer::computeObjective(
-  const MatrixXuf& Zmat,
-  const MatrixXuf& Wmat,
-  const MatrixXuf& Vmat,
-  const MatrixXuf& Thetamat,
+  const ZMatType& Zmat,
+  const WMatType& Wmat,
+  const VMatType& Vmat,
+  const ThetaMatType& Thetamat,
   const MatrixXuf& ZX,
   const LabelMatType& Y)
 {
@@ -198,10 +287,14 @@ FP_TYPE BonsaiTrainer::computeObjective(
 
   MatrixXuf margin = trueBestScore.row(0) - trueBestScore.row(1);
   FP_TYPE marginLoss = (FP_TYPE)0.0L;
+  // An importance-sampled minibatch estimates the mean loss with its unbiasing weights
+  const bool isWeighted = treeCache.pointWeight.size() != 0;
+  assert(!isWeighted || treeCache.pointWeight.cols() == ZX.cols());
   for (int n = 0; n < ZX.cols(); n++)
   {
     if ((FP_TYPE)1.0 - YMultCoeff(0, n)*margin(0, n) > 0.0)
-      marginLoss += (FP_TYPE)1.0 - YMultCoeff(0, n)*margin(0, n);
+      marginLoss += (isWeighted ? treeCache.pointWeight(0, n) : (FP_TYPE)1.0)
+        * ((FP_TYPE)1.0 - YMultCoeff(0, n)*margin(0, n));
     if (YMultCoeff(0, n)*margin(0, n) > 0)
       accuracy += 1;
   }
@@ -248,10 +341,56 @@ void BonsaiTrainer::train()
   assert(model.hyperParams.isModelInitialized == true);
 
   normalize();
+// The fixed-support gradient wrt sparse Z reads minibatches of Xtrain^T from the CSR copy
+#if defined(XTRAIN_CSR) || defined(SPARSE_Z_BONSAI)
+  data.buildXtrainCSR();
+#endif
+#if defined(COMPRESSED_XTRAIN_FP16)
+  data.compressXtrain(true);
+#elif defined(COMPRESSED_XTRAIN)
+  data.compressXtrain(false);
+#endif
 
   jointSgdBonsai(*this);
 }
 
+void BonsaiTrainer::enableCheckpointing(const std::string& path, const int interval, const int stopAfter)
+{
+  assert(!path.empty());
+  assert(interval >= 1);
+  assert(stopAfter >= 0 && stopAfter % interval == 0);
+  checkpointPath = path;
+  checkpointInterval = interval;
+  checkpointStopBatch = stopAfter;
+}
+
+void BonsaiTrainer::enableImportanceSampling(const FP_TYPE uniformShare)
+{
+  // A share above 0 bounds the weights by 1/uniformShare
+  assert(uniformShare > (FP_TYPE)0.0 && uniformShare <= (FP_TYPE)1.0);
+  isImportanceSampled = true;
+  importanceUniformShare = uniformShare;
+}
+
+void BonsaiTrainer::fineTune(const int iters)
+{
+  assert(data.isDataLoaded == true);
+  assert(model.hyperParams.isModelInitialized == true);
+  assert(iters >= 1);
+
+  model.hyperParams.iters = iters;
+// The fixed-support gradient wrt sparse Z reads minibatches of Xtrain^T from the CSR copy
+#if defined(XTRAIN_CSR) || defined(SPARSE_Z_BONSAI)
+  data.buildXtrainCSR();
+#endif
+#if defined(COMPRESSED_XTRAIN_FP16)
+  data.compressXtrain(true);
+#elif defined(COMPRESSED_XTRAIN)
+  data.compressXtrain(false);
+#endif
+  jointSgdBonsai(*this, true);
+}
+
 
 size_t BonsaiTrainer::getModelSize()
 {
@@ -357,48 +496,90 @@ void BonsaiTrainer::exportMeanStd(
   meanStdExporter.close();
 }
 
+void BonsaiTrainer::importMeanStd(
+  const size_t numBytes,
+  const char *const fromBuffer)
+{
+  Bonsai::importMeanStd(numBytes, fromBuffer, mean, stdDev);
+}
+
+void EdgeML::Bonsai::importMeanStd(
+  const size_t numBytes,
+  const char *const fromBuffer,
+  MatrixXuf& mean,
+  MatrixXuf& stdDev)
+{
+  size_t offset = 0;
+
+  size_t meanStdSize;
+  memcpy((void *)&meanStdSize, fromBuffer + offset, sizeof(meanStdSize));
+  offset += sizeof(meanStdSize);
+  memcpy(mean.data(), fromBuffer + offset, sizeof(FP_TYPE) * mean.rows() * mean.cols());
+  offset += sizeof(FP_TYPE) * mean.rows() * mean.cols();
+  memcpy(stdDev.data(), fromBuffer + offset, sizeof(FP_TYPE) * stdDev.rows() * stdDev.cols());
+  offset += sizeof(FP_TYPE) * stdDev.rows() * stdDev.cols();
+
+  assert(numBytes == offset);
+}
+
 void BonsaiTrainer::normalize()
 {
   if (model.hyperParams.normalizationType == minMax) {
-    computeMinMax(data.Xtrain, data.min, data.max);
-    minMaxNormalize(data.Xtrain, data.min, data.max);
+    data.computeMinMax();
+    data.minMaxNormalize(trainSplit);
     if (data.Xvalidation.cols() > 0)
-      minMaxNormalize(data.Xvalidation, data.min, data.max);
+      data.minMaxNormalize(validationSplit);
   }
   else if (model.hyperParams.normalizationType == l2) {
-    l2Normalize(data.Xtrain);
+    data.l2Normalize(trainSplit);
     if (data.Xvalidation.cols() > 0)
-      l2Normalize(data.Xvalidation);
+      data.l2Normalize(validationSplit);
   }
   else;
 }
 
+//
+// Entries uniform in [-1, 1] like MatrixXuf::Random, drawn from @generator rather than
+// the shared rand(), so that trainers initializing concurrently do not interfere
+//
+static MatrixXuf uniformRandom(
+  const Eigen::Index rows,
+  const Eigen::Index cols,
+  std::mt19937_64& generator)
+{
+  std::uniform_real_distribution<FP_TYPE> distribution((FP_TYPE)-1.0, (FP_TYPE)1.0);
+  MatrixXuf mat(rows, cols);
+  for (Eigen::Index i = 0; i < rows * cols; ++i)
+    mat.data()[i] = distribution(generator);
+  return mat;
+}
+
 void BonsaiTrainer::initializeModel()
 {
-  srand((unsigned int)model.hyperParams.seed);
+  std::mt19937_64 generator((unsigned long long)model.hyperParams.seed);
 
 #ifdef SPARSE_Z_BONSAI
-  model.params.Z = (MatrixXuf::Random(model.params.Z.rows(), model.params.Z.cols())).sparseView();
+  model.params.Z = (uniformRandom(model.params.Z.rows(), model.params.Z.cols(), generator)).sparseView();
 #else
-  model.params.Z = MatrixXuf::Random(model.params.Z.rows(), model.params.Z.cols());
+  model.params.Z = uniformRandom(model.params.Z.rows(), model.params.Z.cols(), generator);
 #endif
 
 #ifdef SPARSE_W_BONSAI
-  model.params.W = (MatrixXuf::Random(model.params.W.rows(), model.params.W.cols())).sparseView();
+  model.params.W = (uniformRandom(model.params.W.rows(), model.params.W.cols(), generator)).sparseView();
 #else
-  model.params.W = MatrixXuf::Random(model.params.W.rows(), model.params.W.cols());
+  model.params.W = uniformRandom(model.params.W.rows(), model.params.W.cols(), generator);
 #endif
 
 #ifdef SPARSE_V_BONSAI
-  model.params.V = (MatrixXuf::Random(model.params.V.rows(), model.params.V.cols())).sparseView();
+  model.params.V = (uniformRandom(model.params.V.rows(), model.params.V.cols(), generator)).sparseView();
 #else
-  model.params.V = MatrixXuf::Random(model.params.V.rows(), model.params.V.cols());
+  model.params.V = uniformRandom(model.params.V.rows(), model.params.V.cols(), generator);
 #endif
 
 #ifdef SPARSE_THETA_BONSAI
-  model.params.Theta = (MatrixXuf::Random(model.params.Theta.rows(), model.params.Theta.cols())).sparseView();
+  model.params.Theta = (uniformRandom(model.params.Theta.rows(), model.params.Theta.cols(), generator)).sparseView();
 #else
-  model.params.Theta = MatrixXuf::Random(model.params.Theta.rows(), model.params.Theta.cols());
+  model.params.Theta = uniformRandom(model.params.Theta.rows(), model.params.Theta.cols(), generator);
 #endif
 
   initializeTrainVariables(data.Ytrain);
@@ -447,40 +628,61 @@ void BonsaiTrainer::computeScoreOfClassID(
 void BonsaiTrainer::getTrueBestClass(
   MatrixXuf& trueBestScore,
   MatrixXufINT& true_best_classIndex,
-  const MatrixXuf& Wmat,
-  const MatrixXuf& Vmat,
+  const WMatType& Wmat,
+  const VMatType& Vmat,
   const LabelMatType& Y,
   const MatrixXuf& ZX)
 {
-  MatrixXuf WXClassID = MatrixXuf::Zero(model.hyperParams.totalNodes, ZX.cols());
-  MatrixXuf VXClassID = MatrixXuf::Zero(model.hyperParams.totalNodes, ZX.cols());
+  const labelCount_t totalNodes = model.hyperParams.totalNodes;
+  const labelCount_t internalClasses = model.hyperParams.internalClasses;
+  const Eigen::Index stackedRows = (Eigen::Index)totalNodes * internalClasses;
+  assert(Wmat.rows() == stackedRows && Vmat.rows() == stackedRows);
+
+  // Score all classes at once with two GEMMs over the stacked W and V.
+  // Points are processed in blocks so that the stacked products stay bounded
+  // when scoring the whole training set (computeObjective).
+  const Eigen::Index blockSize
+    = std::max((Eigen::Index)1, (Eigen::Index)(((Eigen::Index)1 << 22) / stackedRows));
+  MatrixXuf WX, VX;
+
+  for (Eigen::Index begin = 0; begin < ZX.cols(); begin += blockSize) {
+    const Eigen::Index numPoints = std::min(blockSize, ZX.cols() - begin);
+    const MatrixXuf ZXBlock = ZX.middleCols(begin, numPoints);
+    WX.resize(stackedRows, numPoints);
+    VX.resize(stackedRows, numPoints);
+
+    mm(WX, Wmat, CblasNoTrans, ZXBlock, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
+    mm(VX, Vmat, CblasNoTrans, ZXBlock, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
+
+    // Scale VX by scalar Sigma and compute tanh in place using vector ops
+    scal(VX.rows()*VX.cols(), model.hyperParams.Sigma, VX.data(), 1);
+    vTanh(VX.rows()*VX.cols(), VX.data(), VX.data());
+
+    // One sweep per point: probability-weighted sum over the nodes of each class,
+    // keeping the true class and the best non-true class as we go.
+    // trueClassScore+=ScoreCL o Y.row(class_i);
+    // bestClassScore=max(bestClassScore,ScoreCL o (1.0 - Y.row(class_i))) -- incorrect;
+    pfor(Eigen::Index j = 0; j < numPoints; ++j) {
+      const Eigen::Index n = begin + j;
+
+      for (labelCount_t class_i = 0; class_i < internalClasses; class_i++) {
+        const Eigen::Index offset = (Eigen::Index)class_i * totalNodes;
+        FP_TYPE score = (FP_TYPE)0.0;
+        for (labelCount_t i = 0; i < totalNodes; ++i)
+          score += WX(offset + i, j) * VX(offset + i, j) * treeCache.nodeProbability(i, n);
+
+        if (internalClasses <= 2) {
+          trueBestScore(0, n) = score;
+          trueBestScore(1, n) = (FP_TYPE)0.0;
+          break;
+        }
 
-  // trueClassScore+=ScoreCL o Y.row(class_i);
-  // bestClassScore=max(bestClassScore,ScoreCL o (1.0 - Y.row(class_i))) -- incorrect;
-  if (model.hyperParams.internalClasses <= 2)
-  {
-    MatrixXuf ScoreCL = MatrixXuf::Zero(1, ZX.cols());
-    computeScoreOfClassID(ScoreCL, Wmat, Vmat, ZX, 0, WXClassID, VXClassID);
-    trueBestScore.row(0) = ScoreCL;
-    trueBestScore.row(1) = MatrixXuf::Zero(1, trueBestScore.cols());
-  }
-  else
-  {
-    for (labelCount_t class_i = 0; class_i < model.hyperParams.internalClasses; class_i++)
-    {
-      MatrixXuf ScoreCL = MatrixXuf::Zero(1, ZX.cols());
-      computeScoreOfClassID(ScoreCL, Wmat, Vmat, ZX, class_i, WXClassID, VXClassID);
-
-      for (int n = 0; n < ZX.cols(); n++)
-      {
-        if (Y.coeff(class_i, n) == 0 && (ScoreCL(0, n) > trueBestScore(1, n)))
-        {
-          trueBestScore(1, n) = ScoreCL(0, n);
+        if (Y.coeff(class_i, n) == 0 && (score > trueBestScore(1, n))) {
+          trueBestScore(1, n) = score;
           true_best_classIndex(1, n) = (FP_TYPE)class_i;
         }
-        else if (Y.coeff(class_i, n) == 1)
-        {
-          trueBestScore(0, n) = ScoreCL(0, n);
+        else if (Y.coeff(class_i, n) == 1) {
+          trueBestScore(0, n) = score;
           true_best_classIndex(0, n) = (FP_TYPE)class_i;
         }
       }
@@ -490,12 +692,12 @@ void BonsaiTrainer::getTrueBestClass(
 
 void BonsaiTrainer::fillNodeProbability(const MatrixXuf& ZX)
 {
-  treeCache.fillNodeProbability(model, MatrixXuf(model.params.Theta), ZX);
+  treeCache.fillNodeProbability(model, model.params.Theta, ZX);
 }
 
 void BonsaiTrainer::TreeCache::fillNodeProbability(
   const BonsaiModel& model,
-  const MatrixXuf& Thetamat,
+  const ThetaMatType& Thetamat,
   const MatrixXuf& Xdata)
 {
   tanhThetaXCache = MatrixXuf::Zero(model.hyperParams.internalNodes, Xdata.cols());
@@ -531,11 +733,14 @@ void BonsaiTrainer::TreeCache::fillWX(
   const MatrixXufINT& classID)
 {
   //treeCache.WXWeight = MatrixXuf::Zero(totalNodes*internalClasses, Xdata.cols());
+  // The node rows of the class are multiplied in place with the small-matrix kernels
+  MatrixXuf X(Xdata.rows(), 1);
+  MatrixXuf WXWeightcolN(model.hyperParams.totalNodes, 1);
   for (int n = 0; n < Xdata.cols(); n++)
   {
-    MatrixXuf X = Xdata.col(n);
-    MatrixXuf WXWeightcolN = MatrixXuf::Zero(model.hyperParams.totalNodes, 1);// treeCache.WXWeight.block(classID(0, n)*totalNodes, n, totalNodes, 1);
-    mm(WXWeightcolN, MatrixXuf(Wmat.middleRows(model.hyperParams.totalNodes*(labelCount_t)classID(0, n), model.hyperParams.totalNodes)), CblasNoTrans, X, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
+    X = Xdata.col(n);
+    smallGemvRows(WXWeightcolN.data(), Wmat, model.hyperParams.totalNodes*(labelCount_t)classID(0, n), model.hyperParams.totalNodes,
+      CblasNoTrans, X.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
     WXWeight.block((labelCount_t)classID(0, n)*model.hyperParams.totalNodes, n, model.hyperParams.totalNodes, 1) = WXWeightcolN;
   }
 };
@@ -551,12 +756,13 @@ void BonsaiTrainer::TreeCache::fillTanhVX(
   const MatrixXuf& Xdata,
   const MatrixXufINT& classID)
 {
+  MatrixXuf X(Xdata.rows(), 1);
+  MatrixXuf VXWeightcolN(model.hyperParams.totalNodes, 1);
   for (int n = 0; n < Xdata.cols(); n++)
   {
-    MatrixXuf X = Xdata.col(n);
-    // Need a function which returns it as a reference to make it faster
-    MatrixXuf VXWeightcolN = MatrixXuf::Zero(model.hyperParams.totalNodes, 1);;// treeCache.tanhVXWeight.block(classID(0, n)*totalNodes, n, totalNodes, 1);
-    mm(VXWeightcolN, MatrixXuf(Vmat.middleRows(model.hyperParams.totalNodes*(labelCount_t)classID(0, n), model.hyperParams.totalNodes)), CblasNoTrans, X, CblasNoTrans, (FP_TYPE)1.0, (FP_TYPE)0.0L);
+    X = Xdata.col(n);
+    smallGemvRows(VXWeightcolN.data(), Vmat, model.hyperParams.totalNodes*(labelCount_t)classID(0, n), model.hyperParams.totalNodes,
+      CblasNoTrans, X.data(), (FP_TYPE)1.0, (FP_TYPE)0.0);
     tanhVXWeight.block((labelCount_t)classID(0, n)*(model.hyperParams.totalNodes), n, (model.hyperParams.totalNodes), 1) = VXWeightcolN;
   }
 };
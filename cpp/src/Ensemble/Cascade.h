@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __CASCADE_H__
+#define __CASCADE_H__
+
+#include "Ensemble.h"
+
+namespace EdgeML
+{
+  namespace Ensemble
+  {
+    //
+    // Two-stage cascade over the same label space, e.g. a small Bonsai model in
+    // front of a large ProtoNN model. Every point is scored by the first stage;
+    // it is escalated to the second stage only when the margin between the first
+    // stage's two highest scores is below the threshold, and then gets the second
+    // stage's scores. Pick the threshold with calibrate() on validation data.
+    //
+    // Each stage is a finalized EnsemblePredictor holding one model; the stages
+    // are not owned.
+    //
+    class CascadePredictor
+    {
+      EnsemblePredictor& firstStage;
+      EnsemblePredictor& secondStage;
+      labelCount_t numScores;
+      FP_TYPE threshold;
+
+      dataCount_t numScored, numEscalated;
+
+    public:
+      CascadePredictor(
+        EnsemblePredictor& firstStage_,
+        EnsemblePredictor& secondStage_,
+        const FP_TYPE threshold_ = 0.0);
+
+      // Difference between the two highest of @numScores_ scores
+      static FP_TYPE margin(const FP_TYPE *const scores, const labelCount_t numScores_);
+
+      void setThreshold(const FP_TYPE threshold_);
+      FP_TYPE getThreshold() const;
+
+      //
+      // Score the validation points with both stages and set the smallest threshold at which
+      // the cascade reaches top-1 @targetAccuracy. If no threshold reaches it, the most
+      // accurate one is used. Returns the threshold. @Xvalidation is MatrixXuf or
+      // SparseMatrixuf, following the storage of the data (see Data::isDense).
+      //
+      template<class DataMatType>
+      FP_TYPE calibrate(
+        const DataMatType& Xvalidation,
+        const SparseMatrixuf& Yvalidation,
+        const FP_TYPE targetAccuracy);
+
+      //
+      // The threshold calibrate() picks for stages that score the validation points with
+      // @firstScores and @secondScores, one column per point.
+      //
+      static FP_TYPE calibrateOnScores(
+        const MatrixXuf& firstScores,
+        const MatrixXuf& secondScores,
+        const SparseMatrixuf& Yvalidation,
+        const FP_TYPE targetAccuracy);
+
+      // Not thread safe. @scores must hold numScores values. Returns true if the point was escalated.
+      bool scoreDenseDataPoint(
+        FP_TYPE* scores,
+        const FP_TYPE *const values);
+
+      // Not thread safe. @scores must hold numScores values. Returns true if the point was escalated.
+      bool scoreSparseDataPoint(
+        FP_TYPE* scores,
+        const FP_TYPE *const values,
+        const featureCount_t *const indices,
+        const featureCount_t& numIndices);
+
+      //
+      // Score every column of @X. The escalated columns are scored by the second stage
+      // in one batch. @X is MatrixXuf or SparseMatrixuf. Not thread safe.
+      //
+      template<class DataMatType>
+      void scoreBatch(
+        MatrixXuf& scores,
+        const DataMatType& X);
+
+      // Fraction of the points scored since the last resetStats that were escalated
+      FP_TYPE escalationRate() const;
+      dataCount_t pointsScored() const;
+      void resetStats();
+    };
+  }
+}
+#endif
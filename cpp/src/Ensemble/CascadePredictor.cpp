@@ -0,0 +1,259 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Cascade.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace EdgeML;
+using namespace EdgeML::Ensemble;
+
+CascadePredictor::CascadePredictor(
+  EnsemblePredictor& firstStage_,
+  EnsemblePredictor& secondStage_,
+  const FP_TYPE threshold_)
+  : firstStage(firstStage_),
+  secondStage(secondStage_),
+  numScores(firstStage_.totalScores()),
+  threshold(threshold_),
+  numScored(0),
+  numEscalated(0)
+{
+  assert(firstStage.numModels() == 1 && secondStage.numModels() == 1);
+  assert(secondStage.totalScores() == numScores && "The stages must score the same labels");
+  assert(numScores > 0);
+}
+
+FP_TYPE CascadePredictor::margin(
+  const FP_TYPE *const scores,
+  const labelCount_t numScores_)
+{
+  if (numScores_ < 2)
+    return std::numeric_limits<FP_TYPE>::max();
+
+  FP_TYPE first = -std::numeric_limits<FP_TYPE>::max();
+  FP_TYPE second = -std::numeric_limits<FP_TYPE>::max();
+  for (labelCount_t c = 0; c < numScores_; ++c) {
+    if (scores[c] > first) {
+      second = first;
+      first = scores[c];
+    }
+    else if (scores[c] > second)
+      second = scores[c];
+  }
+  return first - second;
+}
+
+void CascadePredictor::setThreshold(const FP_TYPE threshold_)
+{
+  threshold = threshold_;
+}
+
+FP_TYPE CascadePredictor::getThreshold() const
+{
+  return threshold;
+}
+
+// Margin of column @j of @scores, copied to @column so that it is contiguous whatever
+// the storage order of MatrixXuf
+static FP_TYPE columnMargin(
+  const MatrixXuf& scores,
+  const dataCount_t j,
+  Matrix<FP_TYPE, Dynamic, 1>& column)
+{
+  column = scores.col(j);
+  return CascadePredictor::margin(column.data(), (labelCount_t)column.rows());
+}
+
+static bool isTop1Correct(
+  const MatrixXuf& scores,
+  const SparseMatrixuf& Y,
+  const dataCount_t j)
+{
+  Eigen::Index predicted;
+  scores.col(j).maxCoeff(&predicted);
+  return Y.coeff(predicted, j) != (FP_TYPE)0.0;
+}
+
+template<class DataMatType>
+FP_TYPE CascadePredictor::calibrate(
+  const DataMatType& Xvalidation,
+  const SparseMatrixuf& Yvalidation,
+  const FP_TYPE targetAccuracy)
+{
+  assert(Xvalidation.cols() > 0);
+  assert(Yvalidation.cols() == Xvalidation.cols() && Yvalidation.rows() == numScores);
+
+  MatrixXuf firstScores, secondScores;
+  firstStage.scoreBatch(firstScores, Xvalidation);
+  secondStage.scoreBatch(secondScores, Xvalidation);
+
+  threshold = calibrateOnScores(firstScores, secondScores, Yvalidation, targetAccuracy);
+  return threshold;
+}
+
+FP_TYPE CascadePredictor::calibrateOnScores(
+  const MatrixXuf& firstScores,
+  const MatrixXuf& secondScores,
+  const SparseMatrixuf& Yvalidation,
+  const FP_TYPE targetAccuracy)
+{
+  const dataCount_t n = firstScores.cols();
+  const Eigen::Index numLabels = firstScores.rows();
+  assert(n > 0);
+  assert(secondScores.rows() == numLabels && secondScores.cols() == n);
+  assert(Yvalidation.rows() == numLabels && Yvalidation.cols() == n);
+
+  std::vector<FP_TYPE> margins(n);
+  std::vector<char> isFirstCorrect(n), isSecondCorrect(n);
+  dataCount_t numFirstCorrect = 0, numSecondCorrect = 0;
+  Matrix<FP_TYPE, Dynamic, 1> column(numLabels);
+  for (dataCount_t j = 0; j < n; ++j) {
+    margins[j] = columnMargin(firstScores, j, column);
+    isFirstCorrect[j] = isTop1Correct(firstScores, Yvalidation, j);
+    isSecondCorrect[j] = isTop1Correct(secondScores, Yvalidation, j);
+    numFirstCorrect += isFirstCorrect[j];
+    numSecondCorrect += isSecondCorrect[j];
+  }
+
+  // Escalating the k points with the smallest margins; a threshold can only
+  // separate points whose margins differ.
+  std::vector<dataCount_t> order(n);
+  for (dataCount_t j = 0; j < n; ++j)
+    order[j] = j;
+  std::sort(order.begin(), order.end(),
+    [&margins](const dataCount_t a, const dataCount_t b) { return margins[a] < margins[b]; });
+
+  dataCount_t numCorrect = numFirstCorrect;
+  dataCount_t bestK = 0, bestCorrect = numCorrect, chosenK = n;
+  bool isTargetReached = false;
+  for (dataCount_t k = 0; k <= n; ++k) {
+    if (k > 0)
+      numCorrect = numCorrect + isSecondCorrect[order[k - 1]] - isFirstCorrect[order[k - 1]];
+    if (k > 0 && k < n && margins[order[k - 1]] == margins[order[k]])
+      continue;
+
+    if ((FP_TYPE)numCorrect >= targetAccuracy * (FP_TYPE)n) {
+      chosenK = k;
+      isTargetReached = true;
+      break;
+    }
+    if (numCorrect > bestCorrect) {
+      bestCorrect = numCorrect;
+      bestK = k;
+    }
+  }
+  if (!isTargetReached) {
+    LOG_WARNING("The cascade cannot reach accuracy " + std::to_string(targetAccuracy)
+      + " on the validation data; using the most accurate threshold");
+    chosenK = bestK;
+    numCorrect = bestCorrect;
+  }
+
+  const FP_TYPE calibrated = chosenK < n ? margins[order[chosenK]] : std::numeric_limits<FP_TYPE>::max();
+
+  LOG_INFO("Cascade calibration on " + std::to_string(n) + " points: first stage accuracy "
+    + std::to_string((FP_TYPE)numFirstCorrect / n) + ", second stage accuracy "
+    + std::to_string((FP_TYPE)numSecondCorrect / n) + ", cascade accuracy "
+    + std::to_string((FP_TYPE)numCorrect / n) + " at threshold " + std::to_string(calibrated)
+    + " with escalation rate " + std::to_string((FP_TYPE)chosenK / n));
+
+  return calibrated;
+}
+
+bool CascadePredictor::scoreDenseDataPoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values)
+{
+  ++numScored;
+  firstStage.scoreDenseDataPoint(scores, values);
+  if (margin(scores, numScores) >= threshold)
+    return false;
+
+  ++numEscalated;
+  secondStage.scoreDenseDataPoint(scores, values);
+  return true;
+}
+
+bool CascadePredictor::scoreSparseDataPoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values,
+  const featureCount_t *const indices,
+  const featureCount_t& numIndices)
+{
+  ++numScored;
+  firstStage.scoreSparseDataPoint(scores, values, indices, numIndices);
+  if (margin(scores, numScores) >= threshold)
+    return false;
+
+  ++numEscalated;
+  secondStage.scoreSparseDataPoint(scores, values, indices, numIndices);
+  return true;
+}
+
+// Columns @columns of @X, in that order
+static MatrixXuf selectColumns(const MatrixXuf& X, const std::vector<dataCount_t>& columns)
+{
+  MatrixXuf selected(X.rows(), columns.size());
+  for (size_t i = 0; i < columns.size(); ++i)
+    selected.col(i) = X.col(columns[i]);
+  return selected;
+}
+
+static SparseMatrixuf selectColumns(const SparseMatrixuf& X, const std::vector<dataCount_t>& columns)
+{
+  std::vector<Trip> triplets;
+  for (size_t i = 0; i < columns.size(); ++i)
+    for (SparseMatrixuf::InnerIterator it(X, columns[i]); it; ++it)
+      triplets.push_back(Trip(it.row(), (sparseIndex_t)i, it.value()));
+  SparseMatrixuf selected(X.rows(), columns.size());
+  selected.setFromTriplets(triplets.begin(), triplets.end());
+  return selected;
+}
+
+template<class DataMatType>
+void CascadePredictor::scoreBatch(
+  MatrixXuf& scores,
+  const DataMatType& X)
+{
+  const dataCount_t n = X.cols();
+  firstStage.scoreBatch(scores, X);
+
+  std::vector<dataCount_t> escalated;
+  Matrix<FP_TYPE, Dynamic, 1> column(numScores);
+  for (dataCount_t j = 0; j < n; ++j)
+    if (columnMargin(scores, j, column) < threshold)
+      escalated.push_back(j);
+
+  numScored += n;
+  numEscalated += escalated.size();
+  if (escalated.empty())
+    return;
+
+  MatrixXuf secondScores;
+  secondStage.scoreBatch(secondScores, selectColumns(X, escalated));
+  for (size_t i = 0; i < escalated.size(); ++i)
+    scores.col(escalated[i]) = secondScores.col(i);
+}
+
+template FP_TYPE CascadePredictor::calibrate<MatrixXuf>(const MatrixXuf&, const SparseMatrixuf&, const FP_TYPE);
+template FP_TYPE CascadePredictor::calibrate<SparseMatrixuf>(const SparseMatrixuf&, const SparseMatrixuf&, const FP_TYPE);
+template void CascadePredictor::scoreBatch<MatrixXuf>(MatrixXuf&, const MatrixXuf&);
+template void CascadePredictor::scoreBatch<SparseMatrixuf>(MatrixXuf&, const SparseMatrixuf&);
+
+FP_TYPE CascadePredictor::escalationRate() const
+{
+  return numScored == 0 ? (FP_TYPE)0.0 : (FP_TYPE)numEscalated / (FP_TYPE)numScored;
+}
+
+dataCount_t CascadePredictor::pointsScored() const
+{
+  return numScored;
+}
+
+void CascadePredictor::resetStats()
+{
+  numScored = 0;
+  numEscalated = 0;
+}
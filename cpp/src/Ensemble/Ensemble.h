@@ -0,0 +1,172 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __ENSEMBLE_H__
+#define __ENSEMBLE_H__
+
+#include "Bonsai.h"
+#include "ProtoNN.h"
+
+#include <memory>
+
+namespace EdgeML
+{
+  namespace Ensemble
+  {
+    //
+    // Scores a data point with a set of Bonsai and ProtoNN models in one call.
+    //
+    // Models are grouped by the input they consume: Bonsai models that share
+    // mean/stdDev, and ProtoNN models that share a normalization, see the
+    // same normalized vector. Within a group the projection matrices
+    // (Bonsai Z, ProtoNN W) are stacked row-wise so that the whole input-side
+    // projection is a single gemm. Each model then only does its own
+    // tree traversal or RBF on its slice of the stacked projection.
+    //
+    // Scores of all models are written into one array; model i owns
+    // [scoreOffset(i), scoreOffset(i) + numScores(i)).
+    //
+    class EnsemblePredictor
+    {
+      enum ModelKind
+      {
+        bonsaiKind, protoNNKind
+      };
+
+      //
+      // A set of models that consume the same normalized input
+      //
+      struct InputGroup
+      {
+        ModelKind kind;
+        NormalizationFormat normalizationType; // ProtoNN groups only
+        MatrixXuf shift, scale;                // mean/stdDev for Bonsai, min/max for ProtoNN minMax
+        featureCount_t inputDimension;         // includes the bias feature for Bonsai
+
+        MatrixXuf projection; // stacked Z (Bonsai) or W (ProtoNN)
+        MatrixXuf normalized; // inputDimension x batch, scratch
+        MatrixXuf projected;  // projection.rows() x batch, scratch
+      };
+
+      struct BonsaiMember
+      {
+        Bonsai::BonsaiModel model;
+        MatrixXuf W, V, Theta; // dense copies, whatever the build's parameter types
+        size_t group;
+        featureCount_t rowOffset;
+        labelCount_t scoreOffset;
+      };
+
+      struct ProtoNNMember
+      {
+        ProtoNN::ProtoNNModel model;
+        size_t group;
+        featureCount_t rowOffset;
+        labelCount_t scoreOffset;
+      };
+
+      featureCount_t numFeatures;
+      labelCount_t totalScoreCount;
+      bool isFinalized;
+
+      std::vector<InputGroup> groups;
+      std::vector<std::unique_ptr<BonsaiMember> > bonsaiMembers;
+      std::vector<std::unique_ptr<ProtoNNMember> > protoNNMembers;
+      std::vector<std::pair<ModelKind, size_t> > memberOrder; // insertion order -> (kind, index)
+
+      MatrixXuf rawInput; // numFeatures x batch, filled once per call or block of scoreBatch
+
+      size_t findOrAddGroup(
+        const ModelKind kind,
+        const NormalizationFormat normalizationType,
+        const MatrixXuf& shift,
+        const MatrixXuf& scale,
+        const featureCount_t inputDimension);
+
+      void normalizeGroup(InputGroup& group, const dataCount_t numPoints);
+
+      void scoreBonsaiMember(
+        const BonsaiMember& member,
+        MatrixXuf& scores,
+        const dataCount_t numPoints);
+
+      void scoreProtoNNMember(
+        const ProtoNNMember& member,
+        MatrixXuf& scores,
+        const dataCount_t numPoints);
+
+      // Scores the first numPoints columns of rawInput
+      void scoreRawInput(MatrixXuf& scores, const dataCount_t numPoints);
+
+      // scoreBatch on blocks of columns of @X, so that only a block is densified at a time
+      template<class DataMatType>
+      void scoreColumnBlocks(MatrixXuf& scores, const DataMatType& X);
+
+    public:
+      //
+      // @numFeatures_: number of raw input features shared by all the models
+      //
+      EnsemblePredictor(const featureCount_t& numFeatures_);
+
+      //
+      // Add a Bonsai model along with the mean/stdDev buffer exported by BonsaiTrainer.
+      // Returns the index of the model in the ensemble.
+      //
+      size_t addBonsaiModel(
+        const size_t numBytes,
+        const char *const fromModel,
+        const size_t meanStdBytes,
+        const char *const fromMeanStd,
+        const bool isDense = true);
+
+      //
+      // Add a ProtoNN model. For min-max normalized models pass the
+      // min/max vectors saved by the trainer (see loadMinMax).
+      // Returns the index of the model in the ensemble.
+      //
+      size_t addProtoNNModel(
+        const size_t numBytes,
+        const char *const fromModel);
+      size_t addProtoNNModel(
+        const size_t numBytes,
+        const char *const fromModel,
+        const MatrixXuf& min,
+        const MatrixXuf& max);
+
+      //
+      // Build the stacked projections. Must be called after the last add and before scoring.
+      //
+      void finalize();
+
+      size_t numModels() const;
+      labelCount_t numScores(const size_t modelIdx) const;
+      labelCount_t scoreOffset(const size_t modelIdx) const;
+      labelCount_t totalScores() const;
+
+      // Not thread safe. @scores must hold totalScores() values.
+      void scoreDenseDataPoint(
+        FP_TYPE* scores,
+        const FP_TYPE *const values);
+
+      // Not thread safe. @scores must hold totalScores() values.
+      void scoreSparseDataPoint(
+        FP_TYPE* scores,
+        const FP_TYPE *const values,
+        const featureCount_t *const indices,
+        const featureCount_t& numIndices);
+
+      //
+      // Score every column of @X. @scores is resized to totalScores() x X.cols().
+      // Columns are scored in blocks of a few tens of MB of dense input. Not thread safe.
+      //
+      void scoreBatch(
+        MatrixXuf& scores,
+        const SparseMatrixuf& X);
+
+      void scoreBatch(
+        MatrixXuf& scores,
+        const MatrixXuf& X);
+    };
+  }
+}
+#endif
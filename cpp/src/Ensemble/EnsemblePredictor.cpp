@@ -0,0 +1,379 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "blas_routines.h"
+#include "ProtoNNFunctions.h"
+#include "Ensemble.h"
+
+using namespace EdgeML;
+using namespace EdgeML::Ensemble;
+
+EnsemblePredictor::EnsemblePredictor(const featureCount_t& numFeatures_)
+  : numFeatures(numFeatures_),
+  totalScoreCount(0),
+  isFinalized(false)
+{
+  assert(numFeatures > 0);
+}
+
+size_t EnsemblePredictor::findOrAddGroup(
+  const ModelKind kind,
+  const NormalizationFormat normalizationType,
+  const MatrixXuf& shift,
+  const MatrixXuf& scale,
+  const featureCount_t inputDimension)
+{
+  for (size_t g = 0; g < groups.size(); ++g) {
+    const InputGroup& group = groups[g];
+    if (group.kind != kind) continue;
+    if (group.inputDimension != inputDimension) continue;
+    if (group.normalizationType != normalizationType) continue;
+    if (group.shift.rows() != shift.rows() || group.scale.rows() != scale.rows()) continue;
+    if ((group.shift.array() != shift.array()).any()) continue;
+    if ((group.scale.array() != scale.array()).any()) continue;
+    return g;
+  }
+
+  InputGroup group;
+  group.kind = kind;
+  group.normalizationType = normalizationType;
+  group.shift = shift;
+  group.scale = scale;
+  group.inputDimension = inputDimension;
+  groups.push_back(group);
+
+  return groups.size() - 1;
+}
+
+size_t EnsemblePredictor::addBonsaiModel(
+  const size_t numBytes,
+  const char *const fromModel,
+  const size_t meanStdBytes,
+  const char *const fromMeanStd,
+  const bool isDense)
+{
+  assert(!isFinalized);
+
+  std::unique_ptr<BonsaiMember> member(new BonsaiMember);
+  member->model = Bonsai::BonsaiModel(numBytes, fromModel, isDense);
+
+  const featureCount_t dataDimension = member->model.hyperParams.dataDimension;
+  // Bonsai appends a bias feature to the raw input
+  assert(dataDimension == numFeatures + 1);
+
+  // Same layout as BonsaiTrainer::exportMeanStd
+  MatrixXuf mean(dataDimension, 1), stdDev(dataDimension, 1);
+  size_t offset = sizeof(size_t);
+  memcpy(mean.data(), fromMeanStd + offset, sizeof(FP_TYPE) * dataDimension);
+  offset += sizeof(FP_TYPE) * dataDimension;
+  memcpy(stdDev.data(), fromMeanStd + offset, sizeof(FP_TYPE) * dataDimension);
+  offset += sizeof(FP_TYPE) * dataDimension;
+  assert(meanStdBytes == offset);
+
+  member->W = MatrixXuf(member->model.params.W);
+  member->V = MatrixXuf(member->model.params.V);
+  member->Theta = MatrixXuf(member->model.params.Theta);
+  member->group = findOrAddGroup(bonsaiKind, none, mean, stdDev, dataDimension);
+  member->rowOffset = 0;
+  member->scoreOffset = totalScoreCount;
+  totalScoreCount += member->model.hyperParams.numClasses;
+
+  bonsaiMembers.push_back(std::move(member));
+  memberOrder.push_back(std::make_pair(bonsaiKind, bonsaiMembers.size() - 1));
+
+  return memberOrder.size() - 1;
+}
+
+size_t EnsemblePredictor::addProtoNNModel(
+  const size_t numBytes,
+  const char *const fromModel)
+{
+  return addProtoNNModel(numBytes, fromModel, MatrixXuf(), MatrixXuf());
+}
+
+size_t EnsemblePredictor::addProtoNNModel(
+  const size_t numBytes,
+  const char *const fromModel,
+  const MatrixXuf& min,
+  const MatrixXuf& max)
+{
+  assert(!isFinalized);
+
+  std::unique_ptr<ProtoNNMember> member(new ProtoNNMember);
+  member->model = ProtoNN::ProtoNNModel(numBytes, fromModel);
+  assert(member->model.hyperParams.D == numFeatures);
+
+  NormalizationFormat normalizationType = member->model.hyperParams.normalizationType;
+  if (normalizationType == minMax) {
+    assert(min.rows() == numFeatures && max.rows() == numFeatures);
+    member->group = findOrAddGroup(protoNNKind, minMax, min, max, numFeatures);
+  }
+  else {
+    assert(normalizationType == l2 || normalizationType == none);
+    member->group = findOrAddGroup(protoNNKind, normalizationType, MatrixXuf(), MatrixXuf(), numFeatures);
+  }
+  member->rowOffset = 0;
+  member->scoreOffset = totalScoreCount;
+  totalScoreCount += member->model.hyperParams.l;
+
+  protoNNMembers.push_back(std::move(member));
+  memberOrder.push_back(std::make_pair(protoNNKind, protoNNMembers.size() - 1));
+
+  return memberOrder.size() - 1;
+}
+
+void EnsemblePredictor::finalize()
+{
+  assert(!isFinalized);
+  assert(memberOrder.size() > 0);
+
+  std::vector<featureCount_t> groupRows(groups.size(), 0);
+  for (size_t i = 0; i < bonsaiMembers.size(); ++i) {
+    bonsaiMembers[i]->rowOffset = groupRows[bonsaiMembers[i]->group];
+    groupRows[bonsaiMembers[i]->group] += bonsaiMembers[i]->model.hyperParams.projectionDimension;
+  }
+  for (size_t i = 0; i < protoNNMembers.size(); ++i) {
+    protoNNMembers[i]->rowOffset = groupRows[protoNNMembers[i]->group];
+    groupRows[protoNNMembers[i]->group] += protoNNMembers[i]->model.hyperParams.d;
+  }
+
+  for (size_t g = 0; g < groups.size(); ++g)
+    groups[g].projection = MatrixXuf::Zero(groupRows[g], groups[g].inputDimension);
+
+  // The 1/projectionDimension scaling of Bonsai's ZX is folded into the stacked Z.
+  for (size_t i = 0; i < bonsaiMembers.size(); ++i) {
+    const BonsaiMember& member = *bonsaiMembers[i];
+    const featureCount_t projDim = member.model.hyperParams.projectionDimension;
+    groups[member.group].projection.middleRows(member.rowOffset, projDim)
+      = MatrixXuf(member.model.params.Z) / (FP_TYPE)projDim;
+  }
+  for (size_t i = 0; i < protoNNMembers.size(); ++i) {
+    const ProtoNNMember& member = *protoNNMembers[i];
+    groups[member.group].projection.middleRows(member.rowOffset, member.model.hyperParams.d)
+      = MatrixXuf(member.model.WInFeatureOrder());
+  }
+
+  LOG_INFO("Ensemble of " + std::to_string(memberOrder.size()) + " models uses "
+    + std::to_string(groups.size()) + " stacked projection(s)");
+  isFinalized = true;
+}
+
+size_t EnsemblePredictor::numModels() const
+{
+  return memberOrder.size();
+}
+
+labelCount_t EnsemblePredictor::numScores(const size_t modelIdx) const
+{
+  assert(modelIdx < memberOrder.size());
+  if (memberOrder[modelIdx].first == bonsaiKind)
+    return bonsaiMembers[memberOrder[modelIdx].second]->model.hyperParams.numClasses;
+  else
+    return protoNNMembers[memberOrder[modelIdx].second]->model.hyperParams.l;
+}
+
+labelCount_t EnsemblePredictor::scoreOffset(const size_t modelIdx) const
+{
+  assert(modelIdx < memberOrder.size());
+  if (memberOrder[modelIdx].first == bonsaiKind)
+    return bonsaiMembers[memberOrder[modelIdx].second]->scoreOffset;
+  else
+    return protoNNMembers[memberOrder[modelIdx].second]->scoreOffset;
+}
+
+labelCount_t EnsemblePredictor::totalScores() const
+{
+  return totalScoreCount;
+}
+
+void EnsemblePredictor::normalizeGroup(
+  InputGroup& group,
+  const dataCount_t numPoints)
+{
+  if (group.kind == bonsaiKind) {
+    // Same as BonsaiPredictor::scoreDenseDataPoint, with the bias feature set to 1
+    group.normalized.resize(group.inputDimension, numPoints);
+    pfor(dataCount_t j = 0; j < numPoints; ++j) {
+      group.normalized.col(j).head(numFeatures)
+        = (rawInput.col(j) - group.shift.col(0).head(numFeatures)).cwiseQuotient(group.scale.col(0).head(numFeatures));
+      group.normalized(numFeatures, j) = (FP_TYPE)1.0;
+    }
+    return;
+  }
+
+  switch (group.normalizationType) {
+    case none:
+      break;
+
+    case l2:
+      group.normalized = rawInput;
+      pfor(dataCount_t j = 0; j < numPoints; ++j) {
+        FP_TYPE norm = group.normalized.col(j).norm();
+        if (norm > (FP_TYPE)0.0)
+          group.normalized.col(j) /= norm;
+      }
+      break;
+
+    case minMax:
+      // Only non-zeros are rescaled, as in minMaxNormalize on sparse data
+      group.normalized = rawInput;
+      pfor(dataCount_t j = 0; j < numPoints; ++j) {
+        for (featureCount_t f = 0; f < numFeatures; ++f) {
+          FP_TYPE& value = group.normalized(f, j);
+          if (value != (FP_TYPE)0.0)
+            value = (value - group.shift(f, 0)) / (group.scale(f, 0) - group.shift(f, 0));
+        }
+      }
+      break;
+
+    default:
+      assert(false);
+  }
+}
+
+void EnsemblePredictor::scoreBonsaiMember(
+  const BonsaiMember& member,
+  MatrixXuf& scores,
+  const dataCount_t numPoints)
+{
+  const Bonsai::BonsaiModel::BonsaiHyperParams& hyperParams = member.model.hyperParams;
+  const MatrixXuf& projected = groups[member.group].projected;
+  const FP_TYPE ymult = hyperParams.internalClasses <= 2 ? (FP_TYPE)-1.0 : (FP_TYPE)1.0;
+
+  scores.middleRows(member.scoreOffset, hyperParams.numClasses).setZero();
+
+  // Rows of W, V and Theta times the member's slice of a column of the projection,
+  // as Eigen expressions so that they hold for either storage order of MatrixXuf
+  pfor(dataCount_t j = 0; j < numPoints; ++j) {
+    const auto ZX = projected.col(j).segment(member.rowOffset, hyperParams.projectionDimension);
+
+    std::vector<int> path;
+    int currNode = 0;
+    path.push_back(currNode);
+    while (currNode < hyperParams.internalNodes) {
+      const FP_TYPE thetaZX = member.Theta.row(currNode).transpose().cwiseProduct(ZX).sum();
+      currNode = thetaZX > (FP_TYPE)0.0 ? 2 * currNode + 1 : 2 * currNode + 2;
+      path.push_back(currNode);
+    }
+
+    for (labelCount_t c = 0; c < hyperParams.internalClasses; ++c) {
+      FP_TYPE score = (FP_TYPE)0.0;
+      for (size_t i = 0; i < path.size(); ++i) {
+        const Eigen::Index row = hyperParams.totalNodes * c + path[i];
+        const FP_TYPE WZX = member.W.row(row).transpose().cwiseProduct(ZX).sum();
+        const FP_TYPE VZX = member.V.row(row).transpose().cwiseProduct(ZX).sum();
+        score += WZX * tanh(hyperParams.Sigma * VZX);
+      }
+      scores(member.scoreOffset + c, j) = ymult * score;
+    }
+  }
+}
+
+void EnsemblePredictor::scoreProtoNNMember(
+  const ProtoNNMember& member,
+  MatrixXuf& scores,
+  const dataCount_t numPoints)
+{
+  const ProtoNN::ProtoNNModel::ProtoNNHyperParams& hyperParams = member.model.hyperParams;
+
+  MatrixXuf WX = groups[member.group].projected.middleRows(member.rowOffset, hyperParams.d);
+  MatrixXuf D = gaussianKernel(member.model.params.B, WX, hyperParams.gamma);
+
+  MatrixXuf Yscores(hyperParams.l, numPoints);
+  mm(Yscores, member.model.params.Z, CblasNoTrans, D, CblasTrans, 1.0, 0.0L);
+  scores.middleRows(member.scoreOffset, hyperParams.l) = Yscores;
+}
+
+void EnsemblePredictor::scoreRawInput(
+  MatrixXuf& scores,
+  const dataCount_t numPoints)
+{
+  assert(isFinalized);
+  assert(rawInput.cols() == numPoints);
+
+  scores.resize(totalScoreCount, numPoints);
+
+  // One normalization and one stacked projection per group
+  for (size_t g = 0; g < groups.size(); ++g) {
+    InputGroup& group = groups[g];
+    normalizeGroup(group, numPoints);
+
+    const MatrixXuf& input = (group.kind == protoNNKind && group.normalizationType == none)
+      ? rawInput : group.normalized;
+    group.projected.resize(group.projection.rows(), numPoints);
+    mm(group.projected, group.projection, CblasNoTrans, input, CblasNoTrans, 1.0, 0.0L);
+  }
+
+  for (size_t i = 0; i < bonsaiMembers.size(); ++i)
+    scoreBonsaiMember(*bonsaiMembers[i], scores, numPoints);
+  for (size_t i = 0; i < protoNNMembers.size(); ++i)
+    scoreProtoNNMember(*protoNNMembers[i], scores, numPoints);
+}
+
+void EnsemblePredictor::scoreDenseDataPoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values)
+{
+  rawInput.resize(numFeatures, 1);
+  memcpy(rawInput.data(), values, sizeof(FP_TYPE) * numFeatures);
+
+  Map<MatrixXuf> scoresMat(scores, totalScoreCount, 1);
+  MatrixXuf scoresBuf;
+  scoreRawInput(scoresBuf, 1);
+  scoresMat = scoresBuf;
+}
+
+void EnsemblePredictor::scoreSparseDataPoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values,
+  const featureCount_t *const indices,
+  const featureCount_t& numIndices)
+{
+  rawInput = MatrixXuf::Zero(numFeatures, 1);
+  for (featureCount_t f = 0; f < numIndices; ++f) {
+    assert(indices[f] < numFeatures);
+    rawInput(indices[f], 0) = values[f];
+  }
+
+  Map<MatrixXuf> scoresMat(scores, totalScoreCount, 1);
+  MatrixXuf scoresBuf;
+  scoreRawInput(scoresBuf, 1);
+  scoresMat = scoresBuf;
+}
+
+// Bytes of rawInput per block of scoreBatch; the normalized copies of a group take as much
+static const size_t scoreBlockBytes = (size_t)32 << 20;
+
+template<class DataMatType>
+void EnsemblePredictor::scoreColumnBlocks(
+  MatrixXuf& scores,
+  const DataMatType& X)
+{
+  assert(X.rows() == numFeatures);
+  const dataCount_t n = X.cols();
+  const dataCount_t blockColumns = std::max((dataCount_t)1,
+    (dataCount_t)(scoreBlockBytes / (sizeof(FP_TYPE) * numFeatures)));
+
+  scores.resize(totalScoreCount, n);
+  MatrixXuf blockScores;
+  for (dataCount_t begin = 0; begin < n; begin += blockColumns) {
+    const dataCount_t numPoints = std::min(blockColumns, n - begin);
+    rawInput = MatrixXuf(X.middleCols(begin, numPoints));
+    scoreRawInput(blockScores, numPoints);
+    scores.middleCols(begin, numPoints) = blockScores;
+  }
+}
+
+void EnsemblePredictor::scoreBatch(
+  MatrixXuf& scores,
+  const SparseMatrixuf& X)
+{
+  scoreColumnBlocks(scores, X);
+}
+
+void EnsemblePredictor::scoreBatch(
+  MatrixXuf& scores,
+  const MatrixXuf& X)
+{
+  scoreColumnBlocks(scores, X);
+}
@@ -5,6 +5,8 @@
 #define __PROTONN_H__
 
 #include "Data.h"
+#include "quantized.h"
+#include "score_cache.h"
 #include "metrics.h"
 
 namespace EdgeML
@@ -96,14 +98,26 @@ namespace EdgeML
 
       struct ProtoNNParams params;
       struct ProtoNNHyperParams hyperParams;
+
+      //
+      // New id of every input feature when the model was trained on reordered features
+      // (see Data::reorderFeatures), empty otherwise. The columns of W are in the new order;
+      // the predictors renumber input features before scoring.
+      //
+      std::vector<featureCount_t> featurePermutation;
+
       size_t modelStat();
 
       //
       // exportModel assumes that toModel is allocated with modelStat() bytes.
+      // A feature permutation is stored after B, so models without one keep their layout.
       //
       void exportModel(const size_t modelSize, char *const toModel);
       void importModel(const size_t numBytes, const char *const fromModel);
 
+      // W with its columns in the original feature order
+      WMatType WInFeatureOrder() const;
+
 
       ProtoNNModel();
       ProtoNNModel(std::string fromModelFile);
@@ -116,10 +130,11 @@ namespace EdgeML
     class ProtoNNTrainer
     {
       ////////////////////////////////////////////////////////
-      // DO NOT REORDER model and data.
+      // DO NOT REORDER model, ownedData and data.
       // They should be in this order for constructors to work
       ProtoNNModel model;
-      Data data;
+      Data ownedData; // empty when training on shared data
+      Data& data;
       ////////////////////////////////////////////////////////
 
       DataFormat dataformatType;
@@ -128,9 +143,17 @@ namespace EdgeML
       std::string modelDir;
       std::string outDir;
       std::string commandLine;
+      bool isModelInitialized;
+      std::string checkpointPath;
+      int checkpointInterval;
+      int hogwildThreads;
+      FeatureOrdering featureOrdering;
 
       void normalize();
+      // WX = W*Xtrain, on the dense or the sparse storage of the training data
+      void projectXtrain(MatrixXuf& WX) const;
       void initializeModel();
+      FP_TYPE optimize(const bool fixSupport);
 
     public:
         //
@@ -151,8 +174,36 @@ namespace EdgeML
       //
       ProtoNNTrainer(const ProtoNNModel::ProtoNNHyperParams& hyperParams);
 
+      //
+      // Call this constructor if:
+      // 1. Training data is already loaded, finalized and normalized, and is
+      //    shared read-only with other trainers (e.g. a hyperparameter sweep)
+      // 2. You are starting with a new model from scratch
+      // Output files are written to outDir_.
+      //
+      ProtoNNTrainer(
+        const ProtoNNModel::ProtoNNHyperParams& hyperParams,
+        Data& sharedData,
+        const std::string& outDir_);
+
+      //
+      // Call this constructor to warm start from an exported model (see exportModel):
+      // 1. warmStartData holds new (plus e.g. reservoir-sampled old) data, loaded and finalized
+      // 2. It is normalized in place like the data the model was trained on; for
+      //    minMax models, set warmStartData.min/max first (see loadMinMax)
+      // Follow with fineTune(...) rather than train().
+      //
+      ProtoNNTrainer(
+        const size_t numBytes,
+        const char *const fromModel,
+        Data& warmStartData,
+        const std::string& outDir_);
+
       ~ProtoNNTrainer();
 
+      // Loaded, finalized and normalized data; can be handed to the shared-data constructor
+      Data& getData();
+
       void feedDenseData(
         const FP_TYPE *const values,
         const labelCount_t *const labels,
@@ -167,6 +218,14 @@ namespace EdgeML
 
       void finalizeData();
 
+      //
+      // Renumber the features of the loaded, normalized data before training (see
+      // Data::reorderFeatures). The permutation is stored in the model and applied by
+      // the predictors; W exported in ASCII or through exportW* is in the original order.
+      // -X <0|1|2> on the command line does the same.
+      //
+      void reorderFeatures(const FeatureOrdering ordering);
+
       void setFromArgs(const int argc, const char** argv);
 
       void storeParams(
@@ -176,7 +235,46 @@ namespace EdgeML
 
       void createOutputDirs();
 
-      void train();
+      //
+      // Returns the validation accuracy after the last iteration (0 without validation data)
+      //
+      FP_TYPE train();
+
+      //
+      // Short schedule for a warm-started model: iters alternating passes that keep
+      // the sparsity support of W, B and Z fixed. No k-means or re-initialization.
+      // Returns the validation accuracy after the last iteration.
+      //
+      FP_TYPE fineTune(const int iters);
+
+      //
+      // Snapshot the solver to @path every @interval outer iterations. If @path already
+      // holds a snapshot of the same run, train()/fineTune() resume from it.
+      // The snapshot is removed once the run completes. -c <interval> on the command line
+      // does the same with <outDir>/checkpoint.
+      //
+      void enableCheckpointing(const std::string& path, const int interval);
+
+      //
+      // Solve for W, Z and B with @numThreads lock-free Hogwild SGD threads on disjoint
+      // shards of the training data instead of the serial accelerated solver; 1 restores
+      // the serial solver. Runs are no longer deterministic. -H <numThreads> on the
+      // command line does the same.
+      //
+      void enableHogwild(const int numThreads);
+
+      //
+      // Share an initialization (W, B, Z and gamma) between trainers whose
+      // configurations only differ in parameters that initializeModel does not use.
+      // exportInitialization initializes the model first if needed;
+      // after importInitialization, train() does not re-initialize.
+      //
+      void exportInitialization(
+        ProtoNNModel::ProtoNNParams& initParams,
+        FP_TYPE& initGamma);
+      void importInitialization(
+        const ProtoNNModel::ProtoNNParams& initParams,
+        const FP_TYPE& initGamma);
 
       // This exports W, B, Z together in a dense format.
       // Call getModelSize, prealloc buffer, and pass it to exportModel.
@@ -224,6 +322,51 @@ namespace EdgeML
       DataFormat dataformatType;
       Data testData;
       FP_TYPE* dataPoint;	// for scoreSparseDataPoint
+      MatrixXuf pointMin, pointMax; // min-max ranges of the point-wise functions, empty until known
+
+      bool isInt8Requested; // -q 1: the caller should also evaluate an int8 copy of the model
+      bool isBinaryOutput; // -o 1: saveTopKScores writes the binary format of PredictionWriter
+      bool isQuantized;     // score with the int8 copies below instead of model.params
+      QuantizedMatrix WQ, BtQ, ZQ; // BtQ holds one prototype per row
+      MatrixXuf BNormSq;           // squared norms of the prototypes, 1 x m
+      std::vector<int8_t> Xq, WXq, Dq;
+      std::vector<FP_TYPE> quantizedPoint, quantizedScores;
+
+      // Scores of a dense point from the int8 parameters
+      void quantizedScore(FP_TYPE *const scores, const FP_TYPE *const values);
+
+      ScoreCache* scoreCache;  // optional cache of point-wise scores, possibly shared with other predictors
+      bool isScoreCacheOwned;  // set when the cache was created from the -c option
+      uint64_t modelTag;       // fingerprint of the model and quantization, used in cache keys
+
+      // Recompute modelTag; called whenever the scores of a point could change
+      void updateModelTag();
+
+      // Buffers and constants used by scoreDenseDataPoint and scoreSparseDataPoint
+      void allocateScoringBuffers();
+
+      // Scores of a dense point, without the cache
+      void scorePoint(FP_TYPE* scores, const FP_TYPE *const values);
+
+      // Scores of a sparse point, scattered into dataPoint through @permutation (NULL if the
+      // indices are already in the feature order of the model). @isRaw points are normalized
+      // on the way, see normalizedValue.
+      void scoreScatteredPoint(
+        FP_TYPE* scores,
+        const FP_TYPE *const values,
+        const featureCount_t *indices,
+        const featureCount_t numIndices,
+        const featureCount_t *const permutation,
+        const bool isRaw);
+
+      //
+      // Normalization of the point-wise functions, the same as that of the training data
+      // (and of EnsemblePredictor): value @value of feature @f, in file order, of a point whose
+      // values have 1/norm @invNorm. Zeros stay zero, as in sparse data.
+      //
+      FP_TYPE normalizedValue(const featureCount_t f, const FP_TYPE value, const FP_TYPE invNorm) const;
+      // 1/norm of @values for l2 models, else 1
+      FP_TYPE pointInvNorm(const FP_TYPE *const values, const featureCount_t numValues) const;
 
 #ifdef SPARSE_Z_PROTONN
       // for mkl csc_mv call
@@ -261,7 +404,10 @@ namespace EdgeML
         const labelCount_t& numLabels,
         const EdgeML::ProblemFormat& problemType);
 
-      // Not thread safe
+      // Not thread safe. The point-wise functions take raw features in file order. They are
+      // normalized like the training data (min-max once importMinMax is called, or when the
+      // predictor loaded the ranges from the command line), and renumbered here if the model
+      // was trained with reordered features.
       void scoreDenseDataPoint(
         FP_TYPE* scores,
         const FP_TYPE *const values);
@@ -277,6 +423,10 @@ namespace EdgeML
         dataCount_t startIdx,
         dataCount_t batchSize);
 
+      // Min/max of the training data of a min-max normalized model (see loadMinMax),
+      // for the point-wise functions; until then their points are scored as given
+      void importMinMax(const MatrixXuf& min, const MatrixXuf& max);
+
       ResultStruct testBatchWise();
 
       ResultStruct testPointWise();
@@ -285,6 +435,29 @@ namespace EdgeML
 
       void saveTopKScores(std::string filename="", int topk=5);
 
+      //
+      // Quantizes W, B and Z to int8 with per-row scales; all later scoring uses int8 dot
+      // products, with the input, WX and the kernel values quantized per point.
+      // Build with AVX2 or AVX-512 VNNI enabled for SIMD kernels.
+      //
+      void quantizeModel();
+
+      //
+      // Replace the model by the one serialized in @fromModel, for point-wise scoring.
+      // Cached scores of the old model are never returned again.
+      //
+      void swapModel(
+        const size_t numBytes,
+        const char *const fromModel);
+
+      //
+      // Look up and store the scores of scoreDenseDataPoint and scoreSparseDataPoint in @cache.
+      // The cache is not owned and can be shared by predictors on several threads; NULL disables caching.
+      //
+      void setScoreCache(ScoreCache* cache);
+
+      inline bool int8Requested() const { return isInt8Requested; }
+
       void normalize();
     };
   }
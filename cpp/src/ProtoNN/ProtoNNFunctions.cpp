@@ -3,6 +3,11 @@
 
 #include "ProtoNNFunctions.h"
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #ifdef LOGGER
 #define mm LOG_DIAGNOSTIC_MSG(std::string("Calling mm")); mm
@@ -242,6 +247,33 @@ MatrixXuf EdgeML::gaussianKernel(
   return gaussianKernel(B, WX, gamma, 0, WX.cols());
 }
 
+//
+// The B and Z gradients are computed in blocks of prototypes: column block [p, p + len)
+// of either gradient only reads the same columns of D (and of Z and B), so the blocks
+// run in parallel, each with its own scratch. With Cilk, each block calls MKL
+// single-threaded to avoid oversubscription, and then restores the thread's own
+// setting (e.g. the per-job budget of runJobs).
+//
+static const Eigen::Index prototypeBlockSize = 64;
+
+// Returns the MKL thread setting to pass to endPrototypeBlock
+static inline int beginPrototypeBlock(const Eigen::Index numBlocks)
+{
+#ifdef CILK
+  if (numBlocks > 1)
+    return mkl_set_num_threads_local(1);
+#endif
+  return 0;
+}
+
+static inline void endPrototypeBlock(const Eigen::Index numBlocks, const int savedThreads)
+{
+#ifdef CILK
+  if (numBlocks > 1)
+    mkl_set_num_threads_local(savedThreads);
+#endif
+}
+
 MatrixXuf EdgeML::gradL_B(
   const BMatType& B, const LabelMatType& Y, const ZMatType& Z,
   const MatrixXuf& WX, const MatrixXuf& D, const FP_TYPE gamma,
@@ -269,22 +301,12 @@ MatrixXuf EdgeML::gradL_B(
 #endif
   LOG_DIAGNOSTIC(temp);
 
-  MatrixXuf T = MatrixXuf::Zero(D.rows(), D.cols());
-  mm(T, temp, CblasNoTrans, Z, CblasNoTrans, 1.0, 0.0L);
-  timer.nextTime("computing T = temp * Z");
-
-  //DT = D.*T;
-  T.noalias() = T.cwiseProduct(D);
-  timer.nextTime("computing T = T .* D");
-
-  //v = 8 * gamma^2 * (B * sparse(1:m, 1:m, sum(DT, 1)) - WX * DT);
-  MatrixXuf ret = B;
 #if defined(L4)
-  VectorXf colMult = 8.0 * gamma * gamma * T.colwise().sum();
+  const FP_TYPE gradScale = (FP_TYPE)8.0 * gamma * gamma;
 #elif defined(L2)
-  VectorXf colMult = 4.0 * gamma * gamma * T.colwise().sum();
+  const FP_TYPE gradScale = (FP_TYPE)4.0 * gamma * gamma;
 #elif defined(L1)
-  VectorXf colMult = 2.0 * gamma * gamma * T.colwise().sum();
+  const FP_TYPE gradScale = (FP_TYPE)2.0 * gamma * gamma;
 #else
   assert(false);
 #endif 
@@ -292,33 +314,35 @@ MatrixXuf EdgeML::gradL_B(
 #ifdef ROWMAJOR
   LOG_INFO("Warning: Column-scaling in gradL_B may be slow in rowmajor\n");
 #endif
-  // TODO: pfor (or map) and vectorize
-  pfor(Eigen::Index i = 0; i < B.cols(); ++i)
-    ret.col(i).noalias() = ret.col(i) * colMult(i);
-  timer.nextTime("multiplying columns of B");
-
-#if defined(L4)
-  mm(ret,
-    WX, CblasNoTrans,
-    T, CblasNoTrans,
-    -8.0 * gamma * gamma, 1.0,
-    begin, end);
-#elif defined(L2)
-  mm(ret,
-    WX, CblasNoTrans,
-    T, CblasNoTrans,
-    (FP_TYPE)-4.0 * gamma * gamma, (FP_TYPE)1.0,
-    begin, end);
-#elif defined(L1)
-  mm(ret,
-    WX, CblasNoTrans,
-    T, CblasNoTrans,
-    -2.0 * gamma * gamma, 1.0,
-    begin, end);
-#else
-  assert(false);
-#endif
-  timer.nextTime("computing WX * T");
+  const Eigen::Index m = D.cols();
+  const Eigen::Index numBlocks = (m + prototypeBlockSize - 1) / prototypeBlockSize;
+  MatrixXuf ret(B.rows(), m);
+  pfor(Eigen::Index block = 0; block < numBlocks; ++block) {
+    const int savedThreads = beginPrototypeBlock(numBlocks);
+    const Eigen::Index p = block * prototypeBlockSize;
+    const Eigen::Index len = std::min(prototypeBlockSize, m - p);
+
+    //DT = (temp * Z) .* D;
+    const ZMatType ZBlock = Z.middleCols(p, len);
+    MatrixXuf T(D.rows(), len);
+    mm(T, temp, CblasNoTrans, ZBlock, CblasNoTrans, 1.0, 0.0L);
+    T = T.cwiseProduct(D.middleCols(p, len));
+
+    //v = 8 * gamma^2 * (B * sparse(1:m, 1:m, sum(DT, 1)) - WX * DT);
+    const VectorXf colMult = gradScale * T.colwise().sum();
+    MatrixXuf retBlock = MatrixXuf(B.middleCols(p, len));
+    for (Eigen::Index i = 0; i < len; ++i)
+      retBlock.col(i) *= colMult(i);
+    mm(retBlock,
+      WX, CblasNoTrans,
+      T, CblasNoTrans,
+      -gradScale, (FP_TYPE)1.0,
+      begin, end);
+
+    ret.middleCols(p, len) = retBlock;
+    endPrototypeBlock(numBlocks, savedThreads);
+  }
+  timer.nextTime("computing the gradient in blocks of prototypes");
 
   return ret / D.rows();
 }
@@ -386,40 +410,58 @@ MatrixXuf EdgeML::gradL_Z(
   assert(end - begin == D.rows());
   Timer timer("gradL_Z");
   LabelMatType YMiddle = Y.middleCols(begin, end - begin);
-  MatrixXuf ret(YMiddle.rows(), D.cols());
-  mm(ret, YMiddle, CblasNoTrans, D, CblasNoTrans, 1.0, 0.0);
-  timer.nextTime("computing ret = Y*D");
-
-  MatrixXuf DtimesD(D.cols(), D.cols());
-  mm(DtimesD, D, CblasTrans, D, CblasNoTrans, 1.0, 0.0);
-  timer.nextTime("computing DtimesD = D'*D");
+  timer.nextTime("slicing Y");
 
 #ifndef L2
   assert(false);
 #endif
 
 #if defined(L4)
-  mm(ret, Z, CblasNoTrans, DtimesD, CblasNoTrans, 4.0, -4.0);
+  const FP_TYPE gradScale = (FP_TYPE)4.0;
 #elif defined(L2)
-  mm(ret, Z, CblasNoTrans, DtimesD, CblasNoTrans, 2.0, -2.0);
+  const FP_TYPE gradScale = (FP_TYPE)2.0;
 #elif defined(L1)
-  mm(ret, Z, CblasNoTrans, DtimesD, CblasNoTrans, 1.0, -1.0);
+  const FP_TYPE gradScale = (FP_TYPE)1.0;
 #else
   assert(false);
 #endif
 
-  timer.nextTime("computing ret = ret - Z*DtimesD");
+  // ret = gradScale * (Z*D'*D - Y*D), a block of prototypes (columns of D) at a time
+  const Eigen::Index m = D.cols();
+  const Eigen::Index numBlocks = (m + prototypeBlockSize - 1) / prototypeBlockSize;
+  MatrixXuf ret(YMiddle.rows(), m);
+  pfor(Eigen::Index block = 0; block < numBlocks; ++block) {
+    const int savedThreads = beginPrototypeBlock(numBlocks);
+    const Eigen::Index p = block * prototypeBlockSize;
+    const Eigen::Index len = std::min(prototypeBlockSize, m - p);
+
+    const MatrixXuf DBlock = D.middleCols(p, len);
+    MatrixXuf retBlock(YMiddle.rows(), len);
+    mm(retBlock, YMiddle, CblasNoTrans, DBlock, CblasNoTrans, 1.0, 0.0);
+
+    MatrixXuf DtimesD(m, len);
+    mm(DtimesD, D, CblasTrans, DBlock, CblasNoTrans, 1.0, 0.0);
+
+    mm(retBlock, Z, CblasNoTrans, DtimesD, CblasNoTrans, gradScale, -gradScale);
+
+    ret.middleCols(p, len) = retBlock;
+    endPrototypeBlock(numBlocks, savedThreads);
+  }
+  timer.nextTime("computing ret = Z*D'*D - Y*D in blocks of prototypes");
 
   return ret / D.rows();
 }
 
+template<class DataMatType>
 MatrixXuf EdgeML::gradL_W(
   const BMatType& B, const LabelMatType& Y, const ZMatType& Z,
-  const WMatType& W, const SparseMatrixuf& X, const MatrixXuf& D,
+  const WMatType& W, const DataMatType& X, const MatrixXuf& D,
   const FP_TYPE gamma,
-  const Eigen::Index begin, const Eigen::Index end)
+  const Eigen::Index begin, const Eigen::Index end,
+  const SparseMatrixufCSR* XCSR)
 {
   assert(end - begin == D.rows());
+  assert(XCSR == NULL || (XCSR->rows() == X.rows() && XCSR->cols() == X.cols()));
   Timer timer("gradL_W");
   //T = ((Y' - D*Z').^3)*Z;
   MatrixXuf temp = Y.middleCols(begin, end - begin).transpose().eval();
@@ -461,7 +503,7 @@ MatrixXuf EdgeML::gradL_W(
 
   //v = -8 * gamma^2 * (B * DT' - W*(X*sparse(1:n, 1:n, sum(DT, 2))))*X;
   // TODO: Fix this, dont automatically cast to dense
-  SparseMatrixuf XMiddle = X.middleCols(begin, end - begin);
+  DataMatType XMiddle = X.middleCols(begin, end - begin);
   VectorXf colMult = T.rowwise().sum();
 
 #ifdef ROWMAJOR
@@ -481,10 +523,13 @@ MatrixXuf EdgeML::gradL_W(
 
   MatrixXuf ret = MatrixXuf::Zero(W.rows(), W.cols());
 
-  mm(ret,
-    temp, CblasNoTrans,
-    XMiddle, CblasTrans,
-    1.0, 0.0L);
+  if (XCSR != NULL)
+    mmTransCSR(ret, temp, *XCSR, 1.0, 0.0L, begin, end);
+  else
+    mm(ret,
+      temp, CblasNoTrans,
+      XMiddle, CblasTrans,
+      1.0, 0.0L);
 
   //ret = temp * XMiddle.transpose();
   timer.nextTime("computing grad_W = temp * X'");
@@ -492,18 +537,31 @@ MatrixXuf EdgeML::gradL_W(
   return ret / (D.rows());
 }
 
+template<class DataMatType>
 MatrixXuf EdgeML::gradL_W(
   const BMatType& B, const LabelMatType& Y, const ZMatType& Z,
-  const WMatType& W, const SparseMatrixuf& X, const MatrixXuf& D,
+  const WMatType& W, const DataMatType& X, const MatrixXuf& D,
   const FP_TYPE gamma)
 {
   assert(Y.cols() == X.cols() && Y.cols() == D.rows());
   return gradL_W(B, Y, Z, W, X, D, gamma, 0, X.cols());
 }
 
+template MatrixXuf EdgeML::gradL_W<MatrixXuf>(const BMatType&, const LabelMatType&, const ZMatType&,
+  const WMatType&, const MatrixXuf&, const MatrixXuf&, const FP_TYPE,
+  const Eigen::Index, const Eigen::Index, const SparseMatrixufCSR*);
+template MatrixXuf EdgeML::gradL_W<SparseMatrixuf>(const BMatType&, const LabelMatType&, const ZMatType&,
+  const WMatType&, const SparseMatrixuf&, const MatrixXuf&, const FP_TYPE,
+  const Eigen::Index, const Eigen::Index, const SparseMatrixufCSR*);
+template MatrixXuf EdgeML::gradL_W<MatrixXuf>(const BMatType&, const LabelMatType&, const ZMatType&,
+  const WMatType&, const MatrixXuf&, const MatrixXuf&, const FP_TYPE);
+template MatrixXuf EdgeML::gradL_W<SparseMatrixuf>(const BMatType&, const LabelMatType&, const ZMatType&,
+  const WMatType&, const SparseMatrixuf&, const MatrixXuf&, const FP_TYPE);
+
 void EdgeML::hardThrsd(
   MatrixXuf& mat,
-  FP_TYPE sparsity)
+  FP_TYPE sparsity,
+  std::mt19937_64& generator)
 {
   Timer timer("hardThrsd");
   assert(sparsity >= 0.0 && sparsity <= 1.0);
@@ -529,7 +587,7 @@ void EdgeML::hardThrsd(
   else {
     unsigned long long prime = 990377764891511ull;
     assert(prime > matSize);
-    unsigned long long seed = (rand() % 100000);
+    unsigned long long seed = std::uniform_int_distribution<unsigned long long>(0, 99999)(generator);
     FP_TYPE* mat_data = mat.data();
     size_t pick;
     for (dataCount_t i = 0; i < sampleSize; ++i) {
@@ -572,11 +630,137 @@ void EdgeML::hardThrsd(
 #endif
 }
 
-void EdgeML::altMinSGD(
+void EdgeML::projectOnSupport(
+  MatrixXuf& mat,
+  const MatrixXuf& support)
+{
+  assert(mat.rows() == support.rows());
+  assert(mat.cols() == support.cols());
+  mat = (support.array() == (FP_TYPE)0.0).select((FP_TYPE)0.0, mat);
+}
+
+//
+// Solver state of altMinSGD between two outer iterations. The momentum and
+// averaged iterates of accProxSGD do not outlive a call, so they are not part of it.
+//
+struct AltMinSGDState
+{
+  int nextIter;
+  int iters;
+  FP_TYPE armijoW;
+  FP_TYPE armijoZ;
+  FP_TYPE armijoB;
+  FP_TYPE fNew;
+  bool fixSupport;
+};
+
+static void snapshotAltMinSGD(
+  std::vector<char>& snapshot,
+  const AltMinSGDState& state,
+  const EdgeML::ProtoNN::ProtoNNModel& model,
+  const FP_TYPE *const stats,
+  const MatrixXuf& supportW,
+  const MatrixXuf& supportZ,
+  const MatrixXuf& supportB)
+{
+  snapshot.clear();
+  appendToSnapshot(snapshot, state);
+  appendToSnapshot(snapshot, (const char*)stats, sizeof(FP_TYPE) * (9 * state.iters + 3));
+  appendMatrixToSnapshot(snapshot, model.params.W);
+  appendMatrixToSnapshot(snapshot, model.params.Z);
+  appendMatrixToSnapshot(snapshot, model.params.B);
+  if (state.fixSupport) {
+    appendMatrixToSnapshot(snapshot, supportW);
+    appendMatrixToSnapshot(snapshot, supportZ);
+    appendMatrixToSnapshot(snapshot, supportB);
+  }
+}
+
+static void restoreAltMinSGD(
+  const std::vector<char>& snapshot,
+  AltMinSGDState& state,
+  EdgeML::ProtoNN::ProtoNNModel& model,
+  FP_TYPE *const stats,
+  MatrixXuf& supportW,
+  MatrixXuf& supportZ,
+  MatrixXuf& supportB)
+{
+  size_t offset = 0;
+  readFromSnapshot(snapshot, offset, state);
+  if (state.iters != model.hyperParams.iters)
+    checkpointError("Checkpoint belongs to a run with another number of iterations");
+  readFromSnapshot(snapshot, offset, (char*)stats, sizeof(FP_TYPE) * (9 * state.iters + 3));
+  readMatrixFromSnapshot(snapshot, offset, model.params.W, model.params.W.rows(), model.params.W.cols());
+  readMatrixFromSnapshot(snapshot, offset, model.params.Z, model.params.Z.rows(), model.params.Z.cols());
+  readMatrixFromSnapshot(snapshot, offset, model.params.B, model.params.B.rows(), model.params.B.cols());
+  if (state.fixSupport) {
+    readMatrixFromSnapshot(snapshot, offset, supportW, model.params.W.rows(), model.params.W.cols());
+    readMatrixFromSnapshot(snapshot, offset, supportZ, model.params.Z.rows(), model.params.Z.cols());
+    readMatrixFromSnapshot(snapshot, offset, supportB, model.params.B.rows(), model.params.B.cols());
+  }
+  if (offset != snapshot.size())
+    checkpointError("Checkpoint holds more than the state of altMinSGD");
+}
+
+//
+// WX = W*X(:, begin:end) for dense or sparse X
+//
+static void projectData(MatrixXuf& WX, const WMatType& W, const MatrixXuf& X,
+  const Eigen::Index begin, const Eigen::Index end)
+{
+  if (begin == 0 && end == X.cols())
+    mm(WX, W, CblasNoTrans, X, CblasNoTrans, 1.0, 0.0L);
+  else {
+    MatrixXuf XMiddle = X.middleCols(begin, end - begin);
+    mm(WX, W, CblasNoTrans, XMiddle, CblasNoTrans, 1.0, 0.0L);
+  }
+}
+
+static void projectData(MatrixXuf& WX, const WMatType& W, const SparseMatrixuf& X,
+  const Eigen::Index begin, const Eigen::Index end)
+{
+  if (begin == 0 && end == X.cols())
+    mmAdaptive(WX, W, CblasNoTrans, X, CblasNoTrans, 1.0, 0.0L);
+  else {
+    SparseMatrixuf XMiddle = X.middleCols(begin, end - begin);
+    mm(WX, W, CblasNoTrans, XMiddle, CblasNoTrans, 1.0, 0.0L);
+  }
+}
+
+//
+// WX = W*Xtrain(:, begin:end), reading the compressed copy of Xtrain when Data holds one
+//
+template<class DataMatType>
+static void projectXtrain(MatrixXuf& WX, const SparseMatrixuf& W, const EdgeML::Data& data,
+  const DataMatType& Xtrain, const Eigen::Index begin, const Eigen::Index end)
+{
+  projectData(WX, W, Xtrain, begin, end);
+}
+
+template<class DataMatType>
+static void projectXtrain(MatrixXuf& WX, const MatrixXuf& W, const EdgeML::Data& data,
+  const DataMatType& Xtrain, const Eigen::Index begin, const Eigen::Index end)
+{
+  const CompressedSparseMatrix* XCompressed = data.getXtrainCompressed();
+  if (XCompressed != NULL)
+    XCompressed->leftMultiply(WX, W, 1.0, 0.0L, begin, end);
+  else
+    projectData(WX, W, Xtrain, begin, end);
+}
+
+//
+// altMinSGD on data stored as DataMatType
+//
+template<class DataMatType>
+static void altMinSGDOn(
   const EdgeML::Data& data,
   EdgeML::ProtoNN::ProtoNNModel& model,
   FP_TYPE *const stats,
-  const std::string& outDir)
+  const std::string& outDir,
+  const bool fixSupport,
+  const std::string& checkpointPath,
+  const int checkpointInterval,
+  const int hogwildThreads)
 {
   // This allows us to make mkl-blas calls on Eigen matrices   
   assert(sizeof(MKL_INT) == sizeof(Eigen::Index));
@@ -598,6 +782,8 @@ void EdgeML::altMinSGD(
     learning_rate_Z = 0.2; learning_rate_B = 0.2; learning_rate_W = 0.2;
   */
 
+  const DataMatType& Xtrain = data.features<DataMatType>(trainSplit);
+  const DataMatType& Xvalidation = data.features<DataMatType>(validationSplit);
   dataCount_t n = data.Xtrain.cols();
   int         epochs = model.hyperParams.epochs;
   FP_TYPE     sgdTol = (FP_TYPE) 0.02;
@@ -615,48 +801,91 @@ void EdgeML::altMinSGD(
   LOG_INFO("\nComputing model size assuming 4 bytes per entry for matrices with sparsity > 0.5 and 8 bytes per entry for matrices with sparsity <= 0.5 (to store sparse matrices, we require about 4 bytes for the index information)...");
   LOG_INFO("Model size in kB = " + std::to_string(computeModelSizeInkB(model.hyperParams.lambdaW, model.hyperParams.lambdaZ, model.hyperParams.lambdaB, model.params.W, model.params.Z, model.params.B)));
 
+  int startIter = 0;
+  MatrixXuf supportW, supportZ, supportB;
+  std::vector<char> snapshot;
+  CheckpointWriter* checkpointWriter = NULL;
+  if (!checkpointPath.empty()) {
+    assert(checkpointInterval > 0);
+    if (loadCheckpoint(checkpointPath, snapshot)) {
+      AltMinSGDState state;
+      restoreAltMinSGD(snapshot, state, model, stats, supportW, supportZ, supportB);
+      if (state.fixSupport != fixSupport)
+        checkpointError("Checkpoint belongs to a run " + std::string(fixSupport ? "without" : "with") + " a fixed support");
+      startIter = state.nextIter;
+      armijoW = state.armijoW;
+      armijoZ = state.armijoZ;
+      armijoB = state.armijoB;
+      fNew = state.fNew;
+      LOG_INFO("Resuming from checkpoint " + checkpointPath + " at iteration " + std::to_string(startIter));
+    }
+    checkpointWriter = new CheckpointWriter(checkpointPath);
+  }
+
   MatrixXuf WX(model.params.W.rows(), data.Xtrain.cols());
-  mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+  projectXtrain(WX, model.params.W, data, Xtrain, 0, data.Xtrain.cols());
 
   MatrixXuf WXvalidation(model.params.W.rows(), data.Xvalidation.cols());
   if (data.Xvalidation.cols() > 0) {
-    mm(WXvalidation, model.params.W, CblasNoTrans, data.Xvalidation, CblasNoTrans, 1.0, 0.0L);
+    projectData(WXvalidation, model.params.W, Xvalidation, 0, Xvalidation.cols());
   }
 
 #ifdef XML
   dataCount_t numEvalTrain = std::min((dataCount_t)20000, (dataCount_t)data.Xtrain.cols());
   MatrixXuf WX_sub(WX.rows(), numEvalTrain);
   SparseMatrixuf Y_sub(data.Ytrain.rows(), numEvalTrain);
-  SparseMatrixuf X_sub(data.Xtrain.rows(), numEvalTrain);
-  randPick(data.Xtrain, X_sub);
+  DataMatType X_sub(data.Xtrain.rows(), numEvalTrain);
+  randPick(Xtrain, X_sub);
   randPick(data.Ytrain, Y_sub);
 
-  mm(WX_sub, model.params.W, CblasNoTrans, X_sub, CblasNoTrans, 1.0, 0.0L);
+  projectData(WX_sub, model.params.W, X_sub, 0, X_sub.cols());
 
   dataCount_t numEvalValidation= std::min((dataCount_t)10000, (dataCount_t)data.Xvalidation.cols());
   MatrixXuf WXvalidation_sub(WX.rows(), numEvalValidation);
   SparseMatrixuf Yvalidation_sub(data.Yvalidation.rows(), numEvalValidation);
-  SparseMatrixuf Xvalidation_sub(data.Xvalidation.rows(), numEvalValidation);
+  DataMatType Xvalidation_sub(data.Xvalidation.rows(), numEvalValidation);
   if (data.Xvalidation.cols() > 0) {
-    randPick(data.Xvalidation, Xvalidation_sub);
+    randPick(Xvalidation, Xvalidation_sub);
     randPick(data.Yvalidation, Yvalidation_sub);
-    mm(WXvalidation_sub, model.params.W, CblasNoTrans, Xvalidation_sub, CblasNoTrans, 1.0, 0.0L);
+    projectData(WXvalidation_sub, model.params.W, Xvalidation_sub, 0, Xvalidation_sub.cols());
   }
 #endif
 
-  timer.nextTime("starting evaluation");
+  // Every draw of this run comes from its own generator, so concurrent runs do not
+  // share state. It is reseeded at the start of every iteration, so that the draws do
+  // not depend on whether the run is checkpointed or resumed.
+  std::mt19937_64 generator;
 
+  timer.nextTime("starting evaluation");
 
-  LOG_INFO("\nInitial stats...");
+  if (startIter == 0) {
+    LOG_INFO("\nInitial stats...");
 #ifdef XML
-  fNew = batchEvaluate(model.params.Z, Y_sub, Yvalidation_sub, model.params.B, WX_sub, WXvalidation_sub, model.hyperParams.gamma, model.hyperParams.problemType, stats);
+    fNew = batchEvaluate(model.params.Z, Y_sub, Yvalidation_sub, model.params.B, WX_sub, WXvalidation_sub, model.hyperParams.gamma, model.hyperParams.problemType, stats);
 #else 
-  fNew = batchEvaluate(model.params.Z, data.Ytrain, data.Yvalidation, model.params.B, WX, WXvalidation, model.hyperParams.gamma, model.hyperParams.problemType, stats);
+    fNew = batchEvaluate(model.params.Z, data.Ytrain, data.Yvalidation, model.params.B, WX, WXvalidation, model.hyperParams.gamma, model.hyperParams.problemType, stats);
 #endif 
-  timer.nextTime("evaluating");
+    timer.nextTime("evaluating");
+  }
 
   VectorXf eta = VectorXf::Zero(10, 1);
 
+  // Proximal steps: hard thresholding to the target sparsity, or, when fine tuning
+  // a warm-started model, projection onto the support the model came with
+  std::function<void(MatrixXuf&)> proxW = std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaW, std::ref(generator));
+  std::function<void(MatrixXuf&)> proxZ = std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaZ, std::ref(generator));
+  std::function<void(MatrixXuf&)> proxB = std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaB, std::ref(generator));
+  if (fixSupport) {
+    if (startIter == 0) {
+      supportW = MatrixXuf(model.params.W);
+      supportZ = MatrixXuf(model.params.Z);
+      supportB = MatrixXuf(model.params.B);
+    }
+    proxW = [&supportW](MatrixXuf& W) { projectOnSupport(W, supportW); };
+    proxZ = [&supportZ](MatrixXuf& Z) { projectOnSupport(Z, supportZ); };
+    proxB = [&supportB](MatrixXuf& B) { projectOnSupport(B, supportB); };
+  }
+
   MatrixXuf gtmpW(model.params.W.rows(), model.params.W.cols());
   WMatType  Wtmp(model.params.W.rows(), model.params.W.cols());
 
@@ -673,8 +902,10 @@ void EdgeML::altMinSGD(
 #endif
 
   LOG_INFO("\nStarting optimization. Number of outer iterations (altMinSGD) = " + std::to_string(model.hyperParams.iters));
+  const auto optimizationStart = std::chrono::steady_clock::now();
   // for i = 1 : iters
-  for (int i = 0; i < model.hyperParams.iters; ++i) {
+  for (int i = startIter; i < model.hyperParams.iters; ++i) {
+    generator.seed((unsigned long long)(model.hyperParams.seed + i));
     LOG_INFO(
       "\n=========================== " + std::to_string(i) + "\n"
       + "On iter " + std::to_string(i) + "\n" +
@@ -684,29 +915,24 @@ void EdgeML::altMinSGD(
 
 #ifdef BTLS
     etaW = armijoW * btls<WMatType>
-      ([&model, &data] (const WMatType& W, const Eigen::Index begin, const Eigen::Index end) ->FP_TYPE {
+      ([&model, &data, &Xtrain] (const WMatType& W, const Eigen::Index begin, const Eigen::Index end) ->FP_TYPE {
 	MatrixXuf WX = MatrixXuf::Zero(W.rows(), end - begin);
-	SparseMatrixuf XMiddle = data.Xtrain.middleCols(begin, end - begin);
-	mm(WX, W, CblasNoTrans, XMiddle,
-	   CblasNoTrans, 1.0, 0.0L);
+	projectXtrain(WX, W, data, Xtrain, begin, end);
 	return L(model.params.Z, data.Ytrain,
 		 gaussianKernel(model.params.B, WX, model.hyperParams.gamma),
 		 begin, end);
       },
-	[&model, &data]
+	[&model, &data, &Xtrain]
 	(const WMatType& W, const Eigen::Index begin, const Eigen::Index end)
 	->MatrixXuf {
 	MatrixXuf WX = MatrixXuf::Zero(W.rows(), end - begin);
-	SparseMatrixuf XMiddle = data.Xtrain.middleCols(begin, end - begin);
-	mm(WX, W, CblasNoTrans,
-	   XMiddle,
-	   CblasNoTrans, 1.0, 0.0L);
-	return gradL_W(model.params.B, data.Ytrain, model.params.Z, W, data.Xtrain,
+	projectXtrain(WX, W, data, Xtrain, begin, end);
+	return gradL_W(model.params.B, data.Ytrain, model.params.Z, W, Xtrain,
 		       gaussianKernel(model.params.B, WX, model.hyperParams.gamma),
-		       model.hyperParams.gamma, begin, end);
+		       model.hyperParams.gamma, begin, end, data.getXtrainCSR());
       },
-	std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaW),
-	model.params.W, n, bs, (etaW/armijoW)*2);
+	proxW,
+	model.params.W, n, bs, (etaW/armijoW)*2, generator);
 #else
     for (auto j = 0; j < eta.size(); ++j) {
       Eigen::Index idx1 = (j*(Eigen::Index)hessianbs) % n;
@@ -715,18 +941,20 @@ void EdgeML::altMinSGD(
 
       if (idx2 <= idx1) idx2 = n;
 
-      gtmpW = gradL_W(model.params.B, data.Ytrain, model.params.Z, model.params.W, data.Xtrain,
+      gtmpW = gradL_W(model.params.B, data.Ytrain, model.params.Z, model.params.W, Xtrain,
         gaussianKernel(model.params.B, WX, model.hyperParams.gamma, idx1, idx2),
-        model.hyperParams.gamma, idx1, idx2);
+        model.hyperParams.gamma, idx1, idx2, data.getXtrainCSR());
 
       MatrixXuf gtmpWThresh = gtmpW;
-      hardThrsd(gtmpWThresh, model.hyperParams.lambdaW);
+      proxW(gtmpWThresh);
 
       Wtmp = model.params.W
         - 0.001*safeDiv(model.params.W.cwiseAbs().maxCoeff(), gtmpW.cwiseAbs().maxCoeff()) * gtmpWThresh;
-      gtmpW -= gradL_W(model.params.B, data.Ytrain, model.params.Z, Wtmp, data.Xtrain,
-        gaussianKernel(model.params.B, Wtmp*data.Xtrain.middleCols(idx1, idx2 - idx1), model.hyperParams.gamma),
-        model.hyperParams.gamma, idx1, idx2);
+      MatrixXuf WtmpX(Wtmp.rows(), idx2 - idx1);
+      projectData(WtmpX, Wtmp, Xtrain, idx1, idx2);
+      gtmpW -= gradL_W(model.params.B, data.Ytrain, model.params.Z, Wtmp, Xtrain,
+        gaussianKernel(model.params.B, WtmpX, model.hyperParams.gamma),
+        model.hyperParams.gamma, idx1, idx2, data.getXtrainCSR());
 
       if (gtmpW.norm() <= 1e-20L) {
         LOG_WARNING("Difference between consecutive gradients of W has become really low.");
@@ -740,46 +968,43 @@ void EdgeML::altMinSGD(
 #endif
     //LOG_INFO("Step-length estimate for gradW = " + std::to_string(etaW));
 
-    accProxSGD<WMatType>
-      (//[&model.params.Z, &data.Ytrain, &model.params.B, &data.Xtrain, &model.hyperParams] TODO: Figure out the elegant way of getting this to work
-        [&model, &data]
+    std::function<FP_TYPE(const WMatType&, const Eigen::Index, const Eigen::Index)> fW
+      = //[&model.params.Z, &data.Ytrain, &model.params.B, &data.Xtrain, &model.hyperParams] TODO: Figure out the elegant way of getting this to work
+        [&model, &data, &Xtrain]
     (const WMatType& W, const Eigen::Index begin, const Eigen::Index end)
       ->FP_TYPE {
       MatrixXuf WX = MatrixXuf::Zero(W.rows(), end - begin);
-      SparseMatrixuf XMiddle = data.Xtrain.middleCols(begin, end - begin);
-      mm(WX, W, CblasNoTrans,
-        XMiddle,
-        CblasNoTrans, 1.0, 0.0L);
+      projectXtrain(WX, W, data, Xtrain, begin, end);
       return L(model.params.Z, data.Ytrain, gaussianKernel(model.params.B, WX, model.hyperParams.gamma), begin, end);
-    },
-      // [&(model.params.B), &(data.Ytrain), &(model.params.Z), &(data.Xtrain), &(model.hyperParams)]
-      [&model, &data]
+    };
+    std::function<MatrixXuf(const WMatType&, const Eigen::Index, const Eigen::Index)> gradW
+      = // [&(model.params.B), &(data.Ytrain), &(model.params.Z), &(data.Xtrain), &(model.hyperParams)]
+      [&model, &data, &Xtrain]
     (const WMatType& W, const Eigen::Index begin, const Eigen::Index end)
       ->MatrixXuf {
       MatrixXuf WX = MatrixXuf::Zero(W.rows(), end - begin);
-      SparseMatrixuf XMiddle = data.Xtrain.middleCols(begin, end - begin);
-      mm(WX, W, CblasNoTrans,
-        XMiddle,
-        CblasNoTrans, 1.0, 0.0L);
-      return gradL_W(model.params.B, data.Ytrain, model.params.Z, W, data.Xtrain,
+      projectXtrain(WX, W, data, Xtrain, begin, end);
+      return gradL_W(model.params.B, data.Ytrain, model.params.Z, W, Xtrain,
         gaussianKernel(model.params.B, WX, model.hyperParams.gamma),
-        model.hyperParams.gamma, begin, end);
-    },
-      std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaW),
-      model.params.W, epochs, n, bs, etaW, etaUpdate);
+        model.hyperParams.gamma, begin, end, data.getXtrainCSR());
+    };
+    if (hogwildThreads > 1)
+      hogwildProxSGD<WMatType>(fW, gradW, proxW, model.params.W, epochs, n, bs, etaW, etaUpdate, hogwildThreads);
+    else
+      accProxSGD<WMatType>(fW, gradW, proxW, model.params.W, epochs, n, bs, etaW, etaUpdate);
     timer.nextTime("ending gradW");
     //LOG_INFO("Final step-length for gradW = " + std::to_string(etaW));
 
-    mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+    projectXtrain(WX, model.params.W, data, Xtrain, 0, data.Xtrain.cols());
     if (data.Xvalidation.cols() > 0) {
-      mm(WXvalidation, model.params.W, CblasNoTrans, data.Xvalidation, CblasNoTrans, 1.0, 0.0L);
+      projectData(WXvalidation, model.params.W, Xvalidation, 0, Xvalidation.cols());
     }
 
     fOld = fNew;
 #ifdef XML
-    mm(WX_sub, model.params.W, CblasNoTrans, X_sub, CblasNoTrans, 1.0, 0.0L);
+    projectData(WX_sub, model.params.W, X_sub, 0, X_sub.cols());
     if (data.Xvalidation.cols() > 0) {
-      mm(WXvalidation_sub, model.params.W, CblasNoTrans, Xvalidation_sub, CblasNoTrans, 1.0, 0.0L);
+      projectData(WXvalidation_sub, model.params.W, Xvalidation_sub, 0, Xvalidation_sub.cols());
     }
     fNew = batchEvaluate(model.params.Z, Y_sub, Yvalidation_sub, model.params.B, WX_sub, WXvalidation_sub, model.hyperParams.gamma, model.hyperParams.problemType, stats + 9 * i + 3);
 #else 
@@ -819,8 +1044,8 @@ void EdgeML::altMinSGD(
       {return gradL_Z(Z, data.Ytrain,
 		      gaussianKernel(model.params.B, WX, model.hyperParams.gamma, begin, end),
 		      begin, end); },
-	std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaZ),
-       model.params.Z, n, bs, (etaZ/armijoZ)*2);
+	proxZ,
+       model.params.Z, n, bs, (etaZ/armijoZ)*2, generator);
 #else
     for (auto j = 0; j < eta.size(); ++j) { //eta.size(); ++j) {
       Eigen::Index idx1 = (j*(Eigen::Index)hessianbs) % n;
@@ -832,7 +1057,7 @@ void EdgeML::altMinSGD(
         idx1, idx2);
 
       MatrixXuf gtmpZThresh = gtmpZ;
-      hardThrsd(gtmpZThresh, model.hyperParams.lambdaZ);
+      proxZ(gtmpZThresh);
 
       // Below: Ztmp = Z - 0.001*safeDiv(maxAbsVal(Z), gtmpZ.cwiseAbs().maxCoeff()) * gtmpZThresh;
       gtmpZThresh *= (FP_TYPE)-0.001*safeDiv(maxAbsVal(model.params.Z), gtmpZ.cwiseAbs().maxCoeff());
@@ -855,20 +1080,23 @@ void EdgeML::altMinSGD(
 #endif
     //LOG_INFO("Step-length estimate for gradZ = " + std::to_string(etaZ));
     
-    accProxSGD<ZMatType>
-      (//[&model.params.B, &data.Ytrain, &WX, &model.hyperParams] 
+    std::function<FP_TYPE(const ZMatType&, const Eigen::Index, const Eigen::Index)> fZ
+      = //[&model.params.B, &data.Ytrain, &WX, &model.hyperParams] 
         [&model, &data, &WX]
     (const ZMatType& Z, const Eigen::Index begin, const Eigen::Index end)
-      ->FP_TYPE {return L(Z, data.Ytrain, gaussianKernel(model.params.B, WX, model.hyperParams.gamma, begin, end), begin, end); },
-      //[&WX, &data.Ytrain, &model.params.B, &model.hyperParams]
+      ->FP_TYPE {return L(Z, data.Ytrain, gaussianKernel(model.params.B, WX, model.hyperParams.gamma, begin, end), begin, end); };
+    std::function<MatrixXuf(const ZMatType&, const Eigen::Index, const Eigen::Index)> gradZ
+      = //[&WX, &data.Ytrain, &model.params.B, &model.hyperParams]
       [&model, &data, &WX]
     (const ZMatType& Z, const Eigen::Index begin, const Eigen::Index end)
       ->MatrixXuf
     {return gradL_Z(Z, data.Ytrain,
       gaussianKernel(model.params.B, WX, model.hyperParams.gamma, begin, end),
-      begin, end); },
-      std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaZ),
-      model.params.Z, epochs, n, bs, etaZ, etaUpdate);
+      begin, end); };
+    if (hogwildThreads > 1)
+      hogwildProxSGD<ZMatType>(fZ, gradZ, proxZ, model.params.Z, epochs, n, bs, etaZ, etaUpdate, hogwildThreads);
+    else
+      accProxSGD<ZMatType>(fZ, gradZ, proxZ, model.params.Z, epochs, n, bs, etaZ, etaUpdate);
     timer.nextTime("ending gradZ");
     //LOG_INFO("Final step-length for gradZ = " + std::to_string(etaZ));
 
@@ -912,8 +1140,8 @@ void EdgeML::altMinSGD(
       {return gradL_B(B, data.Ytrain, model.params.Z, WX,
 		      gaussianKernel(B, WX, model.hyperParams.gamma, begin, end),
 		      model.hyperParams.gamma, begin, end); },
-       std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaB),
-       model.params.B, n, bs, (etaB/armijoB)*2);
+       proxB,
+       model.params.B, n, bs, (etaB/armijoB)*2, generator);
 #else    
     for (auto j = 0; j < eta.size(); ++j) {
       Eigen::Index idx1 = (j*(Eigen::Index)hessianbs) % n;
@@ -925,7 +1153,7 @@ void EdgeML::altMinSGD(
         model.hyperParams.gamma, idx1, idx2);
 
       MatrixXuf gtmpBThresh = gtmpB;
-      hardThrsd(gtmpBThresh, model.hyperParams.lambdaB);
+      proxB(gtmpBThresh);
 
       Btmp = model.params.B - 0.001*safeDiv(model.params.B.cwiseAbs().maxCoeff(), gtmpB.cwiseAbs().maxCoeff())*gtmpBThresh;
 
@@ -946,20 +1174,23 @@ void EdgeML::altMinSGD(
 #endif
     //LOG_INFO("Step-length estimate for gradB = " + std::to_string(etaB));
 
-    accProxSGD<BMatType>
-      (//[&model.params.Z, &data.Ytrain, &WX, &model.hyperParams] 
+    std::function<FP_TYPE(const BMatType&, const Eigen::Index, const Eigen::Index)> fB
+      = //[&model.params.Z, &data.Ytrain, &WX, &model.hyperParams] 
         [&model, &data, &WX]
     (const BMatType& B, const Eigen::Index begin, const Eigen::Index end)
-      ->FP_TYPE {return L(model.params.Z, data.Ytrain, gaussianKernel(B, WX, model.hyperParams.gamma, begin, end), begin, end); },
-      //[&WX, &data.Ytrain, &model.params.Z, &model.hyperParams]
+      ->FP_TYPE {return L(model.params.Z, data.Ytrain, gaussianKernel(B, WX, model.hyperParams.gamma, begin, end), begin, end); };
+    std::function<MatrixXuf(const BMatType&, const Eigen::Index, const Eigen::Index)> gradB
+      = //[&WX, &data.Ytrain, &model.params.Z, &model.hyperParams]
       [&model, &data, &WX]
     (const BMatType& B, const Eigen::Index begin, const Eigen::Index end)
       ->MatrixXuf
     {return gradL_B(B, data.Ytrain, model.params.Z, WX,
       gaussianKernel(B, WX, model.hyperParams.gamma, begin, end),
-      model.hyperParams.gamma, begin, end); },
-      std::bind(hardThrsd, std::placeholders::_1, model.hyperParams.lambdaB),
-      model.params.B, epochs, n, bs, etaB, etaUpdate);
+      model.hyperParams.gamma, begin, end); };
+    if (hogwildThreads > 1)
+      hogwildProxSGD<BMatType>(fB, gradB, proxB, model.params.B, epochs, n, bs, etaB, etaUpdate, hogwildThreads);
+    else
+      accProxSGD<BMatType>(fB, gradB, proxB, model.params.B, epochs, n, bs, etaB, etaUpdate);
     timer.nextTime("ending gradB");
     //LOG_INFO("Final step-length for gradB = " + std::to_string(etaB));
 
@@ -988,9 +1219,41 @@ void EdgeML::altMinSGD(
     f << model.params.B.format(eigen_tsv);
     f.close();
 #endif 
+
+    // Wall time against the accuracies above, e.g. to compare the serial and Hogwild solvers
+    LOG_INFO("Optimization time after iteration " + std::to_string(i) + ": "
+      + std::to_string(std::chrono::duration<double>(std::chrono::steady_clock::now() - optimizationStart).count()) + " s");
+
+    if (checkpointWriter != NULL && (i + 1) % checkpointInterval == 0 && i + 1 < model.hyperParams.iters) {
+      snapshotAltMinSGD(snapshot,
+        AltMinSGDState{ i + 1, model.hyperParams.iters, armijoW, armijoZ, armijoB, fNew, fixSupport },
+        model, stats, supportW, supportZ, supportB);
+      checkpointWriter->submit(snapshot);
+    }
+  }
+
+  if (checkpointWriter != NULL) {
+    delete checkpointWriter; // waits for the pending snapshot
+    std::remove(checkpointPath.c_str());
   }
 }
 
+void EdgeML::altMinSGD(
+  const EdgeML::Data& data,
+  EdgeML::ProtoNN::ProtoNNModel& model,
+  FP_TYPE *const stats,
+  const std::string& outDir,
+  const bool fixSupport,
+  const std::string& checkpointPath,
+  const int checkpointInterval,
+  const int hogwildThreads)
+{
+  if (data.isDense(trainSplit))
+    altMinSGDOn<MatrixXuf>(data, model, stats, outDir, fixSupport, checkpointPath, checkpointInterval, hogwildThreads);
+  else
+    altMinSGDOn<SparseMatrixuf>(data, model, stats, outDir, fixSupport, checkpointPath, checkpointInterval, hogwildThreads);
+}
+
 // function v = accuracy(Ytrue, D, Z, k)
 // We have set k = inf permanently
 // computes accuracy for binary/multiclass datasets, and prec1, prec3, prec5 for multilabel datasets
@@ -1088,7 +1351,8 @@ FP_TYPE EdgeML::btls(std::function<FP_TYPE(const ParamType&,
   ParamType& param,
   const dataCount_t& n,
   const dataCount_t& bs,
-  FP_TYPE initialStepSizeEstimate)
+  FP_TYPE initialStepSizeEstimate,
+  std::mt19937_64& generator)
 {
   Timer timer("btls");
   Logger logger("btls");
@@ -1109,7 +1373,7 @@ FP_TYPE EdgeML::btls(std::function<FP_TYPE(const ParamType&,
   
   Eigen::Index randStartIndex; 
   if (n > bs) 
-    randStartIndex = rand()%(n-bs);
+    randStartIndex = std::uniform_int_distribution<Eigen::Index>(0, n - bs - 1)(generator);
   else
     randStartIndex = 0;
   
@@ -1243,3 +1507,149 @@ void EdgeML::accProxSGD(std::function<FP_TYPE(const ParamType&,
   param = paramTailAverage;
   eta = stepSize;
 }
+
+// Minibatch updates between two projections of the shared parameter in hogwildProxSGD
+static const uint64_t hogwildProjectInterval = 16;
+
+template<class ParamType>
+void EdgeML::hogwildProxSGD(std::function<FP_TYPE(const ParamType&,
+  const Eigen::Index, const Eigen::Index)> f,
+  std::function<MatrixXuf(const ParamType&,
+    const Eigen::Index, const Eigen::Index)> gradf,
+  std::function<void(MatrixXuf&)> prox,
+  ParamType& param,
+  const int& epochs,
+  const dataCount_t& n,
+  const dataCount_t& bs,
+  FP_TYPE eta,
+  const int& etaUpdate,
+  const int& numThreads)
+{
+  Timer timer("hogwildProxSGD");
+  assert(bs <= n);
+
+  // Every shard needs at least one full minibatch
+  const int numShards = (int)std::min((dataCount_t)numThreads, n / bs);
+  if (numShards < 2) {
+    LOG_INFO("Too few minibatches for Hogwild shards; falling back to accProxSGD.");
+    accProxSGD<ParamType>(f, gradf, prox, param, epochs, n, bs, eta, etaUpdate);
+    return;
+  }
+
+  const Eigen::Index rows = param.rows(), cols = param.cols();
+  const Eigen::Index size = rows * cols;
+
+  // The shared iterate. Relaxed atomic loads and stores compile to plain moves, but keep
+  // the unsynchronized reads and writes of the workers well defined.
+  MatrixXuf current(rows, cols);
+  typeMismatchAssign(current, param);
+  std::unique_ptr<std::atomic<FP_TYPE>[]> shared(new std::atomic<FP_TYPE>[size]);
+  for (Eigen::Index j = 0; j < size; ++j)
+    shared[j].store(current.data()[j], std::memory_order_relaxed);
+
+  uint64_t totalUpdates = 0;
+  for (int s = 0; s < numShards; ++s) {
+    const dataCount_t shardSize = n * (s + 1) / numShards - n * s / numShards;
+    totalUpdates += ((uint64_t)shardSize * (uint64_t)epochs) / (uint64_t)bs;
+  }
+
+  std::atomic<uint64_t> numUpdates(0);
+  std::atomic<int> numRunning(numShards);
+  std::mutex mutex;
+  std::condition_variable progress;
+  auto notifyCoordinator = [&]() {
+    { std::lock_guard<std::mutex> lock(mutex); }
+    progress.notify_one();
+  };
+
+  auto worker = [&](const int s) {
+    const dataCount_t shardBegin = n * s / numShards;
+    const dataCount_t shardEnd = n * (s + 1) / numShards;
+    const dataCount_t shardSize = shardEnd - shardBegin;
+    const uint64_t iters = ((uint64_t)shardSize * (uint64_t)epochs) / (uint64_t)bs;
+
+    MatrixXuf local(rows, cols), grad;
+    ParamType localParam;
+    // The shards run concurrently, so each calls MKL single-threaded
+    const int savedThreads = mkl_set_num_threads_local(1);
+    FP_TYPE stepSize = eta;
+    for (uint64_t i = 0; i < iters; ++i) {
+      Eigen::Index idx1 = shardBegin + (i * bs) % shardSize;
+      Eigen::Index idx2 = shardBegin + ((i + 1) * bs) % shardSize;
+      if (idx2 <= idx1) idx2 = shardEnd;
+
+      switch (etaUpdate) {
+      case -1:
+        stepSize = safeDiv(eta, (1 + (FP_TYPE)0.2 * ((FP_TYPE)i + (FP_TYPE)1.0)));
+        break;
+      case 0:
+        stepSize = safeDiv(eta, pow((FP_TYPE)i + (FP_TYPE)1.0, (FP_TYPE)0.5));
+        break;
+      }
+
+      for (Eigen::Index j = 0; j < size; ++j)
+        local.data()[j] = shared[j].load(std::memory_order_relaxed);
+      typeMismatchAssign(localParam, local);
+
+      grad = gradf(localParam, idx1, idx2);
+
+      for (Eigen::Index j = 0; j < size; ++j)
+        if (grad.data()[j] != (FP_TYPE)0.0)
+          shared[j].store(shared[j].load(std::memory_order_relaxed) - stepSize * grad.data()[j],
+            std::memory_order_relaxed);
+
+      if (++numUpdates % hogwildProjectInterval == 0)
+        notifyCoordinator();
+    }
+    mkl_set_num_threads_local(savedThreads);
+
+    --numRunning;
+    notifyCoordinator();
+  };
+
+  std::vector<std::thread> workers;
+  for (int s = 0; s < numShards; ++s)
+    workers.push_back(std::thread(worker, s));
+  timer.nextTime("starting workers");
+
+  // Coordinator: project the shared iterate and average the projections of the second half
+  auto project = [&]() {
+    for (Eigen::Index j = 0; j < size; ++j)
+      current.data()[j] = shared[j].load(std::memory_order_relaxed);
+    prox(current);
+    for (Eigen::Index j = 0; j < size; ++j)
+      shared[j].store(current.data()[j], std::memory_order_relaxed);
+  };
+
+  MatrixXuf tailAverage = MatrixXuf::Zero(rows, cols);
+  FP_TYPE numAveraged = 0;
+  uint64_t nextProjection = hogwildProjectInterval;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      progress.wait(lock, [&]() { return numUpdates.load() >= nextProjection || numRunning.load() == 0; });
+    }
+    if (numRunning.load() == 0)
+      break;
+    nextProjection = numUpdates.load() + hogwildProjectInterval;
+
+    project();
+    if (2 * numUpdates.load() >= totalUpdates) {
+      numAveraged += 1;
+      tailAverage += safeDiv((FP_TYPE)1.0, numAveraged) * (current - tailAverage);
+    }
+  }
+
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  timer.nextTime("running workers");
+
+  project();
+  numAveraged += 1;
+  tailAverage += safeDiv((FP_TYPE)1.0, numAveraged) * (current - tailAverage);
+  prox(tailAverage);
+  typeMismatchAssign(param, tailAverage);
+
+  LOG_INFO("Hogwild SGD: " + std::to_string(numUpdates.load()) + " minibatch updates on "
+    + std::to_string(numShards) + " threads");
+}
@@ -8,6 +8,7 @@
 #include "blas_routines.h"
 #include "par_utils.h"
 #include "cluster.h"
+#include "checkpoint.h"
 #include "ProtoNN.h"
 
 namespace EdgeML
@@ -137,24 +138,29 @@ namespace EdgeML
   // Returns the gradient of @B
   // Input: @B, @Y, @Z, @X, @W can be CSR or CSC
   // Input: @D=gaussianKernel
+  // Input: @X is MatrixXuf or SparseMatrixuf, following the storage of the data (see Data::isDense)
+  // Input: @XCSR, if not NULL, a CSR copy of a sparse @X used for the product with X^T (see Data::getXtrainCSR)
   //
+  template<class DataMatType>
   MatrixXuf gradL_W(
     const BMatType& B,
     const LabelMatType& Y,
     const ZMatType& Z,
     const WMatType& W,
-    const SparseMatrixuf& X,
+    const DataMatType& X,
     const MatrixXuf& D,
     const FP_TYPE gamma,
     const Eigen::Index begin,
-    const Eigen::Index end);
+    const Eigen::Index end,
+    const SparseMatrixufCSR* XCSR = NULL);
 
+  template<class DataMatType>
   MatrixXuf gradL_W(
     const BMatType& B,
     const LabelMatType& Y,
     const ZMatType& Z,
     const WMatType& W,
-    const SparseMatrixuf& X,
+    const DataMatType& X,
     const MatrixXuf& D,
     const FP_TYPE gamma);
 
@@ -162,16 +168,30 @@ namespace EdgeML
   // Returns sparsified version of @mat, retaining only the top sparsity-many values
   // @mat: Matrix to be thresholded and returned
   // @sparsity: ratio of non-zero entries to be retained
+  // @generator: picks the entries the threshold is estimated from, for large matrices
   //
-  void hardThrsd(MatrixXuf& mat, FP_TYPE sparsity);
+  void hardThrsd(MatrixXuf& mat, FP_TYPE sparsity, std::mt19937_64& generator);
+
+  //
+  // Zeroes the entries of @mat that are zero in @support
+  //
+  void projectOnSupport(MatrixXuf& mat, const MatrixXuf& support);
 
 
   // uses accelerated proximal stochastic gradient descent
+  // @fixSupport: keep the current sparsity pattern of W, B, Z instead of hard thresholding (warm starts)
+  // @checkpointPath: if non-empty, snapshot the solver every @checkpointInterval outer iterations
+  //                  and resume from an existing snapshot; the file is removed once training completes
+  // @hogwildThreads: if > 1, solve for W, Z and B with hogwildProxSGD on that many threads
   void altMinSGD(
     const EdgeML::Data& data,
     EdgeML::ProtoNN::ProtoNNModel& model,
     FP_TYPE *const stats,
-    const std::string& outDir);
+    const std::string& outDir,
+    const bool fixSupport = false,
+    const std::string& checkpointPath = "",
+    const int checkpointInterval = 1,
+    const int hogwildThreads = 0);
 
   // ParamType is either MatrixXuf or SparseMatrixuf
   template <class ParamType>
@@ -188,6 +208,30 @@ namespace EdgeML
     FP_TYPE eta,
     const int& etaUpdate);
 
+  //
+  // Hogwild-style proximal SGD: @numThreads threads each take plain SGD steps on
+  // their own shard of the n points and write the non-zero entries of their updates into a
+  // shared copy of @param without locks. The calling thread applies @prox to the shared copy
+  // every few minibatches, tail-averages the projected iterates of the second half of the
+  // run, and projects the average once more at the end. No momentum; the step size follows
+  // @etaUpdate per thread like in accProxSGD. Falls back to accProxSGD when the data has too
+  // few minibatches for two shards. @f is only used by the fallback.
+  //
+  template <class ParamType>
+  void hogwildProxSGD(
+    std::function<FP_TYPE(const ParamType&,
+      const Eigen::Index, const Eigen::Index)> f,
+    std::function<MatrixXuf(const ParamType&,
+      const Eigen::Index, const Eigen::Index)> gradf,
+    std::function<void(MatrixXuf&)> prox,
+    ParamType& param,
+    const int& epochs,
+    const dataCount_t& n,
+    const dataCount_t& bs,
+    FP_TYPE eta,
+    const int& etaUpdate,
+    const int& numThreads);
+
   template<class ParamType>
     FP_TYPE btls(std::function<FP_TYPE(const ParamType&,
       const Eigen::Index, const Eigen::Index)> f,
@@ -197,6 +241,7 @@ namespace EdgeML
     ParamType& param,
     const dataCount_t& n,
     const dataCount_t& bs,
-    FP_TYPE initialStepSizeEstimate);
+    FP_TYPE initialStepSizeEstimate,
+    std::mt19937_64& generator);
 }
 #endif
@@ -103,7 +103,6 @@ void ProtoNNModel::ProtoNNHyperParams::finalizeHyperParams()
   assert(problemType != undefinedProblem && "problem not specified as binary, multiclass or multilabel. Please use -C flag. ");
   assert(normalizationType != undefinedNormalization);
 
-  srand(seed);
   isHyperParamInitialized = true;
   LOG_INFO("Passed.");
 }
@@ -189,6 +188,9 @@ void ProtoNNModel::ProtoNNHyperParams::setHyperParamsFromArgs(const int argc, co
       case 'O':
       case 'F':
       case 'M':
+      case 'c':
+      case 'H':
+      case 'X':
         break;
 
       default:
@@ -226,7 +228,10 @@ void ProtoNNModel::ProtoNNHyperParams::exitWithHelp()
 
   LOG_INFO("-T    : [Optional] Total number of optimization iterations. [Default:  20]");
   LOG_INFO("-E    : [Optional] Number of epochs (complete see-through's) of the data for each iteration, and each parameter. [Default:  20]");
-  LOG_INFO("-N    : [Optional] Normalization. Default: 0 (No Normalization), 1 (Min-Max Normalization), 2 (L2-Normalization)\n");
+  LOG_INFO("-N    : [Optional] Normalization. Default: 0 (No Normalization), 1 (Min-Max Normalization), 2 (L2-Normalization)");
+  LOG_INFO("-c    : [Optional] Checkpoint the solver to <outDir>/checkpoint every c iterations; a rerun with the same arguments resumes from it. [Default:  off]");
+  LOG_INFO("-H    : [Optional] Train with lock-free Hogwild SGD on H threads, each over its own shard of the training data; not deterministic. [Default:  0 (serial)]");
+  LOG_INFO("-X    : [Optional] Renumber the features for locality in W: 0 (file order), 1 (most frequent first), 2 (reverse Cuthill-McKee on feature co-occurrence). Stored in the model. [Default:  0]\n");
 
   exit(1);
 }
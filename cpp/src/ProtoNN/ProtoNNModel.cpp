@@ -73,6 +73,7 @@ size_t ProtoNNModel::modelStat()
 #endif
   offset += sizeof(FP_TYPE) * params.W.rows() * params.W.cols();
   offset += sizeof(FP_TYPE) * params.B.rows() * params.B.cols();
+  offset += sizeof(featureCount_t) * featurePermutation.size();
   return offset;
 }
 
@@ -114,6 +115,12 @@ void ProtoNNModel::exportModel(
 
   memcpy(toModel + offset, params.B.data(), sizeof(FP_TYPE) * params.B.rows() * params.B.cols());
   offset += sizeof(FP_TYPE) * params.B.rows() * params.B.cols();
+
+  if (!featurePermutation.empty()) {
+    assert(featurePermutation.size() == hyperParams.D);
+    memcpy(toModel + offset, featurePermutation.data(), sizeof(featureCount_t) * featurePermutation.size());
+    offset += sizeof(featureCount_t) * featurePermutation.size();
+  }
 }
 
 void ProtoNNModel::importModel(const size_t numBytes, const char *const fromModel)
@@ -139,5 +146,25 @@ void ProtoNNModel::importModel(const size_t numBytes, const char *const fromMode
 
   memcpy(params.B.data(), fromModel + offset, sizeof(FP_TYPE) * params.B.rows() * params.B.cols());
   offset += sizeof(FP_TYPE) * params.B.rows() * params.B.cols();
+
+  featurePermutation.clear();
+  if (numBytes > offset) {
+    assert(numBytes == offset + sizeof(featureCount_t) * hyperParams.D);
+    featurePermutation.resize(hyperParams.D);
+    memcpy(featurePermutation.data(), fromModel + offset, sizeof(featureCount_t) * hyperParams.D);
+    offset += sizeof(featureCount_t) * hyperParams.D;
+  }
+}
+
+WMatType ProtoNNModel::WInFeatureOrder() const
+{
+  if (featurePermutation.empty())
+    return params.W;
+
+  // Column j of W belongs to the original feature i with featurePermutation[i] == j
+  Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, sparseIndex_t> P(hyperParams.D);
+  for (featureCount_t i = 0; i < hyperParams.D; ++i)
+    P.indices()[i] = (sparseIndex_t)featurePermutation[i];
+  return WMatType(params.W * P);
 }
 
@@ -3,6 +3,7 @@
 
 #include "blas_routines.h"
 #include "Data.h"
+#include "prediction_writer.h"
 #include "ProtoNNFunctions.h"
 
 
@@ -18,6 +19,11 @@ ProtoNNPredictor::ProtoNNPredictor(
   ntest = 0;
   dataformatType = undefinedData; 
   dataPoint = NULL;
+  isInt8Requested = false;
+  isBinaryOutput = false;
+  isQuantized = false;
+  scoreCache = NULL;
+  isScoreCacheOwned = false;
   
   commandLine = "";
   for (int i = 0; i < argc; ++i)
@@ -61,37 +67,30 @@ ProtoNNPredictor::ProtoNNPredictor(
   testData.finalizeData();
 
   normalize();
+  if (!model.featurePermutation.empty())
+    testData.permuteFeatures(model.featurePermutation);
 
   // if batchSize is not set, then we want to do point-wise prediction
-  if (batchSize == 0){
-    WX = MatrixXuf::Zero(model.hyperParams.d, 1);
-    WXColSum = MatrixXuf::Zero(1, 1);
-    D = MatrixXuf::Zero(1, model.hyperParams.m);
-
-    BColSum = MatrixXuf::Zero(1, model.hyperParams.m);
-    BAccumulator = MatrixXuf::Constant(1, model.hyperParams.d, 1.0);
-    B_B = model.params.B.cwiseProduct(model.params.B);
-    mm(BColSum, BAccumulator, CblasNoTrans, B_B, CblasNoTrans, 1.0, 0.0L);
-
-    gammaSq = model.hyperParams.gamma * model.hyperParams.gamma;
-    gammaSqRow = MatrixXuf::Constant(1, model.hyperParams.m, -gammaSq);
-    gammaSqCol = MatrixXuf::Constant(WX.cols(), 1, -gammaSq);
-
-    dataPoint = new FP_TYPE[model.hyperParams.D];
-  }
-  
-#ifdef SPARSE_Z_PROTONN
-  ZRows = model.params.Z.rows();
-  ZCols = model.params.Z.cols();
-  alpha = 1.0;
-  beta = 0.0;
-#endif
+  if (batchSize == 0)
+    allocateScoringBuffers();
+  updateModelTag();
 }
 
 ProtoNNPredictor::ProtoNNPredictor(
   const size_t numBytes,
   const char *const fromModel)
-  : model(numBytes, fromModel)
+  : model(numBytes, fromModel),
+  isInt8Requested(false),
+  isBinaryOutput(false),
+  isQuantized(false),
+  scoreCache(NULL),
+  isScoreCacheOwned(false)
+{
+  allocateScoringBuffers();
+  updateModelTag();
+}
+
+void ProtoNNPredictor::allocateScoringBuffers()
 {
   // Set to 0 and use in scoring function 
   WX = MatrixXuf::Zero(model.hyperParams.d, 1);
@@ -117,6 +116,42 @@ ProtoNNPredictor::ProtoNNPredictor(
 #endif
 }
 
+void ProtoNNPredictor::swapModel(
+  const size_t numBytes,
+  const char *const fromModel)
+{
+  if (dataPoint)
+    delete[] dataPoint;
+
+  model = ProtoNNModel(numBytes, fromModel);
+  allocateScoringBuffers();
+  isQuantized = false;
+  updateModelTag();
+}
+
+void ProtoNNPredictor::updateModelTag()
+{
+  uint64_t tag = hashMatrix(model.params.W, 0);
+  tag = hashMatrix(model.params.B, tag);
+  tag = hashMatrix(model.params.Z, tag);
+  tag = hashBytes(&model.hyperParams.gamma, sizeof(model.hyperParams.gamma), tag);
+  tag = hashMatrix(pointMin, tag);
+  tag = hashMatrix(pointMax, tag);
+  if (!model.featurePermutation.empty())
+    tag = hashBytes(model.featurePermutation.data(), sizeof(featureCount_t)*model.featurePermutation.size(), tag);
+  modelTag = hashBytes(&isQuantized, sizeof(isQuantized), tag);
+}
+
+void ProtoNNPredictor::setScoreCache(ScoreCache* cache)
+{
+  if (isScoreCacheOwned) {
+    scoreCache->logStats();
+    delete scoreCache;
+    isScoreCacheOwned = false;
+  }
+  scoreCache = cache;
+}
+
 void ProtoNNPredictor::createOutputDirs()
 {
   std::string subdirName = model.hyperParams.subdirName();
@@ -228,6 +263,21 @@ void ProtoNNPredictor::setFromArgs(const int argc, const char** argv)
           batchSize = strtol(argv[i], NULL, 0);
           break;
 
+        case 'q':
+          isInt8Requested = strtol(argv[i], NULL, 0) != 0;
+          break;
+
+        case 'o':
+          isBinaryOutput = strtol(argv[i], NULL, 0) != 0;
+          break;
+
+        case 'c':
+          if (strtod(argv[i], NULL) > 0) {
+            setScoreCache(new ScoreCache((size_t)(strtod(argv[i], NULL) * 1024 * 1024)));
+            isScoreCacheOwned = true;
+          }
+          break;
+
 /*
         case 'P':
         case 'C':
@@ -263,6 +313,7 @@ ProtoNNPredictor::~ProtoNNPredictor()
 {
   if(dataPoint)
     delete[] dataPoint;
+  setScoreCache(NULL);
 }
 
 FP_TYPE ProtoNNPredictor::testDenseDataPoint(
@@ -280,7 +331,11 @@ FP_TYPE ProtoNNPredictor::testDenseDataPoint(
   FP_TYPE* features = Xtest.data();
   FP_TYPE* currentLabels = Ytest.data();
 
-  memcpy(features, values, sizeof(FP_TYPE)*model.hyperParams.D);
+  if (model.featurePermutation.empty())
+    memcpy(features, values, sizeof(FP_TYPE)*model.hyperParams.D);
+  else
+    for (featureCount_t f = 0; f < model.hyperParams.D; ++f)
+      features[model.featurePermutation[f]] = values[f];
   for (labelCount_t id = 0; id < num_labels; id = id + 1) {
     assert(labels[id] < model.hyperParams.l);
     currentLabels[labels[id]] = 1; // TODO: Figure something elegant instead of casting
@@ -310,10 +365,82 @@ void ProtoNNPredictor::RBF()
   parallelExp(D);
 }
 
+void ProtoNNPredictor::quantizeModel()
+{
+  const MatrixXuf B = model.params.B;
+  WQ.quantize(MatrixXuf(model.params.W));
+  BtQ.quantize(B.transpose());
+  ZQ.quantize(MatrixXuf(model.params.Z));
+  BNormSq = B.cwiseProduct(B).colwise().sum();
+
+  Xq.assign(int8PaddedLength(model.hyperParams.D), 0);
+  WXq.assign(int8PaddedLength(model.hyperParams.d), 0);
+  Dq.assign(int8PaddedLength(model.hyperParams.m), 0);
+  quantizedPoint.assign(model.hyperParams.D, 0);
+  quantizedScores.assign(model.hyperParams.l, 0);
+  isQuantized = true;
+  updateModelTag();
+
+  LOG_INFO("Quantized the model to int8 (" + std::string(int8KernelName()) + " kernel): "
+    + std::to_string(WQ.sizeInBytes() + BtQ.sizeInBytes() + ZQ.sizeInBytes()) + " bytes");
+}
+
+void ProtoNNPredictor::quantizedScore(
+  FP_TYPE *const scores,
+  const FP_TYPE *const values)
+{
+  const Eigen::Index d = model.hyperParams.d;
+  const Eigen::Index m = model.hyperParams.m;
+  MatrixXuf projected(d, 1), kernel(m, 1);
+
+  const FP_TYPE xScale = quantizeVector(values, model.hyperParams.D, Xq.data());
+  WQ.gemv(projected.data(), Xq.data(), xScale);
+
+  // ||b_j - WX||^2 = ||b_j||^2 - 2 b_j.WX + ||WX||^2, with the cross terms in int8
+  const FP_TYPE WXNormSq = projected.squaredNorm();
+  const FP_TYPE WXScale = quantizeVector(projected.data(), d, WXq.data());
+  BtQ.gemv(kernel.data(), WXq.data(), WXScale);
+  const FP_TYPE gammaSquared = model.hyperParams.gamma * model.hyperParams.gamma;
+  for (Eigen::Index j = 0; j < m; ++j)
+    kernel(j, 0) = exp(-gammaSquared * std::max((FP_TYPE)0.0, BNormSq(0, j) - (FP_TYPE)2.0 * kernel(j, 0) + WXNormSq));
+
+  const FP_TYPE kernelScale = quantizeVector(kernel.data(), m, Dq.data());
+  ZQ.gemv(scores, Dq.data(), kernelScale);
+}
+
 void ProtoNNPredictor::scoreDenseDataPoint(
   FP_TYPE* scores,
   const FP_TYPE *const values)
 {
+  if (scoreCache != NULL
+    && scoreCache->lookup(modelTag, values, NULL, model.hyperParams.D, scores, model.hyperParams.l))
+    return;
+
+  const NormalizationFormat normalizationType = model.hyperParams.normalizationType;
+  const bool isNormalized = normalizationType == l2 || (normalizationType == minMax && pointMin.rows() > 0);
+  if (!isNormalized && model.featurePermutation.empty())
+    scorePoint(scores, values);
+  else {
+    const FP_TYPE invNorm = pointInvNorm(values, model.hyperParams.D);
+    for (featureCount_t f = 0; f < model.hyperParams.D; ++f)
+      dataPoint[model.featurePermutation.empty() ? f : model.featurePermutation[f]]
+        = normalizedValue(f, values[f], invNorm);
+    scorePoint(scores, dataPoint);
+  }
+
+  if (scoreCache != NULL)
+    scoreCache->insert(modelTag, values, NULL, model.hyperParams.D, scores, model.hyperParams.l);
+}
+
+void ProtoNNPredictor::scorePoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values)
+{
+  if (isQuantized) {
+    quantizedScore(scores, values);
+    return;
+  }
+
   //  mm(WX, model.params.W, CblasNoTrans, Xtest, CblasNoTrans, 1.0, 0.0L);
   gemv(CblasColMajor, CblasNoTrans,
     model.params.W.rows(), model.params.W.cols(),
@@ -330,7 +457,7 @@ void ProtoNNPredictor::scoreDenseDataPoint(
     &alpha, matdescra, model.params.Z.valuePtr(),
     model.params.Z.innerIndexPtr(),
     model.params.Z.outerIndexPtr(),
-    model.nnnparams.Z.outerIndexPtr() + 1,
+    model.params.Z.outerIndexPtr() + 1,
     D.data(), &beta, scores);
 #else
   gemv(CblasColMajor, CblasNoTrans,
@@ -347,36 +474,65 @@ void ProtoNNPredictor::scoreSparseDataPoint(
   const featureCount_t numIndices)
   
 {
+  scoreScatteredPoint(scores, values, indices, numIndices,
+    model.featurePermutation.empty() ? NULL : model.featurePermutation.data(), true);
+}
+
+void ProtoNNPredictor::scoreScatteredPoint(
+  FP_TYPE* scores,
+  const FP_TYPE *const values,
+  const featureCount_t *indices,
+  const featureCount_t numIndices,
+  const featureCount_t *const permutation,
+  const bool isRaw)
+{
+  if (scoreCache != NULL
+    && scoreCache->lookup(modelTag, values, indices, numIndices, scores, model.hyperParams.l))
+    return;
+
   memset(dataPoint, 0, sizeof(FP_TYPE)*model.hyperParams.D);
 
+  const FP_TYPE invNorm = isRaw ? pointInvNorm(values, numIndices) : (FP_TYPE)1.0;
   pfor(featureCount_t i = 0; i < numIndices; ++i) {
     assert(indices[i] < model.hyperParams.D);
-    dataPoint[indices[i]] = values[i];
+    dataPoint[permutation == NULL ? indices[i] : permutation[indices[i]]]
+      = isRaw ? normalizedValue(indices[i], values[i], invNorm) : values[i];
   }
 
-  gemv(CblasColMajor, CblasNoTrans,
-    model.params.W.rows(), model.params.W.cols(),
-    1.0, model.params.W.data(), model.params.W.rows(),
-    dataPoint, 1, 0.0, WX.data(), 1);
+  scorePoint(scores, dataPoint);
 
-  //  MatrixXuf D = gaussianKernel(model.params.B, WX, model.hyperParams.gamma);
-  RBF();
+  if (scoreCache != NULL)
+    scoreCache->insert(modelTag, values, indices, numIndices, scores, model.hyperParams.l);
+}
 
-  //  mm(scoresMat, model.params.Z, CblasNoTrans, D, CblasTrans, 1.0, 0.0L);
-#ifdef SPARSE_Z_PROTONN
-  cscmv(&transa,
-    &ZRows, &ZCols,
-    &alpha, matdescra, model.params.Z.valuePtr(),
-    model.params.Z.innerIndexPtr(),
-    model.params.Z.outerIndexPtr(),
-    model.params.Z.outerIndexPtr() + 1,
-    D.data(), &beta, scores);
-#else
-  gemv(CblasColMajor, CblasNoTrans,
-    model.params.Z.rows(), model.params.Z.cols(),
-    1.0, model.params.Z.data(), model.params.Z.rows(),
-    D.data(), 1, 0.0, scores, 1);
-#endif
+FP_TYPE ProtoNNPredictor::pointInvNorm(
+  const FP_TYPE *const values,
+  const featureCount_t numValues) const
+{
+  if (model.hyperParams.normalizationType != l2)
+    return (FP_TYPE)1.0;
+  const FP_TYPE norm = Map<const Matrix<FP_TYPE, Dynamic, 1> >(values, numValues).norm();
+  return norm > (FP_TYPE)0.0 ? (FP_TYPE)1.0 / norm : (FP_TYPE)1.0;
+}
+
+FP_TYPE ProtoNNPredictor::normalizedValue(
+  const featureCount_t f,
+  const FP_TYPE value,
+  const FP_TYPE invNorm) const
+{
+  if (value == (FP_TYPE)0.0)
+    return value;
+  if (model.hyperParams.normalizationType == minMax && pointMin.rows() > 0)
+    return (value - pointMin(f, 0)) / (pointMax(f, 0) - pointMin(f, 0));
+  return value * invNorm;
+}
+
+void ProtoNNPredictor::importMinMax(const MatrixXuf& min, const MatrixXuf& max)
+{
+  assert(min.rows() == model.hyperParams.D && max.rows() == model.hyperParams.D);
+  pointMin = min;
+  pointMax = max;
+  updateModelTag();
 }
 
 void ProtoNNPredictor::scoreBatch(
@@ -390,9 +546,33 @@ void ProtoNNPredictor::scoreBatch(
   assert(batchSize > 0);
   assert(startIdx + batchSize <= ntest);
 
+  if (isQuantized) {
+    for (dataCount_t i = 0; i < batchSize; ++i) {
+      if (testData.isDense(testSplit)) {
+        for (Eigen::Index f = 0; f < testData.testData.rows(); ++f)
+          quantizedPoint[f] = testData.testData(f, startIdx + i);
+      }
+      else {
+        std::fill(quantizedPoint.begin(), quantizedPoint.end(), (FP_TYPE)0.0);
+        for (SparseMatrixuf::InnerIterator it(testData.Xtest, startIdx + i); it; ++it)
+          quantizedPoint[it.row()] = it.value();
+      }
+      quantizedScore(quantizedScores.data(), quantizedPoint.data());
+      for (Eigen::Index c = 0; c < Yscores.rows(); ++c)
+        Yscores(c, i) = quantizedScores[c];
+    }
+    return;
+  }
+
   MatrixXuf curWX = MatrixXuf(model.params.W.rows(), batchSize);
-  SparseMatrixuf curTestData = testData.Xtest.middleCols(startIdx, batchSize);
-  mm(curWX, model.params.W, CblasNoTrans, curTestData, CblasNoTrans, 1.0, 0.0L);
+  if (testData.isDense(testSplit)) {
+    MatrixXuf curTestData = testData.testData.middleCols(startIdx, batchSize);
+    mm(curWX, model.params.W, CblasNoTrans, curTestData, CblasNoTrans, 1.0, 0.0L);
+  }
+  else {
+    SparseMatrixuf curTestData = testData.Xtest.middleCols(startIdx, batchSize);
+    mm(curWX, model.params.W, CblasNoTrans, curTestData, CblasNoTrans, 1.0, 0.0L);
+  }
   
   MatrixXuf curD = gaussianKernel(model.params.B, curWX, model.hyperParams.gamma);
 
@@ -408,12 +588,13 @@ void ProtoNNPredictor::normalize()
     case minMax:
       assert(!normParamFile.empty() && "Normalization parameteres file for min-max normalization needs to be provided");
       loadMinMax(testData.min, testData.max, testData.Xtest.rows(), normParamFile);
-      minMaxNormalize(testData.Xtest, testData.min, testData.max);
+      testData.minMaxNormalize(testSplit);
+      importMinMax(testData.min, testData.max);
       LOG_INFO("Completed min-max normalization of test data\n");
       break;
 
     case l2:
-      l2Normalize(testData.Xtest);
+      testData.l2Normalize(testSplit);
       LOG_INFO("Completed l2 normalization of test data\n");
       break;
 
@@ -468,12 +649,22 @@ EdgeML::ResultStruct ProtoNNPredictor::testPointWise()
   scores = new FP_TYPE[model.hyperParams.l];
   Map<MatrixXuf> Yscores(scores, model.hyperParams.l, 1);
 
+  const bool isDense = testData.isDense(testSplit);
+  MatrixXuf densePoint(isDense ? model.hyperParams.D : 0, 1);
+
   EdgeML::ResultStruct res, tempRes;
   for (dataCount_t i = 0; i < n; ++i) {
-	scoreSparseDataPoint(scores,
-		(const FP_TYPE*) testData.Xtest.valuePtr() + testData.Xtest.outerIndexPtr()[i],
-		(const featureCount_t*) testData.Xtest.innerIndexPtr() + testData.Xtest.outerIndexPtr()[i],
-		(featureCount_t) testData.Xtest.outerIndexPtr()[i + 1] - testData.Xtest.outerIndexPtr()[i]);
+	// testData is already in the feature order of the model
+	if (isDense) {
+	  densePoint = testData.testData.col(i);
+	  scorePoint(scores, densePoint.data());
+	}
+	else
+	  scoreScatteredPoint(scores,
+		  (const FP_TYPE*) testData.Xtest.valuePtr() + testData.Xtest.outerIndexPtr()[i],
+		  (const featureCount_t*) testData.Xtest.innerIndexPtr() + testData.Xtest.outerIndexPtr()[i],
+		  (featureCount_t) testData.Xtest.outerIndexPtr()[i + 1] - testData.Xtest.outerIndexPtr()[i],
+		  NULL, false);
 
     tempRes = evaluate(Yscores, testData.Ytest.middleCols(i, 1), model.hyperParams.problemType);
     res.scaleAndAdd(tempRes, 1);
@@ -497,13 +688,18 @@ void ProtoNNPredictor::saveTopKScores(std::string filename, int topk)
     topk = 5;
 
   if (filename.empty())
-      filename = outDir + "/detailedPrediction";
+      filename = outDir + (isBinaryOutput ? "/detailedPrediction.bin" : "/detailedPrediction");
   LOG_INFO("Attempting to open the following file for detailed prediction output: " + filename);
-  std::ofstream outfile(filename);
-  assert(outfile.is_open());
+  PredictionWriter outfile(filename,
+    isBinaryOutput
+    ? (PredictionFormatter*)new BinaryPredictionFormatter()
+    : (PredictionFormatter*)new TextPredictionFormatter(true, ":", "  "),
+    (labelCount_t)std::min((labelCount_t)topk, model.hyperParams.l));
 
   dataCount_t nBatches = ((n + tempBatchSize - 1)/ tempBatchSize); 
   MatrixXuf topKindices, topKscores;
+  std::vector<labelCount_t> trueLabels, labels;
+  std::vector<FP_TYPE> scores;
   for (dataCount_t i = 0; i < nBatches; ++i) {
     Eigen::Index startIdx =  i * tempBatchSize;
     dataCount_t curBatchSize = (tempBatchSize < n - startIdx)? tempBatchSize : n - startIdx;
@@ -511,13 +707,17 @@ void ProtoNNPredictor::saveTopKScores(std::string filename, int topk)
     scoreBatch(Yscores, startIdx, curBatchSize); 
     getTopKScoresBatch(Yscores, topKindices, topKscores, topk); 
 
+    labels.resize(topKindices.rows());
+    scores.resize(topKindices.rows());
     for (Eigen::Index j = 0; j < topKindices.cols(); j++) {
+      trueLabels.clear();
       for (SparseMatrixuf::InnerIterator it(testData.Ytest, i*tempBatchSize+j); it; ++it)
-        outfile << it.row() << ",  ";
+        trueLabels.push_back((labelCount_t)it.row());
       for (Eigen::Index k = 0; k < topKindices.rows(); k++) {
-        outfile << topKindices(k, j) << ":" << topKscores(k, j) << "  ";
+        labels[k] = (labelCount_t)topKindices(k, j);
+        scores[k] = topKscores(k, j);
       }
-      outfile << std::endl;
+      outfile.writeRow(trueLabels.data(), (labelCount_t)trueLabels.size(), labels.data(), scores.data());
     }
   }
 
@@ -6,7 +6,6 @@
 #include "mmaped.h"
 
 #ifdef LINUX
-#include <dirent.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -16,19 +15,33 @@
 using namespace EdgeML;
 using namespace EdgeML::ProtoNN;
 
+#ifdef LINUX
+// True if @path is an existing directory
+static bool directoryExists(const std::string& path)
+{
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+#endif
+
 ProtoNNTrainer::ProtoNNTrainer(
   const int& argc,
   const char ** argv)
   :
   model(argc, argv),               // Initialize model
-  data(FileIngest,
+  ownedData(FileIngest,
     DataFormatParams{
       model.hyperParams.ntrain,
       model.hyperParams.nvalidation,
       0, // Set the number of test points to zero
       model.hyperParams.l,
       model.hyperParams.D }),
-      dataformatType(DataFormat::undefinedData)
+      data(ownedData),
+      dataformatType(DataFormat::undefinedData),
+      isModelInitialized(false),
+      checkpointInterval(0),
+      hogwildThreads(0),
+      featureOrdering(fileOrder)
 {
   commandLine = "";
   for (int i = 0; i < argc; ++i)
@@ -36,6 +49,8 @@ ProtoNNTrainer::ProtoNNTrainer(
   setFromArgs(argc, argv);
 
   createOutputDirs();
+  if (checkpointInterval > 0)
+    checkpointPath = outDir + "/checkpoint";
 
 #ifdef TIMER
   OPEN_TIMER_LOGFILE(outDir);
@@ -57,6 +72,7 @@ ProtoNNTrainer::ProtoNNTrainer(
  
   finalizeData();
   normalize();
+  reorderFeatures(featureOrdering);
 }
 
 void ProtoNNTrainer::createOutputDirs()
@@ -75,11 +91,11 @@ void ProtoNNTrainer::createOutputDirs()
     std::string command = "mkdir " + outDir;
 
   // On linux -
-  // opendir() is non-NULL if dir exists
+  // directoryExists() is true if dir exists
   // mkdir() returns -1 on error
 
 #ifdef LINUX
-    if (opendir(outDir.c_str()))
+    if (directoryExists(outDir))
       LOG_INFO("Directory " + outDir + " already exists.");
     else
       if (mkdir(outDir.c_str(), 0700) == -1)
@@ -95,7 +111,7 @@ void ProtoNNTrainer::createOutputDirs()
 #ifdef DUMP
 #ifdef LINUX
     std::string dumpDir = outDir + "/dump";
-    if (opendir(dumpDir.c_str()))
+    if (directoryExists(dumpDir))
       LOG_INFO("Directory " + dumpDir + " already exists.");
     else
       if (mkdir(dumpDir.c_str(), 0700) == -1)
@@ -112,7 +128,7 @@ void ProtoNNTrainer::createOutputDirs()
 #ifdef VERIFY
 #ifdef LINUX
     std::string verifyDir = outDir + "/verify";
-    if (opendir(verifyDir.c_str()))
+    if (directoryExists(verifyDir))
       LOG_INFO("Directory " + verifyDir + " already exists.");
     else
       if (mkdir(verifyDir.c_str(), 0700) == -1)
@@ -135,19 +151,131 @@ ProtoNNTrainer::ProtoNNTrainer(
   const ProtoNNModel::ProtoNNHyperParams& fromHyperParams)
   :
   model(fromHyperParams),
-  data(InterfaceIngest,
+  ownedData(InterfaceIngest,
     DataFormatParams{
        model.hyperParams.ntrain,
        model.hyperParams.nvalidation,
        model.hyperParams.l,
          model.hyperParams.D }),
-         dataformatType(DataFormat::interfaceIngestFormat)
+         data(ownedData),
+         dataformatType(DataFormat::interfaceIngestFormat),
+         isModelInitialized(false),
+         checkpointInterval(0),
+         hogwildThreads(0),
+         featureOrdering(fileOrder)
 {
   assert(model.hyperParams.normalizationType == none);
 }
 
+ProtoNNTrainer::ProtoNNTrainer(
+  const ProtoNNModel::ProtoNNHyperParams& fromHyperParams,
+  Data& sharedData,
+  const std::string& outDir_)
+  :
+  model(fromHyperParams),
+  ownedData(),
+  data(sharedData),
+  dataformatType(DataFormat::undefinedData),
+  outDir(outDir_),
+  isModelInitialized(false),
+  checkpointInterval(0),
+  hogwildThreads(0),
+  featureOrdering(fileOrder)
+{
+  assert(data.isDataLoaded == true);
+  assert(data.Xtrain.rows() == model.hyperParams.D);
+
+#ifdef LINUX
+  if (!directoryExists(outDir))
+    if (mkdir(outDir.c_str(), 0700) == -1)
+      LOG_WARNING("Error in creating directory at this location: " + outDir);
+#endif
+
+#ifdef WINDOWS
+  std::string command = "mkdir " + outDir;
+  if (system(command.c_str()) != 0)
+    LOG_WARNING("Error in creating directory at this location: " + outDir + " (Directory might already exist)");
+#endif
+
+  // Data is already finalized and normalized, only pick up the counts
+  model.hyperParams.ntrain = data.Xtrain.cols();
+  model.hyperParams.nvalidation = data.Xvalidation.cols();
+  assert(model.hyperParams.ntrain > 0);
+  assert(model.hyperParams.m <= model.hyperParams.ntrain);
+  model.featurePermutation = data.featurePermutation;
+}
+
+ProtoNNTrainer::ProtoNNTrainer(
+  const size_t numBytes,
+  const char *const fromModel,
+  Data& warmStartData,
+  const std::string& outDir_)
+  :
+  model(numBytes, fromModel),
+  ownedData(),
+  data(warmStartData),
+  dataformatType(DataFormat::undefinedData),
+  outDir(outDir_),
+  isModelInitialized(true),
+  checkpointInterval(0),
+  hogwildThreads(0),
+  featureOrdering(fileOrder)
+{
+  assert(data.isDataLoaded == true);
+  assert(data.Xtrain.rows() == model.hyperParams.D);
+  assert(data.Ytrain.rows() == model.hyperParams.l);
+
+#ifdef LINUX
+  if (!directoryExists(outDir))
+    if (mkdir(outDir.c_str(), 0700) == -1)
+      LOG_WARNING("Error in creating directory at this location: " + outDir);
+#endif
+
+#ifdef WINDOWS
+  std::string command = "mkdir " + outDir;
+  if (system(command.c_str()) != 0)
+    LOG_WARNING("Error in creating directory at this location: " + outDir + " (Directory might already exist)");
+#endif
+
+  model.hyperParams.ntrain = data.Xtrain.cols();
+  model.hyperParams.nvalidation = data.Xvalidation.cols();
+  assert(model.hyperParams.ntrain > 0);
+
+  // Normalize with the statistics of the original training data; min/max are not recomputed
+  switch (model.hyperParams.normalizationType) {
+    case minMax:
+      assert(data.min.rows() == model.hyperParams.D && data.max.rows() == model.hyperParams.D);
+      saveMinMax(data.min, data.max, outDir + "/minMaxParams");
+      data.minMaxNormalize(trainSplit);
+      if (data.Xvalidation.cols() > 0)
+        data.minMaxNormalize(validationSplit);
+      break;
+
+    case l2:
+      data.l2Normalize(trainSplit);
+      if (data.Xvalidation.cols() > 0)
+        data.l2Normalize(validationSplit);
+      break;
+
+    case none:
+      break;
+
+    default:
+      assert(false);
+  }
+
+  // The model's W expects the features in the order it was trained on
+  if (!model.featurePermutation.empty())
+    data.permuteFeatures(model.featurePermutation);
+}
+
 ProtoNNTrainer::~ProtoNNTrainer() {}
 
+Data& ProtoNNTrainer::getData()
+{
+  return data;
+}
+
 void ProtoNNTrainer::feedDenseData(
   const FP_TYPE *const values,
   const labelCount_t *const labels,
@@ -189,18 +317,64 @@ void ProtoNNTrainer::finalizeData()
 
 }
 
-void ProtoNNTrainer::train()
+FP_TYPE ProtoNNTrainer::train()
 {
   assert(data.isDataLoaded == true);
   assert(model.hyperParams.isHyperParamInitialized == true);
 
-  initializeModel();
+  if (!isModelInitialized)
+    initializeModel();
+
+  return optimize(false);
+}
+
+FP_TYPE ProtoNNTrainer::fineTune(const int iters)
+{
+  assert(data.isDataLoaded == true);
+  assert(isModelInitialized == true);
+  assert(iters >= 1);
+
+  model.hyperParams.iters = iters;
+  return optimize(true);
+}
+
+void ProtoNNTrainer::reorderFeatures(const FeatureOrdering ordering)
+{
+  assert(data.isDataLoaded == true);
+  assert(!isModelInitialized && "reorder the features before the model is initialized");
+  data.reorderFeatures(ordering);
+  model.featurePermutation = data.featurePermutation;
+}
+
+void ProtoNNTrainer::enableCheckpointing(const std::string& path, const int interval)
+{
+  assert(!path.empty());
+  assert(interval > 0);
+  checkpointPath = path;
+  checkpointInterval = interval;
+}
+
+void ProtoNNTrainer::enableHogwild(const int numThreads)
+{
+  assert(numThreads >= 1);
+  hogwildThreads = numThreads;
+}
 
+FP_TYPE ProtoNNTrainer::optimize(const bool fixSupport)
+{
   FP_TYPE* stats = new FP_TYPE[model.hyperParams.iters * 9 + 3]; // store output of this run
-  altMinSGD(data, model, stats, outDir);
+#ifdef XTRAIN_CSR
+  data.buildXtrainCSR();
+#endif
+#if defined(COMPRESSED_XTRAIN_FP16)
+  data.compressXtrain(true);
+#elif defined(COMPRESSED_XTRAIN)
+  data.compressXtrain(false);
+#endif
+  altMinSGD(data, model, stats, outDir, fixSupport, checkpointPath, checkpointInterval, hogwildThreads);
 
   // Save the parameters of the model in separate files
-  writeMatrixInASCII(model.params.W, outDir, "W");
+  writeMatrixInASCII(model.WInFeatureOrder(), outDir, "W");
   writeMatrixInASCII(model.params.B, outDir, "B");
   writeMatrixInASCII(model.params.Z, outDir, "Z");
   MatrixXuf gammaMat(1, 1);
@@ -221,8 +395,38 @@ void ProtoNNTrainer::train()
   std::string outFile = outDir + "/runInfo";
   storeParams(commandLine, stats, outFile);
 
+  // Validation accuracy of the last evaluation, see altMinSGD
+  FP_TYPE validationAccuracy = stats[model.hyperParams.iters * 9 + 2];
+
   // Log and final output
   delete[] stats; // currently, stats are not being stored anywhere
+
+  return validationAccuracy;
+}
+
+void ProtoNNTrainer::exportInitialization(
+  ProtoNNModel::ProtoNNParams& initParams,
+  FP_TYPE& initGamma)
+{
+  if (!isModelInitialized)
+    initializeModel();
+
+  initParams = model.params;
+  initGamma = model.hyperParams.gamma;
+}
+
+void ProtoNNTrainer::importInitialization(
+  const ProtoNNModel::ProtoNNParams& initParams,
+  const FP_TYPE& initGamma)
+{
+  assert(initParams.W.rows() == model.params.W.rows());
+  assert(initParams.W.cols() == model.params.W.cols());
+  assert(initParams.B.rows() == model.params.B.rows());
+
+  model.params = initParams;
+  model.hyperParams.m = model.params.B.cols(); // per-class k-means can drop empty classes
+  model.hyperParams.gamma = initGamma;
+  isModelInitialized = true;
 }
 
 size_t ProtoNNTrainer::getModelSize()
@@ -249,11 +453,11 @@ void ProtoNNTrainer::exportBSparse(int bufferSize, char * const buf)
 }
 size_t ProtoNNTrainer::sizeForExportWSparse()
 {
-  return sparseExportStat(model.params.W);
+  return sparseExportStat(model.WInFeatureOrder());
 }
 void ProtoNNTrainer::exportWSparse(int bufferSize, char *const buf)
 {
-  exportSparseMatrix(model.params.W, bufferSize, buf);
+  exportSparseMatrix(model.WInFeatureOrder(), bufferSize, buf);
 }
 size_t ProtoNNTrainer::sizeForExportZSparse()
 {
@@ -279,7 +483,7 @@ size_t ProtoNNTrainer::sizeForExportWDense()
 }
 void ProtoNNTrainer::exportWDense(int bufferSize, char *const buf)
 {
-  exportDenseMatrix(model.params.W, bufferSize, buf);
+  exportDenseMatrix(model.WInFeatureOrder(), bufferSize, buf);
 }
 size_t ProtoNNTrainer::sizeForExportZDense()
 {
@@ -298,19 +502,19 @@ void ProtoNNTrainer::normalize()
     case minMax: 
     {
       std::string minMaxFile = outDir + "/minMaxParams";
-      computeMinMax(data.Xtrain, data.min, data.max);
+      data.computeMinMax();
       saveMinMax(data.min, data.max, minMaxFile);
-      minMaxNormalize(data.Xtrain, data.min, data.max);
+      data.minMaxNormalize(trainSplit);
       if (data.Xvalidation.cols() > 0)
-        minMaxNormalize(data.Xvalidation, data.min, data.max);
+        data.minMaxNormalize(validationSplit);
       LOG_INFO("Completed min-max normalization of data");
       break;
     }
 
     case l2:
-      l2Normalize(data.Xtrain);
+      data.l2Normalize(trainSplit);
       if (data.Xvalidation.cols() > 0)
-        l2Normalize(data.Xvalidation);
+        data.l2Normalize(validationSplit);
       LOG_INFO("Completed l2 normalization of data");
       break;
 
@@ -322,6 +526,14 @@ void ProtoNNTrainer::normalize()
   }
 }
 
+void ProtoNNTrainer::projectXtrain(MatrixXuf& WX) const
+{
+  if (data.isDense(trainSplit))
+    mm(WX, model.params.W, CblasNoTrans, data.trainData, CblasNoTrans, 1.0, 0.0L);
+  else
+    mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+}
+
 void ProtoNNTrainer::initializeModel()
 {
   LOG_INFO("    ");
@@ -370,11 +582,21 @@ void ProtoNNTrainer::initializeModel()
       WPtr[i] = distribution(generator);
     }
 
-    // Initialize B, Z according to what user wants
+    // Initialize B, Z according to what user wants. Sampling and k-means draw from a
+    // generator of their own, so that trainers running concurrently do not share state
+    std::mt19937_64 prototypeGenerator((unsigned long long)model.hyperParams.seed);
     if (model.hyperParams.initializationType == sample) {
+      std::uniform_int_distribution<dataCount_t> pickPoint(0, data.Xtrain.cols() - 1);
       for (labelCount_t i = 0; i < model.hyperParams.m; ++i) {
-        dataCount_t prot = rand() % data.Xtrain.cols();
-        model.params.B.col(i) = model.params.W * data.Xtrain.col(prot);
+        dataCount_t prot = pickPoint(prototypeGenerator);
+        if (data.isDense(trainSplit)) {
+          const MatrixXuf x = data.trainData.col(prot);
+          MatrixXuf Wx(model.params.W.rows(), 1);
+          mm(Wx, model.params.W, CblasNoTrans, x, CblasNoTrans, 1.0, 0.0L);
+          model.params.B.col(i) = Wx;
+        }
+        else
+          model.params.B.col(i) = model.params.W * data.Xtrain.col(prot);
 #ifdef SPARSE_Z_PROTONN
         model.params.Z.col(i) = data.trainLabel.col(prot).sparseView();
 #else
@@ -387,18 +609,18 @@ void ProtoNNTrainer::initializeModel()
       LOG_INFO("Initializing prototype matrix (B) and prototype-label matrix (Z) by clustering data (in projected space) from each class separately using k-means++... ");
 
       MatrixXuf WX = MatrixXuf::Zero(model.params.W.rows(), data.Xtrain.cols());
-      mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+      projectXtrain(WX);
 
 #ifdef SPARSE_Z_PROTONN
       MatrixXuf Z = model.params.Z;
       assert(model.params.B.cols() % data.Ytrain.rows() == 0);
       kmeansLabelwise(data.Ytrain, WX, model.params.B, Z,
-        model.params.B.cols() / model.params.Z.rows());
+        model.params.B.cols() / model.params.Z.rows(), prototypeGenerator);
       model.params.Z = Z.sparseView();
 #else
       assert(model.params.B.cols() % data.Ytrain.rows() == 0);
       kmeansLabelwise(data.Ytrain, WX, model.params.B, model.params.Z,
-        model.params.B.cols() / model.params.Z.rows());
+        model.params.B.cols() / model.params.Z.rows(), prototypeGenerator);
 #endif
       model.hyperParams.m = model.params.B.cols();
     }
@@ -407,7 +629,7 @@ void ProtoNNTrainer::initializeModel()
       LOG_INFO("Initializing prototype matrix (B) and prototype-label matrix (Z) by clustering data in projected space using k-means++... ");
 
       MatrixXuf WX = MatrixXuf::Zero(model.params.W.rows(), data.Xtrain.cols());
-      mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+      projectXtrain(WX);
 
 #ifdef XML
       dataCount_t numRand = std::min((dataCount_t)100000, (dataCount_t)WX.cols());
@@ -417,19 +639,19 @@ void ProtoNNTrainer::initializeModel()
       randPick(data.Ytrain, YTrainSub);
 #ifdef SPARSE_Z_PROTONN 
       MatrixXuf Z = model.params.Z;
-      kmeansOverall(YTrainSub, WXSub, model.params.B, Z);
+      kmeansOverall(YTrainSub, WXSub, model.params.B, Z, prototypeGenerator);
       model.params.Z = Z.sparseView();
 #else
-      kmeansOverall(YTrainSub, WXSub, model.params.B, model.params.Z);
+      kmeansOverall(YTrainSub, WXSub, model.params.B, model.params.Z, prototypeGenerator);
 #endif
 
 #else
 #ifdef SPARSE_Z_PROTONN
       MatrixXuf Z = model.params.Z;
-      kmeansOverall(data.Ytrain, WX, model.params.B, Z);
+      kmeansOverall(data.Ytrain, WX, model.params.B, Z, prototypeGenerator);
       model.params.Z = Z.sparseView();
 #else
-      kmeansOverall(data.Ytrain, WX, model.params.B, model.params.Z);
+      kmeansOverall(data.Ytrain, WX, model.params.B, model.params.Z, prototypeGenerator);
 #endif
 #endif
     }
@@ -437,7 +659,7 @@ void ProtoNNTrainer::initializeModel()
     // Set gamma = model.hyperParams.gammaNumerator * 2.5 / (median b/w B and WX)
 
     MatrixXuf WX = MatrixXuf::Zero(model.params.W.rows(), data.Xtrain.cols());
-    mm(WX, model.params.W, CblasNoTrans, data.Xtrain, CblasNoTrans, 1.0, 0.0L);
+    projectXtrain(WX);
 
     FP_TYPE initGuess = (FP_TYPE)0.005;
     FP_TYPE multiplier = model.hyperParams.gammaNumerator * (FP_TYPE) 2.5;
@@ -455,6 +677,8 @@ void ProtoNNTrainer::initializeModel()
 
     LOG_INFO("Set value of gamma using median heuristic: " + std::to_string(model.hyperParams.gamma));
   }
+
+  isModelInitialized = true;
 }
 
 void ProtoNNTrainer::setFromArgs(const int argc, const char** argv)
@@ -481,6 +705,23 @@ void ProtoNNTrainer::setFromArgs(const int argc, const char** argv)
         modelDir = argv[i];
         break;
 
+      case 'c':
+        checkpointInterval = atoi(argv[i]);
+        assert(checkpointInterval > 0);
+        break;
+
+      case 'H':
+        hogwildThreads = atoi(argv[i]);
+        assert(hogwildThreads >= 0);
+        break;
+
+      case 'X':
+        if (argv[i][0] == '0') featureOrdering = fileOrder;
+        else if (argv[i][0] == '1') featureOrdering = frequencyOrder;
+        else if (argv[i][0] == '2') featureOrdering = coOccurrenceOrder;
+        else assert(false); //Ordering unknown
+        break;
+
       case 'F':
         if (argv[i][0] == '0') dataformatType = libsvmFormat;
         else if (argv[i][0] == '1') dataformatType = tsvFormat;
@@ -5,6 +5,39 @@
 
 using namespace EdgeML;
 
+//
+// cumul[p + 1] = cumul[p] + values[p] with cumul[0] = 0, for the k-means++ dice throws.
+// Chunks are summed in parallel, then scanned from their offsets in parallel.
+//
+static void cumulativeSum(
+  const FP_TYPE *const values,
+  const Eigen::Index count,
+  std::vector<FP_TYPE>& cumul)
+{
+  assert((Eigen::Index)cumul.size() == count + 1);
+  const Eigen::Index chunkSize = 8192;
+  const Eigen::Index numChunks = (count + chunkSize - 1) / chunkSize;
+  std::vector<FP_TYPE> chunkOffsets(numChunks + 1, (FP_TYPE)0.0);
+
+  pfor(Eigen::Index chunk = 0; chunk < numChunks; ++chunk) {
+    FP_TYPE sum = (FP_TYPE)0.0;
+    for (Eigen::Index p = chunk * chunkSize; p < std::min(count, (chunk + 1) * chunkSize); ++p)
+      sum += values[p];
+    chunkOffsets[chunk + 1] = sum;
+  }
+  for (Eigen::Index chunk = 0; chunk < numChunks; ++chunk)
+    chunkOffsets[chunk + 1] += chunkOffsets[chunk];
+
+  cumul[0] = (FP_TYPE)0.0;
+  pfor(Eigen::Index chunk = 0; chunk < numChunks; ++chunk) {
+    FP_TYPE sum = chunkOffsets[chunk];
+    for (Eigen::Index p = chunk * chunkSize; p < std::min(count, (chunk + 1) * chunkSize); ++p) {
+      sum += values[p];
+      cumul[p + 1] = sum;
+    }
+  }
+}
+
 void sparsekmeans::computePointsL2Sq(
   const SparseMatrixuf& pointsMatrix,
   FP_TYPE *const pointsL2Sq)
@@ -214,7 +247,8 @@ void sparsekmeans::updateMinDistSqToCenters(
 FP_TYPE sparsekmeans::kmeanspp(
   const SparseMatrixuf& pointsMatrix,
   const FP_TYPE *const pointsL2Sq,
-  MatrixXuf& centersMatrix)
+  MatrixXuf& centersMatrix,
+  std::mt19937_64& generator)
 {
   const MKL_INT numCenters = centersMatrix.cols();
   std::vector<dataCount_t> centers;
@@ -234,7 +268,7 @@ FP_TYPE sparsekmeans::kmeanspp(
   memset(centersCoords, 0, sizeof(FP_TYPE)*numCenters*dim);
   std::fill_n(minDist, numPoints, FP_TYPE_MAX);
 
-  centers.push_back((dataCount_t)(((long long)rand() * 84619573LL) % numPoints));
+  centers.push_back((dataCount_t)std::uniform_int_distribution<MKL_INT>(0, numPoints - 1)(generator));
   centersL2Sq[0] = dot(offsetsCSC[centers[0] + 1] - offsetsCSC[centers[0]],
     valsCSC + offsetsCSC[centers[0]], 1,
     valsCSC + offsetsCSC[centers[0]], 1);
@@ -246,9 +280,7 @@ FP_TYPE sparsekmeans::kmeanspp(
     updateMinDistSqToCenters(pointsMatrix, pointsL2Sq,
       1, centersCoords + (centers.size() - 1)*dim,
       minDist, distScratchSpace);
-    distCumul[0] = 0;
-    for (int point = 0; point < numPoints; ++point)
-      distCumul[point + 1] = distCumul[point] + minDist[point];
+    cumulativeSum(minDist, numPoints, distCumul);
     for (auto iter = centers.begin(); iter != centers.end(); ++iter) {
       // Disance from center to its closest center == 0
       assert(abs(distCumul[(*iter) + 1] - distCumul[*iter]) < 1e-4);
@@ -257,7 +289,7 @@ FP_TYPE sparsekmeans::kmeanspp(
       assert(std::find(iter + 1, centers.end(), *iter) == centers.end());
     }
 
-    auto diceThrow = distCumul[numPoints] * rand_fraction();
+    auto diceThrow = distCumul[numPoints] * std::uniform_real_distribution<double>(0.0, 1.0)(generator);
     assert(diceThrow < distCumul[numPoints]);
     dataCount_t newCenter = (dataCount_t)(std::upper_bound(distCumul.begin(), distCumul.end(), diceThrow)
       - 1 - distCumul.begin());
@@ -284,7 +316,8 @@ FP_TYPE sparsekmeans::kmeans(
   const SparseMatrixuf& pointsMatrix,
   MatrixXuf& centersMatrix,
   const int numIters,
-  dataCount_t *const closestCenter)
+  dataCount_t *const closestCenter,
+  std::mt19937_64& generator)
 {
   assert(!pointsMatrix.IsRowMajor);
   assert(!centersMatrix.IsRowMajor);
@@ -297,7 +330,7 @@ FP_TYPE sparsekmeans::kmeans(
   FP_TYPE *pointsL2Sq = new FP_TYPE[pointsMatrix.cols()];
   computePointsL2Sq(pointsMatrix, pointsL2Sq);
   memset(centersMatrix.data(), 0, sizeof(FP_TYPE)*centersMatrix.rows()*centersMatrix.cols());
-  kmeanspp(pointsMatrix, pointsL2Sq, centersMatrix);
+  kmeanspp(pointsMatrix, pointsL2Sq, centersMatrix, generator);
 
   for (int i = 0; i < numIters; ++i) {
     residual = lloydsIter(pointsMatrix, numCenters, pointsL2Sq, centersMatrix, closestCenter, true);
@@ -476,7 +509,8 @@ void densekmeans::updateMinDistSqToCenters(
 FP_TYPE densekmeans::kmeanspp(
   const MatrixXuf& pointsMatrix,
   const FP_TYPE *const pointsL2Sq,
-  MatrixXuf& centersMatrix)
+  MatrixXuf& centersMatrix,
+  std::mt19937_64& generator)
 {
   const MKL_INT numCenters = centersMatrix.cols();
   std::vector<dataCount_t> centers;
@@ -495,7 +529,7 @@ FP_TYPE densekmeans::kmeanspp(
   std::fill_n(minDist, numPoints, FP_TYPE_MAX);
 
   //centers.push_back((dataCount_t)(rand() * 84619573 % numPoints));
-  centers.push_back((dataCount_t)(((long long)rand() * 84619573LL) % numPoints));
+  centers.push_back((dataCount_t)std::uniform_int_distribution<MKL_INT>(0, numPoints - 1)(generator));
   centersL2Sq[0] = dot(dim,
     points + centers[0] * dim, 1,
     points + centers[0] * dim, 1);
@@ -508,9 +542,7 @@ FP_TYPE densekmeans::kmeanspp(
     updateMinDistSqToCenters(pointsMatrix, pointsL2Sq,
       1, centersCoords + (centers.size() - 1)*dim,
       minDist, distScratchSpace);
-    distCumul[0] = 0;
-    for (int point = 0; point < numPoints; ++point)
-      distCumul[point + 1] = distCumul[point] + minDist[point];
+    cumulativeSum(minDist, numPoints, distCumul);
     for (auto iter = centers.begin(); iter != centers.end(); ++iter) {
       // Disance from center to its closest center == 0
         assert(abs(distCumul[(*iter) + 1] - distCumul[*iter]) < 1e-2 *distCumul[numPoints]/numPoints);
@@ -519,7 +551,7 @@ FP_TYPE densekmeans::kmeanspp(
       assert(std::find(iter + 1, centers.end(), *iter) == centers.end());
     }
 
-    auto diceThrow = distCumul[numPoints] * rand_fraction();
+    auto diceThrow = distCumul[numPoints] * std::uniform_real_distribution<double>(0.0, 1.0)(generator);
     assert(diceThrow < distCumul[numPoints]);
     dataCount_t newCenter = (dataCount_t)(std::upper_bound(distCumul.begin(), distCumul.end(), diceThrow)
       - 1 - distCumul.begin());
@@ -543,7 +575,8 @@ FP_TYPE densekmeans::kmeans(
   const MatrixXuf& pointsMatrix,
   MatrixXuf& centersMatrix,
   const int numIters,
-  dataCount_t *const closestCenter)
+  dataCount_t *const closestCenter,
+  std::mt19937_64& generator)
 {
   assert(pointsMatrix.rows() == centersMatrix.rows());
   const MKL_INT numPoints = pointsMatrix.cols();
@@ -553,7 +586,7 @@ FP_TYPE densekmeans::kmeans(
   FP_TYPE *pointsL2Sq = new FP_TYPE[numPoints];
   computePointsL2Sq(pointsMatrix, pointsL2Sq);
   memset(centersMatrix.data(), 0, sizeof(FP_TYPE)*centersMatrix.rows()*centersMatrix.cols());
-  kmeanspp(pointsMatrix, pointsL2Sq, centersMatrix);
+  kmeanspp(pointsMatrix, pointsL2Sq, centersMatrix, generator);
 
   for (int i = 0; i < numIters; ++i) {
     residual = lloydsIter(pointsMatrix, pointsL2Sq,
@@ -569,7 +602,8 @@ FP_TYPE densekmeans::kmeans(
 
 void EdgeML::labelSpaceClustering(
   SparseMatrixuf& labels,
-  int numClusters)
+  int numClusters,
+  const unsigned long long seed)
 {
   Timer timer("labelSpaceClustering");
   labelCount_t L = labels.rows();
@@ -583,8 +617,9 @@ void EdgeML::labelSpaceClustering(
   MatrixXuf clusterCenters(N, numClusters);
   assert(clusterIdentities != NULL);
 
+  std::mt19937_64 generator(seed);
   sparsekmeans::kmeans(labels_transpose, clusterCenters,
-    20, clusterIdentities);
+    20, clusterIdentities, generator);
   /*
   RunKMeans(labels.data(),
         L, N, numClusters,
@@ -592,65 +627,102 @@ void EdgeML::labelSpaceClustering(
         clusterCenters, clusterIdentities);
   */
 
+  // One write, rather than a flush per label
+  std::string identities;
+  identities.reserve((size_t)L * 8);
+  for (labelCount_t i = 0; i < L; ++i)
+    identities += std::to_string(clusterIdentities[i]) + "\n";
   std::ofstream f("label_identities");
-  for (labelCount_t i = 0; i < L; ++i) f << clusterIdentities[i] << std::endl;
+  f.write(identities.data(), identities.size());
 
   delete[] clusterIdentities;
 }
 
+//
+// Appends every point j with Y(i, j) > threshold to classPoints[i], in increasing order of j.
+// The sparse overload visits only the non-zeros, in either storage order.
+//
+static void bucketPointsByLabel(
+  const SparseMatrixuf& Y,
+  const FP_TYPE threshold,
+  std::vector<std::vector<dataCount_t> >& classPoints)
+{
+  for (Eigen::Index outer = 0; outer < Y.outerSize(); ++outer)
+    for (SparseMatrixuf::InnerIterator it(Y, outer); it; ++it)
+      if (it.value() > threshold)
+        classPoints[it.row()].push_back((dataCount_t)it.col());
+}
+
+static void bucketPointsByLabel(
+  const MatrixXuf& Y,
+  const FP_TYPE threshold,
+  std::vector<std::vector<dataCount_t> >& classPoints)
+{
+  for (Eigen::Index j = 0; j < Y.cols(); ++j)
+    for (Eigen::Index i = 0; i < Y.rows(); ++i)
+      if (Y(i, j) > threshold)
+        classPoints[i].push_back((dataCount_t)j);
+}
+
 void EdgeML::kmeansLabelwise(
   const LabelMatType& Y,
   const MatrixXuf& WX,
   MatrixXuf& B,
   MatrixXuf& Z,
-  const int KPerClass)
+  const int KPerClass,
+  std::mt19937_64& generator)
 {
   assert(KPerClass*Y.rows() == B.cols());
   assert(Y.cols() == WX.cols());
   Timer timer("kmeans initialization");
 
-  int nonZeroLabels = 0;
-  const FP_TYPE* WXData = WX.data();
+#ifdef ROWMAJOR
+  assert(false); // densekmeans reads the points of a class column-major
+#endif
   FP_TYPE eps = 1.0e-2f;
   B = MatrixXuf::Zero(B.rows(), B.cols());
   Z = MatrixXuf::Zero(Z.rows(), Z.cols());
 
-  for (Eigen::Index i = 0; i < Y.rows(); ++i) {
-    std::vector <FP_TYPE> protData;
-    dataCount_t numP = 0;
-    for (Eigen::Index j = 0; j < Y.cols(); ++j) {
-      if (Y.coeff(i, j) > 1 - eps) {
-#ifdef ROWMAJOR
-        assert(false); //Following line does not work if in rowmajor
-#endif
-        protData.insert(protData.end(), WXData + j*WX.rows(), WXData + (j + 1)*WX.rows());
-        numP++;
-      }
-    }
-
-    if (numP == 0) continue;
-    else nonZeroLabels++;
+  // One pass over the labels of the points, in increasing point order within each class
+  std::vector<std::vector<dataCount_t> > classPoints(Y.rows());
+  bucketPointsByLabel(Y, (FP_TYPE)1.0 - eps, classPoints);
 
-    timer.nextTime("collecting points that belong to the current class");
-    MatrixXuf clusterPoints = MatrixXuf::Zero(WX.rows(), numP);
-    assert(protData.size() == WX.rows() * numP);
-    memcpy(clusterPoints.data(), protData.data(), sizeof(FP_TYPE) * protData.size());
-    timer.nextTime("converting data sub-matrix into appropriate format to pass");
-
-    dataCount_t* clusterIdentities = new dataCount_t[numP];
+  // Classes with points get consecutive blocks of KPerClass prototypes, in class order
+  std::vector<Eigen::Index> classBlock(Y.rows(), -1);
+  int nonZeroLabels = 0;
+  for (Eigen::Index i = 0; i < Y.rows(); ++i)
+    if (!classPoints[i].empty())
+      classBlock[i] = nonZeroLabels++;
+
+  // Each class draws from its own generator, seeded in order from @generator,
+  // so that the result does not depend on the order the classes run in
+  std::vector<unsigned long long> classSeeds(Y.rows());
+  for (Eigen::Index i = 0; i < Y.rows(); ++i)
+    classSeeds[i] = generator();
+  timer.nextTime("collecting points that belong to each class");
+
+  pfor(Eigen::Index i = 0; i < Y.rows(); ++i) {
+    if (classBlock[i] < 0) continue;
+
+    const std::vector<dataCount_t>& points = classPoints[i];
+    MatrixXuf clusterPoints(WX.rows(), (Eigen::Index)points.size());
+    for (size_t p = 0; p < points.size(); ++p)
+      clusterPoints.col(p) = WX.col(points[p]);
+
+    std::vector<dataCount_t> clusterIdentities(points.size());
     MatrixXuf BProt = MatrixXuf(B.rows(), KPerClass);
+    std::mt19937_64 classGenerator(classSeeds[i]);
 
     densekmeans::kmeans(clusterPoints, BProt,
-      20, clusterIdentities);
+      20, clusterIdentities.data(), classGenerator);
 
+    // Each class writes its own columns
     for (int j = 0; j < KPerClass; ++j) {
-      B.col((nonZeroLabels - 1)*KPerClass + j) = BProt.col(j);
-      Z(i, (nonZeroLabels - 1)*KPerClass + j) = 1.0;
+      B.col(classBlock[i] * KPerClass + j) = BProt.col(j);
+      Z(i, classBlock[i] * KPerClass + j) = 1.0;
     }
-    delete[] clusterIdentities;
-    if (i % 100 == 99)
-      LOG_TRACE("Completed 100 labels.");
   }
+  timer.nextTime("clustering the points of each class");
 
   if (Z.rows() != nonZeroLabels)
     LOG_INFO("Some labels have no data-points. #labels with at least one data-point = " + std::to_string(nonZeroLabels));
@@ -662,7 +734,8 @@ void EdgeML::kmeansOverall(
   const LabelMatType& Y,
   const MatrixXuf& WX,
   MatrixXuf& B,
-  MatrixXuf& Z)
+  MatrixXuf& Z,
+  std::mt19937_64& generator)
 {
   assert(B.cols() == Z.cols());
   assert(Y.cols() == WX.cols());
@@ -675,7 +748,7 @@ void EdgeML::kmeansOverall(
   assert(clusterIdentities != NULL && clusterDensity != NULL);
   for (Eigen::Index i = 0; i < Z.cols(); ++i) clusterDensity[i] = 0;
 
-  densekmeans::kmeans(WX, B, 20, clusterIdentities);
+  densekmeans::kmeans(WX, B, 20, clusterIdentities, generator);
 
   //B = B_transpose.cast <FP_TYPE>().transpose().eval();
   Z = MatrixXuf::Zero(Z.rows(), Z.cols());
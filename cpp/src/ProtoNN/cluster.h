@@ -11,20 +11,29 @@ namespace EdgeML
 {
   void labelSpaceClustering(
     SparseMatrixuf& labels,
-    int numClusters);
-
+    int numClusters,
+    const unsigned long long seed = 42);
+
+  //
+  // Initial prototypes B and their labels Z: k-means with KPerClass centers on the points
+  // WX of every class that has points. Each class draws from its own generator, seeded in
+  // class order from @generator, so the result depends on @generator alone, neither on
+  // rand() nor on the order the classes run in.
+  //
   void kmeansLabelwise(
     const LabelMatType& Y,
     const MatrixXuf& WX,
     MatrixXuf& B,
     MatrixXuf& Z,
-    const int KPerClass);
+    const int KPerClass,
+    std::mt19937_64& generator);
 
   void kmeansOverall(
     const LabelMatType& Y,
     const MatrixXuf& WX,
     MatrixXuf& B,
-    MatrixXuf& Z);
+    MatrixXuf& Z,
+    std::mt19937_64& generator);
 
 
   namespace sparsekmeans
@@ -73,7 +82,8 @@ namespace EdgeML
     FP_TYPE kmeanspp(
       const SparseMatrixuf& pointsMatrix,
       const FP_TYPE *const pointsL2Sq,
-      MatrixXuf& centersMatrix);
+      MatrixXuf& centersMatrix,
+      std::mt19937_64& generator);
 
     // data is CSC with each column being a point
     // Points are clustered.
@@ -81,7 +91,8 @@ namespace EdgeML
       const SparseMatrixuf& pointsMatrix,
       MatrixXuf& centersMatrix,
       const int numIterations,
-      dataCount_t *const closestCenter);
+      dataCount_t *const closestCenter,
+      std::mt19937_64& generator);
   };
 
 
@@ -131,13 +142,15 @@ namespace EdgeML
     FP_TYPE kmeanspp(
       const MatrixXuf& pointsMatrix,
       const FP_TYPE *const pointsL2Sq,
-      MatrixXuf& centersMatrix);
+      MatrixXuf& centersMatrix,
+      std::mt19937_64& generator);
 
     FP_TYPE kmeans(
       const MatrixXuf& pointsMatrix,
       MatrixXuf& centersMatrix,
       const int numIterations,
-      dataCount_t *const closestCenter);
+      dataCount_t *const closestCenter,
+      std::mt19937_64& generator);
   };
 };
 #endif
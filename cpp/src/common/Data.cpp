@@ -5,8 +5,39 @@
 #include "Data.h"
 #include "blas_routines.h"
 
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
 using namespace EdgeML;
 
+// Serializes building the copies of Xtrain among trainers sharing one Data object
+static std::mutex XtrainCopiesMutex;
+
+//
+// Density from which dense input is kept dense; see Data::finalizeData
+//
+static FP_TYPE denseStorageMinDensity()
+{
+  static const FP_TYPE density = []() {
+    const char* setting = getenv("EDGEML_DENSE_STORAGE_MIN_DENSITY");
+    if (setting != NULL) {
+      const FP_TYPE value = (FP_TYPE)atof(setting);
+      LOG_INFO("Density from which dense input is stored dense, from the environment: " + std::to_string(value));
+      return value;
+    }
+    return (FP_TYPE)sizeof(FP_TYPE) / (FP_TYPE)(sizeof(FP_TYPE) + sizeof(sparseIndex_t));
+  }();
+  return density;
+}
+
+static const char* splitName(const DataSplit split)
+{
+  return split == trainSplit ? "train" : (split == validationSplit ? "validation" : "test");
+}
+
 Data::Data(
   DataIngestType ingestType_,
   DataFormatParams formatParams_)
@@ -32,7 +63,7 @@ void Data::loadDataFromFile(
   validationData = MatrixXuf(0, 0);
   testData = MatrixXuf(0, 0);
 
-  Xtest = SparseMatrixuf(0, 0);
+  Xtrain = SparseMatrixuf(0, 0);
   Xvalidation = SparseMatrixuf(0, 0);
   Xtest = SparseMatrixuf(0, 0);
 
@@ -122,7 +153,7 @@ void Data::loadDataFromFile(
         trainData(count, i) = 1.0;
       }
       trainreader.close();
-      Xtrain = trainData.sparseView(); trainData.resize(0, 0);
+      storeDense(trainSplit);
       Ytrain = trainLabel.sparseView(); trainLabel.resize(0, 0);
     }
 
@@ -153,7 +184,7 @@ void Data::loadDataFromFile(
         validationData(count, i) = 1.0;
       }
       validationreader.close();
-      Xvalidation = validationData.sparseView(); validationData.resize(0, 0);
+      storeDense(validationSplit);
       Yvalidation = validationLabel.sparseView(); validationLabel.resize(0, 0);
     }
 
@@ -185,7 +216,7 @@ void Data::loadDataFromFile(
       }
       testreader.close();
 
-      Xtest = testData.sparseView(); testData.resize(0, 0);
+      storeDense(testSplit);
       Ytest = testLabel.sparseView(); testLabel.resize(0, 0);
     }
 
@@ -251,21 +282,16 @@ void Data::finalizeData()
   // 2. getnnzs(Xtrain) == 0
   // 3. getnnzs(Ytest) == 0
   // 4. getnnzs(Ytrain) == 0
-  // If these conditions are true, then we set these sparse matrices to their dense counter-parts
-  // Additionally, we deallocate the dense matrices. ProtoNN only uses the sparse data and label matrices.
+  // If these conditions are true, then the dense matrices are kept or replaced by their
+  // sparse views, depending on their density (see storeDense).
+  // ProtoNN only uses the sparse label matrices.
   //
-  if (getnnzs(Xtest) == 0) {
-    Xtest = testData.sparseView();
-    testData.resize(0, 0);
-  }
-  if (getnnzs(Xtrain) == 0) {
-    Xtrain = trainData.sparseView();
-    trainData.resize(0, 0);
-  }
-  if (getnnzs(Xvalidation) == 0) {
-    Xvalidation = validationData.sparseView();
-    validationData.resize(0, 0);
-  }
+  if (getnnzs(Xtest) == 0)
+    storeDense(testSplit);
+  if (getnnzs(Xtrain) == 0)
+    storeDense(trainSplit);
+  if (getnnzs(Xvalidation) == 0)
+    storeDense(validationSplit);
 
   if (getnnzs(Ytest) == 0) {
     Ytest = testLabel.sparseView();
@@ -294,6 +320,238 @@ void Data::finalizeData()
   isDataLoaded = true;
 }
 
+MatrixXuf& Data::denseSplit(const DataSplit split)
+{
+  return split == trainSplit ? trainData : (split == validationSplit ? validationData : testData);
+}
+
+SparseMatrixuf& Data::sparseSplit(const DataSplit split)
+{
+  return split == trainSplit ? Xtrain : (split == validationSplit ? Xvalidation : Xtest);
+}
+
+bool Data::isDense(const DataSplit split) const
+{
+  return features<MatrixXuf>(split).size() > 0;
+}
+
+template<>
+const MatrixXuf& Data::features<MatrixXuf>(const DataSplit split) const
+{
+  return split == trainSplit ? trainData : (split == validationSplit ? validationData : testData);
+}
+
+template<>
+const SparseMatrixuf& Data::features<SparseMatrixuf>(const DataSplit split) const
+{
+  return split == trainSplit ? Xtrain : (split == validationSplit ? Xvalidation : Xtest);
+}
+
+//
+// Keeps the dense matrix of @split if it is dense enough (see finalizeData), leaving the
+// sparse matrix empty with the shape of the data, or replaces it by its sparse view
+//
+void Data::storeDense(const DataSplit split)
+{
+  MatrixXuf& dense = denseSplit(split);
+  SparseMatrixuf& sparse = sparseSplit(split);
+  if (dense.size() == 0)
+    return;
+
+  const Eigen::Index nnz = (dense.array() != (FP_TYPE)0.0).count();
+  const FP_TYPE density = (FP_TYPE)nnz / (FP_TYPE)dense.size();
+  if (density >= denseStorageMinDensity()) {
+    sparse = SparseMatrixuf(dense.rows(), dense.cols());
+    LOG_INFO("Storing the " + std::string(splitName(split)) + " data dense, "
+      + std::to_string(density) + " of its entries are non-zero.");
+  }
+  else {
+    sparse = dense.sparseView();
+    dense.resize(0, 0);
+    LOG_INFO("Storing the " + std::string(splitName(split)) + " data sparse, "
+      + std::to_string(density) + " of its entries are non-zero.");
+  }
+}
+
+// Moves a sparse @split to dense storage
+void Data::densify(const DataSplit split)
+{
+  if (isDense(split))
+    return;
+  SparseMatrixuf& sparse = sparseSplit(split);
+  denseSplit(split) = MatrixXuf(sparse);
+  sparse = SparseMatrixuf(sparse.rows(), sparse.cols());
+  if (split == trainSplit) {
+    std::lock_guard<std::mutex> lock(XtrainCopiesMutex);
+    XtrainCSR = SparseMatrixufCSR();
+    XtrainCompressed = CompressedSparseMatrix();
+  }
+}
+
+void Data::computeMinMax()
+{
+  if (isDense(trainSplit))
+    EdgeML::computeMinMax(trainData, min, max);
+  else
+    EdgeML::computeMinMax(Xtrain, min, max);
+}
+
+void Data::minMaxNormalize(const DataSplit split)
+{
+  if (isDense(split))
+    EdgeML::minMaxNormalize(denseSplit(split), min, max);
+  else
+    EdgeML::minMaxNormalize(sparseSplit(split), min, max);
+}
+
+void Data::l2Normalize(const DataSplit split)
+{
+  if (isDense(split))
+    EdgeML::l2Normalize(denseSplit(split));
+  else
+    EdgeML::l2Normalize(sparseSplit(split));
+}
+
+void Data::meanVarNormalize(const DataSplit split, MatrixXuf& mean, MatrixXuf& stdDev)
+{
+  densify(split);
+  EdgeML::meanVarNormalize(denseSplit(split), mean, stdDev);
+}
+
+void Data::applyMeanVarNormalize(const DataSplit split, const MatrixXuf& mean, const MatrixXuf& stdDev)
+{
+  densify(split);
+  EdgeML::applyMeanVarNormalize(denseSplit(split), mean, stdDev);
+}
+
+void Data::buildXtrainCSR()
+{
+#ifndef ROWMAJOR
+  std::lock_guard<std::mutex> lock(XtrainCopiesMutex);
+  if (getXtrainCSR() != NULL || isDense(trainSplit))
+    return;
+  Timer timer("buildXtrainCSR");
+
+  assert(Xtrain.isCompressed());
+  const Eigen::Index numRows = Xtrain.rows();
+  const Eigen::Index numCols = Xtrain.cols();
+  const sparseIndex_t *const colStart = Xtrain.outerIndexPtr();
+  const sparseIndex_t *const rowIdx = Xtrain.innerIndexPtr();
+  const FP_TYPE *const vals = Xtrain.valuePtr();
+
+  // Each chunk of columns counts its non-zeros per row, and the offsets are laid out
+  // chunk after chunk within every row, so that chunks fill their slots independently
+  // and each row of the CSR keeps its column indices sorted.
+  const Eigen::Index numChunks = std::max((Eigen::Index)1, std::min((Eigen::Index)64, numCols / 4096));
+  const Eigen::Index chunkSize = (numCols + numChunks - 1) / numChunks;
+  std::vector<sparseIndex_t> slot(numChunks * numRows, 0);
+
+  pfor(Eigen::Index c = 0; c < numChunks; ++c) {
+    const Eigen::Index colEnd = std::min(numCols, (c + 1) * chunkSize);
+    for (Eigen::Index j = c * chunkSize; j < colEnd; ++j)
+      for (sparseIndex_t k = colStart[j]; k < colStart[j + 1]; ++k)
+        ++slot[c * numRows + rowIdx[k]];
+  }
+  timer.nextTime("counting non-zeros per row");
+
+  XtrainCSR = SparseMatrixufCSR(numRows, numCols);
+  XtrainCSR.resizeNonZeros(Xtrain.nonZeros());
+  sparseIndex_t *const rowStart = XtrainCSR.outerIndexPtr();
+  sparseIndex_t offset = 0;
+  for (Eigen::Index r = 0; r < numRows; ++r) {
+    rowStart[r] = offset;
+    for (Eigen::Index c = 0; c < numChunks; ++c) {
+      const sparseIndex_t count = slot[c * numRows + r];
+      slot[c * numRows + r] = offset;
+      offset += count;
+    }
+  }
+  rowStart[numRows] = offset;
+
+  sparseIndex_t *const colIdx = XtrainCSR.innerIndexPtr();
+  FP_TYPE *const csrVals = XtrainCSR.valuePtr();
+  pfor(Eigen::Index c = 0; c < numChunks; ++c) {
+    const Eigen::Index colEnd = std::min(numCols, (c + 1) * chunkSize);
+    for (Eigen::Index j = c * chunkSize; j < colEnd; ++j)
+      for (sparseIndex_t k = colStart[j]; k < colStart[j + 1]; ++k) {
+        const sparseIndex_t pos = slot[c * numRows + rowIdx[k]]++;
+        colIdx[pos] = (sparseIndex_t)j;
+        csrVals[pos] = vals[k];
+      }
+  }
+  timer.nextTime("filling rows");
+#endif
+}
+
+const SparseMatrixufCSR* Data::getXtrainCSR() const
+{
+#ifdef ROWMAJOR
+  return NULL;
+#else
+  if (Xtrain.nonZeros() == 0
+    || XtrainCSR.rows() != Xtrain.rows()
+    || XtrainCSR.cols() != Xtrain.cols()
+    || XtrainCSR.nonZeros() != Xtrain.nonZeros())
+    return NULL;
+  return &XtrainCSR;
+#endif
+}
+
+void Data::compressXtrain(const bool halfPrecision)
+{
+  std::lock_guard<std::mutex> lock(XtrainCopiesMutex);
+  if (getXtrainCompressed() != NULL || isDense(trainSplit))
+    return;
+  XtrainCompressed.compress(Xtrain, halfPrecision);
+}
+
+const CompressedSparseMatrix* Data::getXtrainCompressed() const
+{
+  if (Xtrain.nonZeros() == 0
+    || XtrainCompressed.rows() != Xtrain.rows()
+    || XtrainCompressed.cols() != Xtrain.cols()
+    || XtrainCompressed.nonZeros() != Xtrain.nonZeros())
+    return NULL;
+  return &XtrainCompressed;
+}
+
+void Data::reorderFeatures(const FeatureOrdering ordering)
+{
+  assert(isDataLoaded);
+  if (ordering == fileOrder)
+    return;
+  // Every column of dense data touches every feature
+  if (isDense(trainSplit)) {
+    LOG_INFO("Training data is stored dense; keeping the features in file order.");
+    return;
+  }
+
+  Timer timer("reorderFeatures");
+  const std::vector<featureCount_t> permutation = computeFeaturePermutation(Xtrain, ordering);
+  timer.nextTime("computing the feature permutation");
+  permuteFeatures(permutation);
+  timer.nextTime("permuting the features");
+}
+
+void Data::permuteFeatures(const std::vector<featureCount_t>& permutation)
+{
+  assert(featurePermutation.empty() && "features are already permuted");
+
+  std::lock_guard<std::mutex> lock(XtrainCopiesMutex);
+  const DataSplit splits[3] = { trainSplit, validationSplit, testSplit };
+  for (int s = 0; s < 3; ++s) {
+    if (isDense(splits[s]))
+      permuteFeatureRows(denseSplit(splits[s]), permutation);
+    else if (sparseSplit(splits[s]).cols() > 0)
+      permuteFeatureRows(sparseSplit(splits[s]), permutation);
+  }
+
+  // The copies of Xtrain are recognized by their shape only
+  XtrainCSR = SparseMatrixufCSR();
+  XtrainCompressed = CompressedSparseMatrix();
+  featurePermutation = permutation;
+}
+
 void Data::feedDenseData(const DenseDataPoint& point)
 {
   assert(ingestType == InterfaceIngest);
@@ -327,33 +585,20 @@ void Data::feedSparseData(const SparseDataPoint& point)
   numPointsIngested++;
 }
 
-void EdgeML::computeMinMax(
-  const SparseMatrixuf& dataMatrix,
+//
+// Sets @min and @max from the running minima @mn and maxima @mx of every feature:
+// constant features get min 0, and features without values get the range [0, 1]
+//
+static void storeMinMax(
+  std::vector<FP_TYPE>& mn,
+  std::vector<FP_TYPE>& mx,
   MatrixXuf& min,
   MatrixXuf& max)
 {
-#ifdef ROWMAJOR
-  assert(false);
-#endif
-  FP_TYPE * mn = new FP_TYPE[dataMatrix.rows()];
-  FP_TYPE * mx = new FP_TYPE[dataMatrix.rows()];
-  for (Eigen::Index i = 0; i < dataMatrix.rows(); ++i) {
-    mn[i] = 99999999999.0f;
-    mx[i] = -99999999999.0f;
-  }
-
-  const FP_TYPE * values = dataMatrix.valuePtr();
-  const sparseIndex_t * offsets = dataMatrix.innerIndexPtr();
-  Eigen::Index nnz = getnnzs(dataMatrix);
-
-  for (auto i = 0; i < nnz; ++i) {
-    mn[offsets[i]] = mn[offsets[i]] < values[i] ? mn[offsets[i]] : values[i];
-    mx[offsets[i]] = mx[offsets[i]] > values[i] ? mx[offsets[i]] : values[i];
-  }
-
+  const featureCount_t numFeatures = (featureCount_t)mn.size();
   featureCount_t zero_feats(0);
 
-  for (auto i = 0; i < dataMatrix.rows(); ++i) {
+  for (featureCount_t i = 0; i < numFeatures; ++i) {
     if (mn[i] == mx[i]) {
       mn[i] = 0;
     }
@@ -371,15 +616,55 @@ void EdgeML::computeMinMax(
   assert(min.rows() == 0);
 
   //Ok, go ahead
-  min = MatrixXuf::Zero(dataMatrix.rows(), 1);
-  max = MatrixXuf::Zero(dataMatrix.rows(), 1);
-  pfor(featureCount_t i = 0; i < dataMatrix.rows(); ++i)
+  min = MatrixXuf::Zero(numFeatures, 1);
+  max = MatrixXuf::Zero(numFeatures, 1);
+  pfor(featureCount_t i = 0; i < numFeatures; ++i)
     min(i, 0) = mn[i];
-  pfor(featureCount_t i = 0; i < dataMatrix.rows(); ++i)
+  pfor(featureCount_t i = 0; i < numFeatures; ++i)
     max(i, 0) = mx[i];
+}
 
-  delete[] mn;
-  delete[] mx;
+void EdgeML::computeMinMax(
+  const SparseMatrixuf& dataMatrix,
+  MatrixXuf& min,
+  MatrixXuf& max)
+{
+#ifdef ROWMAJOR
+  assert(false);
+#endif
+  std::vector<FP_TYPE> mn(dataMatrix.rows(), 99999999999.0f);
+  std::vector<FP_TYPE> mx(dataMatrix.rows(), -99999999999.0f);
+
+  const FP_TYPE * values = dataMatrix.valuePtr();
+  const sparseIndex_t * offsets = dataMatrix.innerIndexPtr();
+  Eigen::Index nnz = getnnzs(dataMatrix);
+
+  for (auto i = 0; i < nnz; ++i) {
+    mn[offsets[i]] = mn[offsets[i]] < values[i] ? mn[offsets[i]] : values[i];
+    mx[offsets[i]] = mx[offsets[i]] > values[i] ? mx[offsets[i]] : values[i];
+  }
+
+  storeMinMax(mn, mx, min, max);
+}
+
+void EdgeML::computeMinMax(
+  const MatrixXuf& dataMatrix,
+  MatrixXuf& min,
+  MatrixXuf& max)
+{
+  std::vector<FP_TYPE> mn(dataMatrix.rows(), 99999999999.0f);
+  std::vector<FP_TYPE> mx(dataMatrix.rows(), -99999999999.0f);
+
+  for (Eigen::Index j = 0; j < dataMatrix.cols(); ++j)
+    for (Eigen::Index i = 0; i < dataMatrix.rows(); ++i) {
+      const FP_TYPE value = dataMatrix(i, j);
+      if (value == (FP_TYPE)0.0)
+        continue;
+      mn[i] = mn[i] < value ? mn[i] : value;
+      mx[i] = mx[i] > value ? mx[i] : value;
+    }
+
+  storeMinMax(mn, mx, min, max);
 }
 
 void EdgeML::minMaxNormalize(
@@ -409,6 +694,20 @@ void EdgeML::minMaxNormalize(
   }
 }
 
+void EdgeML::minMaxNormalize(
+  MatrixXuf& dataMatrix,
+  const MatrixXuf& min,
+  const MatrixXuf& max)
+{
+  assert(min.rows() == dataMatrix.rows());
+  assert(max.rows() == dataMatrix.rows());
+
+  pfor(Eigen::Index j = 0; j < dataMatrix.cols(); ++j)
+    for (Eigen::Index i = 0; i < dataMatrix.rows(); ++i)
+      if (dataMatrix(i, j) != (FP_TYPE)0.0)
+        dataMatrix(i, j) = (dataMatrix(i, j) - min(i, 0)) / (max(i, 0) - min(i, 0));
+}
+
 void EdgeML::l2Normalize(SparseMatrixuf& dataMatrix)
 {
 #ifdef ROWMAJOR
@@ -423,44 +722,289 @@ void EdgeML::l2Normalize(SparseMatrixuf& dataMatrix)
   }
 }
 
+void EdgeML::l2Normalize(MatrixXuf& dataMatrix)
+{
+  pfor(Eigen::Index i = 0; i < dataMatrix.cols(); ++i) {
+    const FP_TYPE norm = dataMatrix.col(i).norm();
+    // Points without non-zeros have no entries to scale in sparse data
+    if (norm > (FP_TYPE)0.0)
+      dataMatrix.col(i) /= norm;
+  }
+}
+
 void EdgeML::meanVarNormalize(
-  SparseMatrixuf& dataMatrix,     //< 
+  MatrixXuf& dataMatrix,          //< 
   MatrixXuf& mean,                //< Initialize to vector of size numFeatures
   MatrixXuf& stdDev)            //< Initialize to vector of size numFeatures
 {
-  MatrixXuf denseDataMatrix = MatrixXuf(dataMatrix);
-  const Eigen::Index numDataPoints = denseDataMatrix.cols();
-  const Eigen::Index numFeatures = denseDataMatrix.rows();
+  const Eigen::Index numDataPoints = dataMatrix.cols();
+  const Eigen::Index numFeatures = dataMatrix.rows();
+
+  // Column by column, to read the data in storage order
+  std::vector<double> sum(numFeatures, 0.0), sumSq(numFeatures, 0.0);
+  for (Eigen::Index j = 0; j < numDataPoints; ++j)
+    for (Eigen::Index f = 0; f < numFeatures; ++f)
+      sum[f] += dataMatrix(f, j);
+  mean = MatrixXuf::Zero(numFeatures, 1);
+  for (Eigen::Index f = 0; f < numFeatures; ++f)
+    mean(f, 0) = (FP_TYPE)(sum[f] / numDataPoints);
+  for (Eigen::Index j = 0; j < numDataPoints; ++j)
+    for (Eigen::Index f = 0; f < numFeatures; ++f) {
+      const double centered = (double)dataMatrix(f, j) - mean(f, 0);
+      sumSq[f] += centered * centered;
+    }
 
-  // std::cout<<denseDataMatrix<<std::endl<<std::endl;
-  const MatrixXuf onesVec = MatrixXuf::Ones(numDataPoints, 1);
+  stdDev = MatrixXuf::Zero(numFeatures, 1);
+  for (Eigen::Index f = 0; f < numFeatures; ++f) {
+    stdDev(f, 0) = (FP_TYPE)std::sqrt(sumSq[f] / numDataPoints);
+    if (fabs(stdDev(f, 0)) < (FP_TYPE)1e-7)
+      stdDev(f, 0) = (FP_TYPE)1.0;
+  }
 
-  mm(mean, denseDataMatrix, CblasNoTrans, onesVec, CblasNoTrans, (FP_TYPE)1.0 / numDataPoints, (FP_TYPE)0.0);
-  mm(denseDataMatrix, mean, CblasNoTrans, onesVec, CblasTrans, (FP_TYPE)-1.0, (FP_TYPE)1.0);
+  applyMeanVarNormalize(dataMatrix, mean, stdDev);
+}
 
+void EdgeML::applyMeanVarNormalize(
+  MatrixXuf& dataMatrix,
+  const MatrixXuf& mean,
+  const MatrixXuf& stdDev)
+{
+  assert(mean.rows() == dataMatrix.rows());
+  assert(stdDev.rows() == dataMatrix.rows());
+
+  const Eigen::Index numFeatures = dataMatrix.rows();
+  const Matrix<FP_TYPE, Dynamic, 1> invStdDev = stdDev.col(0).cwiseInverse();
+  pfor(Eigen::Index j = 0; j < dataMatrix.cols(); ++j) {
+    dataMatrix.col(j) = (dataMatrix.col(j) - mean.col(0)).cwiseProduct(invStdDev);
+    // Bias feature
+    dataMatrix(numFeatures - 1, j) = (FP_TYPE)1.0;
+  }
+}
 
-  denseDataMatrix.transposeInPlace();
+void EdgeML::appendReservoirSample(
+  SparseMatrixuf& X,
+  SparseMatrixuf& Y,
+  const SparseMatrixuf& Xold,
+  const SparseMatrixuf& Yold,
+  const dataCount_t numSamples,
+  const unsigned long long seed)
+{
+#ifdef ROWMAJOR
+  assert(false);
+#endif
+  assert(X.rows() == Xold.rows());
+  assert(Y.rows() == Yold.rows());
+  assert(X.cols() == Y.cols());
+  assert(Xold.cols() == Yold.cols());
+
+  std::mt19937_64 generator(seed);
+
+  // Algorithm R over the columns of Xold
+  const Eigen::Index numOld = Xold.cols();
+  const Eigen::Index numSampled = std::min((Eigen::Index)numSamples, numOld);
+  std::vector<Eigen::Index> reservoir;
+  for (Eigen::Index c = 0; c < numOld; ++c) {
+    if (c < numSampled)
+      reservoir.push_back(c);
+    else {
+      std::uniform_int_distribution<Eigen::Index> pick(0, c);
+      Eigen::Index r = pick(generator);
+      if (r < numSampled) reservoir[r] = c;
+    }
+  }
+
+  // (fromOld, column) of every output column
+  std::vector<std::pair<bool, Eigen::Index> > order;
+  for (Eigen::Index c = 0; c < X.cols(); ++c)
+    order.push_back(std::make_pair(false, c));
+  for (Eigen::Index r = 0; r < numSampled; ++r)
+    order.push_back(std::make_pair(true, reservoir[r]));
+  std::shuffle(order.begin(), order.end(), generator);
+
+  std::vector<Trip> dataTriplets, labelTriplets;
+  dataTriplets.reserve(X.nonZeros() + numSampled * (Xold.nonZeros() / std::max((Eigen::Index)1, numOld) + 1));
+  for (size_t o = 0; o < order.size(); ++o) {
+    const SparseMatrixuf& fromX = order[o].first ? Xold : X;
+    const SparseMatrixuf& fromY = order[o].first ? Yold : Y;
+    for (SparseMatrixuf::InnerIterator it(fromX, order[o].second); it; ++it)
+      dataTriplets.push_back(Trip(it.row(), o, it.value()));
+    for (SparseMatrixuf::InnerIterator it(fromY, order[o].second); it; ++it)
+      labelTriplets.push_back(Trip(it.row(), o, it.value()));
+  }
 
-  for (Eigen::Index f = 0; f < numFeatures; f++) {
-    stdDev(f, 0) = (FP_TYPE)std::sqrt(dot(numDataPoints, denseDataMatrix.data() + f*numDataPoints, 1,
-      denseDataMatrix.data() + f*numDataPoints, 1)
-      / numDataPoints);
+  SparseMatrixuf mergedX(X.rows(), order.size());
+  SparseMatrixuf mergedY(Y.rows(), order.size());
+  mergedX.setFromTriplets(dataTriplets.begin(), dataTriplets.end());
+  mergedY.setFromTriplets(labelTriplets.begin(), labelTriplets.end());
+  X.swap(mergedX);
+  Y.swap(mergedY);
 
-    if (!(fabs(stdDev(f, 0)) < (FP_TYPE)1e-7)) {
-      scal(numDataPoints, (FP_TYPE)1.0 / stdDev(f, 0), denseDataMatrix.data() + f*numDataPoints, 1);
+  LOG_INFO("Appended " + std::to_string(numSampled) + " of " + std::to_string(numOld) + " old points to " + std::to_string(X.cols() - numSampled) + " new points");
+}
+
+// Columns sampled, and features kept per sampled column, for the co-occurrence graph
+static const Eigen::Index coOccurrenceSampleSize = 10000;
+static const size_t coOccurrenceMaxFeaturesPerColumn = 64;
+// Edges collected before duplicates are first removed from the co-occurrence graph
+static const size_t coOccurrenceMinEdgesToCompact = (size_t)1 << 20;
+
+// Original ids of the features with non-zeros in reverse Cuthill-McKee order
+static std::vector<featureCount_t> reverseCuthillMcKeeOrder(
+  const SparseMatrixuf& X,
+  const std::vector<dataCount_t>& frequency)
+{
+  typedef SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t> SparseColMajor;
+#ifdef ROWMAJOR
+  const SparseColMajor XCols(X);
+#else
+  const SparseColMajor& XCols = X;
+#endif
+  const featureCount_t numFeatures = X.rows();
+  const Eigen::Index stride = std::max((Eigen::Index)1, X.cols() / coOccurrenceSampleSize);
+
+  // An edge (lower id, higher id) between every two features of a sampled column; columns
+  // with many features only contribute their most frequent ones. Duplicates are removed
+  // whenever the edges have doubled since the last removal, so that the list stays within
+  // twice the number of distinct edges instead of growing with the pairs of every column.
+  std::vector<std::pair<featureCount_t, featureCount_t> > edges;
+  size_t compactedEdges = 0;
+  std::vector<featureCount_t> features;
+  auto isMoreFrequent = [&frequency](const featureCount_t a, const featureCount_t b) {
+    return frequency[a] > frequency[b];
+  };
+  for (Eigen::Index j = 0; j < XCols.cols(); j += stride) {
+    features.clear();
+    for (SparseColMajor::InnerIterator it(XCols, j); it; ++it)
+      features.push_back((featureCount_t)it.row());
+    if (features.size() > coOccurrenceMaxFeaturesPerColumn) {
+      std::partial_sort(features.begin(), features.begin() + coOccurrenceMaxFeaturesPerColumn,
+        features.end(), isMoreFrequent);
+      features.resize(coOccurrenceMaxFeaturesPerColumn);
     }
-    else {
-      stdDev(f, 0) = (FP_TYPE)1.0;
+    for (size_t a = 0; a < features.size(); ++a)
+      for (size_t b = a + 1; b < features.size(); ++b)
+        edges.push_back(std::minmax(features[a], features[b]));
+
+    if (edges.size() >= std::max(coOccurrenceMinEdgesToCompact, 2 * compactedEdges)) {
+      std::sort(edges.begin(), edges.end());
+      edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+      compactedEdges = edges.size();
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  // Adjacency lists with both directions of every edge, each sorted by neighbour id
+  std::vector<size_t> adjacencyStart(numFeatures + 1, 0);
+  for (size_t e = 0; e < edges.size(); ++e) {
+    ++adjacencyStart[edges[e].first + 1];
+    ++adjacencyStart[edges[e].second + 1];
+  }
+  for (featureCount_t f = 0; f < numFeatures; ++f)
+    adjacencyStart[f + 1] += adjacencyStart[f];
+  std::vector<featureCount_t> adjacency(2 * edges.size());
+  std::vector<size_t> next(adjacencyStart.begin(), adjacencyStart.end() - 1);
+  for (size_t e = 0; e < edges.size(); ++e)
+    adjacency[next[edges[e].second]++] = edges[e].first;
+  for (size_t e = 0; e < edges.size(); ++e)
+    adjacency[next[edges[e].first]++] = edges[e].second;
+  edges.clear();
+  edges.shrink_to_fit();
+
+  auto hasLowerDegree = [&adjacencyStart](const featureCount_t a, const featureCount_t b) {
+    return adjacencyStart[a + 1] - adjacencyStart[a] < adjacencyStart[b + 1] - adjacencyStart[b];
+  };
+
+  // Breadth-first from a feature of lowest degree in every component, visiting
+  // neighbours by increasing degree
+  std::vector<featureCount_t> starts;
+  for (featureCount_t f = 0; f < numFeatures; ++f)
+    if (frequency[f] > 0)
+      starts.push_back(f);
+  std::stable_sort(starts.begin(), starts.end(), hasLowerDegree);
+
+  std::vector<char> isVisited(numFeatures, 0);
+  std::vector<featureCount_t> order, neighbours;
+  order.reserve(starts.size());
+  for (size_t s = 0; s < starts.size(); ++s) {
+    if (isVisited[starts[s]])
+      continue;
+    isVisited[starts[s]] = 1;
+    size_t head = order.size();
+    order.push_back(starts[s]);
+    while (head < order.size()) {
+      const featureCount_t f = order[head++];
+      neighbours.clear();
+      for (size_t k = adjacencyStart[f]; k < adjacencyStart[f + 1]; ++k)
+        if (!isVisited[adjacency[k]]) {
+          isVisited[adjacency[k]] = 1;
+          neighbours.push_back(adjacency[k]);
+        }
+      std::stable_sort(neighbours.begin(), neighbours.end(), hasLowerDegree);
+      order.insert(order.end(), neighbours.begin(), neighbours.end());
     }
   }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
 
-  for (Eigen::Index d = 0; d < numDataPoints; d++) {
-    denseDataMatrix(d, numFeatures - 1) = (FP_TYPE)1.0;
+std::vector<featureCount_t> EdgeML::computeFeaturePermutation(
+  const SparseMatrixuf& X,
+  const FeatureOrdering ordering)
+{
+  const featureCount_t numFeatures = X.rows();
+  std::vector<dataCount_t> frequency(numFeatures, 0);
+  for (Eigen::Index k = 0; k < X.outerSize(); ++k)
+    for (SparseMatrixuf::InnerIterator it(X, k); it; ++it)
+      ++frequency[it.row()];
+
+  // Original ids in their new order
+  std::vector<featureCount_t> order;
+  if (ordering == coOccurrenceOrder) {
+    order = reverseCuthillMcKeeOrder(X, frequency);
+    for (featureCount_t f = 0; f < numFeatures; ++f)
+      if (frequency[f] == 0)
+        order.push_back(f);
+  }
+  else {
+    order.resize(numFeatures);
+    std::iota(order.begin(), order.end(), (featureCount_t)0);
+    if (ordering == frequencyOrder)
+      std::stable_sort(order.begin(), order.end(),
+        [&frequency](const featureCount_t a, const featureCount_t b) { return frequency[a] > frequency[b]; });
   }
+  assert(order.size() == numFeatures);
 
-  denseDataMatrix.transposeInPlace();
+  std::vector<featureCount_t> permutation(numFeatures);
+  for (featureCount_t i = 0; i < numFeatures; ++i)
+    permutation[order[i]] = i;
+  return permutation;
+}
+
+void EdgeML::permuteFeatureRows(
+  SparseMatrixuf& X,
+  const std::vector<featureCount_t>& permutation)
+{
+  assert(permutation.size() == (size_t)X.rows());
+  Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, sparseIndex_t> P(X.rows());
+  for (Eigen::Index i = 0; i < X.rows(); ++i)
+    P.indices()[i] = (sparseIndex_t)permutation[i];
+
+  SparseMatrixuf permuted = P * X;
+  permuted.makeCompressed();
+  X.swap(permuted);
+}
+
+void EdgeML::permuteFeatureRows(
+  MatrixXuf& X,
+  const std::vector<featureCount_t>& permutation)
+{
+  assert(permutation.size() == (size_t)X.rows());
+  Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, sparseIndex_t> P(X.rows());
+  for (Eigen::Index i = 0; i < X.rows(); ++i)
+    P.indices()[i] = (sparseIndex_t)permutation[i];
 
-  dataMatrix = denseDataMatrix.sparseView();
+  X = P * X;
 }
 
 void EdgeML::saveMinMax(
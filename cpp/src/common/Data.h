@@ -5,6 +5,7 @@
 #define __DATA_H__
 
 #include "pre_processor.h"
+#include "compressed_sparse.h"
 
 namespace EdgeML
 {
@@ -33,6 +34,16 @@ namespace EdgeML
     FileIngest, InterfaceIngest
   };
 
+  enum FeatureOrdering
+  {
+    fileOrder, frequencyOrder, coOccurrenceOrder
+  };
+
+  enum DataSplit
+  {
+    trainSplit, validationSplit, testSplit
+  };
+
   struct DataFormatParams
   {
     dataCount_t numTrainPoints;
@@ -69,11 +80,22 @@ namespace EdgeML
     std::vector<FP_TYPE> denseDataHolder;
     dataCount_t numPointsIngested;
 
+    MatrixXuf& denseSplit(const DataSplit split);
+    SparseMatrixuf& sparseSplit(const DataSplit split);
+    void storeDense(const DataSplit split);
+    void densify(const DataSplit split);
+
   public:
     bool isDataLoaded;
 
     //NormalizationFormat normalizationType;
 
+    //
+    // Each split of the features is stored either dense, in trainData, validationData or
+    // testData, or sparse, in Xtrain, Xvalidation or Xtest (see isDense). The sparse matrix
+    // of a dense split keeps the shape of the data but no entries, so that its rows() and
+    // cols() can be read whatever the storage. Labels are always in Ytrain etc.
+    //
     MatrixXuf trainData, trainLabel;
     MatrixXuf validationData, validationLabel;
     MatrixXuf testData, testLabel;
@@ -82,9 +104,18 @@ namespace EdgeML
     SparseMatrixuf Xvalidation, Yvalidation;
     SparseMatrixuf Xtest, Ytest;
 
+    // CSR copy of Xtrain for products with Xtrain^T, empty until buildXtrainCSR is called
+    SparseMatrixufCSR XtrainCSR;
+
+    // Compressed copy of Xtrain for W*X passes, empty until compressXtrain is called
+    CompressedSparseMatrix XtrainCompressed;
+
     MatrixXuf mean, stdDev;
     MatrixXuf min, max;
 
+    // New id of every original feature id; empty while the features are in file order
+    std::vector<featureCount_t> featurePermutation;
+
     void loadDataFromFile(
       DataFormat format,
       std::string trainFile,
@@ -100,15 +131,104 @@ namespace EdgeML
 
     void feedSparseData(const SparseDataPoint& point);
     void feedDenseData(const DenseDataPoint& point);
+
+    //
+    // Input given dense (tsv files or feedDenseData) is kept dense when that takes no more
+    // memory than its non-zeros with their indices, i.e. when at least a fraction
+    // sizeof(FP_TYPE)/(sizeof(FP_TYPE) + sizeof(sparseIndex_t)) of its entries is non-zero.
+    // EDGEML_DENSE_STORAGE_MIN_DENSITY in the environment overrides that fraction;
+    // 0 keeps all dense input dense, and any value above 1 stores it sparse.
+    //
     void finalizeData();
 
+    // True if @split is stored in trainData, validationData or testData
+    bool isDense(const DataSplit split) const;
+
+    // The features of @split as stored: DataMatType is MatrixXuf if isDense(split), else SparseMatrixuf
+    template<class DataMatType>
+    const DataMatType& features(const DataSplit split) const;
+
+    //
+    // Normalization of a split, on its own storage. computeMinMax sets min and max from
+    // the training split. Zeros are left out of min-max normalization, as they are absent
+    // from sparse data. Mean-variance normalization fills in the zeros, so it stores the
+    // split dense; meanVarNormalize computes mean and stdDev on the split, and
+    // applyMeanVarNormalize uses given ones (e.g. those exported with a model).
+    //
+    void computeMinMax();
+    void minMaxNormalize(const DataSplit split);
+    void l2Normalize(const DataSplit split);
+    void meanVarNormalize(const DataSplit split, MatrixXuf& mean, MatrixXuf& stdDev);
+    void applyMeanVarNormalize(const DataSplit split, const MatrixXuf& mean, const MatrixXuf& stdDev);
+
+    //
+    // Builds XtrainCSR in parallel, unless it is already built for the current Xtrain.
+    // Call after Xtrain has been normalized; concurrent callers sharing the data are serialized.
+    // No-op with ROWMAJOR, where Xtrain itself is CSR, and for dense training data,
+    // whose products with its transpose run as gemm.
+    //
+    void buildXtrainCSR();
+
+    // NULL if XtrainCSR has not been built for the current Xtrain
+    const SparseMatrixufCSR* getXtrainCSR() const;
+
+    //
+    // Builds XtrainCompressed, unless it is already built for the current Xtrain.
+    // Same calling rules as buildXtrainCSR, including the no-op for dense training data.
+    // @halfPrecision stores values as float16.
+    //
+    void compressXtrain(const bool halfPrecision);
+
+    // NULL if XtrainCompressed has not been built for the current Xtrain
+    const CompressedSparseMatrix* getXtrainCompressed() const;
+
+    //
+    // Renumbers the features so that features used together get nearby ids, and hence
+    // nearby columns in projection matrices (see computeFeaturePermutation). The permutation
+    // is computed on Xtrain and applied to every loaded split. Call after normalization:
+    // min/max and mean/stdDev stay in the original order.
+    //
+    void reorderFeatures(const FeatureOrdering ordering);
+
+    // Renumbers the features of every loaded split, sparse or dense, with @permutation,
+    // e.g. one stored in a model
+    void permuteFeatures(const std::vector<featureCount_t>& permutation);
+
     inline DataIngestType getIngestType() { return ingestType; }
  };
 
+  template<> const MatrixXuf& Data::features<MatrixXuf>(const DataSplit split) const;
+  template<> const SparseMatrixuf& Data::features<SparseMatrixuf>(const DataSplit split) const;
+
   void computeMinMax(const SparseMatrixuf& dataMatrix, MatrixXuf& min, MatrixXuf& max);
+  // Zeros are skipped, so that the result is the same as on the sparse view of @dataMatrix
+  void computeMinMax(const MatrixXuf& dataMatrix, MatrixXuf& min, MatrixXuf& max);
   void minMaxNormalize(SparseMatrixuf& dataMatrix, const MatrixXuf& min, const MatrixXuf& max);
+  // Zeros stay zero, as on the sparse view of @dataMatrix
+  void minMaxNormalize(MatrixXuf& dataMatrix, const MatrixXuf& min, const MatrixXuf& max);
   void l2Normalize(SparseMatrixuf& dataMatrix);
-  void meanVarNormalize(SparseMatrixuf& dataMatrix, MatrixXuf& mean, MatrixXuf& stdDev);
+  void l2Normalize(MatrixXuf& dataMatrix);
+  void meanVarNormalize(MatrixXuf& dataMatrix, MatrixXuf& mean, MatrixXuf& stdDev);
+  // Normalizes with previously computed mean/stdDev (e.g. those exported with a model)
+  void applyMeanVarNormalize(MatrixXuf& dataMatrix, const MatrixXuf& mean, const MatrixXuf& stdDev);
+  // Appends a uniform sample of numSamples columns of Xold/Yold (reservoir sampling) to X/Y
+  // and shuffles the columns, so that minibatches mix new and old points
+  void appendReservoirSample(
+    SparseMatrixuf& X, SparseMatrixuf& Y,
+    const SparseMatrixuf& Xold, const SparseMatrixuf& Yold,
+    const dataCount_t numSamples, const unsigned long long seed);
+  //
+  // New id of every row (feature) of @X. frequencyOrder puts the features with the most
+  // non-zeros first. coOccurrenceOrder numbers the features with reverse Cuthill-McKee on
+  // the graph of features that co-occur in a column, computed on a sample of columns.
+  // Features without non-zeros come last in both.
+  //
+  std::vector<featureCount_t> computeFeaturePermutation(
+    const SparseMatrixuf& X,
+    const FeatureOrdering ordering);
+  // Moves row i of @X to row permutation[i]
+  void permuteFeatureRows(SparseMatrixuf& X, const std::vector<featureCount_t>& permutation);
+  void permuteFeatureRows(MatrixXuf& X, const std::vector<featureCount_t>& permutation);
   void saveMinMax(const MatrixXuf& min, const MatrixXuf& max, std::string fileName);
   void loadMinMax(MatrixXuf& min, MatrixXuf& max, int dim, std::string fileName);
 }
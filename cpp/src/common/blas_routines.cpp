@@ -3,6 +3,12 @@
 
 #include "blas_routines.h"
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <sstream>
+
 using namespace EdgeML;
 
 // OUT = alpha*t1(in1)*t2(in2) + beta*out
@@ -354,6 +360,199 @@ void EdgeML::mm(
 }
 
 
+// out = alpha*in1*in2 + beta*out
+// Both inputs sparse, output dense
+void EdgeML::mm(
+  MatrixXuf& out,
+  const SparseMatrixuf& in1,
+  const CBLAS_TRANSPOSE t1,
+  const SparseMatrixuf& in2,
+  const CBLAS_TRANSPOSE t2,
+  const FP_TYPE alpha,
+  const FP_TYPE beta)
+{
+  Timer timer("sp_sp_mm");
+
+  assert(t1 == CblasNoTrans && t2 == CblasNoTrans);
+  assert(out.rows() == in1.rows());
+  assert(out.cols() == in2.cols());
+  assert(in1.cols() == in2.rows());
+
+  // Column j of the output is the combination of the columns of in1 picked by column j of in2
+  typedef SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t> SparseColMajor;
+#ifdef ROWMAJOR
+  const SparseColMajor in1Cols(in1);
+  const SparseColMajor in2Cols(in2);
+  timer.nextTime("creating colmajor copies of the inputs");
+#else
+  const SparseColMajor& in1Cols = in1;
+  const SparseColMajor& in2Cols = in2;
+#endif
+
+  const Eigen::Index blockSize = 64;
+  const Eigen::Index numBlocks = (out.cols() + blockSize - 1) / blockSize;
+  pfor(Eigen::Index block = 0; block < numBlocks; ++block) {
+    const Eigen::Index colsEnd = std::min(out.cols(), (block + 1) * blockSize);
+    for (Eigen::Index j = block * blockSize; j < colsEnd; ++j) {
+      if (beta == (FP_TYPE)0.0)
+        out.col(j).setZero();
+      else if (beta != (FP_TYPE)1.0)
+        out.col(j) *= beta;
+
+      for (SparseColMajor::InnerIterator it2(in2Cols, j); it2; ++it2) {
+        const FP_TYPE scale = alpha * it2.value();
+        for (SparseColMajor::InnerIterator it1(in1Cols, it2.row()); it1; ++it1)
+          out(it1.row(), j) += scale * it1.value();
+      }
+    }
+  }
+  timer.nextTime("sparse x sparse product");
+}
+
+
+static FP_TYPE density(const MatrixXuf& A)
+{
+  if (A.size() == 0)
+    return (FP_TYPE)0.0;
+  return (FP_TYPE)(A.array() != (FP_TYPE)0.0).count() / (FP_TYPE)A.size();
+}
+
+// Seconds taken by the faster of a few runs of @product
+static double fastestRun(const std::function<void()>& product)
+{
+  const int numRuns = 3;
+  double fastest = std::numeric_limits<double>::max();
+  for (int r = 0; r < numRuns; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    product();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    fastest = std::min(fastest, elapsed.count());
+  }
+  return fastest;
+}
+
+//
+// Density of in1 below which mmAdaptive takes the sparse x sparse path. Which kernel is
+// faster depends on the shapes, the sparsity of in2 and the machine, so it is measured
+// once per process, on the first call: random in1 of the caller's shape at increasing
+// densities times the first columns of the caller's in2, with both kernels. The crossover
+// is the lowest density at which the dense x sparse kernel wins. Setting
+// EDGEML_SPSP_CROSSOVER_DENSITY in the environment skips the measurement.
+//
+static FP_TYPE spSpCrossoverDensity(const MatrixXuf& in1, const SparseMatrixuf& in2)
+{
+  static const FP_TYPE crossover = [&]() {
+    const char* setting = getenv("EDGEML_SPSP_CROSSOVER_DENSITY");
+    if (setting != NULL) {
+      const FP_TYPE value = (FP_TYPE)atof(setting);
+      LOG_INFO("Crossover density for sparse x sparse products, from the environment: " + std::to_string(value));
+      return value;
+    }
+
+    Timer timer("spSpCrossoverDensity");
+    const Eigen::Index sampleCols = std::min(in2.cols(), (Eigen::Index)512);
+    const SparseMatrixuf in2Sample = in2.leftCols(sampleCols);
+    MatrixXuf out(in1.rows(), sampleCols);
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<FP_TYPE> uniform((FP_TYPE)0.0, (FP_TYPE)1.0);
+
+    const FP_TYPE densities[] = { 0.005f, 0.01f, 0.02f, 0.05f, 0.1f, 0.2f, 0.5f };
+    FP_TYPE value = densities[0];
+    std::stringstream measured;
+    for (const FP_TYPE d : densities) {
+      MatrixXuf in1Sample(in1.rows(), in1.cols());
+      for (Eigen::Index i = 0; i < in1Sample.size(); ++i)
+        in1Sample.data()[i] = uniform(generator) < d ? uniform(generator) : (FP_TYPE)0.0;
+      const SparseMatrixuf in1SampleSparse = in1Sample.sparseView();
+
+      const double dense = fastestRun([&]() {
+        mm(out, in1Sample, CblasNoTrans, in2Sample, CblasNoTrans, 1.0, 0.0); });
+      const double sparse = fastestRun([&]() {
+        mm(out, in1SampleSparse, CblasNoTrans, in2Sample, CblasNoTrans, 1.0, 0.0); });
+      measured << " " << d << ": " << sparse / std::max(dense, 1e-9);
+      value = d;
+      if (dense <= sparse)
+        break;
+    }
+    timer.nextTime("timing both kernels");
+
+    LOG_INFO("Crossover density for sparse x sparse products, measured on "
+      + std::to_string(in1.rows()) + "x" + std::to_string(in1.cols()) + " times "
+      + std::to_string(in2.rows()) + "x" + std::to_string(sampleCols) + ": " + std::to_string(value)
+      + " (sparse/dense time per density:" + measured.str() + ")");
+    return value;
+  }();
+  return crossover;
+}
+
+void EdgeML::mmAdaptive(
+  MatrixXuf& out,
+  const MatrixXuf& in1,
+  const CBLAS_TRANSPOSE t1,
+  const SparseMatrixuf& in2,
+  const CBLAS_TRANSPOSE t2,
+  const FP_TYPE alpha,
+  const FP_TYPE beta)
+{
+  if (t1 != CblasNoTrans || t2 != CblasNoTrans) {
+    mm(out, in1, t1, in2, t2, alpha, beta);
+    return;
+  }
+
+  if (in1.size() > 0 && in2.cols() > 0 && density(in1) < spSpCrossoverDensity(in1, in2)) {
+    const SparseMatrixuf in1Sparse = in1.sparseView();
+    mm(out, in1Sparse, CblasNoTrans, in2, CblasNoTrans, alpha, beta);
+  }
+  else
+    mm(out, in1, CblasNoTrans, in2, CblasNoTrans, alpha, beta);
+}
+
+void EdgeML::mmAdaptive(
+  MatrixXuf& out,
+  const SparseMatrixuf& in1,
+  const CBLAS_TRANSPOSE t1,
+  const SparseMatrixuf& in2,
+  const CBLAS_TRANSPOSE t2,
+  const FP_TYPE alpha,
+  const FP_TYPE beta)
+{
+  mm(out, in1, t1, in2, t2, alpha, beta);
+}
+
+
+void EdgeML::mmTransCSR(
+  MatrixXuf& out,
+  const MatrixXuf& in1,
+  const SparseMatrixufCSR& in2,
+  const FP_TYPE alpha,
+  const FP_TYPE beta,
+  Eigen::Index in2ColsBegin,
+  Eigen::Index in2ColsEnd)
+{
+  Timer timer("dn_csrT_mm");
+  assert(0 <= in2ColsBegin && in2ColsBegin <= in2ColsEnd && in2ColsEnd <= in2.cols());
+  assert(in1.cols() == in2ColsEnd - in2ColsBegin);
+  assert(out.rows() == in1.rows());
+  assert(out.cols() == in2.rows());
+  assert(in2.isCompressed());
+
+  const sparseIndex_t *const rowStart = in2.outerIndexPtr();
+  const sparseIndex_t *const colIdx = in2.innerIndexPtr();
+  const FP_TYPE *const vals = in2.valuePtr();
+
+  pfor(Eigen::Index r = 0; r < in2.rows(); ++r) {
+    if (beta == (FP_TYPE)0.0)
+      out.col(r).setZero();
+    else if (beta != (FP_TYPE)1.0)
+      out.col(r) *= beta;
+
+    // Column indices are sorted within a row; skip to the requested range
+    const sparseIndex_t *const first = std::lower_bound(colIdx + rowStart[r], colIdx + rowStart[r + 1], (sparseIndex_t)in2ColsBegin);
+    for (sparseIndex_t k = (sparseIndex_t)(first - colIdx); k < rowStart[r + 1] && colIdx[k] < in2ColsEnd; ++k)
+      out.col(r).noalias() += (alpha * vals[k]) * in1.col(colIdx[k] - in2ColsBegin);
+  }
+}
+
 Eigen::Index EdgeML::getnnzs(const SparseMatrixuf& A)
 {
 #ifdef ROWMAJOR
@@ -38,6 +38,52 @@ namespace EdgeML
     Eigen::Index in2ColsBegin = -1,
     Eigen::Index in2ColsEnd = -1);
 
+  // out = alpha*in1*in2 + beta*out with both inputs sparse and a dense output;
+  // only CblasNoTrans is supported. Parallel over blocks of output columns.
+  void mm(MatrixXuf& out,
+    const SparseMatrixuf& in1,
+    const CBLAS_TRANSPOSE t1,
+    const SparseMatrixuf& in2,
+    const CBLAS_TRANSPOSE t2,
+    const FP_TYPE alpha,
+    const FP_TYPE beta);
+
+  //
+  // Same as mm(out, dense in1, ..., sparse in2, ...), but takes the sparse x sparse
+  // path when the fraction of non-zeros in in1 is below a crossover density. The crossover
+  // is measured once per process on operands of the shapes of the first call and logged,
+  // unless EDGEML_SPSP_CROSSOVER_DENSITY is set in the environment.
+  //
+  void mmAdaptive(MatrixXuf& out,
+    const MatrixXuf& in1,
+    const CBLAS_TRANSPOSE t1,
+    const SparseMatrixuf& in2,
+    const CBLAS_TRANSPOSE t2,
+    const FP_TYPE alpha,
+    const FP_TYPE beta);
+
+  // For callers whose in1 type is a build option; a sparse in1 always takes the sparse x sparse path
+  void mmAdaptive(MatrixXuf& out,
+    const SparseMatrixuf& in1,
+    const CBLAS_TRANSPOSE t1,
+    const SparseMatrixuf& in2,
+    const CBLAS_TRANSPOSE t2,
+    const FP_TYPE alpha,
+    const FP_TYPE beta);
+
+  //
+  // out = alpha*in1*in2(:, in2ColsBegin:in2ColsEnd)^T + beta*out, with in2 held as CSR.
+  // Columns in2ColsBegin.. of in2 pair with columns 0.. of in1. Parallel over the rows
+  // of in2, each of which only updates its own column of out.
+  //
+  void mmTransCSR(MatrixXuf& out,
+    const MatrixXuf& in1,
+    const SparseMatrixufCSR& in2,
+    const FP_TYPE alpha,
+    const FP_TYPE beta,
+    Eigen::Index in2ColsBegin,
+    Eigen::Index in2ColsEnd);
+
   Eigen::Index getnnzs(const SparseMatrixuf& A);
 
   FP_TYPE maxAbsVal(const MatrixXuf& A);
@@ -0,0 +1,219 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "checkpoint.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace EdgeML;
+
+// Start of every checkpoint file, followed by the size of the snapshot and the snapshot.
+// Bump the last character when the layout of the file changes.
+static const char checkpointMagic[8] = { 'E', 'D', 'G', 'E', 'M', 'L', 'C', '2' };
+
+// Storage of a matrix in a snapshot, written before its dimensions
+static const char denseMatrixTag = 'D';
+static const char sparseMatrixTag = 'S';
+
+CheckpointWriter::CheckpointWriter(const std::string& path_)
+  : path(path_),
+  hasPending(false),
+  isClosing(false),
+  worker(&CheckpointWriter::writeLoop, this)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isClosing = true;
+  }
+  hasWork.notify_one();
+  worker.join();
+}
+
+void CheckpointWriter::submit(std::vector<char>& snapshot)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.swap(snapshot);
+    hasPending = true;
+    if (snapshot.capacity() < spare.capacity())
+      snapshot.swap(spare);
+  }
+  snapshot.clear();
+  hasWork.notify_one();
+}
+
+void CheckpointWriter::writeLoop()
+{
+  std::vector<char> snapshot;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      hasWork.wait(lock, [this]() { return hasPending || isClosing; });
+      if (!hasPending)
+        return;
+      snapshot.swap(pending);
+      hasPending = false;
+    }
+
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream writer(tmpPath, std::ios::out | std::ios::binary);
+    if (!writer.is_open()) {
+      LOG_WARNING("Could not open checkpoint file " + tmpPath);
+      continue;
+    }
+    size_t numBytes = snapshot.size();
+    writer.write(checkpointMagic, sizeof(checkpointMagic));
+    writer.write((const char*)&numBytes, sizeof(numBytes));
+    writer.write(snapshot.data(), numBytes);
+    writer.close();
+
+#ifdef WINDOWS
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+      LOG_WARNING("Could not move checkpoint to " + path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.capacity() < snapshot.capacity())
+      spare.swap(snapshot);
+  }
+}
+
+bool EdgeML::loadCheckpoint(const std::string& path, std::vector<char>& snapshot)
+{
+  std::ifstream reader(path, std::ios::in | std::ios::binary);
+  if (!reader.is_open())
+    return false;
+
+  char magic[sizeof(checkpointMagic)];
+  size_t numBytes = 0;
+  reader.read(magic, sizeof(magic));
+  if ((size_t)reader.gcount() != sizeof(magic) || memcmp(magic, checkpointMagic, sizeof(magic)) != 0)
+    checkpointError(path + " is not a checkpoint of this version of EdgeML");
+  reader.read((char*)&numBytes, sizeof(numBytes));
+  if ((size_t)reader.gcount() != sizeof(numBytes))
+    checkpointError("Checkpoint " + path + " is truncated");
+
+  // Compare with the file size before allocating, so that a corrupt size is not trusted
+  const std::streamoff headerBytes = reader.tellg();
+  reader.seekg(0, std::ios::end);
+  const std::streamoff fileBytes = reader.tellg();
+  if (fileBytes < headerBytes || (size_t)(fileBytes - headerBytes) != numBytes)
+    checkpointError("Checkpoint " + path + " holds " + std::to_string(fileBytes - headerBytes)
+      + " bytes of state, but its header gives " + std::to_string(numBytes));
+  reader.seekg(headerBytes);
+
+  snapshot.resize(numBytes);
+  reader.read(snapshot.data(), numBytes);
+  if ((size_t)reader.gcount() != numBytes)
+    checkpointError("Could not read checkpoint " + path);
+  reader.close();
+  return true;
+}
+
+void EdgeML::checkpointError(const std::string& message)
+{
+  LOG_ERROR(message + ". Remove the checkpoint file to start the run from scratch.");
+  exit(1);
+}
+
+static void readMatrixTag(const std::vector<char>& snapshot, size_t& offset, const char expected)
+{
+  char tag;
+  readFromSnapshot(snapshot, offset, tag);
+  if (tag != expected)
+    checkpointError("Checkpoint holds a " + std::string(tag == sparseMatrixTag ? "sparse" : "dense")
+      + " matrix where this build stores it " + (expected == sparseMatrixTag ? "sparse" : "dense"));
+}
+
+static void checkMatrixShape(const Eigen::Index rows, const Eigen::Index cols,
+  const Eigen::Index expectedRows, const Eigen::Index expectedCols)
+{
+  if (rows != expectedRows || cols != expectedCols)
+    checkpointError("Checkpoint holds a " + std::to_string(rows) + " x " + std::to_string(cols)
+      + " matrix where the model has " + std::to_string(expectedRows) + " x " + std::to_string(expectedCols));
+}
+
+void EdgeML::appendMatrixToSnapshot(std::vector<char>& snapshot, const MatrixXuf& mat)
+{
+  appendToSnapshot(snapshot, denseMatrixTag);
+  appendToSnapshot(snapshot, (Eigen::Index)mat.rows());
+  appendToSnapshot(snapshot, (Eigen::Index)mat.cols());
+  appendToSnapshot(snapshot, (const char*)mat.data(), sizeof(FP_TYPE) * mat.rows() * mat.cols());
+}
+
+void EdgeML::appendMatrixToSnapshot(std::vector<char>& snapshot, const SparseMatrixuf& mat)
+{
+  if (!mat.isCompressed()) {
+    SparseMatrixuf compressed(mat);
+    compressed.makeCompressed();
+    appendMatrixToSnapshot(snapshot, compressed);
+    return;
+  }
+
+  const Eigen::Index nnz = mat.nonZeros();
+  appendToSnapshot(snapshot, sparseMatrixTag);
+  appendToSnapshot(snapshot, (Eigen::Index)mat.rows());
+  appendToSnapshot(snapshot, (Eigen::Index)mat.cols());
+  appendToSnapshot(snapshot, nnz);
+  appendToSnapshot(snapshot, (const char*)mat.outerIndexPtr(), sizeof(sparseIndex_t) * (mat.outerSize() + 1));
+  appendToSnapshot(snapshot, (const char*)mat.innerIndexPtr(), sizeof(sparseIndex_t) * nnz);
+  appendToSnapshot(snapshot, (const char*)mat.valuePtr(), sizeof(FP_TYPE) * nnz);
+}
+
+void EdgeML::readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, MatrixXuf& mat)
+{
+  Eigen::Index rows, cols;
+  readMatrixTag(snapshot, offset, denseMatrixTag);
+  readFromSnapshot(snapshot, offset, rows);
+  readFromSnapshot(snapshot, offset, cols);
+  if (rows < 0 || cols < 0 || (cols > 0 && (size_t)rows > snapshot.size() / sizeof(FP_TYPE) / (size_t)cols))
+    checkpointError("Checkpoint holds a matrix of invalid size");
+  mat.resize(rows, cols);
+  readFromSnapshot(snapshot, offset, (char*)mat.data(), sizeof(FP_TYPE) * rows * cols);
+}
+
+void EdgeML::readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, MatrixXuf& mat,
+  const Eigen::Index rows, const Eigen::Index cols)
+{
+  readMatrixFromSnapshot(snapshot, offset, mat);
+  checkMatrixShape(mat.rows(), mat.cols(), rows, cols);
+}
+
+void EdgeML::readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, SparseMatrixuf& mat,
+  const Eigen::Index rows, const Eigen::Index cols)
+{
+  Eigen::Index snapshotRows, snapshotCols, nnz;
+  readMatrixTag(snapshot, offset, sparseMatrixTag);
+  readFromSnapshot(snapshot, offset, snapshotRows);
+  readFromSnapshot(snapshot, offset, snapshotCols);
+  readFromSnapshot(snapshot, offset, nnz);
+  checkMatrixShape(snapshotRows, snapshotCols, rows, cols);
+  if (nnz < 0 || (size_t)nnz > snapshot.size() / (sizeof(sparseIndex_t) + sizeof(FP_TYPE)))
+    checkpointError("Checkpoint holds a sparse matrix of invalid size");
+
+  mat.resize(rows, cols);
+  mat.resizeNonZeros(nnz);
+  readFromSnapshot(snapshot, offset, (char*)mat.outerIndexPtr(), sizeof(sparseIndex_t) * (mat.outerSize() + 1));
+  readFromSnapshot(snapshot, offset, (char*)mat.innerIndexPtr(), sizeof(sparseIndex_t) * nnz);
+  readFromSnapshot(snapshot, offset, (char*)mat.valuePtr(), sizeof(FP_TYPE) * nnz);
+
+  // Eigen relies on the indices being in range and sorted within every column (row)
+  const sparseIndex_t *const outer = mat.outerIndexPtr();
+  const sparseIndex_t *const inner = mat.innerIndexPtr();
+  bool isValid = outer[0] == 0 && outer[mat.outerSize()] == nnz;
+  for (Eigen::Index o = 0; isValid && o < mat.outerSize(); ++o) {
+    isValid = outer[o] <= outer[o + 1];
+    for (sparseIndex_t k = outer[o]; isValid && k < outer[o + 1]; ++k)
+      isValid = inner[k] >= 0 && inner[k] < mat.innerSize() && (k == outer[o] || inner[k - 1] < inner[k]);
+  }
+  if (!isValid)
+    checkpointError("Checkpoint holds a sparse matrix with invalid indices");
+}
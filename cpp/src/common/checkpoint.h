@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "pre_processor.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace EdgeML
+{
+  //
+  // Writes training snapshots to disk on a background thread, so that the
+  // solver only pays for serializing its state into a buffer.
+  // Each snapshot replaces the previous file atomically (write to <path>.tmp, then rename).
+  //
+  class CheckpointWriter
+  {
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable hasWork;
+    std::vector<char> pending;
+    std::vector<char> spare; // buffer of a written snapshot, handed back by submit
+    bool hasPending;
+    bool isClosing;
+    std::thread worker; // keep last, started after the members above are initialized
+
+    void writeLoop();
+
+  public:
+    CheckpointWriter(const std::string& path_);
+
+    // Writes the last submitted snapshot before returning
+    ~CheckpointWriter();
+
+    //
+    // Hands @snapshot over to the writer thread; @snapshot is left empty, but keeps the
+    // memory of an earlier snapshot when one is free, so that serializing the next one
+    // does not reallocate. A snapshot that has not been written yet is replaced by the newer one.
+    //
+    void submit(std::vector<char>& snapshot);
+  };
+
+  //
+  // Returns false if there is no checkpoint at @path. A file that is not a checkpoint
+  // written by CheckpointWriter, or is truncated, stops the program with an error.
+  //
+  bool loadCheckpoint(const std::string& path, std::vector<char>& snapshot);
+
+  // Logs @message and stops the program; for checkpoints that cannot be resumed from
+  void checkpointError(const std::string& message);
+
+  //
+  // Helpers for (de)serializing solver state. Only for trivially copyable types.
+  //
+  template<class T>
+  void appendToSnapshot(std::vector<char>& snapshot, const T& value)
+  {
+    const char* bytes = (const char*)&value;
+    snapshot.insert(snapshot.end(), bytes, bytes + sizeof(T));
+  }
+
+  inline void appendToSnapshot(std::vector<char>& snapshot, const char *const bytes, const size_t numBytes)
+  {
+    snapshot.insert(snapshot.end(), bytes, bytes + numBytes);
+  }
+
+  template<class T>
+  void readFromSnapshot(const std::vector<char>& snapshot, size_t& offset, T& value)
+  {
+    if (offset + sizeof(T) > snapshot.size())
+      checkpointError("Checkpoint is shorter than the state it should hold");
+    memcpy((void *)&value, snapshot.data() + offset, sizeof(T));
+    offset += sizeof(T);
+  }
+
+  inline void readFromSnapshot(const std::vector<char>& snapshot, size_t& offset, char *const bytes, const size_t numBytes)
+  {
+    if (numBytes > snapshot.size() || offset > snapshot.size() - numBytes)
+      checkpointError("Checkpoint is shorter than the state it should hold");
+    memcpy(bytes, snapshot.data() + offset, numBytes);
+    offset += numBytes;
+  }
+
+  //
+  // Matrices with their dimensions, in their own storage: a sparse matrix takes its non-zeros
+  // only. A matrix must be read back into the storage it was written from.
+  //
+  void appendMatrixToSnapshot(std::vector<char>& snapshot, const MatrixXuf& mat);
+  void appendMatrixToSnapshot(std::vector<char>& snapshot, const SparseMatrixuf& mat);
+  void readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, MatrixXuf& mat);
+  // Same, stopping with an error unless the matrix is @rows x @cols, e.g. the shape of the parameter it restores
+  void readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, MatrixXuf& mat,
+    const Eigen::Index rows, const Eigen::Index cols);
+  void readMatrixFromSnapshot(const std::vector<char>& snapshot, size_t& offset, SparseMatrixuf& mat,
+    const Eigen::Index rows, const Eigen::Index cols);
+}
+#endif
@@ -0,0 +1,236 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "compressed_sparse.h"
+
+#include <cstring>
+
+using namespace EdgeML;
+
+static inline void appendVarint(std::vector<uint8_t>& bytes, uint64_t value)
+{
+  while (value >= 0x80) {
+    bytes.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back((uint8_t)value);
+}
+
+static inline uint64_t readVarint(const uint8_t*& p)
+{
+  uint64_t value = *p & 0x7f;
+  for (int shift = 7; *p++ & 0x80; shift += 7)
+    value |= (uint64_t)(*p & 0x7f) << shift;
+  return value;
+}
+
+uint16_t EdgeML::floatToHalf(const float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+  const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) // inf and nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if (exponent >= 31) // overflow
+    return sign | 0x7c00;
+  if (exponent <= 0) { // subnormal or zero
+    if (exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+      ++half;
+    return sign | (uint16_t)half;
+  }
+
+  uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    ++half; // may carry into the exponent, which rounds up to inf correctly
+  return sign | (uint16_t)half;
+}
+
+float EdgeML::halfToFloat(const uint16_t value)
+{
+  const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  uint32_t bits;
+
+  if (exponent == 0x1f)
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  else if (exponent != 0)
+    bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  else if (mantissa == 0)
+    bits = sign;
+  else {
+    // Normalize the subnormal
+    exponent = 127 - 15 + 1;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+
+  float ret;
+  memcpy(&ret, &bits, sizeof(ret));
+  return ret;
+}
+
+CompressedSparseMatrix::CompressedSparseMatrix()
+  : numRows(0),
+  numCols(0),
+  valueEncoding(fullPrecisionValues)
+{
+}
+
+void CompressedSparseMatrix::compress(const SparseMatrixuf& X, const bool halfPrecision)
+{
+  Timer timer("CompressedSparseMatrix::compress");
+  // A column-major copy is only made with ROWMAJOR
+  typedef SparseMatrix<FP_TYPE, ColMajor, sparseIndex_t> ColMajorSparse;
+  const ColMajorSparse& XCols = X;
+  numRows = XCols.rows();
+  numCols = XCols.cols();
+
+  bool allOnes = true;
+  for (Eigen::Index j = 0; j < numCols && allOnes; ++j)
+    for (ColMajorSparse::InnerIterator it(XCols, j); it; ++it)
+      if (it.value() != (FP_TYPE)1.0) {
+        allOnes = false;
+        break;
+      }
+  valueEncoding = allOnes ? implicitOnes : (halfPrecision ? halfPrecisionValues : fullPrecisionValues);
+
+  indexStart.assign(1, 0);
+  valueStart.assign(1, 0);
+  indexBytes.clear();
+  fullValues.clear();
+  halfValues.clear();
+  indexStart.reserve(numCols + 1);
+  valueStart.reserve(numCols + 1);
+  indexBytes.reserve(XCols.nonZeros());
+  if (valueEncoding == fullPrecisionValues)
+    fullValues.reserve(XCols.nonZeros());
+  else if (valueEncoding == halfPrecisionValues)
+    halfValues.reserve(XCols.nonZeros());
+
+  for (Eigen::Index j = 0; j < numCols; ++j) {
+    Eigen::Index previousRow = 0;
+    size_t numNonZeros = 0;
+    for (ColMajorSparse::InnerIterator it(XCols, j); it; ++it) {
+      // The first row index is stored as is, later ones as gaps
+      appendVarint(indexBytes, (uint64_t)(it.row() - previousRow));
+      previousRow = it.row();
+      if (valueEncoding == fullPrecisionValues)
+        fullValues.push_back(it.value());
+      else if (valueEncoding == halfPrecisionValues)
+        halfValues.push_back(floatToHalf((float)it.value()));
+      ++numNonZeros;
+    }
+    indexStart.push_back(indexBytes.size());
+    valueStart.push_back(valueStart.back() + numNonZeros);
+  }
+  indexBytes.shrink_to_fit();
+
+  LOG_INFO("Compressed " + std::to_string(XCols.nonZeros()) + " non-zeros to "
+    + std::to_string(sizeInBytes()) + " bytes ("
+    + std::to_string((size_t)XCols.nonZeros() * (sizeof(FP_TYPE) + sizeof(sparseIndex_t))
+      + (numCols + 1) * sizeof(sparseIndex_t)) + " uncompressed)");
+}
+
+SparseMatrixuf CompressedSparseMatrix::decompress() const
+{
+  std::vector<Trip> triplets;
+  triplets.reserve(nonZeros());
+  for (Eigen::Index j = 0; j < numCols; ++j) {
+    const uint8_t* p = indexBytes.data() + indexStart[j];
+    const uint8_t *const pEnd = indexBytes.data() + indexStart[j + 1];
+    Eigen::Index row = 0;
+    for (size_t k = valueStart[j]; p < pEnd; ++k) {
+      row += (Eigen::Index)readVarint(p);
+      const FP_TYPE value = valueEncoding == implicitOnes ? (FP_TYPE)1.0
+        : (valueEncoding == halfPrecisionValues ? (FP_TYPE)halfToFloat(halfValues[k]) : fullValues[k]);
+      triplets.push_back(Trip((sparseIndex_t)row, (sparseIndex_t)j, value));
+    }
+  }
+  SparseMatrixuf X(numRows, numCols);
+  X.setFromTriplets(triplets.begin(), triplets.end());
+  return X;
+}
+
+size_t CompressedSparseMatrix::sizeInBytes() const
+{
+  return indexBytes.size() * sizeof(uint8_t)
+    + (indexStart.size() + valueStart.size()) * sizeof(size_t)
+    + fullValues.size() * sizeof(FP_TYPE)
+    + halfValues.size() * sizeof(uint16_t);
+}
+
+template<class ValueDecoder>
+void CompressedSparseMatrix::leftMultiplyColumns(
+  MatrixXuf& out,
+  const MatrixXuf& in1,
+  const FP_TYPE alpha,
+  const FP_TYPE beta,
+  const Eigen::Index colsBegin,
+  const Eigen::Index colsEnd,
+  const ValueDecoder& valueAt) const
+{
+  const uint8_t *const bytes = indexBytes.data();
+  pfor(Eigen::Index j = colsBegin; j < colsEnd; ++j) {
+    if (beta == (FP_TYPE)0.0)
+      out.col(j - colsBegin).setZero();
+    else if (beta != (FP_TYPE)1.0)
+      out.col(j - colsBegin) *= beta;
+
+    // Decoding is fused with the axpys, so every index byte is read once
+    const uint8_t* p = bytes + indexStart[j];
+    const uint8_t *const pEnd = bytes + indexStart[j + 1];
+    Eigen::Index row = 0;
+    for (size_t k = valueStart[j]; p < pEnd; ++k) {
+      row += (Eigen::Index)readVarint(p);
+      out.col(j - colsBegin).noalias() += (alpha * valueAt(k)) * in1.col(row);
+    }
+  }
+}
+
+void CompressedSparseMatrix::leftMultiply(
+  MatrixXuf& out,
+  const MatrixXuf& in1,
+  const FP_TYPE alpha,
+  const FP_TYPE beta,
+  Eigen::Index colsBegin,
+  Eigen::Index colsEnd) const
+{
+  Timer timer("dn_compressed_mm");
+  if (colsBegin == -1 && colsEnd == -1) {
+    colsBegin = 0;
+    colsEnd = numCols;
+  }
+  assert(0 <= colsBegin && colsBegin <= colsEnd && colsEnd <= numCols);
+  assert(in1.cols() == numRows);
+  assert(out.rows() == in1.rows());
+  assert(out.cols() == colsEnd - colsBegin);
+
+  if (valueEncoding == implicitOnes)
+    leftMultiplyColumns(out, in1, alpha, beta, colsBegin, colsEnd,
+      [](const size_t) { return (FP_TYPE)1.0; });
+  else if (valueEncoding == halfPrecisionValues) {
+    const uint16_t *const values = halfValues.data();
+    leftMultiplyColumns(out, in1, alpha, beta, colsBegin, colsEnd,
+      [values](const size_t k) { return (FP_TYPE)halfToFloat(values[k]); });
+  }
+  else {
+    const FP_TYPE *const values = fullValues.data();
+    leftMultiplyColumns(out, in1, alpha, beta, colsBegin, colsEnd,
+      [values](const size_t k) { return values[k]; });
+  }
+}
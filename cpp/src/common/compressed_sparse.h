@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __COMPRESSED_SPARSE_H__
+#define __COMPRESSED_SPARSE_H__
+
+#include "pre_processor.h"
+
+#include <cstdint>
+
+namespace EdgeML
+{
+  //
+  // Read-only column-compressed copy of a sparse matrix that spends fewer bytes per non-zero
+  // than SparseMatrixuf, for memory-bound passes over the training data:
+  // - row indices of every column are delta-coded as LEB128 varints (1 byte for gaps < 128)
+  // - a matrix whose non-zeros are all 1.0 stores no values at all
+  // - other values are stored as FP_TYPE, or optionally as float16
+  // Columns can only be visited sequentially, so this complements SparseMatrixuf
+  // for products rather than replacing it.
+  //
+  class CompressedSparseMatrix
+  {
+  public:
+    enum ValueEncoding
+    {
+      fullPrecisionValues,
+      halfPrecisionValues,
+      implicitOnes
+    };
+
+    CompressedSparseMatrix();
+
+    // @halfPrecision: store values as float16 unless they are all 1.0; lossy
+    void compress(const SparseMatrixuf& X, const bool halfPrecision);
+
+    SparseMatrixuf decompress() const;
+
+    inline Eigen::Index rows() const { return numRows; }
+    inline Eigen::Index cols() const { return numCols; }
+    inline Eigen::Index nonZeros() const { return (Eigen::Index)(valueStart.empty() ? 0 : valueStart.back()); }
+    inline ValueEncoding getValueEncoding() const { return valueEncoding; }
+    size_t sizeInBytes() const;
+
+    //
+    // out = alpha*in1*X(:, colsBegin:colsEnd) + beta*out, decoding every column once.
+    // Parallel over the columns of out. colsBegin = colsEnd = -1 selects all columns.
+    //
+    void leftMultiply(MatrixXuf& out,
+      const MatrixXuf& in1,
+      const FP_TYPE alpha,
+      const FP_TYPE beta,
+      Eigen::Index colsBegin = -1,
+      Eigen::Index colsEnd = -1) const;
+
+  private:
+    Eigen::Index numRows, numCols;
+    ValueEncoding valueEncoding;
+
+    std::vector<size_t> indexStart; // byte offset of the indices of every column in indexBytes
+    std::vector<size_t> valueStart; // offset of the first non-zero of every column
+    std::vector<uint8_t> indexBytes;
+    std::vector<FP_TYPE> fullValues;
+    std::vector<uint16_t> halfValues;
+
+    template<class ValueDecoder>
+    void leftMultiplyColumns(MatrixXuf& out,
+      const MatrixXuf& in1,
+      const FP_TYPE alpha,
+      const FP_TYPE beta,
+      const Eigen::Index colsBegin,
+      const Eigen::Index colsEnd,
+      const ValueDecoder& valueAt) const;
+  };
+
+  uint16_t floatToHalf(const float value);
+  float halfToFloat(const uint16_t value);
+}
+
+#endif
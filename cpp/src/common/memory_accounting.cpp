@@ -0,0 +1,380 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "memory_accounting.h"
+
+#ifdef MEMORY_ACCOUNTING
+#include <execinfo.h>
+#include <malloc.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+// glibc's own allocator, which the replacements below forward to
+extern "C"
+{
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* ptr, size_t size);
+  void* __libc_memalign(size_t alignment, size_t size);
+  void* __libc_valloc(size_t size);
+  void* __libc_pvalloc(size_t size);
+  void __libc_free(void* ptr);
+}
+
+using namespace EdgeML;
+
+namespace
+{
+  // Constant-initialized, so they are usable by allocations made before main
+  std::atomic<int64_t> currentBytes(0);
+  std::atomic<int64_t> peakBytes(0);
+  std::atomic<int64_t> sampleInterval(-1); // -1 until EDGEML_ALLOC_SAMPLE_BYTES is read
+
+  // Open Timer scopes of a thread; deeper scopes are counted in the deepest frame.
+  // A frame closed by another thread is marked closed and popped by its own thread
+  // once the frames above it are gone. The counts are only written by the frame's
+  // own thread, and accessed with atomic builtins so that the closing thread can read
+  // them (std::atomic members would make the __thread array need dynamic initialization).
+  const int maxScopeDepth = 64;
+  struct ScopeFrame
+  {
+    int64_t entryBytes;
+    int64_t peakBytes;
+    uint64_t allocations;
+    int64_t allocatedBytes;
+    bool isClosed;
+  };
+
+  template <class T>
+  inline T loadRelaxed(const T& value)
+  {
+    return __atomic_load_n(&value, __ATOMIC_RELAXED);
+  }
+
+  template <class T>
+  inline void storeRelaxed(T& value, const T newValue)
+  {
+    __atomic_store_n(&value, newValue, __ATOMIC_RELAXED);
+  }
+
+  // initial-exec: reading these must not allocate
+#define MEMORY_TLS __thread __attribute__((tls_model("initial-exec")))
+  MEMORY_TLS ScopeFrame scopeStack[maxScopeDepth];
+  MEMORY_TLS int scopeDepth = 0;
+  MEMORY_TLS bool isSampling = false;
+  MEMORY_TLS int64_t bytesUntilSample = 0;
+#undef MEMORY_TLS
+
+  struct ScopeTotals
+  {
+    uint64_t calls;
+    uint64_t allocations;
+    int64_t allocatedBytes;
+    int64_t peakBytes;
+    int64_t peakGrowth;
+    int64_t retainedBytes;
+  };
+
+  const int maxSampledFrames = 16;
+  const int skippedFrames = 3; // sampleAllocation, recordAllocation and the replaced function
+  const size_t reportedSites = 20;
+
+  struct SiteTotals
+  {
+    uint64_t samples;
+    int64_t sampledBytes;
+  };
+
+  struct MemoryRegistry
+  {
+    std::mutex mutex;
+    std::map<std::string, ScopeTotals> scopes;
+    std::map<std::vector<void*>, SiteTotals> sites;
+  };
+
+  std::mutex sitesMutex;
+  MemoryRegistry* sampleRegistry = NULL; // set once the first scope is entered
+
+  MemoryRegistry& memoryRegistry()
+  {
+    static MemoryRegistry registry;
+    return registry;
+  }
+
+  inline double megabytes(const int64_t bytes)
+  {
+    return (double)bytes / (1024.0 * 1024.0);
+  }
+
+  void dumpMemoryTotals()
+  {
+    MemoryRegistry& registry = memoryRegistry();
+    std::stringstream table;
+    {
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      table << std::fixed << std::setprecision(2)
+        << "\nMemory per Timer scope (MB; peak is the process-wide allocation while the scope was open)\n"
+        << std::left << std::setw(40) << "scope" << std::right
+        << std::setw(10) << "calls" << std::setw(14) << "allocations" << std::setw(14) << "allocated"
+        << std::setw(12) << "peak" << std::setw(14) << "peak growth" << std::setw(12) << "retained" << "\n";
+      for (auto it = registry.scopes.begin(); it != registry.scopes.end(); ++it) {
+        const ScopeTotals& t = it->second;
+        table << std::left << std::setw(40) << it->first.substr(0, 39) << std::right
+          << std::setw(10) << t.calls << std::setw(14) << t.allocations
+          << std::setw(14) << megabytes(t.allocatedBytes) << std::setw(12) << megabytes(t.peakBytes)
+          << std::setw(14) << megabytes(t.peakGrowth) << std::setw(12) << megabytes(t.retainedBytes) << "\n";
+      }
+      table << "Process peak: " << megabytes(peakAllocatedBytes()) << " MB, in use at exit: "
+        << megabytes(allocatedBytes()) << " MB\n";
+    }
+
+    // Sampling stops here, the registry is destroyed after the dump
+    std::vector<std::pair<std::vector<void*>, SiteTotals> > sites;
+    {
+      std::lock_guard<std::mutex> lock(sitesMutex);
+      sites.assign(registry.sites.begin(), registry.sites.end());
+      sampleRegistry = NULL;
+    }
+    if (!sites.empty()) {
+      std::sort(sites.begin(), sites.end(),
+        [](const std::pair<std::vector<void*>, SiteTotals>& a, const std::pair<std::vector<void*>, SiteTotals>& b)
+        { return a.second.sampledBytes > b.second.sampledBytes; });
+      table << "\nAllocation sites with the most sampled bytes (one sample per "
+        << sampleInterval.load() << " bytes per thread)\n";
+      for (size_t s = 0; s < std::min(sites.size(), reportedSites); ++s) {
+        table << megabytes(sites[s].second.sampledBytes) << " MB in " << sites[s].second.samples << " samples\n";
+        char** symbols = backtrace_symbols(sites[s].first.data(), (int)sites[s].first.size());
+        for (size_t f = 0; f < sites[s].first.size(); ++f)
+          table << "    " << (symbols != NULL ? symbols[f] : "?") << "\n";
+        free(symbols);
+      }
+    }
+    std::cerr << table.str();
+  }
+
+  void sampleAllocation(const int64_t size)
+  {
+    // Allocations made while sampling (backtrace, the map) are counted but not sampled
+    isSampling = true;
+    void* frames[maxSampledFrames + skippedFrames];
+    const int numFrames = backtrace(frames, maxSampledFrames + skippedFrames);
+    if (numFrames > skippedFrames && sampleRegistry != NULL) {
+      std::vector<void*> site(frames + skippedFrames, frames + numFrames);
+      std::lock_guard<std::mutex> lock(sitesMutex);
+      SiteTotals& totals = sampleRegistry->sites[site];
+      totals.samples += 1;
+      totals.sampledBytes += size;
+    }
+    isSampling = false;
+  }
+
+  void recordAllocation(void* ptr)
+  {
+    if (ptr == NULL)
+      return;
+    const int64_t size = (int64_t)malloc_usable_size(ptr);
+    const int64_t current = currentBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = peakBytes.load(std::memory_order_relaxed);
+    while (current > peak && !peakBytes.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+
+    if (scopeDepth > 0) {
+      ScopeFrame& frame = scopeStack[scopeDepth - 1];
+      if (current > frame.peakBytes)
+        storeRelaxed(frame.peakBytes, current);
+      storeRelaxed(frame.allocations, frame.allocations + 1);
+      storeRelaxed(frame.allocatedBytes, frame.allocatedBytes + size);
+    }
+
+    if (isSampling)
+      return;
+    int64_t interval = sampleInterval.load(std::memory_order_relaxed);
+    if (interval < 0) {
+      // getenv does not allocate
+      const char* setting = getenv("EDGEML_ALLOC_SAMPLE_BYTES");
+      interval = setting != NULL ? std::max(atoll(setting), 0LL) : 0;
+      sampleInterval.store(interval, std::memory_order_relaxed);
+    }
+    if (interval == 0)
+      return;
+    bytesUntilSample -= size;
+    if (bytesUntilSample <= 0) {
+      bytesUntilSample = interval;
+      sampleAllocation(size);
+    }
+  }
+
+  inline void recordFree(void* ptr)
+  {
+    if (ptr != NULL)
+      currentBytes.fetch_sub((int64_t)malloc_usable_size(ptr), std::memory_order_relaxed);
+  }
+}
+
+int64_t EdgeML::allocatedBytes()
+{
+  return currentBytes.load(std::memory_order_relaxed);
+}
+
+int64_t EdgeML::peakAllocatedBytes()
+{
+  return peakBytes.load(std::memory_order_relaxed);
+}
+
+// Pops the frames of the calling thread that other threads have closed
+static void popClosedScopes()
+{
+  while (scopeDepth > 0 && __atomic_load_n(&scopeStack[scopeDepth - 1].isClosed, __ATOMIC_ACQUIRE))
+    --scopeDepth;
+}
+
+MemoryScope EdgeML::enterMemoryScope()
+{
+  // The registry must be constructed before dumpMemoryTotals is registered,
+  // so that it is destroyed after the dump
+  static const bool isDumpRegistered = (sampleRegistry = &memoryRegistry(), std::atexit(dumpMemoryTotals) == 0);
+  (void)isDumpRegistered;
+
+  popClosedScopes();
+  if (scopeDepth >= maxScopeDepth)
+    return NULL;
+
+  ScopeFrame& frame = scopeStack[scopeDepth];
+  storeRelaxed(frame.entryBytes, allocatedBytes());
+  storeRelaxed(frame.peakBytes, frame.entryBytes);
+  storeRelaxed(frame.allocations, (uint64_t)0);
+  storeRelaxed(frame.allocatedBytes, (int64_t)0);
+  storeRelaxed(frame.isClosed, false);
+  ++scopeDepth;
+  return &frame;
+}
+
+void EdgeML::exitMemoryScope(const std::string& name, MemoryScope scope)
+{
+  if (scope == NULL)
+    return;
+
+  // Read before the frame is marked closed, after which its thread may reuse it
+  ScopeFrame& frame = *(ScopeFrame*)scope;
+  const int64_t entryBytes = loadRelaxed(frame.entryBytes);
+  const int64_t exitBytes = allocatedBytes();
+  const int64_t peak = std::max(loadRelaxed(frame.peakBytes), exitBytes);
+  const uint64_t allocations = loadRelaxed(frame.allocations);
+  const int64_t allocated = loadRelaxed(frame.allocatedBytes);
+
+  if (scopeDepth > 0 && &scopeStack[scopeDepth - 1] == &frame) {
+    --scopeDepth;
+    // Counts are inclusive of nested scopes, like the times of Timer
+    if (scopeDepth > 0) {
+      ScopeFrame& parent = scopeStack[scopeDepth - 1];
+      if (peak > parent.peakBytes)
+        storeRelaxed(parent.peakBytes, peak);
+      storeRelaxed(parent.allocations, parent.allocations + allocations);
+      storeRelaxed(parent.allocatedBytes, parent.allocatedBytes + allocated);
+    }
+    popClosedScopes();
+  }
+  else {
+    // Opened on another thread, or below scopes of this thread that are still open:
+    // the frame is left for its own thread to pop
+    __atomic_store_n(&frame.isClosed, true, __ATOMIC_RELEASE);
+  }
+
+  MemoryRegistry& registry = memoryRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto inserted = registry.scopes.insert(std::make_pair(name, ScopeTotals()));
+  ScopeTotals& totals = inserted.first->second;
+  if (inserted.second)
+    memset(&totals, 0, sizeof(totals));
+  totals.calls += 1;
+  totals.allocations += allocations;
+  totals.allocatedBytes += allocated;
+  totals.peakBytes = std::max(totals.peakBytes, peak);
+  totals.peakGrowth = std::max(totals.peakGrowth, peak - entryBytes);
+  totals.retainedBytes += exitBytes - entryBytes;
+}
+
+//
+// Replacements of the C allocator (see "Replacing malloc" in the glibc manual).
+// glibc calls these for its own allocations too, so every pointer freed here was
+// counted when it was allocated.
+//
+extern "C"
+{
+  void* malloc(size_t size)
+  {
+    void* ptr = __libc_malloc(size);
+    recordAllocation(ptr);
+    return ptr;
+  }
+
+  void* calloc(size_t count, size_t size)
+  {
+    void* ptr = __libc_calloc(count, size);
+    recordAllocation(ptr);
+    return ptr;
+  }
+
+  void* realloc(void* ptr, size_t size)
+  {
+    const int64_t oldSize = ptr != NULL ? (int64_t)malloc_usable_size(ptr) : 0;
+    void* newPtr = __libc_realloc(ptr, size);
+    if (newPtr == NULL && size != 0)
+      return NULL; // ptr is untouched
+    currentBytes.fetch_sub(oldSize, std::memory_order_relaxed);
+    recordAllocation(newPtr);
+    return newPtr;
+  }
+
+  void free(void* ptr)
+  {
+    recordFree(ptr);
+    __libc_free(ptr);
+  }
+
+  void* memalign(size_t alignment, size_t size)
+  {
+    void* ptr = __libc_memalign(alignment, size);
+    recordAllocation(ptr);
+    return ptr;
+  }
+
+  void* aligned_alloc(size_t alignment, size_t size)
+  {
+    return memalign(alignment, size);
+  }
+
+  int posix_memalign(void** ptr, size_t alignment, size_t size)
+  {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+      return EINVAL;
+    void* aligned = memalign(alignment, size);
+    if (aligned == NULL && size != 0)
+      return ENOMEM;
+    *ptr = aligned;
+    return 0;
+  }
+
+  void* valloc(size_t size)
+  {
+    void* ptr = __libc_valloc(size);
+    recordAllocation(ptr);
+    return ptr;
+  }
+
+  void* pvalloc(size_t size)
+  {
+    void* ptr = __libc_pvalloc(size);
+    recordAllocation(ptr);
+    return ptr;
+  }
+}
+#endif
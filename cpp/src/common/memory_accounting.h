@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __MEMORY_ACCOUNTING_H__
+#define __MEMORY_ACCOUNTING_H__
+
+#include <cstdint>
+#include <string>
+
+// The allocator is replaced through glibc's malloc interposition, so Linux only
+#if defined(MEMORY_ACCOUNTING) && !defined(LINUX)
+#undef MEMORY_ACCOUNTING
+#endif
+
+#ifdef MEMORY_ACCOUNTING
+namespace EdgeML
+{
+  //
+  // With MEMORY_ACCOUNTING, malloc, calloc, realloc, free and the aligned variants are
+  // replaced for the whole process by versions that count the bytes in use. This covers
+  // Eigen's aligned_malloc, new[] and the allocations of MKL. Every Timer scope records
+  // the peak bytes in use while it is open, the bytes it allocated and its growth, and
+  // the totals per scope name are printed to stderr at exit.
+  //
+  // A scope's peak is raised by the allocations of its own thread; allocations on other
+  // threads (MKL, cilk_for workers) count in the process-wide bytes it sees.
+  //
+  // Setting EDGEML_ALLOC_SAMPLE_BYTES=<n> in the environment also samples one allocation
+  // per n bytes allocated by each thread (every allocation of n bytes or more is sampled)
+  // and prints the call stacks that allocated the most sampled bytes. Link with
+  // -rdynamic for function names; otherwise resolve the addresses with addr2line.
+  //
+
+  // Bytes currently allocated by the process, and the most at any point so far
+  int64_t allocatedBytes();
+  int64_t peakAllocatedBytes();
+
+  // The frame of an open scope, kept by its Timer; NULL when scopes are nested too deeply
+  typedef void* MemoryScope;
+
+  // Called by Timer when a scope is opened and closed. A scope may be closed on another
+  // thread than it was opened on, e.g. by the Cilk worker that continues after a cilk_for;
+  // it is then recorded without its counts being added to the enclosing scope.
+  MemoryScope enterMemoryScope();
+  void exitMemoryScope(const std::string& name, MemoryScope scope);
+}
+#endif
+
+#endif
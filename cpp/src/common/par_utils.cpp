@@ -2,6 +2,9 @@
 // Licensed under the MIT license.
 
 #include "par_utils.h"
+#include "logger.h"
+#include <atomic>
+#include <thread>
 
 using namespace EdgeML;
 
@@ -45,3 +48,51 @@ struct col_multiply
   col_multiply(MatrixXuf *mat, VectorXf *colMultiplier) : _mat(mat), _colMultiplier(colMultiplier) {}
   void operator() (const int& c) { _mat->col(c).noalias() = _mat->col(c) * (*_colMultiplier)(c); }
 };
+
+#ifdef CILK
+//
+// Cilk has a single pool of workers for the process, so pfor loops cannot be limited per job.
+// The pool can only be resized while the runtime is stopped, i.e. between parallel regions of
+// the calling thread. Returns the previous size.
+//
+static int resizeCilkPool(const int numWorkers)
+{
+  const int savedWorkers = __cilkrts_get_nworkers();
+  __cilkrts_end_cilk();
+  if (__cilkrts_set_param("nworkers", std::to_string(numWorkers).c_str()) != 0)
+    LOG_WARNING("Could not set the number of Cilk workers to " + std::to_string(numWorkers));
+  return savedWorkers;
+}
+#endif
+
+void EdgeML::runJobs(
+  const std::vector<std::function<void()> >& jobs,
+  const int numConcurrent,
+  const int threadsPerJob)
+{
+  assert(numConcurrent >= 1);
+  assert(threadsPerJob >= 1);
+
+#ifdef CILK
+  const int numWorkers = (int)std::min((size_t)numConcurrent, jobs.size()) * threadsPerJob;
+  const int savedCilkWorkers = resizeCilkPool(std::max(numWorkers, 1));
+#endif
+
+  std::atomic<size_t> nextJob(0);
+  auto worker = [&]() {
+    const int savedThreads = mkl_set_num_threads_local(threadsPerJob);
+    for (size_t j = nextJob++; j < jobs.size(); j = nextJob++)
+      jobs[j]();
+    mkl_set_num_threads_local(savedThreads);
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < numConcurrent && (size_t)t < jobs.size(); ++t)
+    workers.push_back(std::thread(worker));
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+
+#ifdef CILK
+  resizeCilkPool(savedCilkWorkers);
+#endif
+}
@@ -6,6 +6,7 @@
 #define SEQ_BASE 32
 
 #include "pre_processor.h"
+#include <functional>
 
 namespace EdgeML
 {
@@ -17,6 +18,17 @@ namespace EdgeML
 
   void parallelExp(MatrixXuf& D);
 
+  // Runs independent jobs (e.g. one training configuration each) on
+  // numConcurrent std::threads. Every worker limits MKL to threadsPerJob
+  // threads; mkl_set_num_threads_local only affects the calling thread.
+  // Cilk workers are shared by the whole process, so pfor loops are bounded
+  // by the total numConcurrent*threadsPerJob instead; one job may use more
+  // than its share while others are in MKL calls. Call between parallel regions.
+  void runJobs(
+    const std::vector<std::function<void()> >& jobs,
+    const int numConcurrent,
+    const int threadsPerJob);
+
   template<class INT_T>
   struct rowExponentiate
   {
@@ -123,6 +123,9 @@ typedef MKL_INT sparseIndex_t;
 #define SparseMatrixuf SparseMatrix<FP_TYPE,ColMajor,sparseIndex_t>
 #endif
 
+// Row-major sparse matrix regardless of ROWMAJOR, for CSR copies of column-major data
+#define SparseMatrixufCSR SparseMatrix<FP_TYPE,RowMajor,sparseIndex_t>
+
 #define MatrixXufINT MatrixXuf
 #define VectorXf Matrix<FP_TYPE,Dynamic,1>
 #define Trip Triplet<FP_TYPE,sparseIndex_t>
@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "prediction_writer.h"
+#include "logger.h"
+
+#include <cstdint>
+#include <cstdio>
+
+using namespace EdgeML;
+
+// Batches handed to the writer thread but not yet written
+static const size_t maxQueuedBatches = 4;
+
+void PredictionRows::clear()
+{
+  trueLabels.clear();
+  trueLabelsEnd.clear();
+  labels.clear();
+  scores.clear();
+}
+
+static inline void appendUnsigned(std::string& out, uint64_t value)
+{
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0)
+    out.push_back(digits[--n]);
+}
+
+TextPredictionFormatter::TextPredictionFormatter(
+  const bool writeTrueLabels_,
+  const std::string& labelScoreSeparator_,
+  const std::string& pairSuffix_)
+  : writeTrueLabels(writeTrueLabels_),
+  labelScoreSeparator(labelScoreSeparator_),
+  pairSuffix(pairSuffix_)
+{
+}
+
+void TextPredictionFormatter::appendRows(std::string& out, const PredictionRows& rows)
+{
+  char number[32];
+  size_t trueBegin = 0;
+  for (size_t r = 0; r < rows.numRows(); ++r) {
+    if (writeTrueLabels)
+      for (size_t t = trueBegin; t < rows.trueLabelsEnd[r]; ++t) {
+        appendUnsigned(out, rows.trueLabels[t]);
+        out.append(",  ");
+      }
+    trueBegin = rows.trueLabelsEnd[r];
+
+    for (labelCount_t j = 0; j < rows.k; ++j) {
+      appendUnsigned(out, rows.labels[r * rows.k + j]);
+      out.append(labelScoreSeparator);
+      const int n = snprintf(number, sizeof(number), "%g", (double)rows.scores[r * rows.k + j]);
+      out.append(number, n);
+      out.append(pairSuffix);
+    }
+    out.push_back('\n');
+  }
+}
+
+void BinaryPredictionFormatter::appendHeader(std::string& out, const labelCount_t k)
+{
+  const uint32_t header[2] = { (uint32_t)k, (uint32_t)sizeof(FP_TYPE) };
+  out.append("EMLPRED1", 8);
+  out.append((const char*)header, sizeof(header));
+}
+
+void BinaryPredictionFormatter::appendRows(std::string& out, const PredictionRows& rows)
+{
+  out.reserve(out.size() + rows.numRows() * (sizeof(uint32_t) * (1 + rows.k) + sizeof(FP_TYPE) * rows.k));
+  size_t trueBegin = 0;
+  for (size_t r = 0; r < rows.numRows(); ++r) {
+    const uint32_t trueLabel = rows.trueLabelsEnd[r] > trueBegin ? (uint32_t)rows.trueLabels[trueBegin] : UINT32_MAX;
+    trueBegin = rows.trueLabelsEnd[r];
+    out.append((const char*)&trueLabel, sizeof(trueLabel));
+    for (labelCount_t j = 0; j < rows.k; ++j) {
+      const uint32_t label = (uint32_t)rows.labels[r * rows.k + j];
+      out.append((const char*)&label, sizeof(label));
+    }
+    out.append((const char*)(rows.scores.data() + r * rows.k), sizeof(FP_TYPE) * rows.k);
+  }
+}
+
+PredictionWriter::PredictionWriter(
+  const std::string& path,
+  PredictionFormatter* formatter_,
+  const labelCount_t k_,
+  const size_t rowsPerBatch_)
+  : file(path, std::ios::out | std::ios::binary),
+  formatter(formatter_),
+  k(k_),
+  rowsPerBatch(rowsPerBatch_ > 0 ? rowsPerBatch_ : 1),
+  isClosed(false),
+  isClosing(false),
+  worker(&PredictionWriter::writeLoop, this)
+{
+  if (!file.is_open())
+    LOG_WARNING("Could not open prediction file " + path);
+  current.k = k;
+}
+
+PredictionWriter::~PredictionWriter()
+{
+  close();
+  delete formatter;
+}
+
+void PredictionWriter::writeRow(
+  const labelCount_t *const trueLabels,
+  const labelCount_t numTrueLabels,
+  const labelCount_t *const labels,
+  const FP_TYPE *const scores)
+{
+  assert(!isClosed);
+  current.trueLabels.insert(current.trueLabels.end(), trueLabels, trueLabels + numTrueLabels);
+  current.trueLabelsEnd.push_back(current.trueLabels.size());
+  current.labels.insert(current.labels.end(), labels, labels + k);
+  current.scores.insert(current.scores.end(), scores, scores + k);
+
+  if (current.numRows() >= rowsPerBatch)
+    submitCurrent();
+}
+
+void PredictionWriter::submitCurrent()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    hasRoom.wait(lock, [this]() { return queue.size() < maxQueuedBatches; });
+    queue.push_back(PredictionRows());
+    queue.back().k = k;
+    queue.back().trueLabels.swap(current.trueLabels);
+    queue.back().trueLabelsEnd.swap(current.trueLabelsEnd);
+    queue.back().labels.swap(current.labels);
+    queue.back().scores.swap(current.scores);
+  }
+  current.clear();
+  hasWork.notify_one();
+}
+
+void PredictionWriter::close()
+{
+  if (isClosed)
+    return;
+  if (current.numRows() > 0)
+    submitCurrent();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isClosing = true;
+  }
+  hasWork.notify_one();
+  worker.join();
+  file.close();
+  isClosed = true;
+}
+
+void PredictionWriter::writeLoop()
+{
+  std::string bytes;
+  formatter->appendHeader(bytes, k);
+
+  PredictionRows rows;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      hasWork.wait(lock, [this]() { return !queue.empty() || isClosing; });
+      if (queue.empty()) {
+        lock.unlock();
+        file.write(bytes.data(), bytes.size());
+        return;
+      }
+      rows = std::move(queue.front());
+      queue.pop_front();
+    }
+    hasRoom.notify_one();
+
+    formatter->appendRows(bytes, rows);
+    file.write(bytes.data(), bytes.size());
+    bytes.clear();
+  }
+}
@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __PREDICTION_WRITER_H__
+#define __PREDICTION_WRITER_H__
+
+#include "pre_processor.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace EdgeML
+{
+  // Rows of predictions: the true labels of each point, then its k labels and their scores
+  struct PredictionRows
+  {
+    labelCount_t k;
+    std::vector<labelCount_t> trueLabels;
+    std::vector<size_t> trueLabelsEnd; ///< End of the true labels of each row in trueLabels
+    std::vector<labelCount_t> labels;  ///< k per row
+    std::vector<FP_TYPE> scores;       ///< k per row
+
+    size_t numRows() const { return trueLabelsEnd.size(); }
+    void clear();
+  };
+
+  //
+  // Turns rows of predictions into the bytes of an output file.
+  //
+  class PredictionFormatter
+  {
+  public:
+    virtual ~PredictionFormatter() {}
+    virtual void appendHeader(std::string& out, const labelCount_t k) {}
+    virtual void appendRows(std::string& out, const PredictionRows& rows) = 0;
+  };
+
+  //
+  // One line per point: the true labels, each followed by ",  " (if @writeTrueLabels_),
+  // then every label and score separated by @labelScoreSeparator_ and followed by
+  // @pairSuffix_. Scores are printed like the default std::ostream formatting (%g).
+  //
+  class TextPredictionFormatter : public PredictionFormatter
+  {
+    const bool writeTrueLabels;
+    const std::string labelScoreSeparator;
+    const std::string pairSuffix;
+
+  public:
+    TextPredictionFormatter(
+      const bool writeTrueLabels_,
+      const std::string& labelScoreSeparator_,
+      const std::string& pairSuffix_);
+
+    void appendRows(std::string& out, const PredictionRows& rows);
+  };
+
+  //
+  // Fixed-width binary rows after a header of the magic "EMLPRED1", then k and
+  // sizeof(FP_TYPE) as uint32. Each row holds the first true label as uint32
+  // (0xffffffff if there is none), k labels as uint32 and k scores as FP_TYPE,
+  // all in native byte order.
+  //
+  class BinaryPredictionFormatter : public PredictionFormatter
+  {
+  public:
+    void appendHeader(std::string& out, const labelCount_t k);
+    void appendRows(std::string& out, const PredictionRows& rows);
+  };
+
+  //
+  // Writes predictions to a file through a PredictionFormatter. Rows are copied into
+  // batches, which a background thread formats and writes with large writes, so the
+  // scoring loop neither formats nor flushes. At most a few batches are queued;
+  // writeRow blocks while the queue is full.
+  //
+  class PredictionWriter
+  {
+    std::ofstream file;
+    PredictionFormatter* formatter;
+    const labelCount_t k;
+    const size_t rowsPerBatch;
+    PredictionRows current;
+    bool isClosed;
+
+    std::mutex mutex;
+    std::condition_variable hasWork, hasRoom;
+    std::deque<PredictionRows> queue;
+    bool isClosing;
+    std::thread worker; // keep last, started after the members above are initialized
+
+    void submitCurrent();
+    void writeLoop();
+
+  public:
+    // Takes ownership of @formatter_. Every row has @k_ labels and scores.
+    PredictionWriter(
+      const std::string& path,
+      PredictionFormatter* formatter_,
+      const labelCount_t k_,
+      const size_t rowsPerBatch_ = 4096);
+
+    ~PredictionWriter();
+
+    void writeRow(
+      const labelCount_t *const trueLabels,
+      const labelCount_t numTrueLabels,
+      const labelCount_t *const labels,
+      const FP_TYPE *const scores);
+
+    // Writes the remaining rows and closes the file; called by the destructor
+    void close();
+  };
+}
+
+#endif
@@ -0,0 +1,138 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "quantized.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+#define INT8_AVX512_VNNI
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#define INT8_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace EdgeML;
+
+const char* EdgeML::int8KernelName()
+{
+#if defined(INT8_AVX512_VNNI)
+  return "AVX-512 VNNI";
+#elif defined(INT8_AVX2)
+  return "AVX2";
+#else
+  return "scalar";
+#endif
+}
+
+//
+// Both SIMD kernels multiply unsigned by signed bytes, so they compute |a| * (b * sign(a)).
+// Inputs are in [-127, 127], which keeps the products and the AVX2 pairwise int16 sums in range.
+//
+int32_t EdgeML::dotInt8(const int8_t *const a, const int8_t *const b, const Eigen::Index n)
+{
+  assert(n % int8Block == 0);
+#if defined(INT8_AVX512_VNNI)
+  __m512i acc = _mm512_setzero_si512();
+  for (Eigen::Index i = 0; i < n; i += 64) {
+    const __m512i va = _mm512_loadu_si512((const void*)(a + i));
+    const __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+    const __mmask64 isNegative = _mm512_movepi8_mask(va);
+    const __m512i signedB = _mm512_mask_sub_epi8(vb, isNegative, _mm512_setzero_si512(), vb);
+    acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(va), signedB);
+  }
+  return _mm512_reduce_add_epi32(acc);
+#elif defined(INT8_AVX2)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i acc = _mm256_setzero_si256();
+  for (Eigen::Index i = 0; i < n; i += 32) {
+    const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+    const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+    const __m256i pairs = _mm256_maddubs_epi16(_mm256_abs_epi8(va), _mm256_sign_epi8(vb, va));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+  }
+  const __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  const __m128i sum2 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+  const __m128i sum1 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum1);
+#else
+  return dotInt8Scalar(a, b, n);
+#endif
+}
+
+int32_t EdgeML::dotInt8Scalar(const int8_t *const a, const int8_t *const b, const Eigen::Index n)
+{
+  int32_t acc = 0;
+  for (Eigen::Index i = 0; i < n; ++i)
+    acc += (int32_t)a[i] * (int32_t)b[i];
+  return acc;
+}
+
+static FP_TYPE quantizeRange(const FP_TYPE *const x, const Eigen::Index n, const Eigen::Index step, int8_t *const xq)
+{
+  FP_TYPE maxAbs = 0;
+  for (Eigen::Index i = 0; i < n; ++i)
+    maxAbs = std::max(maxAbs, (FP_TYPE)std::fabs(x[i * step]));
+  if (maxAbs == (FP_TYPE)0.0) {
+    memset(xq, 0, n);
+    return (FP_TYPE)1.0;
+  }
+
+  const FP_TYPE scale = maxAbs / (FP_TYPE)127.0;
+  for (Eigen::Index i = 0; i < n; ++i)
+    xq[i] = (int8_t)std::lround(x[i * step] / scale);
+  return scale;
+}
+
+FP_TYPE EdgeML::quantizeVector(const FP_TYPE *const x, const Eigen::Index n, int8_t *const xq)
+{
+  const FP_TYPE scale = quantizeRange(x, n, 1, xq);
+  memset(xq + n, 0, int8PaddedLength(n) - n);
+  return scale;
+}
+
+QuantizedMatrix::QuantizedMatrix()
+  : numRows(0),
+  numCols(0),
+  stride(0)
+{
+}
+
+void QuantizedMatrix::quantize(const MatrixXuf& A)
+{
+  numRows = A.rows();
+  numCols = A.cols();
+  stride = int8PaddedLength(numCols);
+  values.assign(numRows * stride, 0);
+  rowScale.resize(numRows);
+
+#ifdef ROWMAJOR
+  const Eigen::Index colStep = 1;
+#else
+  const Eigen::Index colStep = A.rows();
+#endif
+  if (numCols == 0)
+    return;
+  pfor(Eigen::Index r = 0; r < numRows; ++r)
+    rowScale[r] = quantizeRange(&A(r, 0), numCols, colStep, values.data() + r * stride);
+}
+
+size_t QuantizedMatrix::sizeInBytes() const
+{
+  return values.size() * sizeof(int8_t) + rowScale.size() * sizeof(FP_TYPE);
+}
+
+FP_TYPE QuantizedMatrix::rowDot(const Eigen::Index r, const int8_t *const xq, const FP_TYPE xScale) const
+{
+  assert(r < numRows);
+  return rowScale[r] * xScale * (FP_TYPE)dotInt8(values.data() + r * stride, xq, stride);
+}
+
+void QuantizedMatrix::gemv(FP_TYPE *const out, const int8_t *const xq, const FP_TYPE xScale, const FP_TYPE alpha) const
+{
+  for (Eigen::Index r = 0; r < numRows; ++r)
+    out[r] = alpha * rowDot(r, xq, xScale);
+}
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __QUANTIZED_H__
+#define __QUANTIZED_H__
+
+#include "pre_processor.h"
+
+#include <cstdint>
+
+namespace EdgeML
+{
+  //
+  // Post-training int8 copy of a dense matrix for scoring: every row is quantized
+  // symmetrically to [-127, 127] with its own scale. Rows are padded with zeros to a
+  // multiple of int8Block entries, so that the dot-product kernels need no tail handling.
+  //
+  const Eigen::Index int8Block = 64;
+
+  inline Eigen::Index int8PaddedLength(const Eigen::Index n)
+  {
+    return (n + int8Block - 1) / int8Block * int8Block;
+  }
+
+  class QuantizedMatrix
+  {
+    Eigen::Index numRows, numCols, stride;
+    std::vector<int8_t> values; // row-major with row stride @stride
+    std::vector<FP_TYPE> rowScale;
+
+  public:
+    QuantizedMatrix();
+
+    // Accepts sparse parameters through MatrixXuf(param)
+    void quantize(const MatrixXuf& A);
+
+    inline Eigen::Index rows() const { return numRows; }
+    inline Eigen::Index cols() const { return numCols; }
+    size_t sizeInBytes() const;
+
+    //
+    // Row @r times a vector quantized by quantizeVector with scale @xScale;
+    // @xq holds int8PaddedLength(cols()) entries.
+    //
+    FP_TYPE rowDot(const Eigen::Index r, const int8_t *const xq, const FP_TYPE xScale) const;
+
+    // out = alpha * (this * x) for x quantized by quantizeVector
+    void gemv(FP_TYPE *const out, const int8_t *const xq, const FP_TYPE xScale, const FP_TYPE alpha = 1.0) const;
+  };
+
+  //
+  // Quantizes the @n entries of @x symmetrically into @xq and zero-fills @xq up to
+  // int8PaddedLength(n). Returns the scale, x ~ scale * xq.
+  //
+  FP_TYPE quantizeVector(const FP_TYPE *const x, const Eigen::Index n, int8_t *const xq);
+
+  //
+  // Dot product of int8 vectors whose length @n is a multiple of int8Block. Uses AVX-512 VNNI
+  // or AVX2 when the build enables them (SIMD_FLAGS in config.mk), dotInt8Scalar otherwise.
+  //
+  int32_t dotInt8(const int8_t *const a, const int8_t *const b, const Eigen::Index n);
+
+  // Portable kernel, and the reference the SIMD kernels are tested against
+  int32_t dotInt8Scalar(const int8_t *const a, const int8_t *const b, const Eigen::Index n);
+
+  // The dot-product kernel selected at compile time, for logs
+  const char* int8KernelName();
+}
+
+#endif
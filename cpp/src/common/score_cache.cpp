@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "score_cache.h"
+
+#include <cstring>
+
+using namespace EdgeML;
+
+static inline uint64_t mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t EdgeML::hashBytes(const void *const bytes, const size_t numBytes, const uint64_t seed)
+{
+  const char *const p = (const char*)bytes;
+  uint64_t h = seed ^ (numBytes * 0x9e3779b97f4a7c15ULL);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= numBytes; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    h = (h ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+  }
+  if (i < numBytes) {
+    uint64_t word = 0;
+    memcpy(&word, p + i, numBytes - i);
+    h = (h ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+  }
+  return mix(h);
+}
+
+uint64_t EdgeML::hashMatrix(const MatrixXuf& A, const uint64_t seed)
+{
+  const Eigen::Index dims[2] = { A.rows(), A.cols() };
+  const uint64_t h = hashBytes(dims, sizeof(dims), seed);
+  return hashBytes(A.data(), sizeof(FP_TYPE) * A.size(), h);
+}
+
+uint64_t EdgeML::hashMatrix(const SparseMatrixuf& A, const uint64_t seed)
+{
+  SparseMatrixuf compressed = A;
+  compressed.makeCompressed();
+  const Eigen::Index dims[2] = { A.rows(), A.cols() };
+  uint64_t h = hashBytes(dims, sizeof(dims), seed);
+  h = hashBytes(compressed.outerIndexPtr(), sizeof(sparseIndex_t) * (compressed.outerSize() + 1), h);
+  h = hashBytes(compressed.innerIndexPtr(), sizeof(sparseIndex_t) * compressed.nonZeros(), h);
+  return hashBytes(compressed.valuePtr(), sizeof(FP_TYPE) * compressed.nonZeros(), h);
+}
+
+ScoreCache::ScoreCache(const size_t budgetBytes, const int numShards)
+  : budgetPerShard(budgetBytes / std::max(1, numShards)),
+  shards(std::max(1, numShards)),
+  numHits(0),
+  numMisses(0),
+  numInserts(0),
+  numEvictions(0)
+{
+}
+
+void ScoreCache::makeKey(
+  std::string& key,
+  const uint64_t modelTag,
+  const FP_TYPE *const values,
+  const featureCount_t *const indices,
+  const size_t numValues)
+{
+  const char isSparse = indices != NULL;
+  key.clear();
+  key.reserve(sizeof(modelTag) + 1 + numValues * (sizeof(FP_TYPE) + (isSparse ? sizeof(featureCount_t) : 0)));
+  key.append((const char*)&modelTag, sizeof(modelTag));
+  key.append(&isSparse, 1);
+  if (isSparse)
+    key.append((const char*)indices, sizeof(featureCount_t) * numValues);
+  key.append((const char*)values, sizeof(FP_TYPE) * numValues);
+}
+
+size_t ScoreCache::entryBytes(const std::string& key, const labelCount_t numScores)
+{
+  return sizeof(Entry) + key.size() + sizeof(FP_TYPE) * numScores;
+}
+
+bool ScoreCache::lookup(
+  const uint64_t modelTag,
+  const FP_TYPE *const values,
+  const featureCount_t *const indices,
+  const size_t numValues,
+  FP_TYPE *const scores,
+  const labelCount_t numScores)
+{
+  std::string key;
+  makeKey(key, modelTag, values, indices, numValues);
+  return lookup(key, scores, numScores);
+}
+
+void ScoreCache::insert(
+  const uint64_t modelTag,
+  const FP_TYPE *const values,
+  const featureCount_t *const indices,
+  const size_t numValues,
+  const FP_TYPE *const scores,
+  const labelCount_t numScores)
+{
+  std::string key;
+  makeKey(key, modelTag, values, indices, numValues);
+  insert(key, scores, numScores);
+}
+
+bool ScoreCache::lookup(const std::string& key, FP_TYPE *const scores, const labelCount_t numScores)
+{
+  const uint64_t hash = hashBytes(key.data(), key.size());
+  Shard& shard = shards[hash % shards.size()];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.slotOfHash.find(hash);
+    if (it != shard.slotOfHash.end()) {
+      Entry& entry = shard.slots[it->second];
+      if (entry.key == key && entry.scores.size() == numScores) {
+        entry.isReferenced = true;
+        memcpy(scores, entry.scores.data(), sizeof(FP_TYPE) * numScores);
+        ++numHits;
+        return true;
+      }
+    }
+  }
+  ++numMisses;
+  return false;
+}
+
+void ScoreCache::insert(const std::string& key, const FP_TYPE *const scores, const labelCount_t numScores)
+{
+  const size_t numBytes = entryBytes(key, numScores);
+  if (numBytes > budgetPerShard)
+    return;
+
+  const uint64_t hash = hashBytes(key.data(), key.size());
+  Shard& shard = shards[hash % shards.size()];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  // A colliding or concurrently inserted entry is replaced
+  auto it = shard.slotOfHash.find(hash);
+  if (it != shard.slotOfHash.end()) {
+    Entry& entry = shard.slots[it->second];
+    shard.numBytes -= entryBytes(entry.key, (labelCount_t)entry.scores.size());
+    entry.isUsed = false;
+    shard.freeSlots.push_back(it->second);
+    shard.slotOfHash.erase(it);
+  }
+
+  // CLOCK: referenced entries get a second chance, the others are evicted
+  while (shard.numBytes + numBytes > budgetPerShard) {
+    assert(!shard.slots.empty());
+    if (shard.clockHand >= shard.slots.size())
+      shard.clockHand = 0;
+    Entry& victim = shard.slots[shard.clockHand];
+    if (victim.isUsed) {
+      if (victim.isReferenced)
+        victim.isReferenced = false;
+      else {
+        shard.numBytes -= entryBytes(victim.key, (labelCount_t)victim.scores.size());
+        shard.slotOfHash.erase(victim.hash);
+        victim.isUsed = false;
+        std::string().swap(victim.key);
+        std::vector<FP_TYPE>().swap(victim.scores);
+        shard.freeSlots.push_back(shard.clockHand);
+        ++numEvictions;
+      }
+    }
+    ++shard.clockHand;
+  }
+
+  size_t slot;
+  if (!shard.freeSlots.empty()) {
+    slot = shard.freeSlots.back();
+    shard.freeSlots.pop_back();
+  }
+  else {
+    slot = shard.slots.size();
+    shard.slots.push_back(Entry());
+  }
+  Entry& entry = shard.slots[slot];
+  entry.key = key;
+  entry.scores.assign(scores, scores + numScores);
+  entry.hash = hash;
+  entry.isUsed = true;
+  entry.isReferenced = false;
+  shard.slotOfHash[hash] = slot;
+  shard.numBytes += numBytes;
+  ++numInserts;
+}
+
+void ScoreCache::clear()
+{
+  for (size_t s = 0; s < shards.size(); ++s) {
+    std::lock_guard<std::mutex> lock(shards[s].mutex);
+    shards[s].slotOfHash.clear();
+    std::vector<Entry>().swap(shards[s].slots);
+    shards[s].freeSlots.clear();
+    shards[s].clockHand = 0;
+    shards[s].numBytes = 0;
+  }
+}
+
+FP_TYPE ScoreCache::hitRate() const
+{
+  const uint64_t lookups = numHits + numMisses;
+  return lookups == 0 ? (FP_TYPE)0.0 : (FP_TYPE)numHits / (FP_TYPE)lookups;
+}
+
+size_t ScoreCache::sizeInBytes()
+{
+  size_t numBytes = 0;
+  for (size_t s = 0; s < shards.size(); ++s) {
+    std::lock_guard<std::mutex> lock(shards[s].mutex);
+    numBytes += shards[s].numBytes;
+  }
+  return numBytes;
+}
+
+void ScoreCache::logStats()
+{
+  LOG_INFO("Score cache: " + std::to_string(hits()) + " hits, " + std::to_string(misses()) + " misses (hit rate "
+    + std::to_string(hitRate()) + "), " + std::to_string(numInserts) + " inserts, "
+    + std::to_string(numEvictions) + " evictions, " + std::to_string(sizeInBytes()) + " bytes held");
+}
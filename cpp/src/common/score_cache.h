@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __SCORE_CACHE_H__
+#define __SCORE_CACHE_H__
+
+#include "pre_processor.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace EdgeML
+{
+  // 64-bit hash of @numBytes bytes, processed a word at a time
+  uint64_t hashBytes(const void *const bytes, const size_t numBytes, const uint64_t seed = 0);
+
+  // Hashes the values (and indices) of a parameter, for fingerprinting models
+  uint64_t hashMatrix(const MatrixXuf& A, const uint64_t seed);
+  uint64_t hashMatrix(const SparseMatrixuf& A, const uint64_t seed);
+
+  //
+  // Concurrent cache of predictor scores keyed by the raw input point.
+  // Entries are spread over shards with one lock each and evicted with the CLOCK
+  // policy once a shard exceeds its share of the memory budget. Keys are compared
+  // byte for byte, so a hash collision costs a miss and never returns wrong scores.
+  // Every key includes a model tag: predictors tag entries with a fingerprint of
+  // their model, so entries of a swapped-out model are never hit again and age out.
+  // One cache can be shared by several predictors (e.g. one per thread).
+  //
+  class ScoreCache
+  {
+    struct Entry
+    {
+      std::string key;
+      std::vector<FP_TYPE> scores;
+      uint64_t hash;
+      bool isUsed;
+      bool isReferenced;
+    };
+
+    struct Shard
+    {
+      std::mutex mutex;
+      std::unordered_map<uint64_t, size_t> slotOfHash;
+      std::vector<Entry> slots;
+      std::vector<size_t> freeSlots;
+      size_t clockHand;
+      size_t numBytes;
+      Shard() : clockHand(0), numBytes(0) {}
+    };
+
+    const size_t budgetPerShard;
+    std::vector<Shard> shards;
+    std::atomic<uint64_t> numHits, numMisses, numInserts, numEvictions;
+
+    static void makeKey(std::string& key, const uint64_t modelTag,
+      const FP_TYPE *const values, const featureCount_t *const indices, const size_t numValues);
+    bool lookup(const std::string& key, FP_TYPE *const scores, const labelCount_t numScores);
+    void insert(const std::string& key, const FP_TYPE *const scores, const labelCount_t numScores);
+    static size_t entryBytes(const std::string& key, const labelCount_t numScores);
+
+  public:
+    // @budgetBytes bounds the keys and scores held, split evenly over @numShards shards
+    ScoreCache(const size_t budgetBytes, const int numShards = 16);
+
+    //
+    // Copy the cached scores of the point to @scores and return true on a hit.
+    // @indices is NULL for dense points.
+    //
+    bool lookup(const uint64_t modelTag,
+      const FP_TYPE *const values, const featureCount_t *const indices, const size_t numValues,
+      FP_TYPE *const scores, const labelCount_t numScores);
+
+    void insert(const uint64_t modelTag,
+      const FP_TYPE *const values, const featureCount_t *const indices, const size_t numValues,
+      const FP_TYPE *const scores, const labelCount_t numScores);
+
+    void clear();
+
+    uint64_t hits() const { return numHits; }
+    uint64_t misses() const { return numMisses; }
+    FP_TYPE hitRate() const;
+    size_t sizeInBytes();
+
+    void logStats();
+  };
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "small_gemv.h"
+
+#include <algorithm>
+
+using namespace EdgeML;
+
+namespace
+{
+  typedef void (*SmallGemvKernel)(
+    const FP_TYPE alpha,
+    const FP_TYPE *const A,
+    const Eigen::Index lda,
+    const FP_TYPE *const x,
+    const FP_TYPE beta,
+    FP_TYPE *const y);
+
+  // y = alpha*A*x + beta*y: a fixed-size accumulator updated one column at a time
+  template<int Rows, int Cols>
+  void smallGemvFixed(
+    const FP_TYPE alpha,
+    const FP_TYPE *const A,
+    const Eigen::Index lda,
+    const FP_TYPE *const x,
+    const FP_TYPE beta,
+    FP_TYPE *const y)
+  {
+    typedef Matrix<FP_TYPE, Rows, 1> Column;
+    Column acc = Column::Zero();
+    for (int k = 0; k < Cols; ++k)
+      acc.noalias() += x[k] * Map<const Column>(A + k * lda);
+
+    Map<Column> out(y);
+    if (beta == (FP_TYPE)0.0)
+      out = alpha * acc;
+    else
+      out = alpha * acc + beta * out;
+  }
+
+  // y = alpha*A'*x + beta*y: one fixed-size dot product per column
+  // (written as a sum, since dot is defined as the BLAS routine)
+  template<int Rows, int Cols>
+  void smallGemvTransFixed(
+    const FP_TYPE alpha,
+    const FP_TYPE *const A,
+    const Eigen::Index lda,
+    const FP_TYPE *const x,
+    const FP_TYPE beta,
+    FP_TYPE *const y)
+  {
+    typedef Matrix<FP_TYPE, Rows, 1> Column;
+    const Map<const Column> xVec(x);
+    for (int k = 0; k < Cols; ++k) {
+      const FP_TYPE product = alpha * Map<const Column>(A + k * lda).cwiseProduct(xVec).sum();
+      y[k] = beta == (FP_TYPE)0.0 ? product : product + beta * y[k];
+    }
+  }
+
+  const int maxDim = (int)smallGemvMaxDim;
+
+  struct SmallGemvKernels
+  {
+    SmallGemvKernel noTrans[maxDim][maxDim]; // indexed by rows - 1 and cols - 1
+    SmallGemvKernel trans[maxDim][maxDim];
+  };
+
+  // Instantiates the kernels of all rows x cols up to Rows x Cols, counting down
+  template<int Rows, int Cols>
+  struct FillSmallGemvKernels
+  {
+    static void fill(SmallGemvKernels& kernels)
+    {
+      kernels.noTrans[Rows - 1][Cols - 1] = &smallGemvFixed<Rows, Cols>;
+      kernels.trans[Rows - 1][Cols - 1] = &smallGemvTransFixed<Rows, Cols>;
+      FillSmallGemvKernels<Rows, Cols - 1>::fill(kernels);
+    }
+  };
+
+  template<int Rows>
+  struct FillSmallGemvKernels<Rows, 0>
+  {
+    static void fill(SmallGemvKernels& kernels)
+    {
+      FillSmallGemvKernels<Rows - 1, maxDim>::fill(kernels);
+    }
+  };
+
+  template<>
+  struct FillSmallGemvKernels<0, maxDim>
+  {
+    static void fill(SmallGemvKernels&) {}
+  };
+
+  const SmallGemvKernels& smallGemvKernels()
+  {
+    static const SmallGemvKernels kernels = []() {
+      SmallGemvKernels table;
+      FillSmallGemvKernels<maxDim, maxDim>::fill(table);
+      return table;
+    }();
+    return kernels;
+  }
+}
+
+void EdgeML::smallGemv(
+  const CBLAS_TRANSPOSE tA,
+  const Eigen::Index rows,
+  const Eigen::Index cols,
+  const FP_TYPE alpha,
+  const FP_TYPE *const A,
+  const Eigen::Index lda,
+  const FP_TYPE *const x,
+  const FP_TYPE beta,
+  FP_TYPE *const y)
+{
+  assert(lda >= rows);
+  const Eigen::Index outLength = tA == CblasNoTrans ? rows : cols;
+
+  if (rows == 0 || cols == 0) {
+    for (Eigen::Index i = 0; i < outLength; ++i)
+      y[i] = beta == (FP_TYPE)0.0 ? (FP_TYPE)0.0 : beta * y[i];
+    return;
+  }
+
+  if (rows <= smallGemvMaxDim && cols <= smallGemvMaxDim) {
+    const SmallGemvKernels& kernels = smallGemvKernels();
+    (tA == CblasNoTrans ? kernels.noTrans : kernels.trans)[rows - 1][cols - 1](alpha, A, lda, x, beta, y);
+    return;
+  }
+
+  gemv(CblasColMajor, tA, rows, cols, alpha, A, lda, x, 1, beta, y, 1);
+}
+
+void EdgeML::smallGemvRows(
+  FP_TYPE *const y,
+  const MatrixXuf& A,
+  const Eigen::Index rowBegin,
+  const Eigen::Index numRows,
+  const CBLAS_TRANSPOSE tA,
+  const FP_TYPE *const x,
+  const FP_TYPE alpha,
+  const FP_TYPE beta)
+{
+  assert(rowBegin >= 0 && rowBegin + numRows <= A.rows());
+  if (A.IsRowMajor)
+    // The rows are a column-major cols x numRows block
+    smallGemv(tA == CblasNoTrans ? CblasTrans : CblasNoTrans, A.cols(), numRows, alpha,
+      A.data() + rowBegin * A.cols(), A.cols(), x, beta, y);
+  else
+    smallGemv(tA, numRows, A.cols(), alpha, A.data() + rowBegin, A.rows(), x, beta, y);
+}
+
+void EdgeML::smallGemvRows(
+  FP_TYPE *const y,
+  const SparseMatrixuf& A,
+  const Eigen::Index rowBegin,
+  const Eigen::Index numRows,
+  const CBLAS_TRANSPOSE tA,
+  const FP_TYPE *const x,
+  const FP_TYPE alpha,
+  const FP_TYPE beta)
+{
+  assert(rowBegin >= 0 && rowBegin + numRows <= A.rows());
+  const Eigen::Index outLength = tA == CblasNoTrans ? numRows : A.cols();
+  for (Eigen::Index i = 0; i < outLength; ++i)
+    y[i] = beta == (FP_TYPE)0.0 ? (FP_TYPE)0.0 : beta * y[i];
+
+  const Eigen::Index rowEnd = rowBegin + numRows;
+  const FP_TYPE *const values = A.valuePtr();
+  const sparseIndex_t *const inner = A.innerIndexPtr();
+  const sparseIndex_t *const outerStart = A.outerIndexPtr();
+  const sparseIndex_t *const innerNonZeros = A.innerNonZeroPtr(); // NULL when compressed
+  auto outerEnd = [&](const Eigen::Index outer) -> Eigen::Index {
+    return innerNonZeros == NULL ? outerStart[outer + 1] : outerStart[outer] + innerNonZeros[outer];
+  };
+
+  if (A.IsRowMajor) {
+    // Only the outer vectors of the rows are visited
+    for (Eigen::Index row = rowBegin; row < rowEnd; ++row) {
+      const Eigen::Index r = row - rowBegin;
+      for (Eigen::Index k = outerStart[row]; k < outerEnd(row); ++k) {
+        if (tA == CblasNoTrans)
+          y[r] += alpha * values[k] * x[inner[k]];
+        else
+          y[inner[k]] += alpha * values[k] * x[r];
+      }
+    }
+  }
+  else {
+    // Row indices are sorted within a column: binary search for the first row of the range
+    for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+      const sparseIndex_t *const end = inner + outerEnd(col);
+      for (const sparseIndex_t* it = std::lower_bound(inner + outerStart[col], end, (sparseIndex_t)rowBegin);
+        it != end && *it < rowEnd; ++it) {
+        const Eigen::Index r = *it - rowBegin;
+        const FP_TYPE value = values[it - inner];
+        if (tA == CblasNoTrans)
+          y[r] += alpha * value * x[col];
+        else
+          y[col] += alpha * value * x[r];
+      }
+    }
+  }
+}
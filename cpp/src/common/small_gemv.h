@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __SMALL_GEMV_H__
+#define __SMALL_GEMV_H__
+
+#include "pre_processor.h"
+
+namespace EdgeML
+{
+  //
+  // Matrix-vector products of the tiny blocks in tree models, such as one node's rows of
+  // Bonsai's W and V. When both dimensions are at most smallGemvMaxDim, the product runs
+  // in a kernel compiled for exactly those dimensions: the loops are unrolled and every
+  // column is a fixed-size Eigen vector, so it runs in SIMD registers. Larger blocks go to
+  // BLAS gemv. Either way there is none of the setup or dispatch cost of mm.
+  //
+  const Eigen::Index smallGemvMaxDim = 16;
+
+  //
+  // y = alpha*op(A)*x + beta*y. A is column-major, @rows x @cols, with column stride @lda.
+  // y is not read when beta is 0.
+  //
+  void smallGemv(
+    const CBLAS_TRANSPOSE tA,
+    const Eigen::Index rows,
+    const Eigen::Index cols,
+    const FP_TYPE alpha,
+    const FP_TYPE *const A,
+    const Eigen::Index lda,
+    const FP_TYPE *const x,
+    const FP_TYPE beta,
+    FP_TYPE *const y);
+
+  //
+  // Same as smallGemv, with A the @numRows rows of @A starting at @rowBegin, and no copy.
+  // The sparse overload is for builds with sparse parameters and visits only the non-zeros
+  // of those rows: the outer vectors of a row-major @A, or the range of each column of a
+  // column-major one, found by binary search.
+  //
+  void smallGemvRows(
+    FP_TYPE *const y,
+    const MatrixXuf& A,
+    const Eigen::Index rowBegin,
+    const Eigen::Index numRows,
+    const CBLAS_TRANSPOSE tA,
+    const FP_TYPE *const x,
+    const FP_TYPE alpha,
+    const FP_TYPE beta);
+
+  void smallGemvRows(
+    FP_TYPE *const y,
+    const SparseMatrixuf& A,
+    const Eigen::Index rowBegin,
+    const Eigen::Index numRows,
+    const CBLAS_TRANSPOSE tA,
+    const FP_TYPE *const x,
+    const FP_TYPE alpha,
+    const FP_TYPE beta);
+}
+
+#endif
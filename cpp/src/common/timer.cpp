@@ -3,10 +3,22 @@
 
 #include "timer.h"
 #include "logger.h"
+#include "memory_accounting.h"
 #include <ctime>
 #include <iostream>
 #include <string>
 
+#ifdef PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#endif
+
 #ifdef CONCISE
 float thresh = 0.1f;
 #else
@@ -17,6 +29,142 @@ using namespace EdgeML;
 
 int Timer::level = 0;  // STATIC INITIALIZATION
 
+#ifdef PERF_COUNTERS
+namespace
+{
+  const uint64_t perfEventConfigs[numPerfEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES };
+
+  struct PerfTotals
+  {
+    uint64_t calls;
+    uint64_t unattributedCalls; // closed on another thread, or counters went backwards
+    double wallSeconds;
+    uint64_t counts[numPerfEvents];
+  };
+
+  struct PerfRegistry
+  {
+    std::mutex mutex;
+    std::map<std::string, PerfTotals> totals;
+    bool isUnavailableLogged;
+    PerfRegistry() : isUnavailableLogged(false) {}
+  };
+
+  PerfRegistry& perfRegistry()
+  {
+    static PerfRegistry registry;
+    return registry;
+  }
+
+  void dumpPerfTotals()
+  {
+    PerfRegistry& registry = perfRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (registry.totals.empty())
+      return;
+
+    std::stringstream table;
+    table << "\nHardware counters per Timer scope (all threads)\n"
+      << std::left << std::setw(40) << "scope" << std::right
+      << std::setw(10) << "calls" << std::setw(12) << "wall(s)"
+      << std::setw(18) << "cycles" << std::setw(18) << "instructions" << std::setw(7) << "IPC"
+      << std::setw(16) << "LLC misses" << std::setw(9) << "LLC/ki"
+      << std::setw(16) << "branch misses" << std::setw(14) << "unattributed" << "\n";
+    for (auto it = registry.totals.begin(); it != registry.totals.end(); ++it) {
+      const PerfTotals& t = it->second;
+      const double instructions = (double)std::max(t.counts[1], (uint64_t)1);
+      table << std::left << std::setw(40) << it->first.substr(0, 39) << std::right
+        << std::setw(10) << t.calls << std::setw(12) << std::fixed << std::setprecision(3) << t.wallSeconds
+        << std::setw(18) << t.counts[0] << std::setw(18) << t.counts[1]
+        << std::setw(7) << std::setprecision(2) << (double)t.counts[1] / (double)std::max(t.counts[0], (uint64_t)1)
+        << std::setw(16) << t.counts[2] << std::setw(9) << std::setprecision(2) << 1000.0 * (double)t.counts[2] / instructions
+        << std::setw(16) << t.counts[3] << std::setw(14) << t.unattributedCalls << "\n";
+    }
+    std::cerr << table.str();
+  }
+
+  //
+  // One counter group per thread, opened by the first Timer of the thread.
+  // Events the CPU or hypervisor does not expose read as zero.
+  //
+  class ThreadCounters
+  {
+    int leader;
+    int memberIndex[numPerfEvents]; // position of the event in a group read, -1 if not opened
+    int fds[numPerfEvents];
+    int numOpened;
+
+    static int open(const uint64_t config, const int groupFd)
+    {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = config;
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+
+  public:
+    ThreadCounters() : leader(-1), numOpened(0)
+    {
+      for (int e = 0; e < numPerfEvents; ++e) {
+        fds[e] = open(perfEventConfigs[e], leader);
+        memberIndex[e] = fds[e] < 0 ? -1 : numOpened++;
+        if (leader < 0)
+          leader = fds[e];
+      }
+
+      if (leader < 0) {
+        const int error = errno;
+        PerfRegistry& registry = perfRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if (!registry.isUnavailableLogged) {
+          LOG_WARNING(std::string("Hardware counters unavailable, Timer scopes will not count them: ") + strerror(error));
+          registry.isUnavailableLogged = true;
+        }
+      }
+    }
+
+    ~ThreadCounters()
+    {
+      for (int e = 0; e < numPerfEvents; ++e)
+        if (fds[e] >= 0)
+          close(fds[e]);
+    }
+
+    bool read(uint64_t (&values)[numPerfEvents]) const
+    {
+      if (leader < 0)
+        return false;
+      uint64_t buffer[1 + numPerfEvents];
+      const ssize_t numBytes = ::read(leader, buffer, sizeof(uint64_t) * (1 + numOpened));
+      if (numBytes != (ssize_t)(sizeof(uint64_t) * (1 + numOpened)))
+        return false;
+      for (int e = 0; e < numPerfEvents; ++e)
+        values[e] = memberIndex[e] < 0 ? 0 : buffer[1 + memberIndex[e]];
+      return true;
+    }
+  };
+
+  ThreadCounters& threadCounters()
+  {
+    // The registry must be constructed before dumpPerfTotals is registered,
+    // so that it is destroyed after the dump
+    static const bool isDumpRegistered = (perfRegistry(), std::atexit(dumpPerfTotals) == 0);
+    (void)isDumpRegistered;
+    thread_local ThreadCounters counters;
+    return counters;
+  }
+}
+#endif
+
 EdgeML::Timer::Timer(std::string fn_name)
 {
   fn = fn_name;
@@ -32,10 +180,48 @@ EdgeML::Timer::Timer(std::string fn_name)
   before = after = std::clock();
   //clock_gettime (CLOCK_MONOTONIC, &before_wall);
   afterSysT = beforeSysT = std::chrono::system_clock::now();
+#ifdef PERF_COUNTERS
+  scopeStartSysT = beforeSysT;
+  ThreadCounters& counters = threadCounters();
+  countersThread = &counters;
+  hasCounters = counters.read(countersBefore);
+#endif
+#ifdef MEMORY_ACCOUNTING
+  memoryScope = enterMemoryScope();
+#endif
 }
 
 EdgeML::Timer::~Timer()
 {
+#ifdef PERF_COUNTERS
+  uint64_t countersAfter[numPerfEvents];
+  ThreadCounters& counters = threadCounters();
+  if (hasCounters && counters.read(countersAfter)) {
+    std::chrono::duration<double> scopeSysT = std::chrono::system_clock::now() - scopeStartSysT;
+    // The counters of another thread are unrelated to countersBefore
+    bool isAttributed = &counters == countersThread;
+    for (int e = 0; e < numPerfEvents; ++e)
+      isAttributed = isAttributed && countersAfter[e] >= countersBefore[e];
+
+    PerfRegistry& registry = perfRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto inserted = registry.totals.insert(std::make_pair(fn, PerfTotals()));
+    PerfTotals& totals = inserted.first->second;
+    if (inserted.second)
+      memset(&totals, 0, sizeof(totals));
+    totals.calls += 1;
+    totals.wallSeconds += scopeSysT.count();
+    if (isAttributed) {
+      for (int e = 0; e < numPerfEvents; ++e)
+        totals.counts[e] += countersAfter[e] - countersBefore[e];
+    }
+    else
+      totals.unattributedCalls += 1;
+  }
+#endif
+#ifdef MEMORY_ACCOUNTING
+  exitMemoryScope(fn, memoryScope);
+#endif
 #ifdef TIMER
   nextTime("returning");
 #endif
@@ -8,9 +8,23 @@
 #include <iomanip>
 #include <ctime>
 #include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "memory_accounting.h"
+
+// perf_event_open is Linux only
+#if defined(PERF_COUNTERS) && !defined(LINUX)
+#undef PERF_COUNTERS
+#endif
 
 namespace EdgeML
 {
+#ifdef PERF_COUNTERS
+  // Cycles, instructions, LLC misses and branch misses
+  const int numPerfEvents = 4;
+#endif
+
   class Timer
   {
     static int level;
@@ -19,7 +33,32 @@ namespace EdgeML
     std::string fn;
     int level_;
 
+#ifdef PERF_COUNTERS
+    // Hardware counters of the calling thread when the scope was entered, and the
+    // counter group they were read from, which identifies that thread
+    uint64_t countersBefore[numPerfEvents];
+    const void* countersThread;
+    bool hasCounters;
+    std::chrono::time_point<std::chrono::system_clock> scopeStartSysT;
+#endif
+
+#ifdef MEMORY_ACCOUNTING
+    MemoryScope memoryScope;
+#endif
+
   public:
+    //
+    // With PERF_COUNTERS, every Timer scope also counts cycles, instructions, LLC misses
+    // and branch misses of its thread. Totals per scope name over all calls and threads
+    // are printed to stderr at exit. Scopes count nothing where perf_event_open is not
+    // permitted (e.g. in containers), and work done by MKL's own threads is not attributed.
+    // A scope closed on another thread than it was opened on (a Cilk worker continuing
+    // after a cilk_for) has no meaningful difference of counters; it is counted as a call
+    // and in the wall time, and reported in the "unattributed" column.
+    //
+    // With MEMORY_ACCOUNTING, every Timer scope also records the bytes allocated while
+    // it is open (see memory_accounting.h).
+    //
     Timer(std::string fn_name);
     ~Timer();
 
@@ -135,48 +135,59 @@ FP_TYPE EdgeML::sequentialQuickSelect(
   assert(order > 0);
   assert(order <= count);
 
-  if (order == 1)
-    return *std::min_element(data, data + count);
-  else if (order >= count)
-    return *std::max_element(data, data + count);
-
-  FP_TYPE pivot = data[(rand() * rand()) % count];
-
-  size_t left = 0;
-  size_t right = count - 1;
-
-  while (left <= right) {
-    if (data[left] <= pivot) left++;
-    else if (data[right] > pivot) right--;
-    else {
-      std::swap(data[left], data[right]);
-      left++; right--;
+  // The pivot only affects the running time; a generator local to the call keeps
+  // concurrent callers off the shared rand() state. It is seeded once and advances
+  // from one partition to the next, so that a pivot that splits off nothing is not
+  // drawn again.
+  std::mt19937_64 pivotGenerator((unsigned long long)count);
+
+  while (true) {
+    if (order == 1)
+      return *std::min_element(data, data + count);
+    else if (order >= count)
+      return *std::max_element(data, data + count);
+
+    FP_TYPE pivot = data[std::uniform_int_distribution<size_t>(0, count - 1)(pivotGenerator)];
+
+    size_t left = 0;
+    size_t right = count - 1;
+
+    while (left <= right) {
+      if (data[left] <= pivot) left++;
+      else if (data[right] > pivot) right--;
+      else {
+        std::swap(data[left], data[right]);
+        left++; right--;
+      }
     }
-  }
 
-  if (left > 0)
-    assert(data[left - 1] <= pivot);
-  else
-    assert(data[0] > pivot);
+    if (left > 0)
+      assert(data[left - 1] <= pivot);
+    else
+      assert(data[0] > pivot);
 
-  if (left < count)
-    assert(data[left] > pivot);
-  else
-    assert(data[left - 1] <= pivot);
+    if (left < count)
+      assert(data[left] > pivot);
+    else
+      assert(data[left - 1] <= pivot);
 
-  if (right + 1 < count)
-    assert(data[right + 1] > pivot);
+    if (right + 1 < count)
+      assert(data[right + 1] > pivot);
 
-  if (left == count)
-    if (*std::min_element(data, data + count) == *std::max_element(data, data + count))
-      return pivot;
+    if (left == count)
+      if (*std::min_element(data, data + count) == *std::max_element(data, data + count))
+        return pivot;
 
-  if (left == order)
-    return pivot;
-  else if (order < left)
-    return sequentialQuickSelect(data, left, order);
-  else
-    return sequentialQuickSelect(data + left, count - left, order - left);
+    if (left == order)
+      return pivot;
+    else if (order < left)
+      count = left;
+    else {
+      data += left;
+      count -= left;
+      order -= left;
+    }
+  }
 }
 
 
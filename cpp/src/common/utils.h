@@ -66,12 +66,6 @@ namespace EdgeML
   void randPick(const MatrixXuf& source, MatrixXuf& target, dataCount_t seed = 42);
   void randPick(const SparseMatrixuf& source, SparseMatrixuf& target, dataCount_t seed = 42);
 
-  inline double rand_fraction()
-  {
-    const double normalizer = (double)(((uint64_t)RAND_MAX + 1) * ((uint64_t)RAND_MAX + 1));
-    return ((double)rand() + (double)rand()*(((double)RAND_MAX + 1.0))) / normalizer;
-  }
-
   size_t sparseExportStat(const SparseMatrixuf& mat);
   size_t sparseExportStat(const MatrixXuf& mat);
   size_t denseExportStat(const MatrixXuf& mat);
@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Bonsai.h"
+#include "BonsaiFunctions.h"
+#include "test_utils.h"
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+using namespace EdgeML::Bonsai;
+
+//
+// Trains Bonsai with importance-sampled minibatches on separable synthetic data and checks
+// its test accuracy, then checks that the weights 1/(n p) of sampled minibatches are
+// unbiased: weighted averages over the draws match the plain averages over the training
+// points. Returns non-zero on failure.
+//
+static const featureCount_t numFeatures = 8;
+static const labelCount_t numClasses = 3;
+
+// A point of class @label, drawn around a class center 4 units away from the others
+static void drawPoint(std::vector<FP_TYPE>& values, const labelCount_t label, std::mt19937_64& generator)
+{
+  std::normal_distribution<FP_TYPE> noise((FP_TYPE)0.0, (FP_TYPE)1.0);
+  for (featureCount_t f = 0; f < numFeatures; ++f)
+    values[f] = noise(generator) + (f % numClasses == label ? (FP_TYPE)4.0 : (FP_TYPE)0.0);
+}
+
+int main()
+{
+  BonsaiModel::BonsaiHyperParams hyperParams;
+  hyperParams.problemType = ProblemFormat::multiclass;
+  hyperParams.dataformatType = DataFormat::interfaceIngestFormat;
+  hyperParams.normalizationType = NormalizationFormat::none;
+  hyperParams.seed = 41;
+  hyperParams.iters = 20;
+  hyperParams.epochs = 1;
+  hyperParams.batchFactor = (FP_TYPE)1.0;
+  hyperParams.dataDimension = numFeatures;
+  hyperParams.projectionDimension = 5;
+  hyperParams.numClasses = numClasses;
+  hyperParams.Sigma = (FP_TYPE)1.0;
+  hyperParams.treeDepth = 2;
+  hyperParams.internalNodes = (1 << hyperParams.treeDepth) - 1;
+  hyperParams.totalNodes = 2 * hyperParams.internalNodes + 1;
+  hyperParams.regList.lW = (FP_TYPE)1.0e-4;
+  hyperParams.regList.lZ = (FP_TYPE)1.0e-5;
+  hyperParams.regList.lV = (FP_TYPE)1.0e-4;
+  hyperParams.regList.lTheta = (FP_TYPE)1.0e-4;
+  hyperParams.finalizeHyperParams();
+
+  std::mt19937_64 generator(42);
+  std::vector<FP_TYPE> values(numFeatures);
+
+  BonsaiTrainer trainer(DataIngestType::InterfaceIngest, hyperParams);
+  const int numTrain = 600;
+  for (int i = 0; i < numTrain; ++i) {
+    const labelCount_t label = (labelCount_t)(i % numClasses);
+    drawPoint(values, label, generator);
+    trainer.feedDenseData(values.data(), &label, 1);
+  }
+  trainer.finalizeData();
+
+  check(trainer.importanceUniformShare > (FP_TYPE)0.0, "uniform share has a default");
+  trainer.enableImportanceSampling((FP_TYPE)0.2);
+  trainer.train();
+
+  auto modelBytes = trainer.getModelSize();
+  auto model = new char[modelBytes];
+  auto meanStdBytes = trainer.getMeanStdSize();
+  auto meanStd = new char[meanStdBytes];
+  trainer.exportModel(modelBytes, model);
+  trainer.exportMeanStd(meanStdBytes, meanStd);
+
+  BonsaiPredictor predictor(modelBytes, model);
+  predictor.importMeanStd(meanStdBytes, meanStd);
+
+  const int numTest = 300;
+  int correct = 0;
+  std::vector<FP_TYPE> scores(numClasses);
+  for (int i = 0; i < numTest; ++i) {
+    const labelCount_t label = (labelCount_t)(i % numClasses);
+    drawPoint(values, label, generator);
+    predictor.scoreDenseDataPoint(scores.data(), values.data());
+    correct += (std::max_element(scores.begin(), scores.end()) - scores.begin()) == label;
+  }
+  const FP_TYPE accuracy = (FP_TYPE)correct / (FP_TYPE)numTest;
+  check(accuracy >= (FP_TYPE)0.9, "test accuracy with importance sampling " + std::to_string(accuracy));
+
+  // Draws from loss estimates that differ by up to 8x and are 0 for every fifth point.
+  // Each point has a value, and the weighted mean of the values over all draws
+  // must match their plain mean, as must the mean weight match 1. The values grow
+  // with the estimates, so that the unweighted mean of the draws is 17% too large.
+  const Eigen::Index n = trainer.data.Xtrain.cols();
+  LossEstimates estimates(n, 1.0);
+  std::vector<double> pointValue(n);
+  double meanValue = 0.0;
+  for (Eigen::Index j = 0; j < n; ++j) {
+    estimates.set(j, (double)(j % 5) * (1.0 + (double)(j % 2)));
+    pointValue[j] = 1.0 + (double)(j % 10);
+    meanValue += pointValue[j] / (double)n;
+  }
+
+  std::vector<Eigen::Index> indices(100);
+  // The training data is dense, so it is stored as MatrixXuf
+  check(trainer.data.isDense(trainSplit), "dense training data is stored dense");
+  MatrixXuf X;
+  LabelMatType Y;
+  std::vector<int> timesDrawn(n, 0);
+  double sumWeights = 0.0, sumWeightedValues = 0.0;
+  const int numDraws = 2000;
+  for (int d = 0; d < numDraws; ++d) {
+    sampleMinibatch(indices, X, Y, trainer, estimates, generator);
+    for (size_t b = 0; b < indices.size(); ++b) {
+      const double weight = trainer.treeCache.pointWeight(0, b);
+      sumWeights += weight;
+      sumWeightedValues += weight * pointValue[indices[b]];
+      ++timesDrawn[indices[b]];
+    }
+  }
+  const double numSamples = (double)numDraws * (double)indices.size();
+  check(std::abs(sumWeights / numSamples - 1.0) < 0.02,
+    "mean weight " + std::to_string(sumWeights / numSamples));
+  check(std::abs(sumWeightedValues / numSamples - meanValue) < 0.02 * meanValue,
+    "weighted mean " + std::to_string(sumWeightedValues / numSamples) + " vs " + std::to_string(meanValue));
+  // Point 9 has 8 times the loss estimate of point 6, and point 5 is only drawn uniformly
+  check(timesDrawn[9] > 3 * timesDrawn[6] && timesDrawn[6] > timesDrawn[5],
+    "points are drawn in proportion to their loss estimates");
+
+  // The minibatch holds the drawn columns of the training data
+  for (size_t b = 0; b < indices.size(); ++b)
+    for (Eigen::Index f = 0; f < X.rows(); ++f)
+      check(X(f, b) == trainer.data.trainData(f, indices[b]),
+        "column " + std::to_string(b) + " of the minibatch is point " + std::to_string(indices[b]));
+
+  // All estimates 0: uniform draws with weight 1
+  LossEstimates zeroEstimates(n, 0.0);
+  sampleMinibatch(indices, X, Y, trainer, zeroEstimates, generator);
+  for (size_t b = 0; b < indices.size(); ++b)
+    check(std::abs(trainer.treeCache.pointWeight(0, b) - (FP_TYPE)1.0) < (FP_TYPE)1e-5,
+      "weight of a uniform draw is 1");
+
+  delete[] model;
+  delete[] meanStd;
+
+  return testResult();
+}
@@ -0,0 +1,107 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Bonsai.h"
+#include "test_utils.h"
+
+#include <cstdio>
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+using namespace EdgeML::Bonsai;
+
+//
+// Trains Bonsai straight through, and again in two runs: one that stops after a snapshot
+// and one that resumes from it. The two models must be identical bit for bit, with plain
+// and with importance-sampled minibatches, and the same as with checkpoints that are never
+// resumed from. Returns non-zero on failure.
+//
+static const featureCount_t numFeatures = 8;
+static const labelCount_t numClasses = 3;
+static const std::string checkpointPath = "BonsaiResumeTest.checkpoint";
+
+static bool fileExists(const std::string& path)
+{
+  return std::ifstream(path).good();
+}
+
+//
+// Trains on fixed synthetic data and returns the exported model. With a non-empty
+// @checkpoint, snapshots every 7 batches and stops after @stopAfter batches if positive.
+//
+static std::vector<char> trainModel(
+  const bool isImportanceSampled,
+  const std::string& checkpoint,
+  const int stopAfter)
+{
+  BonsaiModel::BonsaiHyperParams hyperParams;
+  hyperParams.problemType = ProblemFormat::multiclass;
+  hyperParams.dataformatType = DataFormat::interfaceIngestFormat;
+  hyperParams.normalizationType = NormalizationFormat::none;
+  hyperParams.seed = 41;
+  hyperParams.iters = 20;
+  hyperParams.epochs = 1;
+  hyperParams.batchFactor = (FP_TYPE)1.0;
+  hyperParams.dataDimension = numFeatures;
+  hyperParams.projectionDimension = 5;
+  hyperParams.numClasses = numClasses;
+  hyperParams.Sigma = (FP_TYPE)1.0;
+  hyperParams.treeDepth = 2;
+  hyperParams.internalNodes = (1 << hyperParams.treeDepth) - 1;
+  hyperParams.totalNodes = 2 * hyperParams.internalNodes + 1;
+  hyperParams.regList.lW = (FP_TYPE)1.0e-4;
+  hyperParams.regList.lZ = (FP_TYPE)1.0e-5;
+  hyperParams.regList.lV = (FP_TYPE)1.0e-4;
+  hyperParams.regList.lTheta = (FP_TYPE)1.0e-4;
+  hyperParams.finalizeHyperParams();
+
+  BonsaiTrainer trainer(DataIngestType::InterfaceIngest, hyperParams);
+  std::mt19937_64 generator(42);
+  std::normal_distribution<FP_TYPE> noise((FP_TYPE)0.0, (FP_TYPE)1.0);
+  std::vector<FP_TYPE> values(numFeatures);
+  for (int i = 0; i < 600; ++i) {
+    const labelCount_t label = (labelCount_t)(i % numClasses);
+    for (featureCount_t f = 0; f < numFeatures; ++f)
+      values[f] = noise(generator) + (f % numClasses == label ? (FP_TYPE)4.0 : (FP_TYPE)0.0);
+    trainer.feedDenseData(values.data(), &label, 1);
+  }
+  trainer.finalizeData();
+
+  if (isImportanceSampled)
+    trainer.enableImportanceSampling((FP_TYPE)0.2);
+  if (!checkpoint.empty())
+    trainer.enableCheckpointing(checkpoint, 7, stopAfter);
+  trainer.train();
+
+  std::vector<char> model(trainer.getModelSize());
+  trainer.exportModel(model.size(), model.data());
+  return model;
+}
+
+static void checkResume(const bool isImportanceSampled)
+{
+  const std::string run = isImportanceSampled ? "importance-sampled run" : "plain run";
+  std::remove(checkpointPath.c_str());
+
+  const std::vector<char> straight = trainModel(isImportanceSampled, "", 0);
+
+  const std::vector<char> checkpointed = trainModel(isImportanceSampled, checkpointPath, 0);
+  check(checkpointed == straight, "checkpointing does not change the model of a " + run);
+  check(!fileExists(checkpointPath), "the checkpoint of a completed " + run + " is removed");
+
+  const std::vector<char> stopped = trainModel(isImportanceSampled, checkpointPath, 49);
+  check(fileExists(checkpointPath), "a stopped " + run + " keeps its checkpoint");
+  check(stopped != straight, "a stopped " + run + " ends early");
+
+  const std::vector<char> resumed = trainModel(isImportanceSampled, checkpointPath, 0);
+  check(resumed == straight, "a resumed " + run + " matches the uninterrupted one bit for bit");
+  check(!fileExists(checkpointPath), "the checkpoint of a resumed " + run + " is removed");
+}
+
+int main()
+{
+  checkResume(false);
+  checkResume(true);
+
+  return testResult();
+}
@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Cascade.h"
+#include "test_utils.h"
+
+#include <limits>
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+using namespace EdgeML::Ensemble;
+
+//
+// Calibrates cascade thresholds on hand-built stage scores: the first target accuracy
+// reached picks the smallest threshold, a threshold never splits points of equal margin,
+// and an unreachable target falls back to the most accurate threshold. Returns non-zero
+// on failure.
+//
+
+// A validation point of label 0: the margin of the first stage and whether each stage is right
+struct Point
+{
+  FP_TYPE margin;
+  bool isFirstCorrect, isSecondCorrect;
+};
+
+struct Validation
+{
+  MatrixXuf firstScores, secondScores;
+  SparseMatrixuf Y;
+};
+
+static Validation makeValidation(const std::vector<Point>& points)
+{
+  const Eigen::Index n = points.size();
+  Validation validation;
+  validation.firstScores = MatrixXuf::Zero(2, n);
+  validation.secondScores = MatrixXuf::Zero(2, n);
+  std::vector<Trip> triplets;
+  for (Eigen::Index j = 0; j < n; ++j) {
+    validation.firstScores(points[j].isFirstCorrect ? 0 : 1, j) = points[j].margin;
+    validation.secondScores(points[j].isSecondCorrect ? 0 : 1, j) = (FP_TYPE)1.0;
+    triplets.push_back(Trip(0, (sparseIndex_t)j, (FP_TYPE)1.0));
+  }
+  validation.Y = SparseMatrixuf(2, n);
+  validation.Y.setFromTriplets(triplets.begin(), triplets.end());
+  return validation;
+}
+
+// Number of points the cascade gets right at @threshold
+static int numCorrectAt(const std::vector<Point>& points, const FP_TYPE threshold)
+{
+  int numCorrect = 0;
+  for (size_t j = 0; j < points.size(); ++j)
+    numCorrect += points[j].margin < threshold ? points[j].isSecondCorrect : points[j].isFirstCorrect;
+  return numCorrect;
+}
+
+static void checkCalibration(
+  const std::vector<Point>& points,
+  const FP_TYPE targetAccuracy,
+  const FP_TYPE expectedThreshold,
+  const int expectedCorrect,
+  const std::string& what)
+{
+  const Validation validation = makeValidation(points);
+  const FP_TYPE threshold = CascadePredictor::calibrateOnScores(
+    validation.firstScores, validation.secondScores, validation.Y, targetAccuracy);
+  check(threshold == expectedThreshold,
+    what + ": threshold " + std::to_string(threshold) + ", expected " + std::to_string(expectedThreshold));
+  check(numCorrectAt(points, threshold) == expectedCorrect,
+    what + ": " + std::to_string(numCorrectAt(points, threshold)) + " points right, expected "
+    + std::to_string(expectedCorrect));
+}
+
+int main()
+{
+  // Escalating the first 2 points by margin would get 4 right, but they tie with
+  // the third, which the second stage gets wrong.
+  std::vector<Point> tied;
+  tied.push_back({ (FP_TYPE)2.0, true, true });
+  tied.push_back({ (FP_TYPE)0.5, false, true });
+  tied.push_back({ (FP_TYPE)0.1, false, true });
+  tied.push_back({ (FP_TYPE)1.0, false, true });
+  tied.push_back({ (FP_TYPE)0.5, true, false });
+
+  checkCalibration(tied, (FP_TYPE)0.4, (FP_TYPE)0.1, 2, "a target the first stage reaches escalates nothing");
+  checkCalibration(tied, (FP_TYPE)0.6, (FP_TYPE)0.5, 3, "the smallest threshold reaching the target");
+  checkCalibration(tied, (FP_TYPE)0.8, (FP_TYPE)2.0, 4, "a target reached only within a tie is reached past it");
+
+  // No threshold gets all 5 right; escalating the first 3 points by margin gets 3 right
+  std::vector<Point> unreachable;
+  unreachable.push_back({ (FP_TYPE)0.2, true, false });
+  unreachable.push_back({ (FP_TYPE)0.4, false, true });
+  unreachable.push_back({ (FP_TYPE)1.5, false, false });
+  unreachable.push_back({ (FP_TYPE)0.4, false, true });
+  unreachable.push_back({ (FP_TYPE)0.8, true, false });
+
+  checkCalibration(unreachable, (FP_TYPE)1.0, (FP_TYPE)0.8, 3, "an unreachable target falls back to the most accurate threshold");
+
+  // Only the second stage gets the points right, so every point is escalated
+  std::vector<Point> secondOnly;
+  secondOnly.push_back({ (FP_TYPE)1.0, false, true });
+  secondOnly.push_back({ (FP_TYPE)3.0, false, true });
+
+  checkCalibration(secondOnly, (FP_TYPE)1.0, std::numeric_limits<FP_TYPE>::max(), 2, "a target reached by escalating all points");
+
+  return testResult();
+}
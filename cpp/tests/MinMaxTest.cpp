@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "Data.h"
+#include "test_utils.h"
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+
+//
+// Min-max normalization of sparse data counts the zeros a file stores explicitly (e.g. -0.0
+// in libsvm input) like any other value, while data stored dense normalizes exactly like its
+// sparse view, whose zeros are absent. Returns non-zero on failure.
+//
+static bool near(const FP_TYPE a, const FP_TYPE b)
+{
+  return std::abs(a - b) < (FP_TYPE)1e-6;
+}
+
+int main()
+{
+  // Features are rows and points are columns. Feature 0 stores -0.0 for point 0 and
+  // feature 1 stores 0 for point 1; feature 2 is non-zero for point 1 only.
+  std::vector<Trip> triplets;
+  triplets.push_back(Trip(0, 0, (FP_TYPE)-0.0));
+  triplets.push_back(Trip(0, 1, (FP_TYPE)2.0));
+  triplets.push_back(Trip(0, 2, (FP_TYPE)3.0));
+  triplets.push_back(Trip(1, 0, (FP_TYPE)-1.0));
+  triplets.push_back(Trip(1, 1, (FP_TYPE)0.0));
+  triplets.push_back(Trip(1, 2, (FP_TYPE)1.0));
+  triplets.push_back(Trip(2, 1, (FP_TYPE)5.0));
+  SparseMatrixuf X(3, 3);
+  X.setFromTriplets(triplets.begin(), triplets.end());
+  check(X.nonZeros() == 7, "stored zeros are kept by setFromTriplets");
+
+  MatrixXuf min, max;
+  computeMinMax(X, min, max);
+  check(near(min(0, 0), 0) && near(max(0, 0), 3), "stored -0.0 is the minimum of feature 0");
+  check(near(min(1, 0), -1) && near(max(1, 0), 1), "range of feature 1");
+  check(near(min(2, 0), 0) && near(max(2, 0), 5), "constant feature 2 is scaled from 0");
+
+  minMaxNormalize(X, min, max);
+  check(near(X.coeff(0, 1), (FP_TYPE)2.0 / 3) && near(X.coeff(0, 2), 1), "normalized feature 0");
+  check(near(X.coeff(1, 0), 0) && near(X.coeff(1, 2), 1), "normalized feature 1");
+  check(near(X.coeff(1, 1), (FP_TYPE)0.5), "stored zero of feature 1 is normalized");
+  check(near(X.coeff(2, 1), 1), "normalized feature 2");
+
+  // A dense matrix with the same entries normalizes like its sparse view
+  MatrixXuf XDense(3, 3);
+  XDense << 0, 2, 3,
+    -1, 0, 1,
+    0, 5, 0;
+  SparseMatrixuf XView = XDense.sparseView();
+
+  MatrixXuf minDense, maxDense, minView, maxView;
+  computeMinMax(XDense, minDense, maxDense);
+  computeMinMax(XView, minView, maxView);
+  for (Eigen::Index f = 0; f < 3; ++f)
+    check(near(minDense(f, 0), minView(f, 0)) && near(maxDense(f, 0), maxView(f, 0)),
+      "range of feature " + std::to_string(f) + " of dense data matches its sparse view");
+
+  minMaxNormalize(XDense, minDense, maxDense);
+  minMaxNormalize(XView, minView, maxView);
+  for (Eigen::Index f = 0; f < 3; ++f)
+    for (Eigen::Index p = 0; p < 3; ++p)
+      check(near(XDense(f, p), XView.coeff(f, p)),
+        "normalized entry (" + std::to_string(f) + ", " + std::to_string(p)
+        + ") of dense data matches its sparse view");
+
+  return testResult();
+}
@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "quantized.h"
+#include "test_utils.h"
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+
+//
+// Checks the int8 dot-product kernel selected at compile time (see SIMD_FLAGS in config.mk)
+// against the scalar one, including the extreme inputs the SIMD kernels' sign handling and
+// int16 pair sums have to get right, and a quantized matrix-vector product against the
+// floating-point one. Returns non-zero on failure.
+//
+static void checkDot(const std::vector<int8_t>& a, const std::vector<int8_t>& b, const std::string& what)
+{
+  const int32_t expected = dotInt8Scalar(a.data(), b.data(), (Eigen::Index)a.size());
+  const int32_t actual = dotInt8(a.data(), b.data(), (Eigen::Index)a.size());
+  check(actual == expected, what + ": " + std::to_string(actual) + " != " + std::to_string(expected));
+}
+
+int main()
+{
+  std::cout << "int8 kernel: " << int8KernelName() << std::endl;
+
+  std::mt19937_64 generator(42);
+  std::uniform_int_distribution<int> entry(-127, 127);
+
+  for (Eigen::Index n = int8Block; n <= 16 * int8Block; n += int8Block) {
+    std::vector<int8_t> a(n), b(n);
+    for (Eigen::Index i = 0; i < n; ++i) {
+      a[i] = (int8_t)entry(generator);
+      b[i] = (int8_t)entry(generator);
+    }
+    checkDot(a, b, "random vectors of length " + std::to_string(n));
+
+    const int8_t extremes[] = { -127, 127 };
+    for (const int8_t x : extremes)
+      for (const int8_t y : extremes) {
+        std::fill(a.begin(), a.end(), x);
+        std::fill(b.begin(), b.end(), y);
+        checkDot(a, b, "constant " + std::to_string(x) + " and " + std::to_string(y)
+          + " of length " + std::to_string(n));
+      }
+
+    for (Eigen::Index i = 0; i < n; ++i) {
+      a[i] = (int8_t)(i % 2 == 0 ? 127 : -127);
+      b[i] = (int8_t)(i % 3 == 0 ? -127 : 127);
+    }
+    checkDot(a, b, "alternating signs of length " + std::to_string(n));
+
+    std::fill(a.begin(), a.end(), 0);
+    checkDot(a, b, "zero vector of length " + std::to_string(n));
+  }
+
+  // A quantized product stays within the rounding error of the floating-point one: entries
+  // in [-1, 1] are rounded to within half a step of 1/127
+  const Eigen::Index rows = 10, cols = 100;
+  std::uniform_real_distribution<FP_TYPE> value((FP_TYPE)-1.0, (FP_TYPE)1.0);
+  MatrixXuf A(rows, cols);
+  std::vector<FP_TYPE> x(cols);
+  for (Eigen::Index j = 0; j < cols; ++j) {
+    x[j] = value(generator);
+    for (Eigen::Index i = 0; i < rows; ++i)
+      A(i, j) = value(generator);
+  }
+
+  QuantizedMatrix Aq;
+  Aq.quantize(A);
+  std::vector<int8_t> xq(int8PaddedLength(cols), (int8_t)1);
+  const FP_TYPE xScale = quantizeVector(x.data(), cols, xq.data());
+  for (size_t i = cols; i < xq.size(); ++i)
+    check(xq[i] == 0, "padding of the quantized vector is zeroed");
+
+  std::vector<FP_TYPE> out(rows);
+  Aq.gemv(out.data(), xq.data(), xScale);
+  for (Eigen::Index i = 0; i < rows; ++i) {
+    FP_TYPE expected = 0, bound = (FP_TYPE)1e-3;
+    for (Eigen::Index j = 0; j < cols; ++j) {
+      expected += A(i, j) * x[j];
+      bound += (std::abs(A(i, j)) + std::abs(x[j]) + (FP_TYPE)(0.5 / 127.0)) * (FP_TYPE)(0.5 / 127.0);
+    }
+    check(std::abs(out[i] - expected) <= bound,
+      "row " + std::to_string(i) + " of the quantized product: "
+      + std::to_string(out[i]) + " vs " + std::to_string(expected));
+  }
+
+  return testResult();
+}
@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "small_gemv.h"
+#include "test_utils.h"
+
+using namespace EdgeML;
+using namespace EdgeML::Test;
+
+//
+// Checks smallGemv and both smallGemvRows overloads against a plain loop, for blocks that
+// take the fixed-size kernels and blocks that fall back to gemv, and for sparse matrices in
+// compressed and uncompressed storage. Returns non-zero on failure.
+//
+// alpha*op(A(rowBegin:rowBegin+numRows, :))*x + beta*y
+static std::vector<FP_TYPE> reference(
+  const MatrixXuf& A,
+  const Eigen::Index rowBegin,
+  const Eigen::Index numRows,
+  const CBLAS_TRANSPOSE tA,
+  const std::vector<FP_TYPE>& x,
+  const FP_TYPE alpha,
+  const FP_TYPE beta,
+  const std::vector<FP_TYPE>& y)
+{
+  std::vector<FP_TYPE> out(y.size());
+  for (size_t i = 0; i < out.size(); ++i) {
+    FP_TYPE sum = 0;
+    if (tA == CblasNoTrans)
+      for (Eigen::Index j = 0; j < A.cols(); ++j)
+        sum += A(rowBegin + i, j) * x[j];
+    else
+      for (Eigen::Index r = 0; r < numRows; ++r)
+        sum += A(rowBegin + r, i) * x[r];
+    out[i] = alpha * sum + beta * y[i];
+  }
+  return out;
+}
+
+static void checkClose(const std::vector<FP_TYPE>& actual, const std::vector<FP_TYPE>& expected, const std::string& what)
+{
+  FP_TYPE maxError = 0;
+  for (size_t i = 0; i < expected.size(); ++i)
+    maxError = std::max(maxError, std::abs(actual[i] - expected[i]));
+  check(maxError < (FP_TYPE)1e-4, what + ", max error " + std::to_string(maxError));
+}
+
+int main()
+{
+  std::mt19937_64 generator(42);
+  std::uniform_real_distribution<FP_TYPE> value((FP_TYPE)-1.0, (FP_TYPE)1.0);
+  std::uniform_real_distribution<FP_TYPE> unit((FP_TYPE)0.0, (FP_TYPE)1.0);
+
+  const Eigen::Index shapes[][2] = { { 1, 1 }, { 15, 10 }, { 16, 16 }, { 7, 3 }, { 40, 10 }, { 15, 33 } };
+  for (const auto& shape : shapes) {
+    // A block of numRows rows in the middle of a taller matrix
+    const Eigen::Index numRows = shape[0], cols = shape[1], rowBegin = 5;
+    MatrixXuf A = MatrixXuf::Zero(rowBegin + numRows + 3, cols);
+    for (Eigen::Index i = 0; i < A.rows(); ++i)
+      for (Eigen::Index j = 0; j < cols; ++j)
+        if (unit(generator) < (FP_TYPE)0.5)
+          A(i, j) = value(generator);
+    SparseMatrixuf ASparse = A.sparseView();
+    SparseMatrixuf AUncompressed = ASparse;
+    AUncompressed.uncompress();
+
+    for (const CBLAS_TRANSPOSE tA : { CblasNoTrans, CblasTrans }) {
+      const Eigen::Index inLength = tA == CblasNoTrans ? cols : numRows;
+      const Eigen::Index outLength = tA == CblasNoTrans ? numRows : cols;
+      std::vector<FP_TYPE> x(inLength), y(outLength);
+      for (auto& v : x) v = value(generator);
+      for (auto& v : y) v = value(generator);
+
+      const std::string name = std::to_string(numRows) + "x" + std::to_string(cols)
+        + (tA == CblasNoTrans ? "" : " transposed");
+      for (const FP_TYPE beta : { (FP_TYPE)0.0, (FP_TYPE)0.5 }) {
+        const std::vector<FP_TYPE> expected = reference(A, rowBegin, numRows, tA, x, (FP_TYPE)2.0, beta, y);
+        const std::string suffix = ", beta " + std::to_string(beta);
+
+        std::vector<FP_TYPE> out(y);
+        smallGemvRows(out.data(), A, rowBegin, numRows, tA, x.data(), (FP_TYPE)2.0, beta);
+        checkClose(out, expected, "dense rows of " + name + suffix);
+
+        out = y;
+        smallGemvRows(out.data(), ASparse, rowBegin, numRows, tA, x.data(), (FP_TYPE)2.0, beta);
+        checkClose(out, expected, "sparse rows of " + name + suffix);
+
+        out = y;
+        smallGemvRows(out.data(), AUncompressed, rowBegin, numRows, tA, x.data(), (FP_TYPE)2.0, beta);
+        checkClose(out, expected, "uncompressed sparse rows of " + name + suffix);
+
+        if (!A.IsRowMajor) {
+          const MatrixXuf block = A.middleRows(rowBegin, numRows);
+          out = y;
+          smallGemv(tA, numRows, cols, (FP_TYPE)2.0, block.data(), block.rows(), x.data(), beta, out.data());
+          checkClose(out, expected, "smallGemv of " + name + suffix);
+        }
+      }
+    }
+  }
+
+  return testResult();
+}
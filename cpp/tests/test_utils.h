@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef __TEST_UTILS_H__
+#define __TEST_UTILS_H__
+
+#include <iostream>
+#include <string>
+
+namespace EdgeML
+{
+  namespace Test
+  {
+    // Number of failed checks of the test program
+    inline int& failures()
+    {
+      static int count = 0;
+      return count;
+    }
+
+    // Reports @what on stderr and counts a failure unless @condition holds
+    inline void check(const bool condition, const std::string& what)
+    {
+      if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures();
+      }
+    }
+
+    // Prints "Passed." if no check failed; the exit code of the test program
+    inline int testResult()
+    {
+      if (failures() == 0)
+        std::cout << "Passed." << std::endl;
+      return failures() == 0 ? 0 : 1;
+    }
+  }
+}
+
+#endif
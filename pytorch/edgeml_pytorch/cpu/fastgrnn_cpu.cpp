@@ -0,0 +1,459 @@
+#include <torch/extension.h>
+#include <ATen/Parallel.h>
+
+#include <cmath>
+#include <vector>
+
+// CPU counterpart of fastgrnn_cuda: same entry points and return values.
+// Each time step is one GEMM for U plus one fused elementwise pass over the
+// batch; the input projection (and its gradients) are hoisted out of the time
+// loop in the unrolled variants.
+
+namespace {
+template <typename scalar_t>
+inline scalar_t sigmoid(scalar_t z) {
+  return 1.0 / (1.0 + std::exp(-z));
+}
+
+template <typename scalar_t>
+inline scalar_t relu(scalar_t z) {
+  return z > 0 ? z : 0;
+}
+
+template <typename scalar_t>
+inline scalar_t tanh(scalar_t z) {
+  return std::tanh(z);
+}
+
+template <typename scalar_t>
+inline scalar_t d_sigmoid(scalar_t sig_z) {
+  return (1.0 - sig_z) * sig_z;
+}
+
+template <typename scalar_t>
+inline scalar_t d_relu(scalar_t relu_z) {
+  return (relu_z == 0)? 0: 1;
+}
+
+template <typename scalar_t>
+inline scalar_t d_tanh(scalar_t tan_z) {
+  return 1.0 - (tan_z * tan_z);
+}
+
+inline int64_t grain_size(int64_t state_size) {
+  return std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(1, state_size));
+}
+
+// All buffers are contiguous [batch_size, state_size]; bias_* are [1, state_size]
+template <typename scalar_t, scalar_t (*non_linearity) (scalar_t)>
+void fastgrnn_cpu_forward_kernel(
+  scalar_t* new_h,
+  scalar_t* z,
+  scalar_t* h_prime,
+  const scalar_t* pre_comp,
+  const scalar_t* bias_z,
+  const scalar_t* bias_h_prime,
+  const scalar_t nu,
+  const scalar_t zeta,
+  const scalar_t* old_h,
+  const int64_t batch_size,
+  const int64_t state_size) {
+  at::parallel_for(0, batch_size, grain_size(state_size), [&](int64_t begin, int64_t end) {
+    for (int64_t n = begin; n < end; n++) {
+      const int64_t row = n * state_size;
+      for (int64_t c = 0; c < state_size; c++) {
+        const scalar_t z_nc = non_linearity(pre_comp[row + c] + bias_z[c]);
+        const scalar_t h_prime_nc = std::tanh(pre_comp[row + c] + bias_h_prime[c]);
+        z[row + c] = z_nc;
+        h_prime[row + c] = h_prime_nc;
+        new_h[row + c] = (zeta * (1.0 - z_nc) + nu) * h_prime_nc + old_h[row + c] * z_nc;
+      }
+    }
+  });
+}
+
+// Adds grad_h to the gradient carried in d_old_h, then overwrites d_old_h with
+// its elementwise part (the U term is added by the caller). The bias, zeta and
+// nu gradients are accumulated per element and reduced once at the end.
+template <typename scalar_t, scalar_t (*d_non_linearity) (scalar_t)>
+void fastgrnn_cpu_backward_kernel(
+  scalar_t* d_precomp,
+  scalar_t* d_old_h,
+  scalar_t* d_bias_z,
+  scalar_t* d_bias_h_prime,
+  scalar_t* d_nu,
+  scalar_t* d_zeta,
+  const scalar_t* grad_h,
+  const scalar_t* z,
+  const scalar_t* h_prime,
+  const scalar_t zeta,
+  const scalar_t nu,
+  const scalar_t d_zeta_sigmoid,
+  const scalar_t d_nu_sigmoid,
+  const scalar_t* old_h,
+  const int64_t batch_size,
+  const int64_t state_size) {
+  at::parallel_for(0, batch_size, grain_size(state_size), [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin * state_size; i < end * state_size; i++) {
+      const scalar_t grad = grad_h[i] + d_old_h[i];
+      const scalar_t temp_bias_h_prime = (zeta * (1.0 - z[i]) + nu) * d_tanh(h_prime[i]) * grad;
+      const scalar_t temp_bias_z = (old_h[i] - zeta * h_prime[i]) * d_non_linearity(z[i]) * grad;
+      d_old_h[i] = z[i] * grad;
+      d_bias_h_prime[i] += temp_bias_h_prime;
+      d_bias_z[i] += temp_bias_z;
+      d_precomp[i] = temp_bias_z + temp_bias_h_prime;
+      d_zeta[i] += (1.0 - z[i]) * h_prime[i] * grad * d_zeta_sigmoid;
+      d_nu[i] += h_prime[i] * grad * d_nu_sigmoid;
+    }
+  });
+}
+
+template <typename scalar_t>
+void fastgrnn_cpu_forward_step(
+  torch::Tensor new_h,
+  torch::Tensor z,
+  torch::Tensor h_prime,
+  torch::Tensor pre_comp,
+  torch::Tensor bias_z,
+  torch::Tensor bias_h_prime,
+  const scalar_t nu,
+  const scalar_t zeta,
+  torch::Tensor old_h,
+  int z_non_linearity) {
+  const auto batch_size = old_h.size(0);
+  const auto state_size = old_h.size(1);
+  if (z_non_linearity == 0) {
+    fastgrnn_cpu_forward_kernel<scalar_t, sigmoid>(
+      new_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      pre_comp.data<scalar_t>(), bias_z.data<scalar_t>(), bias_h_prime.data<scalar_t>(),
+      nu, zeta, old_h.data<scalar_t>(), batch_size, state_size);
+  } else if (z_non_linearity == 1) {
+    fastgrnn_cpu_forward_kernel<scalar_t, relu>(
+      new_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      pre_comp.data<scalar_t>(), bias_z.data<scalar_t>(), bias_h_prime.data<scalar_t>(),
+      nu, zeta, old_h.data<scalar_t>(), batch_size, state_size);
+  } else if (z_non_linearity == 2) {
+    fastgrnn_cpu_forward_kernel<scalar_t, tanh>(
+      new_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      pre_comp.data<scalar_t>(), bias_z.data<scalar_t>(), bias_h_prime.data<scalar_t>(),
+      nu, zeta, old_h.data<scalar_t>(), batch_size, state_size);
+  }
+}
+
+template <typename scalar_t>
+void fastgrnn_cpu_backward_step(
+  torch::Tensor d_precomp,
+  torch::Tensor d_old_h,
+  torch::Tensor d_bias_z,
+  torch::Tensor d_bias_h_prime,
+  torch::Tensor d_nu,
+  torch::Tensor d_zeta,
+  torch::Tensor grad_h,
+  torch::Tensor z,
+  torch::Tensor h_prime,
+  const scalar_t zeta,
+  const scalar_t nu,
+  const scalar_t d_zeta_sigmoid,
+  const scalar_t d_nu_sigmoid,
+  torch::Tensor old_h,
+  int z_non_linearity) {
+  const auto batch_size = old_h.size(0);
+  const auto state_size = old_h.size(1);
+  if (z_non_linearity == 0) {
+    fastgrnn_cpu_backward_kernel<scalar_t, d_sigmoid>(
+      d_precomp.data<scalar_t>(), d_old_h.data<scalar_t>(), d_bias_z.data<scalar_t>(),
+      d_bias_h_prime.data<scalar_t>(), d_nu.data<scalar_t>(), d_zeta.data<scalar_t>(),
+      grad_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      zeta, nu, d_zeta_sigmoid, d_nu_sigmoid, old_h.data<scalar_t>(), batch_size, state_size);
+  } else if (z_non_linearity == 1) {
+    fastgrnn_cpu_backward_kernel<scalar_t, d_relu>(
+      d_precomp.data<scalar_t>(), d_old_h.data<scalar_t>(), d_bias_z.data<scalar_t>(),
+      d_bias_h_prime.data<scalar_t>(), d_nu.data<scalar_t>(), d_zeta.data<scalar_t>(),
+      grad_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      zeta, nu, d_zeta_sigmoid, d_nu_sigmoid, old_h.data<scalar_t>(), batch_size, state_size);
+  } else if (z_non_linearity == 2) {
+    fastgrnn_cpu_backward_kernel<scalar_t, d_tanh>(
+      d_precomp.data<scalar_t>(), d_old_h.data<scalar_t>(), d_bias_z.data<scalar_t>(),
+      d_bias_h_prime.data<scalar_t>(), d_nu.data<scalar_t>(), d_zeta.data<scalar_t>(),
+      grad_h.data<scalar_t>(), z.data<scalar_t>(), h_prime.data<scalar_t>(),
+      zeta, nu, d_zeta_sigmoid, d_nu_sigmoid, old_h.data<scalar_t>(), batch_size, state_size);
+  }
+}
+
+// Splits the full-rank gradients onto the low-rank factors, as fastgrnn_cuda does
+void low_rank_gradients(
+  torch::Tensor& d_w,
+  torch::Tensor& d_u,
+  torch::Tensor& d_w1,
+  torch::Tensor& d_w2,
+  torch::Tensor& d_u1,
+  torch::Tensor& d_u2,
+  torch::Tensor w1,
+  torch::Tensor w2,
+  torch::Tensor u1,
+  torch::Tensor u2) {
+  if (w1.size(0) != 0) {
+    d_w1 = torch::mm(w2.transpose(0, 1), d_w);
+    d_w2 = torch::mm(d_w, w1.transpose(0, 1));
+    d_w = torch::empty(0);
+  }
+  if (u1.size(0) != 0) {
+    d_u1 = torch::mm(u2.transpose(0, 1), d_u);
+    d_u2 = torch::mm(d_u, u1.transpose(0, 1));
+    d_u = torch::empty(0);
+  }
+}
+} // namespace
+
+#define CHECK_CPU(x) AT_ASSERTM(!x.is_cuda(), #x " must be a CPU tensor")
+#define CHECK_CONTIGUOUS(x) AT_ASSERTM(x.is_contiguous(), #x " must be contiguous")
+#define CHECK_INPUT(x) CHECK_CPU(x); CHECK_CONTIGUOUS(x)
+
+#define CHECK_WEIGHTS(w, u, w1, w2, u1, u2) \
+  if (w1.size(0) == 0) { CHECK_INPUT(w); } else { CHECK_INPUT(w1); CHECK_INPUT(w2); } \
+  if (u1.size(0) == 0) { CHECK_INPUT(u); } else { CHECK_INPUT(u1); CHECK_INPUT(u2); }
+
+std::vector<torch::Tensor> fastgrnn_forward(
+  torch::Tensor input,
+  torch::Tensor w,
+  torch::Tensor u,
+  torch::Tensor bias_gate,
+  torch::Tensor bias_update,
+  torch::Tensor zeta,
+  torch::Tensor nu,
+  torch::Tensor old_h,
+  int z_non_linearity,
+  torch::Tensor w1,
+  torch::Tensor w2,
+  torch::Tensor u1,
+  torch::Tensor u2) {
+  CHECK_INPUT(input);
+  CHECK_WEIGHTS(w, u, w1, w2, u1, u2);
+  CHECK_INPUT(bias_gate);
+  CHECK_INPUT(bias_update);
+  CHECK_INPUT(zeta);
+  CHECK_INPUT(nu);
+  CHECK_INPUT(old_h);
+
+  if (w1.size(0) != 0) {
+    w = torch::mm(w2, w1);
+  }
+  if (u1.size(0) != 0) {
+    u = torch::mm(u2, u1);
+  }
+
+  auto pre_comp = torch::addmm(torch::mm(input, w.transpose(0, 1)), old_h, u.transpose(0, 1));
+  auto new_h = torch::empty_like(old_h);
+  auto z = torch::empty_like(old_h);
+  auto h_prime = torch::empty_like(old_h);
+
+  AT_DISPATCH_FLOATING_TYPES(pre_comp.scalar_type(), "fastgrnn_forward_cpu", ([&] {
+    fastgrnn_cpu_forward_step<scalar_t>(new_h, z, h_prime, pre_comp, bias_gate, bias_update,
+      torch::sigmoid(nu).item<scalar_t>(), torch::sigmoid(zeta).item<scalar_t>(),
+      old_h, z_non_linearity);
+  }));
+  return {new_h, z, h_prime};
+}
+
+std::vector<torch::Tensor> fastgrnn_backward(
+  torch::Tensor grad_h,
+  torch::Tensor input,
+  torch::Tensor old_h,
+  torch::Tensor zeta,
+  torch::Tensor nu,
+  torch::Tensor w,
+  torch::Tensor u,
+  torch::Tensor z,
+  torch::Tensor h_prime,
+  torch::Tensor w1,
+  torch::Tensor w2,
+  torch::Tensor u1,
+  torch::Tensor u2,
+  int z_non_linearity) {
+  CHECK_INPUT(grad_h);
+  CHECK_INPUT(input);
+  CHECK_INPUT(old_h);
+  CHECK_INPUT(zeta);
+  CHECK_INPUT(nu);
+  CHECK_INPUT(z);
+  CHECK_INPUT(h_prime);
+  CHECK_WEIGHTS(w, u, w1, w2, u1, u2);
+
+  auto d_precomp = torch::empty_like(old_h);
+  auto d_old_h = torch::zeros_like(old_h);
+  auto d_bias_z = torch::zeros_like(old_h);
+  auto d_bias_h_prime = torch::zeros_like(old_h);
+  auto d_nu = torch::zeros_like(old_h);
+  auto d_zeta = torch::zeros_like(old_h);
+  auto d_w1 = torch::empty(0);
+  auto d_w2 = torch::empty(0);
+  auto d_u1 = torch::empty(0);
+  auto d_u2 = torch::empty(0);
+
+  if (w1.size(0) != 0) {
+    w = torch::mm(w2, w1);
+  }
+  if (u1.size(0) != 0) {
+    u = torch::mm(u2, u1);
+  }
+  zeta = torch::sigmoid(zeta);
+  nu = torch::sigmoid(nu);
+
+  AT_DISPATCH_FLOATING_TYPES(old_h.scalar_type(), "fastgrnn_backward_cpu", ([&] {
+    const scalar_t zeta_ = zeta.item<scalar_t>();
+    const scalar_t nu_ = nu.item<scalar_t>();
+    fastgrnn_cpu_backward_step<scalar_t>(d_precomp, d_old_h, d_bias_z, d_bias_h_prime, d_nu, d_zeta,
+      grad_h, z, h_prime, zeta_, nu_, d_sigmoid(zeta_), d_sigmoid(nu_), old_h, z_non_linearity);
+  }));
+
+  d_old_h.addmm_(d_precomp, u);
+  auto d_input = torch::mm(d_precomp, w);
+  auto d_w = torch::mm(d_precomp.transpose(0, 1), input);
+  auto d_u = torch::mm(d_precomp.transpose(0, 1), old_h);
+  d_bias_z = d_bias_z.sum(0, true);
+  d_bias_h_prime = d_bias_h_prime.sum(0, true);
+  d_zeta = d_zeta.sum().view({1, 1});
+  d_nu = d_nu.sum().view({1, 1});
+  low_rank_gradients(d_w, d_u, d_w1, d_w2, d_u1, d_u2, w1, w2, u1, u2);
+  return {d_input, d_bias_z, d_bias_h_prime, d_zeta, d_nu, d_old_h, d_w, d_u, d_w1, d_w2, d_u1, d_u2};
+}
+
+std::vector<torch::Tensor> fastgrnn_unroll_forward(
+  torch::Tensor input,
+  torch::Tensor w,
+  torch::Tensor u,
+  torch::Tensor bias_z,
+  torch::Tensor bias_h_prime,
+  torch::Tensor zeta,
+  torch::Tensor nu,
+  torch::Tensor initial_h,
+  int z_non_linearity,
+  torch::Tensor w1,
+  torch::Tensor w2,
+  torch::Tensor u1,
+  torch::Tensor u2) {
+  CHECK_INPUT(input);
+  CHECK_WEIGHTS(w, u, w1, w2, u1, u2);
+  CHECK_INPUT(bias_z);
+  CHECK_INPUT(bias_h_prime);
+  CHECK_INPUT(initial_h);
+  CHECK_INPUT(zeta);
+  CHECK_INPUT(nu);
+
+  const auto timesteps = input.size(0);
+  const auto batch_size = initial_h.size(0);
+  const auto state_size = initial_h.size(1);
+
+  if (w1.size(0) != 0) {
+    w = torch::mm(w2, w1);
+  }
+  if (u1.size(0) != 0) {
+    u = torch::mm(u2, u1);
+  }
+  auto u_t = u.transpose(0, 1).contiguous();
+
+  // W x_t for all time steps in one GEMM
+  auto w_comp = torch::mm(input.reshape({timesteps * batch_size, input.size(2)}), w.transpose(0, 1))
+    .view({timesteps, batch_size, state_size});
+
+  auto hidden_states = torch::empty({timesteps, batch_size, state_size}, initial_h.options());
+  auto z_s = torch::empty_like(hidden_states);
+  auto h_prime_s = torch::empty_like(hidden_states);
+
+  AT_DISPATCH_FLOATING_TYPES(input.scalar_type(), "fastgrnn_unroll_forward_cpu", ([&] {
+    const scalar_t zeta_ = torch::sigmoid(zeta).item<scalar_t>();
+    const scalar_t nu_ = torch::sigmoid(nu).item<scalar_t>();
+    auto prev_h = initial_h;
+    for (int64_t t = 0; t < timesteps; t++) {
+      auto pre_comp = torch::addmm(w_comp[t], prev_h, u_t);
+      fastgrnn_cpu_forward_step<scalar_t>(hidden_states[t], z_s[t], h_prime_s[t], pre_comp,
+        bias_z, bias_h_prime, nu_, zeta_, prev_h, z_non_linearity);
+      prev_h = hidden_states[t];
+    }
+  }));
+  return {hidden_states, z_s, h_prime_s};
+}
+
+std::vector<torch::Tensor> fastgrnn_unroll_backward(
+  torch::Tensor grad_h,
+  torch::Tensor input,
+  torch::Tensor hidden_states,
+  torch::Tensor zeta,
+  torch::Tensor nu,
+  torch::Tensor w,
+  torch::Tensor u,
+  torch::Tensor z,
+  torch::Tensor h_prime,
+  torch::Tensor initial_h,
+  torch::Tensor w1,
+  torch::Tensor w2,
+  torch::Tensor u1,
+  torch::Tensor u2,
+  int z_non_linearity) {
+  CHECK_INPUT(grad_h);
+  CHECK_INPUT(input);
+  CHECK_INPUT(hidden_states);
+  CHECK_INPUT(z);
+  CHECK_INPUT(h_prime);
+  CHECK_WEIGHTS(w, u, w1, w2, u1, u2);
+  CHECK_INPUT(zeta);
+  CHECK_INPUT(nu);
+  CHECK_INPUT(initial_h);
+
+  const auto timesteps = hidden_states.size(0);
+  const auto batch_size = hidden_states.size(1);
+  const auto state_size = hidden_states.size(2);
+
+  auto d_precomp = torch::empty_like(hidden_states);
+  auto d_old_h = torch::zeros_like(initial_h);
+  auto d_bias_z = torch::zeros_like(initial_h);
+  auto d_bias_h_prime = torch::zeros_like(initial_h);
+  auto d_nu = torch::zeros_like(initial_h);
+  auto d_zeta = torch::zeros_like(initial_h);
+  auto d_w1 = torch::empty(0);
+  auto d_w2 = torch::empty(0);
+  auto d_u1 = torch::empty(0);
+  auto d_u2 = torch::empty(0);
+
+  if (w1.size(0) != 0) {
+    w = torch::mm(w2, w1);
+  }
+  if (u1.size(0) != 0) {
+    u = torch::mm(u2, u1);
+  }
+  zeta = torch::sigmoid(zeta);
+  nu = torch::sigmoid(nu);
+
+  // Only the recurrence through U stays in the time loop
+  AT_DISPATCH_FLOATING_TYPES(hidden_states.scalar_type(), "fastgrnn_unroll_backward_cpu", ([&] {
+    const scalar_t zeta_ = zeta.item<scalar_t>();
+    const scalar_t nu_ = nu.item<scalar_t>();
+    for (int64_t t = timesteps - 1; t >= 0; t--) {
+      auto prev_h = (t == 0) ? initial_h : hidden_states[t - 1];
+      fastgrnn_cpu_backward_step<scalar_t>(d_precomp[t], d_old_h, d_bias_z, d_bias_h_prime, d_nu, d_zeta,
+        grad_h[t], z[t], h_prime[t], zeta_, nu_, d_sigmoid(zeta_), d_sigmoid(nu_), prev_h, z_non_linearity);
+      d_old_h.addmm_(d_precomp[t], u);
+    }
+  }));
+
+  auto d_precomp_all = d_precomp.view({timesteps * batch_size, state_size});
+  auto prev_h_all = torch::cat({initial_h.unsqueeze(0), hidden_states.narrow(0, 0, timesteps - 1)})
+    .view({timesteps * batch_size, state_size});
+  auto d_input = torch::mm(d_precomp_all, w).view_as(input);
+  auto d_w = torch::mm(d_precomp_all.transpose(0, 1), input.reshape({timesteps * batch_size, input.size(2)}));
+  auto d_u = torch::mm(d_precomp_all.transpose(0, 1), prev_h_all);
+  d_bias_z = d_bias_z.sum(0, true);
+  d_bias_h_prime = d_bias_h_prime.sum(0, true);
+  d_zeta = d_zeta.sum().view({1, 1});
+  d_nu = d_nu.sum().view({1, 1});
+  low_rank_gradients(d_w, d_u, d_w1, d_w2, d_u1, d_u2, w1, w2, u1, u2);
+  return {d_input, d_bias_z, d_bias_h_prime, d_zeta, d_nu, d_old_h, d_w, d_u, d_w1, d_w2, d_u1, d_u2};
+}
+
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
+  m.def("forward", &fastgrnn_forward, "FastGRNN forward (CPU)");
+  m.def("backward", &fastgrnn_backward, "FastGRNN backward (CPU)");
+  m.def("forward_unroll", &fastgrnn_unroll_forward, "FastGRNN Unrolled forward (CPU)");
+  m.def("backward_unroll", &fastgrnn_unroll_backward, "FastGRNN Unrolled backward (CPU)");
+}
@@ -12,6 +12,24 @@ import edgeml_pytorch.utils as utils
 if utils.findCUDA() is not None:
     import fastgrnn_cuda
 
+try:
+    import fastgrnn_cpu
+except ImportError:
+    fastgrnn_cpu = None
+
+
+def fastgrnn_device():
+    '''Device for FastGRNNCUDACell/FastGRNNCUDA: CUDA if present, else the CPU extension.'''
+    if utils.findCUDA() is not None:
+        return torch.device("cuda")
+    if fastgrnn_cpu is not None:
+        return torch.device("cpu")
+    raise Exception('FastGRNNCUDA needs either a GPU device or the fastgrnn_cpu extension.')
+
+
+def fastgrnn_backend(tensor):
+    return fastgrnn_cuda if tensor.is_cuda else fastgrnn_cpu
+
 
 # All the matrix vector computations of the form Wx are done 
 # in the form of xW (with appropriate changes in shapes) to 
@@ -313,6 +331,8 @@ class FastGRNNCell(RNNCell):
 class FastGRNNCUDACell(RNNCell):
     '''
     A CUDA implementation of FastGRNN Cell with Full Rank Support
+    Falls back to the fused C++ CPU implementation (fastgrnn_cpu) on
+    machines without CUDA.
     hidden_size = # hidden units
 
     zetaInit = init for zeta, the scale param
@@ -330,17 +350,15 @@ class FastGRNNCUDACell(RNNCell):
     '''
     def __init__(self, input_size, hidden_size, gate_nonlinearity="sigmoid", 
     update_nonlinearity="tanh", wRank=None, uRank=None, zetaInit=1.0, nuInit=-4.0, wSparsity=1.0, uSparsity=1.0, name="FastGRNNCUDACell"):
-        super(FastGRNNCUDACell, self).__init__(input_size, hidden_size, gate_non_linearity, update_nonlinearity, 
+        super(FastGRNNCUDACell, self).__init__(input_size, hidden_size, gate_nonlinearity, update_nonlinearity, 
                                                 1, 1, 2, wRank, uRank, wSparsity, uSparsity)
-        if utils.findCUDA() is None:
-            raise Exception('FastGRNNCUDA is supported only on GPU devices.')
         NON_LINEARITY = {"sigmoid": 0, "relu": 1, "tanh": 2}
         self._input_size = input_size
         self._hidden_size = hidden_size
         self._zetaInit = zetaInit
         self._nuInit = nuInit
         self._name = name
-        self.device = torch.device("cuda")
+        self.device = fastgrnn_device()
 
         if wRank is not None:
             self._num_W_matrices += 1
@@ -351,29 +369,29 @@ class FastGRNNCUDACell(RNNCell):
         self._name = name
 
         if wRank is None:
-            self.W = nn.Parameter(0.1 * torch.randn([hidden_size, input_size], self.device))
+            self.W = nn.Parameter(0.1 * torch.randn([hidden_size, input_size], device=self.device))
             self.W1 = torch.empty(0)
             self.W2 = torch.empty(0)
         else:
             self.W = torch.empty(0)
-            self.W1 = nn.Parameter(0.1 * torch.randn([wRank, input_size], self.device))
-            self.W2 = nn.Parameter(0.1 * torch.randn([hidden_size, wRank], self.device))
+            self.W1 = nn.Parameter(0.1 * torch.randn([wRank, input_size], device=self.device))
+            self.W2 = nn.Parameter(0.1 * torch.randn([hidden_size, wRank], device=self.device))
 
         if uRank is None:
-            self.U = nn.Parameter(0.1 * torch.randn([hidden_size, hidden_size], self.device))
+            self.U = nn.Parameter(0.1 * torch.randn([hidden_size, hidden_size], device=self.device))
             self.U1 = torch.empty(0)
             self.U2 = torch.empty(0)
         else:
             self.U = torch.empty(0)
-            self.U1 = nn.Parameter(0.1 * torch.randn([uRank, hidden_size], self.device))
-            self.U2 = nn.Parameter(0.1 * torch.randn([hidden_size, uRank], self.device))
+            self.U1 = nn.Parameter(0.1 * torch.randn([uRank, hidden_size], device=self.device))
+            self.U2 = nn.Parameter(0.1 * torch.randn([hidden_size, uRank], device=self.device))
 
         self._gate_non_linearity = NON_LINEARITY[gate_nonlinearity]
 
-        self.bias_gate = nn.Parameter(torch.ones([1, hidden_size], self.device))
-        self.bias_update = nn.Parameter(torch.ones([1, hidden_size], self.device))
-        self.zeta = nn.Parameter(self._zetaInit * torch.ones([1, 1], self.device))
-        self.nu = nn.Parameter(self._nuInit * torch.ones([1, 1], self.device))
+        self.bias_gate = nn.Parameter(torch.ones([1, hidden_size], device=self.device))
+        self.bias_update = nn.Parameter(torch.ones([1, hidden_size], device=self.device))
+        self.zeta = nn.Parameter(self._zetaInit * torch.ones([1, 1], device=self.device))
+        self.nu = nn.Parameter(self._nuInit * torch.ones([1, 1], device=self.device))
 
     @property
     def name(self):
@@ -1132,8 +1150,6 @@ class FastGRNNCUDA(nn.Module):
                  wSparsity=1.0, uSparsity=1.0, zetaInit=1.0, nuInit=-4.0,
                  batch_first=False, name="FastGRNNCUDA"):
         super(FastGRNNCUDA, self).__init__()
-        if utils.findCUDA() is None:
-            raise Exception('FastGRNNCUDA is supported only on GPU devices.')
         NON_LINEARITY = {"sigmoid": 0, "relu": 1, "tanh": 2}
         self._input_size = input_size
         self._hidden_size = hidden_size
@@ -1149,7 +1165,7 @@ class FastGRNNCUDA(nn.Module):
         self._wSparsity = wSparsity
         self._uSparsity = uSparsity
         self.oldmats = []
-        self.device = torch.device("cuda")
+        self.device = fastgrnn_device()
         self.batch_first = batch_first
         if wRank is not None:
             self._num_W_matrices += 1
@@ -1390,7 +1406,8 @@ class SRNN2(nn.Module):
 class FastGRNNFunction(Function):
     @staticmethod
     def forward(ctx, input, bias_gate, bias_update, zeta, nu, old_h, w, u, w1, w2, u1, u2, gate_non_linearity):
-        outputs = fastgrnn_cuda.forward(input, w, u, bias_gate, bias_update, zeta, nu, old_h, gate_non_linearity, w1, w2, u1, u2)
+        ctx.backend = fastgrnn_backend(input)
+        outputs = ctx.backend.forward(input, w, u, bias_gate, bias_update, zeta, nu, old_h, gate_non_linearity, w1, w2, u1, u2)
         new_h = outputs[0]
         variables = [input, old_h, zeta, nu, w, u] + outputs[1:] + [w1, w2, u1, u2]
         ctx.save_for_backward(*variables)
@@ -1399,14 +1416,15 @@ class FastGRNNFunction(Function):
 
     @staticmethod
     def backward(ctx, grad_h):
-        outputs = fastgrnn_cuda.backward(
+        outputs = ctx.backend.backward(
             grad_h.contiguous(), *ctx.saved_variables, ctx.non_linearity)
         return tuple(outputs + [None])
 
 class FastGRNNUnrollFunction(Function):
     @staticmethod
     def forward(ctx, input, bias_gate, bias_update, zeta, nu, old_h, w, u, w1, w2, u1, u2, gate_non_linearity):
-        outputs = fastgrnn_cuda.forward_unroll(input, w, u, bias_gate, bias_update, zeta, nu, old_h, gate_non_linearity, w1, w2, u1, u2)
+        ctx.backend = fastgrnn_backend(input)
+        outputs = ctx.backend.forward_unroll(input, w, u, bias_gate, bias_update, zeta, nu, old_h, gate_non_linearity, w1, w2, u1, u2)
         hidden_states = outputs[0]
         variables = [input, hidden_states, zeta, nu, w, u] + outputs[1:] + [old_h, w1, w2, u1, u2]
         ctx.save_for_backward(*variables)
@@ -1415,6 +1433,6 @@ class FastGRNNUnrollFunction(Function):
 
     @staticmethod
     def backward(ctx, grad_h):
-        outputs = fastgrnn_cuda.backward_unroll(
+        outputs = ctx.backend.backward_unroll(
             grad_h.contiguous(), *ctx.saved_variables, ctx.gate_non_linearity)
         return tuple(outputs + [None])
@@ -1,6 +1,7 @@
 import setuptools #enables develop
 import os
-from torch.utils.cpp_extension import BuildExtension, CUDAExtension
+import sys
+from torch.utils.cpp_extension import BuildExtension, CppExtension, CUDAExtension
 from edgeml_pytorch.utils import findCUDA
 
 if findCUDA() is not None:
@@ -17,6 +18,22 @@ if findCUDA() is not None:
         }
     )
 
+# at::parallel_for in the CPU kernels is only parallel when compiled with OpenMP
+openmp_flag = '/openmp' if sys.platform == 'win32' else '-fopenmp'
+setuptools.setup(
+    name='fastgrnn_cpu',
+    ext_modules=[
+        CppExtension('fastgrnn_cpu', [
+            'edgeml_pytorch/cpu/fastgrnn_cpu.cpp',
+        ],
+        extra_compile_args=[openmp_flag],
+        extra_link_args=[] if sys.platform == 'win32' else [openmp_flag]),
+    ],
+    cmdclass={
+        'build_ext': BuildExtension
+    }
+)
+
 setuptools.setup(
     name='edgeml',
     version='0.3.0',
@@ -0,0 +1,101 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT license.
+
+# Checks the fastgrnn_cpu extension against the Python FastGRNNCell.
+# Run from pytorch/ after `pip install -e .`:  python -m unittest tests.test_fastgrnn_cpu
+
+import unittest
+import torch
+
+import edgeml_pytorch.utils as utils
+from edgeml_pytorch.graph.rnn import FastGRNNCell, FastGRNNCUDACell, FastGRNNCUDA, fastgrnn_cpu
+
+
+def copy_weights(cell, fused, wRank, uRank):
+    '''FastGRNNCell computes xW, the fused kernels W x: weights are transposed.'''
+    with torch.no_grad():
+        if wRank is None:
+            fused.W.copy_(cell.W.t())
+        else:
+            fused.W1.copy_(cell.W1.t())
+            fused.W2.copy_(cell.W2.t())
+        if uRank is None:
+            fused.U.copy_(cell.U.t())
+        else:
+            fused.U1.copy_(cell.U1.t())
+            fused.U2.copy_(cell.U2.t())
+        fused.bias_gate.copy_(torch.randn_like(fused.bias_gate))
+        fused.bias_update.copy_(torch.randn_like(fused.bias_update))
+        cell.bias_gate.copy_(fused.bias_gate)
+        cell.bias_update.copy_(fused.bias_update)
+
+
+def weight_grads(module, wRank, uRank, transpose):
+    mats = [module.W] if wRank is None else [module.W1, module.W2]
+    mats += [module.U] if uRank is None else [module.U1, module.U2]
+    grads = [m.grad.t() if transpose else m.grad for m in mats]
+    return grads + [module.bias_gate.grad, module.bias_update.grad, module.zeta.grad, module.nu.grad]
+
+
+@unittest.skipIf(fastgrnn_cpu is None or utils.findCUDA() is not None,
+                 'needs the fastgrnn_cpu extension on a machine without CUDA')
+class TestFastGRNNCPU(unittest.TestCase):
+    input_size, hidden_size, batch_size, timesteps = 7, 16, 5, 6
+
+    def check_unrolled(self, gate, wRank, uRank):
+        torch.manual_seed(0)
+        cell = FastGRNNCell(self.input_size, self.hidden_size, gate_nonlinearity=gate,
+                            wRank=wRank, uRank=uRank).double()
+        fused = FastGRNNCUDA(self.input_size, self.hidden_size, gate_nonlinearity=gate,
+                             wRank=wRank, uRank=uRank).double()
+        copy_weights(cell, fused, wRank, uRank)
+
+        x = torch.randn(self.timesteps, self.batch_size, self.input_size, dtype=torch.float64)
+        h0 = torch.randn(self.batch_size, self.hidden_size, dtype=torch.float64)
+        x_ref, h0_ref = x.clone().requires_grad_(), h0.clone().requires_grad_()
+        x_cpu, h0_cpu = x.clone().requires_grad_(), h0.clone().requires_grad_()
+        scale = torch.randn(self.timesteps, self.batch_size, self.hidden_size, dtype=torch.float64)
+
+        h, outputs = h0_ref, []
+        for t in range(self.timesteps):
+            h = cell(x_ref[t], h)
+            outputs.append(h)
+        expected = torch.stack(outputs)
+        (expected * scale).sum().backward()
+
+        actual = fused(x_cpu, h0_cpu)
+        (actual * scale).sum().backward()
+
+        self.assertTrue(torch.allclose(actual, expected))
+        self.assertTrue(torch.allclose(x_cpu.grad, x_ref.grad))
+        self.assertTrue(torch.allclose(h0_cpu.grad, h0_ref.grad))
+        for g_cpu, g_ref in zip(weight_grads(fused, wRank, uRank, True), weight_grads(cell, wRank, uRank, False)):
+            self.assertTrue(torch.allclose(g_cpu, g_ref))
+
+    def test_unrolled_full_rank(self):
+        for gate in ["sigmoid", "relu", "tanh"]:
+            self.check_unrolled(gate, None, None)
+
+    def test_unrolled_low_rank(self):
+        self.check_unrolled("sigmoid", 3, 4)
+
+    def test_single_step(self):
+        torch.manual_seed(0)
+        cell = FastGRNNCell(self.input_size, self.hidden_size, wRank=3).double()
+        fused = FastGRNNCUDACell(self.input_size, self.hidden_size, wRank=3).double()
+        copy_weights(cell, fused, 3, None)
+
+        x = torch.randn(self.batch_size, self.input_size, dtype=torch.float64)
+        h0 = torch.randn(self.batch_size, self.hidden_size, dtype=torch.float64)
+        expected = cell(x, h0)
+        actual = fused(x, h0)
+        expected.sum().backward()
+        actual.sum().backward()
+
+        self.assertTrue(torch.allclose(actual, expected))
+        for g_cpu, g_ref in zip(weight_grads(fused, 3, None, True), weight_grads(cell, 3, None, False)):
+            self.assertTrue(torch.allclose(g_cpu, g_ref))
+
+
+if __name__ == '__main__':
+    unittest.main()